@@ -0,0 +1,558 @@
+/*
+ * Implementation of the asynchronous disk engine
+ */
+
+#include "AsyncDisk.h"
+#include "Utility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+//moves the blocks of one request with a blocking call
+static INT syncTransfer(DiskArray *disk, DiskRequest *req)
+{
+  if (req->_req_write)
+    return writeBlks(disk, req->_req_bid, req->_req_nBlks, req->_req_buf);
+  return readBlks(disk, req->_req_bid, req->_req_nBlks, req->_req_buf);
+}
+
+static BOOL validRequest(DiskArray *disk, DiskRequest *req)
+{
+  return req->_req_bid >= 0 && req->_req_bid + req->_req_nBlks <= disk->_dsk_numBlk;
+}
+
+#ifdef HAVE_IO_URING
+static INT uringEnter(AsyncDisk *aio, UINT toSubmit, UINT minComplete)
+{
+  INT ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, aio->_aio_ringFd, toSubmit, minComplete,
+                  minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+static void uringClose(AsyncDisk *aio)
+{
+  if (aio->_aio_sqes != NULL)
+    munmap(aio->_aio_sqes, aio->_aio_sqesSize);
+  if (aio->_aio_cqRing != NULL && aio->_aio_cqRing != aio->_aio_sqRing)
+    munmap(aio->_aio_cqRing, aio->_aio_cqRingSize);
+  if (aio->_aio_sqRing != NULL)
+    munmap(aio->_aio_sqRing, aio->_aio_sqRingSize);
+  if (aio->_aio_ringFd >= 0)
+    close(aio->_aio_ringFd);
+  aio->_aio_ringFd = -1;
+  aio->_aio_sqRing = aio->_aio_cqRing = NULL;
+  aio->_aio_sqes = NULL;
+}
+
+//sets up the rings, returns -1 if the kernel refuses io_uring
+static INT uringInit(AsyncDisk *aio)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  aio->_aio_ringFd = syscall(__NR_io_uring_setup, aio->_aio_depth, &p);
+  if (aio->_aio_ringFd < 0)
+    return -1;
+
+  aio->_aio_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(UINT);
+  aio->_aio_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (aio->_aio_cqRingSize > aio->_aio_sqRingSize)
+      aio->_aio_sqRingSize = aio->_aio_cqRingSize;
+    aio->_aio_cqRingSize = aio->_aio_sqRingSize;
+  }
+
+  aio->_aio_sqRing = mmap(NULL, aio->_aio_sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                          aio->_aio_ringFd, IORING_OFF_SQ_RING);
+  if (aio->_aio_sqRing == MAP_FAILED) {
+    aio->_aio_sqRing = NULL;
+    uringClose(aio);
+    return -1;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    aio->_aio_cqRing = aio->_aio_sqRing;
+  else {
+    aio->_aio_cqRing = mmap(NULL, aio->_aio_cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                            aio->_aio_ringFd, IORING_OFF_CQ_RING);
+    if (aio->_aio_cqRing == MAP_FAILED) {
+      aio->_aio_cqRing = NULL;
+      uringClose(aio);
+      return -1;
+    }
+  }
+  aio->_aio_sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  aio->_aio_sqes = mmap(NULL, aio->_aio_sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                        aio->_aio_ringFd, IORING_OFF_SQES);
+  if (aio->_aio_sqes == MAP_FAILED) {
+    aio->_aio_sqes = NULL;
+    uringClose(aio);
+    return -1;
+  }
+
+  aio->_aio_sqTail = (UINT *)(aio->_aio_sqRing + p.sq_off.tail);
+  aio->_aio_sqMask = (UINT *)(aio->_aio_sqRing + p.sq_off.ring_mask);
+  aio->_aio_sqArray = (UINT *)(aio->_aio_sqRing + p.sq_off.array);
+  aio->_aio_cqHead = (UINT *)(aio->_aio_cqRing + p.cq_off.head);
+  aio->_aio_cqTail = (UINT *)(aio->_aio_cqRing + p.cq_off.tail);
+  aio->_aio_cqMask = (UINT *)(aio->_aio_cqRing + p.cq_off.ring_mask);
+  aio->_aio_cqes = aio->_aio_cqRing + p.cq_off.cqes;
+  //never have more in flight than the submission ring holds
+  aio->_aio_depth = p.sq_entries;
+  return 0;
+}
+
+static INT uringReap(AsyncDisk *aio, UINT min);
+
+static INT uringSubmit(AsyncDisk *aio, DiskRequest *reqs, UINT n)
+{
+  UINT tail = *aio->_aio_sqTail;
+  UINT mask = *aio->_aio_sqMask;
+  UINT queued = 0;
+  for (; queued < n && aio->_aio_inflight + queued < aio->_aio_depth; queued++) {
+    DiskRequest *req = &reqs[queued];
+    UINT idx = (tail + queued) & mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)aio->_aio_sqes + idx;
+    LONG len = (LONG)req->_req_nBlks * aio->_aio_disk->_dsk_blkSize;
+
+    //direct transfers of unaligned buffers go through an aligned copy
+    req->_req_bounce = NULL;
+    if (!isBlkBufAligned(aio->_aio_disk, req->_req_buf, len)) {
+      if (posix_memalign((void **)&req->_req_bounce, aio->_aio_disk->_dsk_align, len) != 0)
+        break;
+      if (req->_req_write)
+        memcpy(req->_req_bounce, req->_req_buf, len);
+    }
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req->_req_write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = aio->_aio_disk->_dsk_dskArray;
+    sqe->off = bid2Offset(aio->_aio_disk, req->_req_bid);
+    sqe->addr = (uintptr_t)(req->_req_bounce != NULL ? req->_req_bounce : req->_req_buf);
+    sqe->len = len;
+    sqe->user_data = (uintptr_t)req;
+    aio->_aio_sqArray[idx] = idx;
+    req->_req_modelNs = chargeDiskModel(aio->_aio_disk, req->_req_bid, req->_req_nBlks);
+    req->_req_startNs = diskClockNs();
+  }
+  if (queued == 0)
+    return 0;
+  __atomic_store_n(aio->_aio_sqTail, tail + queued, __ATOMIC_RELEASE);
+
+  //the kernel may take fewer entries than offered, only those are in flight;
+  //when it is out of resources, completions make room for the rest
+  UINT submitted = 0;
+  while (submitted < queued) {
+    INT ret = uringEnter(aio, queued - submitted, 0);
+    if (ret > 0) {
+      submitted += ret;
+      aio->_aio_inflight += ret;
+      continue;
+    }
+    if (ret < 0 && (errno == EAGAIN || errno == EBUSY) && aio->_aio_inflight > 0 && uringReap(aio, 1) >= 0)
+      continue;
+    break;
+  }
+
+  //the entries the kernel never took are taken back off the ring and moved
+  //with blocking calls, their model time was charged already
+  if (submitted < queued) {
+    #ifdef DEBUG
+    printf("uringSubmit: kernel took %u of %u requests, moving the rest synchronously\n", submitted, queued);
+    #endif
+    __atomic_store_n(aio->_aio_sqTail, tail + submitted, __ATOMIC_RELEASE);
+    for (UINT i = submitted; i < queued; i++) {
+      DiskRequest *req = &reqs[i];
+      free(req->_req_bounce);
+      req->_req_bounce = NULL;
+      req->_req_result = transferBlksNoModel(aio->_aio_disk, req->_req_bid, req->_req_nBlks, req->_req_buf, req->_req_write);
+      recordDiskRequest(aio->_aio_disk, req->_req_bid, req->_req_nBlks, req->_req_write,
+                        req->_req_result, req->_req_modelNs, req->_req_startNs);
+      req->_req_done = true;
+    }
+  }
+  return queued;
+}
+
+//finishes a short transfer left over by the kernel
+static INT finishTransfer(INT fd, LONG offset, BYTE *buf, LONG len, BOOL isWrite)
+{
+  while (len > 0) {
+    ssize_t done = isWrite ? pwrite(fd, buf, len, offset) : pread(fd, buf, len, offset);
+    if (done < 0 && errno == EINTR)
+      continue;
+    if (done <= 0)
+      return -1;
+    offset += done;
+    buf += done;
+    len -= done;
+  }
+  return 0;
+}
+
+static INT uringReap(AsyncDisk *aio, UINT min)
+{
+  UINT reaped = 0;
+  while (reaped < min || reaped == 0) {
+    UINT head = *aio->_aio_cqHead;
+    UINT tail = __atomic_load_n(aio->_aio_cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      if (reaped >= min)
+        break;
+      if (uringEnter(aio, 0, min - reaped) < 0)
+        return -1;
+      continue;
+    }
+    for (; head != tail; head++, reaped++) {
+      struct io_uring_cqe *cqe = (struct io_uring_cqe *)aio->_aio_cqes + (head & *aio->_aio_cqMask);
+      DiskRequest *req = (DiskRequest *)(uintptr_t)cqe->user_data;
+      LONG len = (LONG)req->_req_nBlks * aio->_aio_disk->_dsk_blkSize;
+      BYTE *buf = req->_req_bounce != NULL ? req->_req_bounce : req->_req_buf;
+      req->_req_result = 0;
+      if (cqe->res < 0)
+        req->_req_result = -1;
+      else if (cqe->res < len)
+        req->_req_result = finishTransfer(aio->_aio_disk->_dsk_dskArray, bid2Offset(aio->_aio_disk, req->_req_bid) + cqe->res,
+                                          buf + cqe->res, len - cqe->res, req->_req_write);
+      if (req->_req_bounce != NULL) {
+        if (!req->_req_write && req->_req_result == 0)
+          memcpy(req->_req_buf, req->_req_bounce, len);
+        free(req->_req_bounce);
+        req->_req_bounce = NULL;
+      }
+      recordDiskRequest(aio->_aio_disk, req->_req_bid, req->_req_nBlks, req->_req_write,
+                        req->_req_result, req->_req_modelNs, req->_req_startNs);
+      req->_req_done = true;
+    }
+    __atomic_store_n(aio->_aio_cqHead, head, __ATOMIC_RELEASE);
+  }
+  aio->_aio_inflight -= reaped;
+  return reaped;
+}
+#endif
+
+static void *workerMain(void *arg)
+{
+  AsyncDisk *aio = arg;
+  pthread_mutex_lock(&aio->_aio_lock);
+  while (true) {
+    while (aio->_aio_head == NULL && !aio->_aio_stop)
+      pthread_cond_wait(&aio->_aio_work, &aio->_aio_lock);
+    if (aio->_aio_head == NULL)
+      break;
+    DiskRequest *req = aio->_aio_head;
+    aio->_aio_head = req->_req_next;
+    if (aio->_aio_head == NULL)
+      aio->_aio_tail = NULL;
+    pthread_mutex_unlock(&aio->_aio_lock);
+
+    //the model was charged in submission order
+    req->_req_startNs = diskClockNs();
+    INT result = transferBlksNoModel(aio->_aio_disk, req->_req_bid, req->_req_nBlks, req->_req_buf, req->_req_write);
+    recordDiskRequest(aio->_aio_disk, req->_req_bid, req->_req_nBlks, req->_req_write,
+                      result, req->_req_modelNs, req->_req_startNs);
+
+    pthread_mutex_lock(&aio->_aio_lock);
+    req->_req_result = result;
+    req->_req_done = true;
+    aio->_aio_completed++;
+    pthread_cond_broadcast(&aio->_aio_done);
+  }
+  pthread_mutex_unlock(&aio->_aio_lock);
+  return NULL;
+}
+
+static void threadsInit(AsyncDisk *aio)
+{
+  pthread_mutex_init(&aio->_aio_lock, NULL);
+  pthread_cond_init(&aio->_aio_work, NULL);
+  pthread_cond_init(&aio->_aio_done, NULL);
+  aio->_aio_head = aio->_aio_tail = NULL;
+  aio->_aio_completed = 0;
+  aio->_aio_stop = false;
+  aio->_aio_nWorkers = 0;
+  aio->_aio_pid = 0;
+}
+
+//serializes the spawning of the pools of every engine
+static pthread_mutex_t startLock = PTHREAD_MUTEX_INITIALIZER;
+
+//spawns the workers for the calling process, unless it has them already;
+//after a fork the workers of the parent are gone, and so may be the
+//waiters the lock and the conditions still count, so those start afresh
+static INT threadsStart(AsyncDisk *aio)
+{
+  pid_t pid = getpid();
+  if (__atomic_load_n(&aio->_aio_pid, __ATOMIC_ACQUIRE) != pid) {
+    pthread_mutex_lock(&startLock);
+    if (aio->_aio_pid != pid) {
+      if (aio->_aio_pid != 0)
+        threadsInit(aio);
+      UINT nWorkers = aio->_aio_depth < AIO_MAX_WORKERS ? aio->_aio_depth : AIO_MAX_WORKERS;
+      for (aio->_aio_nWorkers = 0; aio->_aio_nWorkers < nWorkers; aio->_aio_nWorkers++) {
+        if (pthread_create(&aio->_aio_workers[aio->_aio_nWorkers], NULL, workerMain, aio) != 0)
+          break;
+      }
+      __atomic_store_n(&aio->_aio_pid, pid, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&startLock);
+  }
+  return aio->_aio_nWorkers > 0 ? 0 : -1;
+}
+
+static INT threadsSubmit(AsyncDisk *aio, DiskRequest *reqs, UINT n)
+{
+  //without a worker the batch is moved here, complete on return
+  if (threadsStart(aio) != 0) {
+    for (UINT i = 0; i < n; i++)
+      reqs[i]._req_result = syncTransfer(aio->_aio_disk, &reqs[i]);
+    pthread_mutex_lock(&aio->_aio_lock);
+    for (UINT i = 0; i < n; i++)
+      reqs[i]._req_done = true;
+    aio->_aio_completed += n;
+    aio->_aio_inflight += n;
+    pthread_mutex_unlock(&aio->_aio_lock);
+    return n;
+  }
+  pthread_mutex_lock(&aio->_aio_lock);
+  for (UINT i = 0; i < n; i++) {
+    reqs[i]._req_modelNs = chargeDiskModel(aio->_aio_disk, reqs[i]._req_bid, reqs[i]._req_nBlks);
+    reqs[i]._req_next = NULL;
+    if (aio->_aio_tail != NULL)
+      aio->_aio_tail->_req_next = &reqs[i];
+    else
+      aio->_aio_head = &reqs[i];
+    aio->_aio_tail = &reqs[i];
+  }
+  aio->_aio_inflight += n;
+  pthread_cond_broadcast(&aio->_aio_work);
+  pthread_mutex_unlock(&aio->_aio_lock);
+  return n;
+}
+
+//waits for the requests of one batch handed to the workers and takes them
+//off the counts itself, so batches of different threads do not wait for
+//each other; requests failed before submission never reached the workers
+static void threadsWait(AsyncDisk *aio, DiskRequest *reqs, UINT n)
+{
+  pthread_mutex_lock(&aio->_aio_lock);
+  for (UINT i = 0; i < n; i++) {
+    if (!validRequest(aio->_aio_disk, &reqs[i]))
+      continue;
+    while (!reqs[i]._req_done)
+      pthread_cond_wait(&aio->_aio_done, &aio->_aio_lock);
+    aio->_aio_completed--;
+    aio->_aio_inflight--;
+  }
+  pthread_mutex_unlock(&aio->_aio_lock);
+}
+
+static INT threadsReap(AsyncDisk *aio, UINT min)
+{
+  pthread_mutex_lock(&aio->_aio_lock);
+  while (aio->_aio_completed < min)
+    pthread_cond_wait(&aio->_aio_done, &aio->_aio_lock);
+  UINT reaped = aio->_aio_completed;
+  aio->_aio_completed = 0;
+  aio->_aio_inflight -= reaped;
+  pthread_mutex_unlock(&aio->_aio_lock);
+  return reaped;
+}
+
+static void threadsClose(AsyncDisk *aio)
+{
+  //workers spawned before a fork are not this process's to stop
+  if (aio->_aio_pid != 0 && aio->_aio_pid != getpid())
+    threadsInit(aio);
+  pthread_mutex_lock(&aio->_aio_lock);
+  aio->_aio_stop = true;
+  pthread_cond_broadcast(&aio->_aio_work);
+  pthread_mutex_unlock(&aio->_aio_lock);
+  for (UINT i = 0; i < aio->_aio_nWorkers; i++)
+    pthread_join(aio->_aio_workers[i], NULL);
+  pthread_cond_destroy(&aio->_aio_work);
+  pthread_cond_destroy(&aio->_aio_done);
+  pthread_mutex_destroy(&aio->_aio_lock);
+}
+
+INT initAsyncDisk(AsyncDisk *aio, DiskArray *disk, AIO_ENGINE engine, UINT depth)
+{
+  memset(aio, 0, sizeof(AsyncDisk));
+  aio->_aio_disk = disk;
+  aio->_aio_ringFd = -1;
+  pthread_mutex_init(&aio->_aio_runLock, NULL);
+  aio->_aio_depth = depth == 0 ? AIO_DEFAULT_DEPTH : (depth > AIO_MAX_DEPTH ? AIO_MAX_DEPTH : depth);
+
+  //a mapped disk is served by memory copies, nothing to overlap
+  if (engine == AIO_ENGINE_AUTO && disk->_dsk_map != NULL)
+    engine = AIO_ENGINE_SYNC;
+
+  #ifdef HAVE_IO_URING
+  //ring requests address a single image, striped disks use the threads
+  if ((engine == AIO_ENGINE_AUTO || engine == AIO_ENGINE_URING) && disk->_dsk_map == NULL && disk->_dsk_nMembers == 1) {
+    if (uringInit(aio) == 0) {
+      aio->_aio_engine = AIO_ENGINE_URING;
+      return 0;
+    }
+    #ifdef DEBUG
+    printf("io_uring unavailable (%s), falling back to worker threads\n", strerror(errno));
+    #endif
+  }
+  #endif
+  if (engine != AIO_ENGINE_SYNC) {
+    threadsInit(aio);
+    aio->_aio_engine = AIO_ENGINE_THREADS;
+    return 0;
+  }
+  aio->_aio_engine = AIO_ENGINE_SYNC;
+  return 0;
+}
+
+void closeAsyncDisk(AsyncDisk *aio)
+{
+  if (aio->_aio_inflight > 0)
+    reapDiskRequests(aio, aio->_aio_inflight);
+  #ifdef HAVE_IO_URING
+  if (aio->_aio_engine == AIO_ENGINE_URING)
+    uringClose(aio);
+  #endif
+  if (aio->_aio_engine == AIO_ENGINE_THREADS)
+    threadsClose(aio);
+  aio->_aio_engine = AIO_ENGINE_SYNC;
+  pthread_mutex_destroy(&aio->_aio_runLock);
+}
+
+INT submitDiskRequests(AsyncDisk *aio, DiskRequest *reqs, UINT n)
+{
+  UINT accepted = 0;
+  while (accepted < n) {
+    //requests that cannot be valid fail right away without reaching the engine
+    if (!validRequest(aio->_aio_disk, &reqs[accepted])) {
+      _err_last = reqs[accepted]._req_write ? _dsk_writeOutOfBoundry : _dsk_readOutOfBoundry;
+      THROW(__FILE__, __LINE__, __func__);
+      reqs[accepted]._req_result = -1;
+      reqs[accepted]._req_done = true;
+      accepted++;
+      continue;
+    }
+    UINT run = 0;
+    while (accepted + run < n && validRequest(aio->_aio_disk, &reqs[accepted + run])) {
+      reqs[accepted + run]._req_done = false;
+      run++;
+    }
+
+    INT queued = run;
+    switch (aio->_aio_engine) {
+      #ifdef HAVE_IO_URING
+      case AIO_ENGINE_URING:
+        queued = uringSubmit(aio, reqs + accepted, run);
+        break;
+      #endif
+      case AIO_ENGINE_THREADS:
+        queued = threadsSubmit(aio, reqs + accepted, run);
+        break;
+      default:
+        for (UINT i = 0; i < run; i++) {
+          reqs[accepted + i]._req_result = syncTransfer(aio->_aio_disk, &reqs[accepted + i]);
+          reqs[accepted + i]._req_done = true;
+        }
+        break;
+    }
+    if (queued < 0) {
+      _err_last = _dsk_ioFail;
+      THROW(__FILE__, __LINE__, __func__);
+      return accepted > 0 ? (INT)accepted : -1;
+    }
+    accepted += queued;
+    if ((UINT)queued < run)
+      break;
+  }
+  return accepted;
+}
+
+INT reapDiskRequests(AsyncDisk *aio, UINT min)
+{
+  if (min > aio->_aio_inflight)
+    min = aio->_aio_inflight;
+  if (aio->_aio_inflight == 0)
+    return 0;
+  switch (aio->_aio_engine) {
+    #ifdef HAVE_IO_URING
+    case AIO_ENGINE_URING:
+      return uringReap(aio, min);
+    #endif
+    case AIO_ENGINE_THREADS:
+      return threadsReap(aio, min);
+    default:
+      return 0;
+  }
+}
+
+INT runDiskRequests(AsyncDisk *aio, DiskRequest *reqs, UINT n)
+{
+  //the worker threads and the blocking calls serve batches side by side,
+  //only a ring, with its single submitter and reaper, takes them in turn
+  if (aio->_aio_engine != AIO_ENGINE_URING) {
+    INT submitted = submitDiskRequests(aio, reqs, n);
+    if (submitted < 0)
+      return -1;
+    if (aio->_aio_engine == AIO_ENGINE_THREADS)
+      threadsWait(aio, reqs, submitted);
+    for (UINT i = 0; i < n; i++) {
+      if (i >= (UINT)submitted || reqs[i]._req_result != 0)
+        return -1;
+    }
+    return 0;
+  }
+
+  pthread_mutex_lock(&aio->_aio_runLock);
+  UINT submitted = 0;
+  while (submitted < n) {
+    INT queued = submitDiskRequests(aio, reqs + submitted, n - submitted);
+    if (queued < 0)
+      break;
+    submitted += queued;
+    //queue full, make room before submitting the rest
+    if (submitted < n && reapDiskRequests(aio, 1) < 0)
+      break;
+  }
+  INT succ = 0;
+  while (aio->_aio_inflight > 0) {
+    if (reapDiskRequests(aio, aio->_aio_inflight) < 0) {
+      succ = -1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&aio->_aio_runLock);
+  if (succ != 0)
+    return -1;
+
+  for (UINT i = 0; i < n; i++) {
+    if (!reqs[i]._req_done || reqs[i]._req_result != 0)
+      return -1;
+  }
+  return 0;
+}
+
+const char *asyncDiskEngineName(AsyncDisk *aio)
+{
+  switch (aio->_aio_engine) {
+    case AIO_ENGINE_URING:
+      return "io_uring";
+    case AIO_ENGINE_THREADS:
+      return "threads";
+    default:
+      return "sync";
+  }
+}
@@ -0,0 +1,121 @@
+/*
+ * Asynchronous disk engine. Batches of block requests are submitted
+ * together and kept in flight, on io_uring when the kernel provides it,
+ * otherwise on a pool of worker threads.
+ */
+
+#pragma once
+#include "DiskEmulator.h"
+#include <pthread.h>
+
+#define AIO_DEFAULT_DEPTH (32)
+#define AIO_MAX_DEPTH (256)
+#define AIO_MAX_WORKERS (8)
+
+//engines, AIO_ENGINE_AUTO picks the best one available
+typedef enum {
+  AIO_ENGINE_AUTO,
+  AIO_ENGINE_URING,
+  AIO_ENGINE_THREADS,
+  AIO_ENGINE_SYNC, //requests complete inside submission
+} AIO_ENGINE;
+
+//one request moves nBlks contiguous disk blocks from/to buf
+typedef struct DiskRequest
+{
+  LONG _req_bid;
+  UINT _req_nBlks;
+  BYTE *_req_buf;
+  BOOL _req_write;
+
+  //set on completion, 0 on success and -1 on failure
+  INT _req_result;
+  BOOL _req_done;
+
+  //aligned copy of the buffer for direct transfers
+  BYTE *_req_bounce;
+
+  //simulated ns charged at submission and when the transfer started,
+  //for the disk statistics
+  LONG _req_modelNs;
+  LONG _req_startNs;
+
+  //pending queue of the thread pool
+  struct DiskRequest *_req_next;
+} DiskRequest;
+
+typedef struct AsyncDisk
+{
+  DiskArray *_aio_disk;
+  AIO_ENGINE _aio_engine;
+
+  //max # of requests in flight
+  UINT _aio_depth;
+
+  //# of requests submitted and not reaped yet
+  UINT _aio_inflight;
+
+  //held by an io_uring batch from submission until it is reaped, a batch
+  //waits for everything in flight so batches of different threads take
+  //turns; with the other engines each batch waits for its own requests
+  pthread_mutex_t _aio_runLock;
+
+  //io_uring rings, mapped from the kernel
+  INT _aio_ringFd;
+  BYTE *_aio_sqRing;
+  BYTE *_aio_cqRing;
+  void *_aio_sqes;
+  void *_aio_cqes;
+  LONG _aio_sqRingSize;
+  LONG _aio_cqRingSize;
+  LONG _aio_sqesSize;
+  UINT *_aio_sqTail;
+  UINT *_aio_sqMask;
+  UINT *_aio_sqArray;
+  UINT *_aio_cqHead;
+  UINT *_aio_cqTail;
+  UINT *_aio_cqMask;
+
+  //thread pool, spawned by the first batch of the process that submits
+  //it, 0 until then
+  pthread_t _aio_workers[AIO_MAX_WORKERS];
+  UINT _aio_nWorkers;
+  pid_t _aio_pid;
+  pthread_mutex_t _aio_lock;
+  pthread_cond_t _aio_work;
+  pthread_cond_t _aio_done;
+  DiskRequest *_aio_head;
+  DiskRequest *_aio_tail;
+  UINT _aio_completed;
+  BOOL _aio_stop;
+} AsyncDisk;
+
+//starts an engine on an opened disk; the worker threads are spawned by
+//the first batch rather than here, since threads do not survive a fork
+//and a FUSE daemon forks after mounting, and a forked child that submits
+//spawns workers of its own
+//args: engine,
+//      disk,
+//      requested engine,
+//      queue depth (0 for the default)
+INT initAsyncDisk(AsyncDisk *, DiskArray *, AIO_ENGINE, UINT);
+
+//waits for everything in flight and stops the engine
+void closeAsyncDisk(AsyncDisk *);
+
+//queues a batch of requests without waiting for them
+//returns the # of requests accepted, which is less than asked when
+//the queue is full
+INT submitDiskRequests(AsyncDisk *, DiskRequest *, UINT);
+
+//waits until at least min requests in flight complete
+//returns the # of requests completed by this call
+INT reapDiskRequests(AsyncDisk *, UINT);
+
+//submits a batch and waits for all of it, safe to call from several
+//threads at once
+//returns 0 if every request succeeded
+INT runDiskRequests(AsyncDisk *, DiskRequest *, UINT);
+
+//name of the engine in use
+const char *asyncDiskEngineName(AsyncDisk *);
@@ -1,69 +1,698 @@
-// This is the in core INodeTable
+// This is the in core data block cache
 
 #pragma once
 #include "DBlkCache.h"
 #include <assert.h>
+#include <stdlib.h>
 
-//initializes all the bin entries to null
+//the counters are shared by the shards
+#define COUNT(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+
+//initializes all the entries to empty
 //MUST be called at filesystem init time since arrays do not default to NULL
-void initDBlkCache(DBlkCache *dCache) {
+void initDBlkCache(DBlkCache *dCache, UINT blkSize, UINT nBlks, UINT nWays, DBLK_CACHE_POLICY policy) {
+    if(nBlks == 0) {
+        nBlks = DBLK_CACHE_DEFAULT_BLKS;
+    }
+    if(nWays == 0) {
+        nWays = DBLK_CACHE_DEFAULT_WAYS;
+    }
+    if(nWays > nBlks) {
+        nWays = nBlks;
+    }
     dCache->_dCache_size = 0;
-    for (UINT i = 0; i < DBLK_CACHE_SET_NUM; i++) {
+    dCache->_dCache_blkSize = blkSize;
+    dCache->_dCache_nWays = nWays;
+    dCache->_dCache_nSets = nBlks / nWays;
+    dCache->_dCache_policy = policy;
+    dCache->_dCache_tick = 0;
+    dCache->_dCache_writeBack = NULL;
+    dCache->_dCache_writeBackCtx = NULL;
+    dCache->_dCache_nDirty = 0;
+    dCache->_dCache_metaBlks = 0;
+    dCache->_dCache_nMeta = 0;
+    resetDBlkCacheStats(dCache);
+
+    UINT nEntries = dCache->_dCache_nSets * nWays;
+    dCache->_dCache_slab = calloc(nEntries, blkSize);
+    dCache->dCache = calloc(nEntries, sizeof(DBlkCacheEntry));
+    dCache->_dCache_hands = calloc(dCache->_dCache_nSets, sizeof(UINT));
+    dCache->_dCache_ghosts = malloc(nEntries * sizeof(LONG));
+    dCache->_dCache_ghostNext = calloc(dCache->_dCache_nSets, sizeof(UINT));
+    dCache->_dCache_nShards = dCache->_dCache_nSets < DBLK_CACHE_SHARDS ? dCache->_dCache_nSets : DBLK_CACHE_SHARDS;
+    dCache->_dCache_locks = malloc(dCache->_dCache_nShards * sizeof(pthread_mutex_t));
+    dCache->_dCache_filled = malloc(dCache->_dCache_nShards * sizeof(pthread_cond_t));
+    assert(dCache->_dCache_slab != NULL && dCache->dCache != NULL && dCache->_dCache_hands != NULL
+           && dCache->_dCache_ghosts != NULL && dCache->_dCache_ghostNext != NULL
+           && dCache->_dCache_locks != NULL && dCache->_dCache_filled != NULL);
+    for (UINT i = 0; i < dCache->_dCache_nShards; i++) {
+        pthread_mutex_init(&dCache->_dCache_locks[i], NULL);
+        pthread_cond_init(&dCache->_dCache_filled[i], NULL);
+    }
+    for (UINT i = 0; i < nEntries; i++) {
         dCache->dCache[i]._dblk_id = -1;
-        memset(dCache->dCache[i]._data_blk, 0, BLK_SIZE);
+        dCache->dCache[i]._data_blk = dCache->_dCache_slab + (LONG)i * blkSize;
+        dCache->_dCache_ghosts[i] = -1;
     }
 }
 
-// adds a datablock to cache, replace the existing one 
-INT putDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf) {
-    UINT set = id % DBLK_CACHE_SET_NUM;
-    //new entry, update size counter
-    if(dCache->dCache[set]._dblk_id == -1) {
-        dCache->_dCache_size++;
+void destroyDBlkCache(DBlkCache *dCache) {
+    for (UINT i = 0; i < dCache->_dCache_nShards; i++) {
+        pthread_mutex_destroy(&dCache->_dCache_locks[i]);
+        pthread_cond_destroy(&dCache->_dCache_filled[i]);
     }
-    
-    dCache->dCache[set]._dblk_id = id;
-    memcpy(dCache->dCache[set]._data_blk, buf, BLK_SIZE);
-    return 0;
+    free(dCache->_dCache_locks);
+    free(dCache->_dCache_filled);
+    dCache->_dCache_locks = NULL;
+    dCache->_dCache_filled = NULL;
+    dCache->_dCache_nShards = 0;
+    free(dCache->_dCache_slab);
+    free(dCache->dCache);
+    free(dCache->_dCache_hands);
+    free(dCache->_dCache_ghosts);
+    free(dCache->_dCache_ghostNext);
+    dCache->_dCache_slab = NULL;
+    dCache->dCache = NULL;
+    dCache->_dCache_hands = dCache->_dCache_ghostNext = NULL;
+    dCache->_dCache_ghosts = NULL;
+    dCache->_dCache_size = 0;
+    dCache->_dCache_nDirty = 0;
+    dCache->_dCache_nMeta = 0;
+}
+
+void setDBlkCacheWriteBack(DBlkCache *dCache, DBlkWriteBack writeBack, void *ctx) {
+    dCache->_dCache_writeBack = writeBack;
+    dCache->_dCache_writeBackCtx = ctx;
+}
+
+void setDBlkCacheMetaBlks(DBlkCache *dCache, UINT metaBlks) {
+    dCache->_dCache_metaBlks = metaBlks;
+}
+
+//first entry of the set a block id hashes to, ids a multiple of the set
+//count apart still spread over the sets
+static UINT setOf(DBlkCache *dCache, LONG id) {
+    UINT set = (UINT)(((unsigned long)id * 0x9e3779b97f4a7c15UL) >> 32) % dCache->_dCache_nSets;
+    return set * dCache->_dCache_nWays;
+}
+
+//shard of the set starting at entry first, or of the set of an entry
+static UINT shardOf(DBlkCache *dCache, UINT first) {
+    return first / dCache->_dCache_nWays % dCache->_dCache_nShards;
+}
+
+static UINT entryShard(DBlkCache *dCache, DBlkCacheEntry* entry) {
+    return shardOf(dCache, (UINT)(entry - dCache->dCache));
+}
+
+//locks the shard of a block id and returns it
+static UINT lockShard(DBlkCache *dCache, LONG id) {
+    UINT shard = shardOf(dCache, setOf(dCache, id));
+    pthread_mutex_lock(&dCache->_dCache_locks[shard]);
+    return shard;
+}
+
+static void unlockShard(DBlkCache *dCache, UINT shard) {
+    pthread_mutex_unlock(&dCache->_dCache_locks[shard]);
+}
+
+static DBlkCacheEntry* findEntry(DBlkCache *dCache, LONG id) {
+    DBlkCacheEntry* set = &dCache->dCache[setOf(dCache, id)];
+    for(UINT w = 0; w < dCache->_dCache_nWays; w++) {
+        if(set[w]._dblk_id == id) {
+            return &set[w];
+        }
+    }
+    return NULL;
+}
+
+//the entry of a cached block, waiting while the block is in flight, NULL
+//if it is not cached; called with its shard locked
+static DBlkCacheEntry* lookupEntry(DBlkCache *dCache, UINT shard, LONG id) {
+    DBlkCacheEntry* entry;
+    while((entry = findEntry(dCache, id)) != NULL && entry->_dblk_busy) {
+        pthread_cond_wait(&dCache->_dCache_filled[shard], &dCache->_dCache_locks[shard]);
+    }
+    return entry;
+}
+
+//moves an entry to the class it was last accessed as
+static void tagEntry(DBlkCache *dCache, DBlkCacheEntry* entry, DBLK_CLASS cls) {
+    if(entry->_dblk_class == cls) {
+        return;
+    }
+    if(cls == DBLK_META) {
+        COUNT(dCache->_dCache_nMeta, 1);
+    }
+    else if(entry->_dblk_class == DBLK_META) {
+        COUNT(dCache->_dCache_nMeta, -1);
+    }
+    entry->_dblk_class = cls;
+}
+
+//marks an entry referenced
+static void touchEntry(DBlkCache *dCache, DBlkCacheEntry* entry) {
+    switch(dCache->_dCache_policy) {
+        case DBLK_CACHE_CLOCK:
+            entry->_dblk_ref = true;
+            break;
+        case DBLK_CACHE_2Q:
+            //probation is FIFO, only the main queue is kept in LRU order
+            if(entry->_dblk_hot) {
+                entry->_dblk_stamp = COUNT(dCache->_dCache_tick, 1);
+            }
+            break;
+        default:
+            entry->_dblk_stamp = COUNT(dCache->_dCache_tick, 1);
+            break;
+    }
+}
+
+//whether a way cannot be evicted, it is pinned or of the class spared
+static BOOL keepWay(DBlkCacheEntry* entry, DBLK_CLASS spare) {
+    return entry->_dblk_pins > 0 || entry->_dblk_class == spare;
+}
+
+//least recently stamped evictable way of a set among the hot or the cold
+//ones, -1 if there is none
+static INT oldestWay(DBlkCache *dCache, DBlkCacheEntry* set, DBLK_CLASS spare, BOOL anyHeat, BOOL hot) {
+    INT victim = -1;
+    for(UINT w = 0; w < dCache->_dCache_nWays; w++) {
+        if(keepWay(&set[w], spare) || (!anyHeat && set[w]._dblk_hot != hot)) {
+            continue;
+        }
+        if(victim == -1 || set[w]._dblk_stamp < set[victim]._dblk_stamp) {
+            victim = w;
+        }
+    }
+    return victim;
+}
+
+//picks the way of a set a new block goes to, passing over the ways of
+//class spare (DBLK_NCLASSES spares none), -1 if every way is kept
+static INT victimWay(DBlkCache *dCache, UINT first, DBLK_CLASS spare) {
+    DBlkCacheEntry* set = &dCache->dCache[first];
+    UINT nWays = dCache->_dCache_nWays;
+    for(UINT w = 0; w < nWays; w++) {
+        if(set[w]._dblk_id == -1) {
+            return w;
+        }
+    }
+
+    UINT setIdx = first / nWays;
+    switch(dCache->_dCache_policy) {
+        case DBLK_CACHE_CLOCK: {
+            //two sweeps clear every referenced bit, kept ways are passed over
+            UINT* hand = &dCache->_dCache_hands[setIdx];
+            for(UINT n = 0; n < 2 * nWays; n++) {
+                UINT w = *hand;
+                *hand = (*hand + 1) % nWays;
+                if(keepWay(&set[w], spare)) {
+                    continue;
+                }
+                if(set[w]._dblk_ref) {
+                    set[w]._dblk_ref = false;
+                    continue;
+                }
+                return w;
+            }
+            return -1;
+        }
+        case DBLK_CACHE_2Q: {
+            //probation keeps about a quarter of the set, past that its
+            //oldest block goes and is remembered in the ghost ring
+            UINT nCold = 0;
+            for(UINT w = 0; w < nWays; w++) {
+                nCold += !set[w]._dblk_hot;
+            }
+            UINT kIn = nWays / 4 > 0 ? nWays / 4 : 1;
+            INT victim = -1;
+            if(nCold > kIn || nCold == nWays) {
+                victim = oldestWay(dCache, set, spare, false, false);
+            }
+            if(victim == -1) {
+                victim = oldestWay(dCache, set, spare, false, true);
+            }
+            if(victim == -1) {
+                victim = oldestWay(dCache, set, spare, false, false);
+            }
+            if(victim != -1 && !set[victim]._dblk_hot) {
+                UINT* next = &dCache->_dCache_ghostNext[setIdx];
+                dCache->_dCache_ghosts[first + *next] = set[victim]._dblk_id;
+                *next = (*next + 1) % nWays;
+            }
+            return victim;
+        }
+        default:
+            return oldestWay(dCache, set, spare, true, false);
+    }
+}
+
+static void markDirty(DBlkCache *dCache, DBlkCacheEntry* entry, LONG nowNs) {
+    if(!entry->_dblk_dirty) {
+        entry->_dblk_dirty = true;
+        entry->_dblk_dirtyNs = nowNs;
+        COUNT(dCache->_dCache_nDirty, 1);
+    }
+}
+
+static void markClean(DBlkCache *dCache, DBlkCacheEntry* entry) {
+    if(entry->_dblk_dirty) {
+        entry->_dblk_dirty = false;
+        COUNT(dCache->_dCache_nDirty, -1);
+    }
+}
+
+//writes a dirty entry back and marks it clean; called with its shard
+//locked, the lock is dropped for the write like for a read in flight: the
+//entry stays pinned and busy meanwhile, so it is neither evicted nor
+//looked up, and a block dirtied again during the write stays dirty
+static INT cleanEntry(DBlkCache *dCache, UINT shard, DBlkCacheEntry* entry) {
+    if(dCache->_dCache_writeBack == NULL) {
+        return -1;
+    }
+    LONG dirtyNs = entry->_dblk_dirtyNs;
+    markClean(dCache, entry);
+    entry->_dblk_busy = true;
+    entry->_dblk_pins++;
+    unlockShard(dCache, shard);
+
+    INT succ = dCache->_dCache_writeBack(dCache->_dCache_writeBackCtx, entry->_dblk_id, entry->_data_blk);
+
+    pthread_mutex_lock(&dCache->_dCache_locks[shard]);
+    entry->_dblk_busy = false;
+    entry->_dblk_pins--;
+    if(succ != 0) {
+        markDirty(dCache, entry, dirtyNs);
+        entry->_dblk_dirtyNs = dirtyNs;
+    }
+    else {
+        COUNT(dCache->_dCache_writeBacks, 1);
+    }
+    pthread_cond_broadcast(&dCache->_dCache_filled[shard]);
+    return succ == 0 ? 0 : -1;
+}
+
+//the entry of a block, taking a way of its set if it has none, *taken
+//tells which unless it is NULL; a dirty victim is written back with the
+//shard unlocked and the set is looked at again afterwards
+//returns NULL if every way is pinned or the victim way was dirty and could
+//not be written back; called with the shard locked
+static DBlkCacheEntry* takeEntry(DBlkCache *dCache, UINT shard, LONG id, DBLK_CLASS cls, BOOL *taken) {
+    DBlkCacheEntry* entry;
+    while((entry = lookupEntry(dCache, shard, id)) == NULL) {
+        //within its budget the metadata partition is kept from data
+        //blocks, past it metadata blocks replace metadata blocks first
+        DBLK_CLASS spare = DBLK_NCLASSES;
+        if(dCache->_dCache_metaBlks > 0) {
+            if(cls == DBLK_DATA && dCache->_dCache_nMeta <= dCache->_dCache_metaBlks) {
+                spare = DBLK_META;
+            }
+            else if(cls == DBLK_META && dCache->_dCache_nMeta >= dCache->_dCache_metaBlks) {
+                spare = DBLK_DATA;
+            }
+        }
+        UINT first = setOf(dCache, id);
+        INT way = victimWay(dCache, first, spare);
+        if(way == -1 && spare != DBLK_NCLASSES) {
+            way = victimWay(dCache, first, DBLK_NCLASSES);
+        }
+        if(way == -1) {
+            return NULL;
+        }
+        entry = &dCache->dCache[first + way];
+        if(entry->_dblk_dirty) {
+            if(cleanEntry(dCache, shard, entry) != 0) {
+                return NULL;
+            }
+            continue;
+        }
+        if(entry->_dblk_id == -1) {
+            COUNT(dCache->_dCache_size, 1);
+        }
+        else {
+            COUNT(dCache->_dCache_evictions, 1);
+        }
+        entry->_dblk_id = id;
+        entry->_dblk_ref = false;
+        entry->_dblk_stamp = COUNT(dCache->_dCache_tick, 1);
+        entry->_dblk_hot = false;
+        tagEntry(dCache, entry, cls);
+        if(dCache->_dCache_policy == DBLK_CACHE_2Q) {
+            //a block evicted from probation and wanted again is hot
+            LONG* ghosts = &dCache->_dCache_ghosts[first];
+            for(UINT w = 0; w < dCache->_dCache_nWays; w++) {
+                if(ghosts[w] == id) {
+                    ghosts[w] = -1;
+                    entry->_dblk_hot = true;
+                }
+            }
+        }
+        if(taken != NULL) {
+            *taken = true;
+        }
+        return entry;
+    }
+    touchEntry(dCache, entry);
+    tagEntry(dCache, entry, cls);
+    if(taken != NULL) {
+        *taken = false;
+    }
+    return entry;
+}
+
+//copies a block into its entry; called with the shard locked
+static DBlkCacheEntry* fillEntry(DBlkCache *dCache, UINT shard, LONG id, BYTE *buf, DBLK_CLASS cls) {
+    DBlkCacheEntry* entry = takeEntry(dCache, shard, id, cls, NULL);
+    if(entry != NULL) {
+        memcpy(entry->_data_blk, buf, dCache->_dCache_blkSize);
+    }
+    return entry;
+}
+
+// adds a datablock to cache, replace the existing one
+INT putDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf, DBLK_CLASS cls) {
+    UINT shard = lockShard(dCache, id);
+    DBlkCacheEntry* entry = fillEntry(dCache, shard, id, buf, cls);
+    if(entry != NULL) {
+        markClean(dCache, entry);
+    }
+    unlockShard(dCache, shard);
+    return entry == NULL ? -1 : 0;
+}
+
+INT writeDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf, DBLK_CLASS cls, LONG nowNs) {
+    UINT shard = lockShard(dCache, id);
+    DBlkCacheEntry* entry = fillEntry(dCache, shard, id, buf, cls);
+    if(entry != NULL) {
+        markDirty(dCache, entry, nowNs);
+    }
+    unlockShard(dCache, shard);
+    return entry == NULL ? -1 : 0;
+}
+
+//a dirty way noted by a flush and the block it held then
+typedef struct DirtyWay {
+    DBlkCacheEntry* entry;
+    LONG id;
+    LONG dirtyNs;
+} DirtyWay;
+
+static int compareDirtyNs(const void *a, const void *b) {
+    const DirtyWay* x = (const DirtyWay*) a;
+    const DirtyWay* y = (const DirtyWay*) b;
+    return (x->dirtyNs > y->dirtyNs) - (x->dirtyNs < y->dirtyNs);
+}
+
+LONG flushDBlkCache(DBlkCache *dCache, LONG olderThanNs, UINT maxDirty) {
+    if(dCache->_dCache_nDirty == 0) {
+        return 0;
+    }
+    //oldest first, both the age and the pressure limit take a prefix; the
+    //dirty ways are noted a shard at a time and each one is checked again
+    //under its lock before it is written back
+    UINT nEntries = dCache->_dCache_nSets * dCache->_dCache_nWays;
+    UINT stride = dCache->_dCache_nShards * dCache->_dCache_nWays;
+    DirtyWay* dirty = malloc(nEntries * sizeof(DirtyWay));
+    assert(dirty != NULL);
+    UINT nDirty = 0;
+    for(UINT shard = 0; shard < dCache->_dCache_nShards; shard++) {
+        pthread_mutex_lock(&dCache->_dCache_locks[shard]);
+        for(UINT first = shard * dCache->_dCache_nWays; first < nEntries; first += stride) {
+            for(UINT w = 0; w < dCache->_dCache_nWays; w++) {
+                DBlkCacheEntry* entry = &dCache->dCache[first + w];
+                if(entry->_dblk_dirty) {
+                    dirty[nDirty].entry = entry;
+                    dirty[nDirty].id = entry->_dblk_id;
+                    dirty[nDirty].dirtyNs = entry->_dblk_dirtyNs;
+                    nDirty++;
+                }
+            }
+        }
+        unlockShard(dCache, shard);
+    }
+    qsort(dirty, nDirty, sizeof(DirtyWay), compareDirtyNs);
+
+    LONG nFlushed = 0;
+    for(UINT i = 0; i < nDirty; i++) {
+        if(dirty[i].dirtyNs > olderThanNs && dCache->_dCache_nDirty <= maxDirty) {
+            break;
+        }
+        DBlkCacheEntry* entry = dirty[i].entry;
+        UINT shard = entryShard(dCache, entry);
+        pthread_mutex_lock(&dCache->_dCache_locks[shard]);
+        INT succ = 0;
+        if(entry->_dblk_id == dirty[i].id && entry->_dblk_dirty && !entry->_dblk_busy) {
+            succ = cleanEntry(dCache, shard, entry);
+            nFlushed += succ == 0;
+        }
+        unlockShard(dCache, shard);
+        if(succ != 0) {
+            nFlushed = -1;
+            break;
+        }
+    }
+    free(dirty);
+    return nFlushed;
 }
 
 // read the datablk from the dcache into a buf
-INT getDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf) {
-    #ifdef DEBUG_DCACHE
-    assert(hasDBlkCacheEntry(dCache, id));
-    #endif
-    
-    UINT set = id % DBLK_CACHE_SET_NUM;
-    memcpy(buf, dCache->dCache[set]._data_blk, BLK_SIZE);
-    return 0;
+//counts a lookup as a hit or a miss
+static void countLookup(DBlkCache *dCache, BOOL hit, DBLK_CLASS cls) {
+    if(hit) {
+        COUNT(dCache->_dCache_hits, 1);
+        COUNT(dCache->_dCache_classHits[cls], 1);
+    }
+    else {
+        COUNT(dCache->_dCache_misses, 1);
+        COUNT(dCache->_dCache_classMisses[cls], 1);
+    }
+}
+
+INT getDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf, DBLK_CLASS cls) {
+    UINT shard = lockShard(dCache, id);
+    DBlkCacheEntry* entry = lookupEntry(dCache, shard, id);
+    countLookup(dCache, entry != NULL, cls);
+    if(entry != NULL) {
+        touchEntry(dCache, entry);
+        tagEntry(dCache, entry, cls);
+        memcpy(buf, entry->_data_blk, dCache->_dCache_blkSize);
+    }
+    unlockShard(dCache, shard);
+    return entry == NULL ? -1 : 0;
+}
+
+//the entry a block pointer handed out by the pin calls belongs to
+static DBlkCacheEntry* entryOf(DBlkCache *dCache, BYTE *blk) {
+    assert(isDBlkCacheBlk(dCache, blk));
+    return &dCache->dCache[(blk - dCache->_dCache_slab) / dCache->_dCache_blkSize];
+}
+
+BYTE* pinDBlkCacheEntry(DBlkCache *dCache, LONG id, DBLK_CLASS cls) {
+    UINT shard = lockShard(dCache, id);
+    DBlkCacheEntry* entry = lookupEntry(dCache, shard, id);
+    countLookup(dCache, entry != NULL, cls);
+    if(entry != NULL) {
+        touchEntry(dCache, entry);
+        tagEntry(dCache, entry, cls);
+        entry->_dblk_pins++;
+    }
+    unlockShard(dCache, shard);
+    return entry == NULL ? NULL : entry->_data_blk;
+}
+
+BYTE* claimDBlkCacheEntry(DBlkCache *dCache, LONG id, DBLK_CLASS cls, BOOL *claimed) {
+    UINT shard = lockShard(dCache, id);
+    DBlkCacheEntry* entry = lookupEntry(dCache, shard, id);
+    *claimed = entry == NULL;
+    countLookup(dCache, entry != NULL, cls);
+    if(entry != NULL) {
+        touchEntry(dCache, entry);
+        tagEntry(dCache, entry, cls);
+    }
+    else {
+        //another caller may cache the block while a victim is written back
+        entry = takeEntry(dCache, shard, id, cls, claimed);
+        if(entry == NULL) {
+            *claimed = false;
+            unlockShard(dCache, shard);
+            return NULL;
+        }
+        entry->_dblk_busy = *claimed;
+    }
+    entry->_dblk_pins++;
+    unlockShard(dCache, shard);
+    return entry->_data_blk;
+}
+
+BYTE* reserveDBlkCacheEntry(DBlkCache *dCache, LONG id, DBLK_CLASS cls) {
+    UINT shard = lockShard(dCache, id);
+    DBlkCacheEntry* entry = NULL;
+    BOOL taken = false;
+    if(findEntry(dCache, id) == NULL) {
+        entry = takeEntry(dCache, shard, id, cls, &taken);
+    }
+    if(entry != NULL && !taken) {
+        entry = NULL;
+    }
+    if(entry != NULL) {
+        entry->_dblk_busy = true;
+        entry->_dblk_pins++;
+    }
+    unlockShard(dCache, shard);
+    return entry == NULL ? NULL : entry->_data_blk;
+}
+
+//empties an entry; called with the shard locked
+static void dropEntry(DBlkCache *dCache, DBlkCacheEntry* entry) {
+    markClean(dCache, entry);
+    tagEntry(dCache, entry, DBLK_DATA);
+    entry->_dblk_id = -1;
+    entry->_dblk_hot = false;
+    entry->_dblk_ref = false;
+    memset(entry->_data_blk, 0, dCache->_dCache_blkSize);
+    COUNT(dCache->_dCache_size, -1);
+}
+
+void readyDBlkCacheEntry(DBlkCache *dCache, BYTE *blk, BOOL filled) {
+    DBlkCacheEntry* entry = entryOf(dCache, blk);
+    UINT shard = entryShard(dCache, entry);
+    pthread_mutex_lock(&dCache->_dCache_locks[shard]);
+    assert(entry->_dblk_busy && entry->_dblk_pins > 0);
+    entry->_dblk_busy = false;
+    if(!filled) {
+        entry->_dblk_pins--;
+        if(entry->_dblk_pins == 0) {
+            dropEntry(dCache, entry);
+        }
+    }
+    pthread_cond_broadcast(&dCache->_dCache_filled[shard]);
+    unlockShard(dCache, shard);
+}
+
+void unpinDBlkCacheEntry(DBlkCache *dCache, BYTE *blk) {
+    DBlkCacheEntry* entry = entryOf(dCache, blk);
+    UINT shard = entryShard(dCache, entry);
+    pthread_mutex_lock(&dCache->_dCache_locks[shard]);
+    assert(entry->_dblk_pins > 0);
+    entry->_dblk_pins--;
+    unlockShard(dCache, shard);
+}
+
+void dirtyDBlkCacheEntry(DBlkCache *dCache, BYTE *blk, LONG nowNs) {
+    DBlkCacheEntry* entry = entryOf(dCache, blk);
+    UINT shard = entryShard(dCache, entry);
+    pthread_mutex_lock(&dCache->_dCache_locks[shard]);
+    markDirty(dCache, entry, nowNs);
+    unlockShard(dCache, shard);
+}
+
+BOOL isDBlkCacheBlk(DBlkCache *dCache, BYTE *blk) {
+    LONG nBytes = (LONG) dCache->_dCache_nSets * dCache->_dCache_nWays * dCache->_dCache_blkSize;
+    return blk >= dCache->_dCache_slab && blk < dCache->_dCache_slab + nBytes;
 }
 
 // remove a cache entry when the datablock is freed
 INT removeDBlkCacheEntry(DBlkCache *dCache, LONG id) {
-    assert(hasDBlkCacheEntry(dCache, id) == true);
-    UINT set = id % DBLK_CACHE_SET_NUM;
-    
-    dCache->dCache[set]._dblk_id = -1;
-    memset(dCache->dCache[set]._data_blk, 0, BLK_SIZE);
-    
-    dCache->_dCache_size--;
+    UINT shard = lockShard(dCache, id);
+    DBlkCacheEntry* entry = lookupEntry(dCache, shard, id);
+    assert(entry != NULL && entry->_dblk_pins == 0);
+    dropEntry(dCache, entry);
+    unlockShard(dCache, shard);
     return 0;
 }
 
 //check if its a dcache hit
 BOOL hasDBlkCacheEntry(DBlkCache *dCache, LONG id) {
-    UINT set = id % DBLK_CACHE_SET_NUM;
-    return id == dCache->dCache[set]._dblk_id;
+    UINT shard = lockShard(dCache, id);
+    BOOL cached = findEntry(dCache, id) != NULL;
+    unlockShard(dCache, shard);
+    return cached;
+}
+
+//orders cached ways hottest first
+static int compareHeat(const void *a, const void *b) {
+    const DBlkCacheEntry* x = *(DBlkCacheEntry* const*) a;
+    const DBlkCacheEntry* y = *(DBlkCacheEntry* const*) b;
+    if(x->_dblk_hot != y->_dblk_hot) {
+        return y->_dblk_hot - x->_dblk_hot;
+    }
+    return (x->_dblk_stamp < y->_dblk_stamp) - (x->_dblk_stamp > y->_dblk_stamp);
+}
+
+UINT listDBlkCacheEntries(DBlkCache *dCache, DBLK_CLASS cls, LONG *ids, UINT max) {
+    UINT nEntries = dCache->_dCache_nSets * dCache->_dCache_nWays;
+    DBlkCacheEntry** ways = malloc(nEntries * sizeof(DBlkCacheEntry*));
+    assert(ways != NULL);
+    UINT n = 0;
+    for(UINT shard = 0; shard < dCache->_dCache_nShards; shard++) {
+        pthread_mutex_lock(&dCache->_dCache_locks[shard]);
+    }
+    for(UINT i = 0; i < nEntries; i++) {
+        DBlkCacheEntry* entry = &dCache->dCache[i];
+        if(entry->_dblk_id != -1 && !entry->_dblk_busy && entry->_dblk_class == cls) {
+            ways[n++] = entry;
+        }
+    }
+    qsort(ways, n, sizeof(DBlkCacheEntry*), compareHeat);
+    if(n > max) {
+        n = max;
+    }
+    for(UINT i = 0; i < n; i++) {
+        ids[i] = ways[i]->_dblk_id;
+    }
+    for(UINT shard = 0; shard < dCache->_dCache_nShards; shard++) {
+        unlockShard(dCache, shard);
+    }
+    free(ways);
+    return n;
+}
+
+void resetDBlkCacheStats(DBlkCache *dCache) {
+    dCache->_dCache_hits = 0;
+    dCache->_dCache_misses = 0;
+    dCache->_dCache_evictions = 0;
+    dCache->_dCache_writeBacks = 0;
+    for(UINT c = 0; c < DBLK_NCLASSES; c++) {
+        dCache->_dCache_classHits[c] = 0;
+        dCache->_dCache_classMisses[c] = 0;
+    }
+}
+
+double dBlkCacheHitRate(DBlkCache *dCache, DBLK_CLASS cls) {
+    LONG nAccesses = dCache->_dCache_classHits[cls] + dCache->_dCache_classMisses[cls];
+    return nAccesses == 0 ? 0 : 100.0 * dCache->_dCache_classHits[cls] / nAccesses;
+}
+
+const char *dBlkClassName(DBLK_CLASS cls) {
+    return cls == DBLK_META ? "metadata" : "data";
+}
+
+const char *dBlkCachePolicyName(DBLK_CACHE_POLICY policy) {
+    switch(policy) {
+        case DBLK_CACHE_CLOCK:
+            return "CLOCK";
+        case DBLK_CACHE_2Q:
+            return "2Q";
+        default:
+            return "LRU";
+    }
 }
 
 #ifdef DEBUG_DCACHE
 #include <stdio.h>
-void printDBlkCache(DBlkCache *dCache) {    
-  printf("[DBlkCache: _dCache_size = %d]\n", dCache->_dCache_size);
-  for(INT set = 0; set < DBLK_CACHE_SET_NUM; set++) {
+void printDBlkCache(DBlkCache *dCache) {
+  printf("[DBlkCache: _dCache_size = %d, %u dirty, %u metadata of %u, %u sets of %u ways, %s, hits %ld, misses %ld, evictions %ld, write backs %ld]\n",
+         dCache->_dCache_size, dCache->_dCache_nDirty, dCache->_dCache_nMeta, dCache->_dCache_metaBlks,
+         dCache->_dCache_nSets, dCache->_dCache_nWays,
+         dBlkCachePolicyName(dCache->_dCache_policy),
+         dCache->_dCache_hits, dCache->_dCache_misses, dCache->_dCache_evictions, dCache->_dCache_writeBacks);
+  for(UINT set = 0; set < dCache->_dCache_nSets; set++) {
     printf("Set %d: ", set);
-    DBlkCacheEntry* curEntry = &dCache->dCache[set];
-    printDBlkCacheEntry(curEntry);
+    for(UINT w = 0; w < dCache->_dCache_nWays; w++) {
+      DBlkCacheEntry* curEntry = &dCache->dCache[set * dCache->_dCache_nWays + w];
+      printDBlkCacheEntry(curEntry);
+    }
   }
 }
 
@@ -1,30 +1,183 @@
-// This is the in core INodeTable
+// This is the in core data block cache
+// N-way set associative, each block id hashes to a set of ways entries
+// and the replacement policy picks the victim inside the set
+// The sets are spread over shards, each with its own lock, so that calls
+// on blocks of different shards run in parallel
 
 #pragma once
 #include "DBlkCacheEntry.h"
 #include "string.h"
+#include <pthread.h>
+
+//capacity in blocks and associativity when the mount options give none
+#define DBLK_CACHE_DEFAULT_BLKS (1024)
+#define DBLK_CACHE_DEFAULT_WAYS (8)
+
+//# of shards the sets are spread over, fewer if there are fewer sets
+#define DBLK_CACHE_SHARDS (16)
+
+typedef enum {
+  DBLK_CACHE_LRU,   //evicts the least recently used way
+  DBLK_CACHE_CLOCK, //second chance over a referenced bit per way
+  DBLK_CACHE_2Q,    //blocks seen once wait in a probation queue, scans do
+                    //not push out blocks referenced twice
+} DBLK_CACHE_POLICY;
+
+//writes a dirty block back to disk, called with the context the cache was
+//given, returns 0 on success
+typedef INT (*DBlkWriteBack)(void *ctx, LONG id, BYTE *buf);
 
 typedef struct DBlkCache{
   UINT _dCache_size;
-  DBlkCacheEntry dCache[DBLK_CACHE_SET_NUM];
+  UINT _dCache_blkSize;
+  BYTE *_dCache_slab;
+
+  //geometry, nSets sets of nWays entries
+  UINT _dCache_nSets;
+  UINT _dCache_nWays;
+  DBLK_CACHE_POLICY _dCache_policy;
+  DBlkCacheEntry *dCache;
+
+  //set s belongs to shard s % nShards, whose lock guards its entries,
+  //hands and ghosts and whose condition wakes the callers waiting for a
+  //block being read in
+  UINT _dCache_nShards;
+  pthread_mutex_t *_dCache_locks;
+  pthread_cond_t *_dCache_filled;
+
+  //access clock stamping the entries
+  LONG _dCache_tick;
+  //CLOCK hand of each set
+  UINT *_dCache_hands;
+  //2Q, ids recently evicted from probation, nWays per set used as a ring
+  LONG *_dCache_ghosts;
+  UINT *_dCache_ghostNext;
+
+  //write-back, dirty entries are written back through this callback when
+  //they are evicted or flushed
+  DBlkWriteBack _dCache_writeBack;
+  void *_dCache_writeBackCtx;
+  UINT _dCache_nDirty;
+
+  //metadata partition, while it holds at most metaBlks blocks a data block
+  //only takes a metadata block's way if its set has nothing else, and past
+  //that a metadata block replaces another one first; 0 shares the cache
+  UINT _dCache_metaBlks;
+  UINT _dCache_nMeta;
+
+  //counters, hits and misses also by class; they, the size and the
+  //dirty and metadata counts are updated atomically
+  LONG _dCache_hits;
+  LONG _dCache_misses;
+  LONG _dCache_classHits[DBLK_NCLASSES];
+  LONG _dCache_classMisses[DBLK_NCLASSES];
+  LONG _dCache_evictions;
+  LONG _dCache_writeBacks;
 } DBlkCache;
 
-//initializes all the bin entries to null
+//initializes all the entries to empty
 //MUST be called at filesystem init time since arrays do not default to NULL
-void initDBlkCache(DBlkCache*);
+//args: cache,
+//      block size,
+//      capacity in blocks (0 for the default),
+//      ways per set (0 for the default),
+//      replacement policy
+void initDBlkCache(DBlkCache*, UINT, UINT, UINT, DBLK_CACHE_POLICY);
+
+//frees the block slab
+void destroyDBlkCache(DBlkCache*);
+
+//sets the callback dirty blocks are written back through
+void setDBlkCacheWriteBack(DBlkCache *, DBlkWriteBack, void *);
+
+//sets the # of blocks the metadata partition is protected up to
+void setDBlkCacheMetaBlks(DBlkCache *, UINT);
+
+// the calls filling or looking up a block take its class, a block found
+// with another class than it was cached with changes class
+
+// addes a datablock to cache, replace the existing one
+// the block is clean, the same as its disk copy
+// returns -1 if a dirty block had to be evicted and could not be written
+// back, the block is then not cached
+INT putDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf, DBLK_CLASS cls);
 
-// addes a datablock to cache, replace the existing one 
-INT putDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf);
+// like putDBlkCacheEntry but marks the block dirty, nowNs is the time it
+// becomes dirty if it was clean
+INT writeDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf, DBLK_CLASS cls, LONG nowNs);
+
+//writes back every dirty block dirtied at or before olderThanNs, then the
+//oldest others until at most maxDirty blocks are dirty
+//returns the # of blocks written back, -1 if a write back failed
+LONG flushDBlkCache(DBlkCache *dCache, LONG olderThanNs, UINT maxDirty);
 
 // read the datablk from the dcache into a buf
-INT getDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf);
+// returns -1 on a miss, hits and misses are counted
+INT getDBlkCacheEntry(DBlkCache *dCache, LONG id, BYTE *buf, DBLK_CLASS cls);
+
+// pinned access, the caller works on the cached bytes themselves instead
+// of a copy; a pinned block stays in the cache until every pin is dropped
+
+// a block claimed on a miss is in flight until the claimer readies it,
+// every call looking the block up meanwhile waits for it, so callers
+// missing on the same block together read it once
+
+// pins a cached block and returns its bytes, NULL on a miss
+// hits and misses are counted
+BYTE* pinDBlkCacheEntry(DBlkCache *, LONG, DBLK_CLASS);
+
+// pins a block like pinDBlkCacheEntry on a hit; on a miss takes a way for
+// it and returns it pinned and in flight with *claimed set, the caller
+// reads the block into it and calls readyDBlkCacheEntry
+// NULL on a miss if every way of the set is pinned or a dirty victim could
+// not be written back, hits and misses are counted
+BYTE* claimDBlkCacheEntry(DBlkCache *, LONG, DBLK_CLASS, BOOL *);
+
+// claims a way like claimDBlkCacheEntry for a block that is neither cached
+// nor in flight, without waiting or counting; NULL otherwise, for
+// prefetches that have nothing to do if the block is already there
+BYTE* reserveDBlkCacheEntry(DBlkCache *, LONG, DBLK_CLASS);
+
+// ends the fill of a claimed block and wakes the callers waiting for it;
+// the block stays pinned if it was read, a block that could not be read
+// is unpinned and dropped
+void readyDBlkCacheEntry(DBlkCache *, BYTE *, BOOL);
+
+// drops a pin taken by pinDBlkCacheEntry, claimDBlkCacheEntry or
+// reserveDBlkCacheEntry
+void unpinDBlkCacheEntry(DBlkCache *, BYTE *);
 
-//check if its a dcache hit
+// marks a pinned block changed in place dirty
+void dirtyDBlkCacheEntry(DBlkCache *, BYTE *, LONG);
+
+// whether a pointer is a block of the cache
+BOOL isDBlkCacheBlk(DBlkCache *, BYTE *);
+
+//check if its a dcache hit, without counting it or touching the entry,
+//a block in flight counts
 BOOL hasDBlkCacheEntry(DBlkCache *, LONG);
 
+//fills ids with up to max cached block ids of a class, hottest first:
+//the hot 2Q blocks and then by recency; returns the # listed
+UINT listDBlkCacheEntries(DBlkCache *, DBLK_CLASS, LONG *, UINT);
+
 //removes an DBlkCache entry, returning true if successful
+//a dirty block is dropped without being written back, the block must not
+//be pinned
 INT removeDBlkCacheEntry(DBlkCache *, LONG);
 
+//clears the hit/miss/eviction/write back counters
+void resetDBlkCacheStats(DBlkCache *);
+
+//hit rate of a class in percent, 0 before any access
+double dBlkCacheHitRate(DBlkCache *, DBLK_CLASS);
+
+//name of a block class
+const char *dBlkClassName(DBLK_CLASS);
+
+//name of a replacement policy
+const char *dBlkCachePolicyName(DBLK_CACHE_POLICY);
+
 #ifdef DEBUG_DCACHE
 void printDBlkCache(DBlkCache *);
 
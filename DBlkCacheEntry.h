@@ -4,11 +4,41 @@
 #pragma once
 #include "Globals.h"
 
+// what a cached block holds, metadata blocks are kept in a protected part
+// of the cache with its own budget
+typedef enum {
+  DBLK_DATA, // file contents
+  DBLK_META, // indirect blocks, directory blocks and free list blocks
+  DBLK_NCLASSES
+} DBLK_CLASS;
+
 typedef struct DBlkCacheEntry {
-     
+
 // datablk id (starting from 0)
-  LONG _dblk_id;         
+  LONG _dblk_id;
+
+// the data block, blkSize bytes inside the cache slab
+  BYTE *_data_blk;
+
+// replacement state, the tick of the last access (LRU, 2Q), the
+// referenced bit (CLOCK) and whether the entry made it to the main
+// queue after a second reference (2Q)
+  LONG _dblk_stamp;
+  BOOL _dblk_ref;
+  BOOL _dblk_hot;
+
+// write-back state, whether the block is newer than its disk copy and
+// the time it first got so
+  BOOL _dblk_dirty;
+  LONG _dblk_dirtyNs;
+
+// class of the block, from the last access
+  DBLK_CLASS _dblk_class;
+
+// # of callers holding a pointer to the block, a pinned entry is never
+// evicted
+  UINT _dblk_pins;
 
-// the data block
-  BYTE _data_blk[BLK_SIZE];
+// the block is being read in by the caller that claimed it
+  BOOL _dblk_busy;
 }DBlkCacheEntry;
@@ -1,31 +1,620 @@
 #include <stdio.h>
-#include "DBlkCache.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include "Directories.h"
+
+#define TEST_CACHE_BLKS (1024)
+#define HOT_BLKS (384)
+#define SCAN_BLKS (65536)
+
+static UINT seed = 1;
+
+//xorshift32, the same trace on every run
+static UINT nextRand() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+//reads a block through the cache the way readDBlk does, filling it on a miss
+static void readThrough(DBlkCache* dCache, LONG id, BYTE* buf) {
+    if(getDBlkCacheEntry(dCache, id, buf, DBLK_DATA) == -1) {
+        *(LONG*) buf = id;
+        putDBlkCacheEntry(dCache, id, buf, DBLK_DATA);
+    }
+    assert(*(LONG*) buf == id);
+}
+
+static double hitRate(DBlkCache* dCache) {
+    return 100.0 * dCache->_dCache_hits / (dCache->_dCache_hits + dCache->_dCache_misses);
+}
+
+//a hot set read over and over while a long sequential scan goes by,
+//two scanned blocks for every hot one
+static double runScanTrace(DBLK_CACHE_POLICY policy, UINT nWays) {
+    DBlkCache dCache;
+    BYTE buf[DEFAULT_BLK_SIZE];
+    initDBlkCache(&dCache, DEFAULT_BLK_SIZE, TEST_CACHE_BLKS, nWays, policy);
+    seed = 1;
+    for(UINT i = 0; i < SCAN_BLKS; i++) {
+        readThrough(&dCache, 100000 + i, buf);
+        if(i % 2 == 1) {
+            readThrough(&dCache, nextRand() % HOT_BLKS, buf);
+        }
+    }
+    double rate = hitRate(&dCache);
+    destroyDBlkCache(&dCache);
+    return rate;
+}
+
+//a working set of three quarters of the capacity at scattered ids, read
+//in a loop, the ids crowding into the same set is all that misses
+static double runConflictTrace(DBLK_CACHE_POLICY policy, UINT nWays) {
+    DBlkCache dCache;
+    BYTE buf[DEFAULT_BLK_SIZE];
+    initDBlkCache(&dCache, DEFAULT_BLK_SIZE, TEST_CACHE_BLKS, nWays, policy);
+    for(UINT round = 0; round < 16; round++) {
+        for(UINT i = 0; i < 3 * TEST_CACHE_BLKS / 4; i++) {
+            readThrough(&dCache, (LONG)i * 1024 + 5, buf);
+        }
+    }
+    double rate = hitRate(&dCache);
+    destroyDBlkCache(&dCache);
+    return rate;
+}
+
+//a skewed (zipf-like) mix over a working set twice the cache size
+static double runSkewTrace(DBLK_CACHE_POLICY policy, UINT nWays) {
+    DBlkCache dCache;
+    BYTE buf[DEFAULT_BLK_SIZE];
+    initDBlkCache(&dCache, DEFAULT_BLK_SIZE, TEST_CACHE_BLKS, nWays, policy);
+    seed = 7;
+    for(UINT i = 0; i < 200000; i++) {
+        //the product of two uniform draws favors small ids
+        UINT a = nextRand() % (2 * TEST_CACHE_BLKS);
+        UINT b = nextRand() % (2 * TEST_CACHE_BLKS);
+        readThrough(&dCache, (LONG)a * b / (2 * TEST_CACHE_BLKS), buf);
+    }
+    double rate = hitRate(&dCache);
+    destroyDBlkCache(&dCache);
+    return rate;
+}
+
+//a metadata heavy filesystem run: files created in a few directories,
+//repeated lookups, and a file much larger than the cache read through
+static double runFsWorkload(DBLK_CACHE_POLICY policy, LONG* evictions) {
+    FileSystem fs;
+    MountOptions opts;
+    char path[64];
+    initMountOptions(&opts);
+    opts.dCacheBlks = 256;
+    opts.dCachePolicy = policy;
+    assert(l2_initfs(4096, 512, 0, 0, &opts, &fs) == 0);
+
+    for(UINT d = 0; d < 4; d++) {
+        sprintf(path, "/d%d", d);
+        assert(l2_mkdir(&fs, path, 0, 0) >= 0);
+    }
+    for(UINT i = 0; i < 400; i++) {
+        sprintf(path, "/d%d/f%d", i % 4, i);
+        assert(l2_mknod(&fs, path, 0, 0) >= 0);
+    }
+    LONG bigSize = 1024 * fs.blkSize;
+    BYTE* big = malloc(bigSize);
+    memset(big, 0x3c, bigSize);
+    assert(l2_mknod(&fs, "/big", 0, 0) >= 0);
+    assert(l2_open(&fs, "/big", OP_READWRITE) == 0);
+    assert(l2_write(&fs, "/big", 0, big, bigSize) == bigSize);
+
+    resetDBlkCacheStats(&fs.dCache);
+    for(UINT round = 0; round < 4; round++) {
+        for(UINT i = 0; i < 400; i += 3) {
+            sprintf(path, "/d%d/f%d", i % 4, i);
+            assert(l2_namei(&fs, path) >= 0);
+        }
+        for(LONG off = 0; off < bigSize; off += fs.blkSize) {
+            assert(l2_read(&fs, "/big", off, big, fs.blkSize) == fs.blkSize);
+        }
+    }
+    l2_close(&fs, "/big", OP_READWRITE);
+    double rate = hitRate(&fs.dCache);
+    *evictions = fs.dCache._dCache_evictions;
+    free(big);
+    l2_unmount(&fs);
+    return rate;
+}
+
+//stands in for the disk under the write-back tests
+static LONG wbIds[4 * TEST_CACHE_BLKS];
+static UINT nWbs = 0;
+
+static INT recordWriteBack(void *ctx, LONG id, BYTE *buf) {
+    assert(*(LONG*) buf == id);
+    wbIds[nWbs++] = id;
+    return 0;
+}
+
+static void testWriteBackCache() {
+    DBlkCache dCache;
+    BYTE buf[DEFAULT_BLK_SIZE];
+    initDBlkCache(&dCache, DEFAULT_BLK_SIZE, 64, 4, DBLK_CACHE_LRU);
+    setDBlkCacheWriteBack(&dCache, recordWriteBack, NULL);
+
+    //rewriting a dirty block keeps one dirty copy and its first dirty time
+    for(LONG i = 0; i < 32; i++) {
+        *(LONG*) buf = i;
+        assert(writeDBlkCacheEntry(&dCache, i, buf, DBLK_DATA, 100 + i) == 0);
+        assert(writeDBlkCacheEntry(&dCache, i, buf, DBLK_DATA, 1000 + i) == 0);
+    }
+    assert(dCache._dCache_nDirty == 32 && nWbs == 0);
+
+    //a clean fill of a dirty block means the disk caught up
+    *(LONG*) buf = 31;
+    putDBlkCacheEntry(&dCache, 31, buf, DBLK_DATA);
+    assert(dCache._dCache_nDirty == 31);
+    //a freed block is dropped, not written back
+    removeDBlkCacheEntry(&dCache, 30);
+    assert(dCache._dCache_nDirty == 30);
+
+    //by age, then by pressure, oldest first
+    assert(flushDBlkCache(&dCache, 109, 64) == 10);
+    assert(dCache._dCache_nDirty == 20 && nWbs == 10);
+    assert(flushDBlkCache(&dCache, 0, 15) == 5);
+    for(UINT i = 0; i < nWbs; i++) {
+        assert(wbIds[i] == i);
+    }
+    assert(dCache._dCache_writeBacks == 15);
+
+    //evicting a dirty block writes it back first
+    nWbs = 0;
+    for(LONG i = 1000; i < 1000 + 4 * 64; i++) {
+        *(LONG*) buf = i;
+        assert(putDBlkCacheEntry(&dCache, i, buf, DBLK_DATA) == 0);
+    }
+    assert(dCache._dCache_nDirty == 0 && nWbs == 15);
+    destroyDBlkCache(&dCache);
+}
+
+static void testPinnedCache() {
+    DBlkCache dCache;
+    BYTE buf[DEFAULT_BLK_SIZE];
+    initDBlkCache(&dCache, DEFAULT_BLK_SIZE, 4, 4, DBLK_CACHE_LRU);
+    setDBlkCacheWriteBack(&dCache, recordWriteBack, NULL);
+
+    //a pinned block is the cached block itself
+    BOOL claimed;
+    assert(pinDBlkCacheEntry(&dCache, 7, DBLK_DATA) == NULL);
+    BYTE* blk = claimDBlkCacheEntry(&dCache, 7, DBLK_DATA, &claimed);
+    assert(blk != NULL && claimed && isDBlkCacheBlk(&dCache, blk));
+    assert(hasDBlkCacheEntry(&dCache, 7) && reserveDBlkCacheEntry(&dCache, 7, DBLK_DATA) == NULL);
+    *(LONG*) blk = 7;
+    readyDBlkCacheEntry(&dCache, blk, true);
+    assert(pinDBlkCacheEntry(&dCache, 7, DBLK_DATA) == blk);
+    assert(getDBlkCacheEntry(&dCache, 7, buf, DBLK_DATA) == 0 && *(LONG*) buf == 7);
+    assert(!isDBlkCacheBlk(&dCache, buf));
+
+    //pinned blocks are never evicted, a set with every way pinned takes
+    //no new block
+    BYTE* pinned[3];
+    for(LONG i = 0; i < 3; i++) {
+        pinned[i] = claimDBlkCacheEntry(&dCache, 100 + i, DBLK_DATA, &claimed);
+        assert(pinned[i] != NULL && claimed);
+        *(LONG*) pinned[i] = 100 + i;
+        readyDBlkCacheEntry(&dCache, pinned[i], true);
+    }
+    *(LONG*) buf = 200;
+    assert(putDBlkCacheEntry(&dCache, 200, buf, DBLK_DATA) == -1);
+    assert(claimDBlkCacheEntry(&dCache, 200, DBLK_DATA, &claimed) == NULL && !claimed);
+    unpinDBlkCacheEntry(&dCache, blk);
+    assert(putDBlkCacheEntry(&dCache, 200, buf, DBLK_DATA) == -1);
+    unpinDBlkCacheEntry(&dCache, blk);
+    assert(putDBlkCacheEntry(&dCache, 200, buf, DBLK_DATA) == 0);
+    assert(!hasDBlkCacheEntry(&dCache, 7));
+
+    //a claim on a cached block pins it, a fill that failed leaves nothing
+    blk = claimDBlkCacheEntry(&dCache, 200, DBLK_DATA, &claimed);
+    assert(blk != NULL && !claimed && *(LONG*) blk == 200);
+    unpinDBlkCacheEntry(&dCache, blk);
+    blk = reserveDBlkCacheEntry(&dCache, 201, DBLK_DATA);
+    assert(blk != NULL);
+    readyDBlkCacheEntry(&dCache, blk, false);
+    assert(!hasDBlkCacheEntry(&dCache, 201));
+
+    //a block changed in place and marked dirty is written back from the
+    //cache
+    nWbs = 0;
+    *(LONG*) pinned[0] = 100;
+    dirtyDBlkCacheEntry(&dCache, pinned[0], 1);
+    assert(dCache._dCache_nDirty == 1);
+    for(UINT i = 0; i < 3; i++) {
+        unpinDBlkCacheEntry(&dCache, pinned[i]);
+    }
+    assert(flushDBlkCache(&dCache, 1, 0) == 1 && nWbs == 1 && wbIds[0] == 100);
+    destroyDBlkCache(&dCache);
+}
+
+//small appends to a file, one call each, with the cache write through and
+//write back; returns the disk block writes per append
+static double runAppendWorkload(BOOL writeBack) {
+    FileSystem fs;
+    MountOptions opts;
+    BYTE rec[100];
+    initMountOptions(&opts);
+    opts.writeBack = writeBack;
+    assert(l2_initfs(4096, 64, 0, 0, &opts, &fs) == 0);
+    assert(l2_mknod(&fs, "/log", 0, 0) >= 0);
+    assert(l2_open(&fs, "/log", OP_READWRITE) == 0);
+
+    resetDiskStats(fs.disk);
+    LONG nRecs = 2000;
+    for(LONG i = 0; i < nRecs; i++) {
+        memset(rec, i, sizeof(rec));
+        assert(l2_write(&fs, "/log", i * sizeof(rec), rec, sizeof(rec)) == sizeof(rec));
+    }
+    assert(l2_sync(&fs) == 0);
+    assert(fs.dCache._dCache_nDirty == 0);
+    DiskStats stats;
+    getDiskStats(fs.disk, &stats);
+    l2_close(&fs, "/log", OP_READWRITE);
+    l2_unmount(&fs);
+
+    //everything made it to disk
+    assert(l2_mount(&fs, &opts) == 0);
+    assert(l2_open(&fs, "/log", OP_READ) == 0);
+    for(LONG i = 0; i < nRecs; i++) {
+        assert(l2_read(&fs, "/log", i * sizeof(rec), rec, sizeof(rec)) == sizeof(rec));
+        assert(rec[0] == (BYTE) i && rec[sizeof(rec) - 1] == (BYTE) i);
+    }
+    l2_close(&fs, "/log", OP_READ);
+    l2_unmount(&fs);
+    return (double) stats._st_writes / nRecs;
+}
+
+//the flusher writes dirty blocks back by age without any sync
+static void testFlusher() {
+    FileSystem fs;
+    MountOptions opts;
+    BYTE rec[100];
+    initMountOptions(&opts);
+    opts.writeBack = true;
+    opts.flushIntervalMs = 10;
+    opts.dirtyExpireMs = 0;
+    assert(l2_initfs(1024, 64, 0, 0, &opts, &fs) == 0);
+    assert(l2_mknod(&fs, "/f", 0, 0) >= 0);
+    assert(l2_open(&fs, "/f", OP_WRITE) == 0);
+    memset(rec, 7, sizeof(rec));
+    assert(l2_write(&fs, "/f", 0, rec, sizeof(rec)) == sizeof(rec));
+    assert(fs.flusherRunning);
+    for(UINT i = 0; i < 200 && fs.dCache._dCache_writeBacks == 0; i++) {
+        usleep(10000);
+    }
+    pthread_mutex_lock(&fs.lock);
+    assert(fs.dCache._dCache_nDirty == 0 && fs.dCache._dCache_writeBacks > 0);
+    pthread_mutex_unlock(&fs.lock);
+    l2_close(&fs, "/f", OP_WRITE);
+    l2_unmount(&fs);
+}
+
+//streams a file several times the size of the cache between rounds of
+//lookups in a directory and scattered reads through the indirect block
+//of another file, returns the metadata misses of the later rounds
+static LONG runMetaWorkload(BOOL protectMeta) {
+    FileSystem fs;
+    MountOptions opts;
+    char path[32];
+    initMountOptions(&opts);
+    opts.dCacheBlks = 256;
+    assert(l2_initfs(8192, 256, 0, 0, &opts, &fs) == 0);
+    if(!protectMeta) {
+        setDBlkCacheMetaBlks(&fs.dCache, 0);
+    }
+    LONG nOtherBlks = INODE_NUM_DIRECT_BLKS + fs.nPtrsPerBlk / 2;
+    LONG nBigBlks = 4 * 256;
+    BYTE* buf = malloc(16 * fs.blkSize);
+    memset(buf, 3, 16 * fs.blkSize);
+
+    assert(l2_mkdir(&fs, "/d", 0, 0) >= 0);
+    for(UINT i = 0; i < 200; i++) {
+        sprintf(path, "/d/f%u", i);
+        assert(l2_mknod(&fs, path, 0, 0) >= 0);
+    }
+    assert(l2_mknod(&fs, "/other", 0, 0) >= 0);
+    assert(l2_open(&fs, "/other", OP_READWRITE) == 0);
+    for(LONG b = 0; b < nOtherBlks; b += 16) {
+        assert(l2_write(&fs, "/other", b * fs.blkSize, buf, 16 * fs.blkSize) == 16 * fs.blkSize);
+    }
+    assert(l2_mknod(&fs, "/big", 0, 0) >= 0);
+    assert(l2_open(&fs, "/big", OP_READWRITE) == 0);
+    for(LONG b = 0; b < nBigBlks; b += 16) {
+        assert(l2_write(&fs, "/big", b * fs.blkSize, buf, 16 * fs.blkSize) == 16 * fs.blkSize);
+    }
+
+    struct stat st;
+    for(UINT round = 0; round < 4; round++) {
+        if(round == 2) {
+            resetDBlkCacheStats(&fs.dCache);
+        }
+        for(LONG b = 0; b < nBigBlks; b += 16) {
+            assert(l2_read(&fs, "/big", b * fs.blkSize, buf, 16 * fs.blkSize) == 16 * fs.blkSize);
+        }
+        for(UINT i = 0; i < 200; i++) {
+            sprintf(path, "/d/f%u", i);
+            assert(l2_getattr(&fs, path, &st) == 0);
+        }
+        for(LONG b = INODE_NUM_DIRECT_BLKS; b < nOtherBlks; b += 17) {
+            assert(l2_read(&fs, "/other", b * fs.blkSize, buf, 1) == 1);
+        }
+    }
+    LONG metaMisses = fs.dCache._dCache_classMisses[DBLK_META];
+    printf("%s metadata partition: %s hit rate %.2f%% (%ld misses), %s hit rate %.2f%%, %u metadata blocks cached\n",
+           protectMeta ? "with" : "without", dBlkClassName(DBLK_META), dBlkCacheHitRate(&fs.dCache, DBLK_META), metaMisses,
+           dBlkClassName(DBLK_DATA), dBlkCacheHitRate(&fs.dCache, DBLK_DATA), fs.dCache._dCache_nMeta);
+    assert(fs.dCache._dCache_nMeta <= fs.dCache._dCache_metaBlks || !protectMeta);
+    free(buf);
+    l2_close(&fs, "/other", OP_READWRITE);
+    l2_close(&fs, "/big", OP_READWRITE);
+    l2_unmount(&fs);
+    return metaMisses;
+}
+
+#define N_THREADS (4)
+#define SHARED_BLKS (64)
+
+typedef struct CacheWorker {
+    DBlkCache* dCache;
+    FileSystem* fs;
+    UINT shift;
+    //what the worker read of each shared block
+    LONG sums[SHARED_BLKS];
+} CacheWorker;
+
+static INT checkWriteBack(void *ctx, LONG id, BYTE *buf) {
+    assert(*(LONG*) buf == id);
+    return 0;
+}
+
+//puts, writes and reads back blocks tagged with their id, each worker
+//over the same ids in its own order
+static void* hammerCache(void* arg) {
+    CacheWorker* w = arg;
+    BYTE buf[DEFAULT_BLK_SIZE];
+    for(UINT round = 0; round < 200; round++) {
+        for(UINT i = 0; i < SHARED_BLKS; i++) {
+            LONG id = (i * 7 + w->shift + round) % (2 * SHARED_BLKS);
+            *(LONG*) buf = id;
+            if(i % 3 == 0) {
+                writeDBlkCacheEntry(w->dCache, id, buf, DBLK_DATA, round);
+            }
+            else if(i % 3 == 1) {
+                putDBlkCacheEntry(w->dCache, id, buf, i % 2 ? DBLK_META : DBLK_DATA);
+            }
+            else if(getDBlkCacheEntry(w->dCache, id, buf, DBLK_DATA) == 0) {
+                assert(*(LONG*) buf == id);
+            }
+        }
+        if(round % 50 == 0) {
+            flushDBlkCache(w->dCache, round, 0);
+        }
+    }
+    return NULL;
+}
+
+//reads every shared block once, starting at a different block per worker
+static void* readShared(void* arg) {
+    CacheWorker* w = arg;
+    BYTE buf[DEFAULT_BLK_SIZE];
+    LONG first = w->fs->superblock.nDBlks - SHARED_BLKS;
+    for(UINT i = 0; i < SHARED_BLKS; i++) {
+        UINT b = (i + w->shift) % SHARED_BLKS;
+        assert(readDBlk(w->fs, first + b, buf, DBLK_DATA) == 0);
+        w->sums[b] = 0;
+        for(UINT j = 0; j < sizeof(buf) / sizeof(LONG); j++) {
+            w->sums[b] += ((LONG*) buf)[j];
+        }
+    }
+    return NULL;
+}
+
+static void runWorkers(void* (*work)(void*), CacheWorker* workers) {
+    pthread_t threads[N_THREADS];
+    for(UINT t = 0; t < N_THREADS; t++) {
+        assert(pthread_create(&threads[t], NULL, work, &workers[t]) == 0);
+    }
+    for(UINT t = 0; t < N_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+//a write back held until the main thread has read another block of the
+//same set, or given up on after a few seconds
+typedef struct SlowWriteBack {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    BOOL writing;
+    BOOL released;
+    BOOL timedOut;
+} SlowWriteBack;
+
+static INT holdWriteBack(void *ctx, LONG id, BYTE *buf) {
+    SlowWriteBack* wb = ctx;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 5;
+    pthread_mutex_lock(&wb->lock);
+    wb->writing = true;
+    pthread_cond_broadcast(&wb->cond);
+    while(!wb->released && !wb->timedOut) {
+        wb->timedOut = pthread_cond_timedwait(&wb->cond, &wb->lock, &deadline) != 0;
+    }
+    pthread_mutex_unlock(&wb->lock);
+    return 0;
+}
+
+static void* evictDirty(void* arg) {
+    BYTE buf[DEFAULT_BLK_SIZE];
+    *(LONG*) buf = 3;
+    assert(putDBlkCacheEntry(arg, 3, buf, DBLK_DATA) == 0);
+    return NULL;
+}
+
+//a dirty victim is written back with its shard unlocked, a lookup of
+//another block of the set goes ahead meanwhile
+static void testUnlockedWriteBack() {
+    DBlkCache dCache;
+    SlowWriteBack wb = { .writing = false, .released = false, .timedOut = false };
+    pthread_mutex_init(&wb.lock, NULL);
+    pthread_cond_init(&wb.cond, NULL);
+    BYTE buf[DEFAULT_BLK_SIZE];
+    initDBlkCache(&dCache, DEFAULT_BLK_SIZE, 2, 2, DBLK_CACHE_LRU);
+    setDBlkCacheWriteBack(&dCache, holdWriteBack, &wb);
+    *(LONG*) buf = 1;
+    assert(writeDBlkCacheEntry(&dCache, 1, buf, DBLK_DATA, 0) == 0);
+    *(LONG*) buf = 2;
+    assert(putDBlkCacheEntry(&dCache, 2, buf, DBLK_DATA) == 0);
+
+    pthread_t evictor;
+    assert(pthread_create(&evictor, NULL, evictDirty, &dCache) == 0);
+    pthread_mutex_lock(&wb.lock);
+    while(!wb.writing) {
+        pthread_cond_wait(&wb.cond, &wb.lock);
+    }
+    pthread_mutex_unlock(&wb.lock);
+    assert(getDBlkCacheEntry(&dCache, 2, buf, DBLK_DATA) == 0 && *(LONG*) buf == 2);
+    pthread_mutex_lock(&wb.lock);
+    wb.released = true;
+    pthread_cond_broadcast(&wb.cond);
+    pthread_mutex_unlock(&wb.lock);
+    pthread_join(evictor, NULL);
+    assert(!wb.timedOut);
+
+    //the lookup made block 2 the newest, block 1 went after its write back
+    assert(!hasDBlkCacheEntry(&dCache, 1) && hasDBlkCacheEntry(&dCache, 3));
+    assert(dCache._dCache_nDirty == 0 && dCache._dCache_writeBacks == 1);
+    destroyDBlkCache(&dCache);
+    pthread_cond_destroy(&wb.cond);
+    pthread_mutex_destroy(&wb.lock);
+}
+
+//threads sharing the cache directly, then threads missing on the same
+//blocks of a filesystem together; returns the disk reads of the latter
+static LONG testConcurrentCache() {
+    DBlkCache dCache;
+    CacheWorker workers[N_THREADS];
+    initDBlkCache(&dCache, DEFAULT_BLK_SIZE, SHARED_BLKS, 4, DBLK_CACHE_2Q);
+    setDBlkCacheWriteBack(&dCache, checkWriteBack, NULL);
+    setDBlkCacheMetaBlks(&dCache, SHARED_BLKS / 4);
+    for(UINT t = 0; t < N_THREADS; t++) {
+        workers[t] = (CacheWorker) { .dCache = &dCache, .shift = t * 13 };
+    }
+    runWorkers(hammerCache, workers);
+    UINT nDirty = 0, nMeta = 0, size = 0;
+    for(UINT i = 0; i < SHARED_BLKS; i++) {
+        DBlkCacheEntry* entry = &dCache.dCache[i];
+        assert(entry->_dblk_pins == 0 && !entry->_dblk_busy);
+        size += entry->_dblk_id != -1;
+        nDirty += entry->_dblk_dirty;
+        nMeta += entry->_dblk_class == DBLK_META;
+        assert(entry->_dblk_id == -1 || *(LONG*) entry->_data_blk == entry->_dblk_id);
+    }
+    assert(dCache._dCache_size == size && dCache._dCache_nDirty == nDirty && dCache._dCache_nMeta == nMeta);
+    destroyDBlkCache(&dCache);
+
+    FileSystem fs;
+    MountOptions opts;
+    DiskStats stats;
+    initMountOptions(&opts);
+    assert(l2_initfs(4096, 64, 0, 0, &opts, &fs) == 0);
+    l2_unmount(&fs);
+    assert(l2_mount(&fs, &opts) == 0);
+    for(LONG id = fs.superblock.nDBlks - SHARED_BLKS; id < fs.superblock.nDBlks; id++) {
+        assert(!hasDBlkCacheEntry(&fs.dCache, id));
+    }
+    for(UINT t = 0; t < N_THREADS; t++) {
+        workers[t] = (CacheWorker) { .fs = &fs, .shift = t * SHARED_BLKS / N_THREADS / 2 };
+    }
+    resetDiskStats(fs.disk);
+    runWorkers(readShared, workers);
+    getDiskStats(fs.disk, &stats);
+    for(UINT t = 1; t < N_THREADS; t++) {
+        assert(memcmp(workers[t].sums, workers[0].sums, sizeof(workers[0].sums)) == 0);
+    }
+    l2_unmount(&fs);
+    return stats._st_readBytes / DEFAULT_BLK_SIZE;
+}
 
 int main() {
     struct DBlkCache *dCache = (struct DBlkCache *)malloc(sizeof(struct DBlkCache));
-    initDBlkCache(dCache);
-    #ifdef DEBUG_DCACHE
-    printDBlkCache(dCache);
-    #endif
-    
-    BYTE buf[BLK_SIZE];
-    memset(buf, 1, BLK_SIZE);
-    for(INT i = 0; i < DBLK_CACHE_SET_NUM / 2; i ++) {
+    initDBlkCache(dCache, DEFAULT_BLK_SIZE, 0, 0, DBLK_CACHE_LRU);
+
+    BYTE buf[DEFAULT_BLK_SIZE];
+    memset(buf, 1, DEFAULT_BLK_SIZE);
+    for(INT i = 0; i < DBLK_CACHE_DEFAULT_BLKS / 2; i ++) {
         if(hasDBlkCacheEntry(dCache, i) == false) {
-            putDBlkCacheEntry(dCache, i, buf);
+            putDBlkCacheEntry(dCache, i, buf, DBLK_DATA);
         }
     }
 
-    #ifdef DEBUG_DCACHE
-    printDBlkCache(dCache);
-    #endif
-
-    for(UINT i = 0; i < DBLK_CACHE_SET_NUM; i ++) {
+    //half the capacity fits, every block stays
+    for(UINT i = 0; i < DBLK_CACHE_DEFAULT_BLKS; i ++) {
         if(hasDBlkCacheEntry(dCache, i) == true) {
-            printf("cache hit on blk: %d\n", i);
-            getDBlkCacheEntry(dCache, i, buf);
+            assert(getDBlkCacheEntry(dCache, i, buf, DBLK_DATA) == 0);
         }
     }
+    assert(dCache->_dCache_size == DBLK_CACHE_DEFAULT_BLKS / 2);
+    assert(dCache->_dCache_hits == DBLK_CACHE_DEFAULT_BLKS / 2);
+    assert(dCache->_dCache_evictions == 0);
+    assert(getDBlkCacheEntry(dCache, DBLK_CACHE_DEFAULT_BLKS, buf, DBLK_DATA) == -1);
+    assert(dCache->_dCache_misses == 1);
+    removeDBlkCacheEntry(dCache, 0);
+    assert(!hasDBlkCacheEntry(dCache, 0));
+
+    //ids a multiple of the old slot count apart no longer evict each other
+    for(UINT i = 0; i < 8; i++) {
+        *(LONG*) buf = i * 1024;
+        putDBlkCacheEntry(dCache, i * 1024, buf, DBLK_DATA);
+    }
+    for(UINT i = 0; i < 8; i++) {
+        assert(getDBlkCacheEntry(dCache, i * 1024, buf, DBLK_DATA) == 0 && *(LONG*) buf == i * 1024);
+    }
+    destroyDBlkCache(dCache);
+    free(dCache);
+
+    const DBLK_CACHE_POLICY policies[] = { DBLK_CACHE_LRU, DBLK_CACHE_CLOCK, DBLK_CACHE_2Q };
+    double scan[3], conflict[3], skew[3], fsRate[3];
+    LONG fsEvictions[3];
+    printf("%-6s %12s %12s %12s %12s %16s\n", "policy", "hot+scan", "conflict", "skewed", "filesystem", "fs evictions");
+    for(UINT p = 0; p < 3; p++) {
+        scan[p] = runScanTrace(policies[p], DBLK_CACHE_DEFAULT_WAYS);
+        conflict[p] = runConflictTrace(policies[p], DBLK_CACHE_DEFAULT_WAYS);
+        skew[p] = runSkewTrace(policies[p], DBLK_CACHE_DEFAULT_WAYS);
+        fsRate[p] = runFsWorkload(policies[p], &fsEvictions[p]);
+        printf("%-6s %11.2f%% %11.2f%% %11.2f%% %11.2f%% %16ld\n", dBlkCachePolicyName(policies[p]),
+               scan[p], conflict[p], skew[p], fsRate[p], fsEvictions[p]);
+    }
+    double directMapped = runConflictTrace(DBLK_CACHE_LRU, 1);
+    printf("direct mapped conflict hit rate %.2f%%\n", directMapped);
+
+    //associativity absorbs the conflicts, 2Q keeps the hot set through scans
+    assert(conflict[0] > directMapped + 5.0);
+    assert(scan[2] > scan[0] && scan[2] > scan[1]);
+
+    testWriteBackCache();
+    testPinnedCache();
+    testFlusher();
+    testUnlockedWriteBack();
+    LONG sharedReads = testConcurrentCache();
+    printf("disk reads of %u blocks missed on by %u threads together: %ld\n", SHARED_BLKS, N_THREADS, sharedReads);
+    assert(sharedReads == SHARED_BLKS);
+    double wt = runAppendWorkload(false);
+    double wb = runAppendWorkload(true);
+    printf("disk block writes per 100 byte append: write through %.2f, write back %.2f\n", wt, wb);
+    assert(wb < 0.75 * wt);
 
+    LONG shared = runMetaWorkload(false);
+    LONG protected = runMetaWorkload(true);
+    assert(protected * 4 < shared);
     return 0;
 }
@@ -11,14 +11,155 @@
 #include "errno.h"
 #include "pwd.h"
 
+// starts an l2 call, holding the filesystem lock against the flusher and
+// other threads; the block writes of the call are held back in the I/O
+// scheduler until it ends
+// in write-back mode the flusher is started by the first call, after a
+// FUSE daemon has forked, and so is a pending warm-up
+static void beginCall(FileSystem* fs) {
+    pthread_mutex_lock(&fs->lock);
+    if(fs->options.writeBack && !fs->flusherRunning) {
+        startFlusher(fs);
+    }
+    if(fs->warmPending) {
+        startWarmUp(fs);
+    }
+    plugIOSched(&fs->sched);
+}
+
+// ends such a call, writing back what it queued, merged, and running the
+// periodic trim pass when it is due
+static INT endCall(FileSystem* fs, INT ret) {
+    if(unplugIOSched(&fs->sched) != 0) {
+        ret = -1;
+    }
+    if(fs->options.trimInterval > 0 && fs->sched._sch_plugged == 0
+            && diskClockNs() - fs->lastTrimNs >= fs->options.trimInterval * 1000000000L) {
+        trimFreeDBlks(fs);
+    }
+    pthread_mutex_unlock(&fs->lock);
+    return ret;
+}
+
+// a scan over the entries of a directory working on its cached blocks,
+// the block holding the current entry stays pinned; an entry straddling
+// two blocks is put together in a copy
+// the entries of an inline directory are changed in its inode, which the
+// caller writes back
+typedef struct DirScan {
+    FileSystem* fs;
+    INode* dir;
+    //file offset of the current entry
+    LONG offset;
+    //the pinned block, its file block index and whether it was changed
+    LONG fileBlkId;
+    LONG blkId;
+    BYTE* blk;
+    BOOL modified;
+    //copy of a straddling current entry
+    DirEntry split;
+    BOOL isSplit;
+} DirScan;
+
+// releases the pinned block, writing it if an entry in it changed
+static INT endDirScan(DirScan* scan) {
+    INT succ = 0;
+    if(scan->blk != NULL) {
+        succ = putDBlk(scan->fs, scan->blkId, scan->blk, scan->modified);
+    }
+    scan->blk = NULL;
+    scan->fileBlkId = -1;
+    scan->modified = false;
+    return succ;
+}
+
+// moves the scan to the entry at a file offset, NULL past the end of the
+// directory or if its block cannot be read
+static DirEntry* seekDirScan(DirScan* scan, LONG offset) {
+    FileSystem* fs = scan->fs;
+    scan->offset = offset;
+    if(offset + (LONG)sizeof(DirEntry) > scan->dir->_in_filesize) {
+        endDirScan(scan);
+        return NULL;
+    }
+    if(scan->dir->_in_flags & INODE_INLINE) {
+        scan->isSplit = false;
+        return (DirEntry*) (scan->dir->_in_inline + offset);
+    }
+    LONG fileBlkId = offset / fs->blkSize;
+    if(fileBlkId != scan->fileBlkId) {
+        endDirScan(scan);
+        LONG blkId = bmap(fs, scan->dir, fileBlkId);
+        if(blkId < 0 || (scan->blk = getDBlk(fs, blkId, DBLK_META)) == NULL) {
+            return NULL;
+        }
+        scan->blkId = blkId;
+        scan->fileBlkId = fileBlkId;
+    }
+    UINT blkOffset = offset % fs->blkSize;
+    scan->isSplit = blkOffset + sizeof(DirEntry) > fs->blkSize;
+    if(!scan->isSplit) {
+        return (DirEntry*) (scan->blk + blkOffset);
+    }
+    if(readINodeData(fs, scan->dir, (BYTE*) &scan->split, offset, sizeof(DirEntry)) != sizeof(DirEntry)) {
+        endDirScan(scan);
+        return NULL;
+    }
+    return &scan->split;
+}
+
+// starts a scan at the first entry of a directory
+static DirEntry* beginDirScan(DirScan* scan, FileSystem* fs, INode* dir, LONG offset) {
+    scan->fs = fs;
+    scan->dir = dir;
+    scan->blk = NULL;
+    scan->fileBlkId = -1;
+    scan->modified = false;
+    return seekDirScan(scan, offset);
+}
+
+static DirEntry* nextDirScan(DirScan* scan) {
+    return seekDirScan(scan, scan->offset + sizeof(DirEntry));
+}
+
+// the current entry was changed in place
+static INT updateDirScan(DirScan* scan) {
+    if(!scan->isSplit) {
+        scan->modified = true;
+        return 0;
+    }
+    LONG bytesWritten = writeINodeData(scan->fs, scan->dir, (BYTE*) &scan->split, scan->offset, sizeof(DirEntry));
+    return bytesWritten == sizeof(DirEntry) ? 0 : -1;
+}
+
+// file offset of the first free entry of a directory, its size if every
+// entry is taken
+static LONG findFreeDirEntry(FileSystem* fs, INode* dir) {
+    DirScan scan;
+    DirEntry* entry;
+    for(entry = beginDirScan(&scan, fs, dir, 0); entry != NULL; entry = nextDirScan(&scan)) {
+        #ifdef DEBUG_DCACHE
+        printf("the dir name of this entry is %s\n", entry->key);
+        printf("the inode id of this entry is %d\n", entry->INodeID);
+        #endif
+        // empty directory entry found, overwrite it
+        if(entry->INodeID == -1) {
+            break;
+        }
+    }
+    endDirScan(&scan);
+    return scan.offset;
+}
+
 // mounts a filesystem from a device
-INT l2_mount(FileSystem* fs) {
+INT l2_mount(FileSystem* fs, MountOptions* opts) {
     #ifdef DEBUG
     printf("l2_mount called for fs: %p\n", fs);
     #endif
 
-    //disk superblock buffer
-    BYTE dsb[BLK_SIZE];
+    //disk superblock buffer, the disk fields fit the smallest block so
+    //they can be read before the block size is known
+    BYTE dsb[MIN_BLK_SIZE];
 
     //read first block as superblock
     #ifdef DEBUG
@@ -28,14 +169,14 @@ INT l2_mount(FileSystem* fs) {
     if (diskFile == -1)
         fprintf(stderr, "Error: disk open error %s\n", strerror(errno));
         
-    lseek(diskFile, SUPERBLOCK_OFFSET, SEEK_SET);
-    UINT bytesRead = read(diskFile, dsb, BLK_SIZE);
-    if(bytesRead < BLK_SIZE) {
+    ssize_t bytesRead = pread(diskFile, dsb, MIN_BLK_SIZE, SUPERBLOCK_OFFSET);
+    if(bytesRead < MIN_BLK_SIZE) {
         fprintf(stderr, "Error: failed to read superblock from disk!\n");
         return -1;
     }
     close(diskFile);
 
+    memset(&fs->superblock, 0, sizeof(SuperBlock));
     unblockify(dsb, &fs->superblock);
     #ifdef DEBUG
     printf("Unblockified superblock:\n");
@@ -43,32 +184,71 @@ INT l2_mount(FileSystem* fs) {
     #endif
 
     //initialize filesystem parameters
-    fs->nBytes = (BLK_SIZE + fs->superblock.nINodes * INODE_SIZE + fs->superblock.nDBlks * BLK_SIZE);
-    fs->diskINodeBlkOffset = SUPERBLOCK_OFFSET + 1;
-    fs->diskDBlkOffset = fs->diskINodeBlkOffset + fs->superblock.nINodes / INODES_PER_BLK;
+    if(initGeometry(fs, fs->superblock.blkSize, fs->superblock.inodeSize) != 0) {
+        fprintf(stderr, "Error: superblock has an invalid geometry!\n");
+        return -1;
+    }
+    fs->nBytes = (fs->blkSize + (LONG)fs->superblock.nINodes * fs->inodeSize
+            + (LONG)iBitmapBlks(fs->superblock.nINodes, fs->blkSize) * fs->blkSize + fs->superblock.nDBlks * fs->blkSize);
+    if(opts != NULL)
+        fs->options = *opts;
+    else
+        initMountOptions(&fs->options);
+
+    //a stripe layout asked for must be the one the disk was made with
+    if(fs->superblock.stripeWidth > DSK_MAX_MEMBERS
+            || (fs->options.stripeWidth != 0 && fs->options.stripeWidth != fs->superblock.stripeWidth)
+            || (fs->options.stripeUnit != 0 && fs->options.stripeUnit != fs->superblock.stripeUnit)) {
+        fprintf(stderr, "Error: disk is striped over %d images in units of %d blocks, not %d/%d!\n",
+                fs->superblock.stripeWidth, fs->superblock.stripeUnit, fs->options.stripeWidth, fs->options.stripeUnit);
+        return -1;
+    }
+    setLayout(fs, fs->superblock.nINodes);
     
     //initialize the datablk cache
     #ifdef DEBUG 
     printf("Initializing DBlkCache...\n"); 
     #endif
-    initDBlkCache(&fs->dCache);
+    setupDBlkCache(fs);
 
     #ifdef DEBUG
     printf("Opening disk device...\n");
     #endif
     fs->disk = malloc(sizeof(DiskArray));
-    openDisk(fs->disk, fs->nBytes);
+    if(openStripedDisk(fs->disk, fs->nBytes, fs->blkSize, fs->options.diskFlags,
+                       fs->superblock.stripeWidth, fs->superblock.stripeUnit) != 0) {
+        fprintf(stderr, "Error: failed to open the disk images!\n");
+        closeDisk(fs->disk);
+        free(fs->disk);
+        destroyDBlkCache(&fs->dCache);
+        return -1;
+    }
+    if(fs->options.diskModel != DSK_MODEL_NONE) {
+        DiskModel model;
+        initDiskModel(&model, fs->options.diskModel);
+        setDiskModel(fs->disk, &model);
+    }
+    initAsyncDisk(&fs->aio, fs->disk, fs->options.ioEngine, fs->options.ioDepth);
+    initIOSched(&fs->sched, fs->disk, &fs->aio, fs->options.schedDepth);
+    fs->nDiscards = 0;
+    fs->lastTrimNs = diskClockNs();
+    initWriteBack(fs);
+    initWarmUp(fs, fs->options.warmUp);
 
     //load free block cache into superblock
     #ifdef DEBUG
     printf("Loading free dblk cache into superblock...\n");
     #endif
-    readDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache));
+    readDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache), DBLK_META);
+
+    //load the free inode bitmap
+    if(loadINodeBitmap(fs) != 0) {
+        return -1;
+    }
 
     //initialize inode table cache
     initOpenFileTable(&fs->openFileTable);
-    initINodeTable(&fs->inodeTable);
-    initINodeCache(&fs->inodeCache);
+    setupINodeTable(fs);
     
     #ifdef DEBUG
     printf("Filesystem mount complete!\n");
@@ -76,21 +256,50 @@ INT l2_mount(FileSystem* fs) {
     return 0;
 }
 
+INT l2_mountWithOptions(FileSystem* fs, const char* optString) {
+    MountOptions opts;
+    initMountOptions(&opts);
+    if(optString != NULL && parseMountOptions(&opts, optString, NULL, 0) != 0) {
+        return -1;
+    }
+    return l2_mount(fs, &opts);
+}
+
 // unmounts a filesystem by syncing the superblock to disk
 INT l2_unmount(FileSystem* fs) {
     #ifdef DEBUG
     printf("l2_unmount called for fs: %p\n", fs);
     #endif
 
+    //no more write back passes, closefs writes back what is left
+    stopFlusher(fs);
+    stopWarmUp(fs);
+
+    //discard what is left of the freed blocks
+    flushDiscards(fs);
+
     //write free block cache back to disk
-    writeDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache));
+    writeDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache), DBLK_META);
 
     //write superblock to disk
     #ifdef DEBUG
     printf("Writing superblock to disk...\n"); 
     #endif
-    BYTE superblockBuf[BLK_SIZE];
+    BYTE superblockBuf[fs->blkSize];
+    memset(superblockBuf, 0, fs->blkSize);
     blockify(&fs->superblock, superblockBuf);
+    if(fs->options.warmUp && fs->warmPending) {
+        //the warm-up never ran, the caches say nothing yet so the warm set
+        //of the last unmount is kept
+        BYTE* old = getBlkBuf(fs->disk);
+        if(readBlk(fs->disk, SUPERBLOCK_OFFSET, old) == 0) {
+            memcpy(warmSetOf(superblockBuf), warmSetOf(old), superblockBuf + fs->blkSize - (BYTE*) warmSetOf(superblockBuf));
+        }
+        putBlkBuf(fs->disk, old);
+    }
+    else if(fs->options.warmUp) {
+        recordWarmSet(fs, superblockBuf);
+    }
     writeBlk(fs->disk, SUPERBLOCK_OFFSET, superblockBuf);
     fs->superblock.modified = false;
     
@@ -104,13 +313,13 @@ INT l2_unmount(FileSystem* fs) {
 }
 
 // make a new filesystem with a root directory
-INT l2_initfs(LONG nDBlks, UINT nINodes, FileSystem* fs) {
+INT l2_initfs(LONG nDBlks, UINT nINodes, UINT blkSize, UINT inodeSize, MountOptions* opts, FileSystem* fs) {
     #ifdef DEBUG 
-    printf("l2_initfs called for nDBlks: %d, nINodes: %d, fs: %p\n", nDBlks, nINodes, (void*) fs); 
+    printf("l2_initfs called for nDBlks: %d, nINodes: %d, blkSize: %d, inodeSize: %d, fs: %p\n", nDBlks, nINodes, blkSize, inodeSize, (void*) fs); 
     #endif
     
     //call layer 1 makefs
-    INT succ = makefs(nDBlks, nINodes, fs);
+    INT succ = makefs(nDBlks, nINodes, blkSize, inodeSize, opts, fs);
     if(succ != 0) {
         fprintf(stderr, "Error: internal makefs failed with error code: %d\n", succ);
         return 1;
@@ -122,7 +331,7 @@ INT l2_initfs(LONG nDBlks, UINT nINodes, FileSystem* fs) {
     #endif
     INode rootINode;
     
-    INT id = allocINode(fs, &rootINode); 
+    INT id = allocINode(fs, &rootINode, DIRECTORY); 
     if(id == -1) {
         fprintf(stderr, "Error: failed to allocate an inode for the root directory!\n");
         return 2;
@@ -178,7 +387,7 @@ INT l2_initfs(LONG nDBlks, UINT nINodes, FileSystem* fs) {
 }
 
 // getattr
-INT l2_getattr(FileSystem* fs, char *path, struct stat *stbuf) {
+static INT doGetattr(FileSystem* fs, char *path, struct stat *stbuf) {
     LONG INodeID = l2_namei(fs, path);
     if (INodeID < 0)
 	return INodeID;
@@ -193,16 +402,22 @@ INT l2_getattr(FileSystem* fs, char *path, struct stat *stbuf) {
     stbuf->st_uid = inode._in_uid;
     stbuf->st_gid = inode._in_gid;
     stbuf->st_size = inode._in_filesize;
-    stbuf->st_blksize = BLK_SIZE;
-    stbuf->st_blocks = inode._in_filesize / BLK_SIZE;
+    stbuf->st_blksize = fs->blkSize;
+    stbuf->st_blocks = inode._in_filesize / fs->blkSize;
     stbuf->st_atime = inode._in_accesstime;
     stbuf->st_mtime = inode._in_modtime;
     stbuf->st_ctime = inode._in_changetime;
     return 0;
 }
 
+INT l2_getattr(FileSystem* fs, char *path, struct stat *stbuf) {
+    beginCall(fs);
+    INT ret = doGetattr(fs, path, stbuf);
+    return endCall(fs, ret);
+}
+
 // make a new directory
-INT l2_mkdir(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
+static INT doMkdir(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     #ifdef DEBUG
     printf("l2_mkdir called for path: %s\n", path);
     #endif
@@ -267,7 +482,7 @@ INT l2_mkdir(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     }
   
     //weilong: check for max_file_in_dir
-    if (par_inode._in_filesize >= MAX_FILE_NUM_IN_DIR * sizeof(DirEntry)) {
+    if (par_inode._in_filesize >= fs->maxFileNumInDir * sizeof(DirEntry)) {
 	_err_last = _in_tooManyEntriesInDir;
 	THROW(__FILE__, __LINE__, __func__);
 	return -ENOSPC;
@@ -281,7 +496,7 @@ INT l2_mkdir(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     }
  
     // allocate a free inode for the new directory 
-    id = allocINode(fs, &inode); 
+    id = allocINode(fs, &inode, DIRECTORY); 
     #ifdef DEBUG_VERBOSE
     printf("l2_mkdir allocated inode id %d for directory %s\n", id, dir_name);
     #endif
@@ -295,21 +510,8 @@ INT l2_mkdir(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     strcpy(newEntry.key, dir_name);
     newEntry.INodeID = id;
 
-    UINT offset;
-    for(offset = 0; offset < par_inode._in_filesize; offset += sizeof(DirEntry)) {
-        // search parent directory table
-        DirEntry parEntry;
-        readINodeData(fs, &par_inode, (BYTE*) &parEntry, offset, sizeof(DirEntry));
-        #ifdef DEBUG_DCACHE
-        printf("the dir name of this entry is %s\n", parEntry.key);
-        printf("the inode id of this entry is %d\n", parEntry.INodeID);
-        #endif
-        
-        // empty directory entry found, overwrite it
-        if (parEntry.INodeID == -1){
-            break;
-        }
-    }
+    // search parent directory table for an empty entry
+    UINT offset = findFreeDirEntry(fs, &par_inode);
     
     #ifdef DEBUG_VERBOSE
     if(offset < par_inode._in_filesize) {
@@ -325,11 +527,15 @@ INT l2_mkdir(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
         return -1;
     }
 
-    // update parent directory file size, if it changed
+    // update parent directory file size, if it changed, and the entries of
+    // an inline parent
     if(offset + bytesWritten > par_inode._in_filesize) {
         par_inode._in_filesize = offset + bytesWritten;
         writeINode(fs, par_id, &par_inode);
     }
+    else if(par_inode._in_flags & INODE_INLINE) {
+        writeINode(fs, par_id, &par_inode);
+    }
     
     /* allocate two entries in the new directory table (. , id) and (.., par_id) */
     // init directory table for the new directory
@@ -372,8 +578,14 @@ INT l2_mkdir(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     return id;
 }
 
+INT l2_mkdir(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
+    beginCall(fs);
+    INT ret = doMkdir(fs, path, uid, gid);
+    return endCall(fs, ret);
+}
+
 // create a new file specified by an absolute path
-INT l2_mknod(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
+static INT doMknod(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     #ifdef DEBUG
     printf("l2_mknod called for path: %s\n", path);
     #endif
@@ -433,7 +645,7 @@ INT l2_mknod(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     }
     
     //weilong: check for max_file_in_dir
-    if (par_inode._in_filesize >= MAX_FILE_NUM_IN_DIR * sizeof(DirEntry)) {
+    if (par_inode._in_filesize >= fs->maxFileNumInDir * sizeof(DirEntry)) {
         _err_last = _in_tooManyEntriesInDir;
         THROW(__FILE__, __LINE__, __func__);
         return -ENOSPC;
@@ -447,7 +659,7 @@ INT l2_mknod(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     }
 
     // allocate a free inode for the new file 
-    id = allocINode(fs, &inode); 
+    id = allocINode(fs, &inode, REGULAR); 
     #ifdef DEBUG
     printf("l2_mknod allocated inode id %d for file %s\n", id, dir_name);
     #endif
@@ -461,17 +673,8 @@ INT l2_mknod(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     strcpy(newEntry.key, dir_name);
     newEntry.INodeID = id;
 
-    UINT offset;
-    for(offset = 0; offset < par_inode._in_filesize; offset += sizeof(DirEntry)) {
-        // search parent directory table
-        DirEntry parEntry;
-        readINodeData(fs, &par_inode, (BYTE*) &parEntry, offset, sizeof(DirEntry));
-        
-        // empty directory entry found, overwrite it
-        if (parEntry.INodeID == -1){
-            break;
-        }
-    }
+    // search parent directory table for an empty entry
+    UINT offset = findFreeDirEntry(fs, &par_inode);
     
     #ifdef DEBUG_VERBOSE
     if(offset < par_inode._in_filesize) {
@@ -487,11 +690,15 @@ INT l2_mknod(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
         return -1;
     }
 
-    // update parent directory file size, if it changed
+    // update parent directory file size, if it changed, and the entries of
+    // an inline parent
     if(offset + bytesWritten > par_inode._in_filesize) {
         par_inode._in_filesize = offset + bytesWritten;
         writeINode(fs, par_id, &par_inode);
     }
+    else if(par_inode._in_flags & INODE_INLINE) {
+        writeINode(fs, par_id, &par_inode);
+    }
 
     inode._in_uid = uid;
     inode._in_gid = gid;
@@ -513,7 +720,13 @@ INT l2_mknod(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
     return id;
 }
 
-INT l2_readdir(FileSystem* fs, char* path, LONG offset, DirEntry* curEntry) {
+INT l2_mknod(FileSystem* fs, char* path, uid_t uid, gid_t gid) {
+    beginCall(fs);
+    INT ret = doMknod(fs, path, uid, gid);
+    return endCall(fs, ret);
+}
+
+static INT doReaddir(FileSystem* fs, char* path, LONG offset, DirEntry* curEntry) {
     INT id; // the inode of the dir
     UINT numDirEntry = 0;
 
@@ -553,8 +766,14 @@ INT l2_readdir(FileSystem* fs, char* path, LONG offset, DirEntry* curEntry) {
     return 0; 
 }
 
+INT l2_readdir(FileSystem* fs, char* path, LONG offset, DirEntry* curEntry) {
+    beginCall(fs);
+    INT ret = doReaddir(fs, path, offset, curEntry);
+    return endCall(fs, ret);
+}
+
 // remove a file/remove dir
-INT l2_unlink(FileSystem* fs, char* path) {
+static INT doUnlink(FileSystem* fs, char* path) {
 
     // 1. get the inode of the parent directory using l2_namei
     // 2. clears the corresponding entry in the parent directory table, write
@@ -632,7 +851,6 @@ INT l2_unlink(FileSystem* fs, char* path) {
     inode._in_linkcount--;
     writeINode(fs, id, &inode);
         
-    UINT offset = 0;
     // free file inode when its link count is 0, which also frees the
     // associated data blocks.
     //weilong: remove dir
@@ -642,30 +860,33 @@ INT l2_unlink(FileSystem* fs, char* path) {
         printf("l2_unlink detected directory, using recursive \"rm -r\"\n");
         #endif
         //skip . and ..
-        for(offset = 2*sizeof(DirEntry); offset < inode._in_filesize; offset += sizeof(DirEntry)) {
-            DirEntry entry;
-            readINodeData(fs, &inode, (BYTE*) &entry, offset, sizeof(DirEntry));
-            if (entry.INodeID != -1) {
+        DirScan scan;
+        DirEntry* entry;
+        for(entry = beginDirScan(&scan, fs, &inode, 2*sizeof(DirEntry)); entry != NULL; entry = nextDirScan(&scan)) {
+            if (entry->INodeID != -1) {
                 //call unlink
-                char *recur_path = (char *)malloc(strlen(path) + 1 + strlen(entry.key));
+                char *recur_path = (char *)malloc(strlen(path) + 1 + strlen(entry->key));
                 strcat(recur_path, path);
                 strcat(recur_path, "/");
-                strcat(recur_path, entry.key);
+                strcat(recur_path, entry->key);
                 #ifdef DEBUG_VERBOSE
-                printf("l2_unlink continuing recursive \"rm -r %s\"\n", entry.key);
+                printf("l2_unlink continuing recursive \"rm -r %s\"\n", entry->key);
                 #endif
                 if (l2_unlink(fs, recur_path) != 0) {
+                    endDirScan(&scan);
                     _err_last = _fs_recursiveUnlinkFail;
                     THROW(__FILE__, __LINE__, __func__);
                     return -1;
                 }
             }
         }
+        endDirScan(&scan);
     }
     //note: the recursion occurs before the freeing step so as to not strand the children files
     
     //free the inode if and only if linkcount reaches 0 AND inode is not open
-    if(!hasINodeEntry(&fs->inodeTable, id)) {
+    INodeEntry* iEntry = getINodeEntry(&fs->inodeTable, id);
+    if(iEntry == NULL || iEntry->_in_ref == 0) {
         #ifdef DEBUG
         printf("l2_unlink freeing the inode %d associated with unlinked file: %s\n", id, path);
         #endif
@@ -678,37 +899,45 @@ INT l2_unlink(FileSystem* fs, char* path) {
     }
 
     //remove the inode from the parent directory
-    for(offset = 0; offset < par_inode._in_filesize; offset += sizeof(DirEntry)) {
-        // search parent directory table
-        DirEntry entry;
-        readINodeData(fs, &par_inode, (BYTE*) &entry, offset, sizeof(DirEntry));
-        
+    DirScan parScan;
+    DirEntry* parEntry;
+    for(parEntry = beginDirScan(&parScan, fs, &par_inode, 0); parEntry != NULL; parEntry = nextDirScan(&parScan)) {
         // directory entry found, mark it as removed
-        if (strcmp(entry.key, node_name) == 0){
+        if (strcmp(parEntry->key, node_name) == 0){
             #ifdef DEBUG_VERBOSE
-            printf("l2_unlink removing file from parent directory at offset: %d\n", offset);
+            printf("l2_unlink removing file from parent directory at offset: %ld\n", parScan.offset);
             #endif
             //strcpy(DEntry->key, "");
-            entry.INodeID = -1;
+            parEntry->INodeID = -1;
             
             // update the parent directory table
-            writeINodeData(fs, &par_inode, (BYTE*) &entry, offset, sizeof(DirEntry));
+            updateDirScan(&parScan);
         }
     }
+    endDirScan(&parScan);
+    if(par_inode._in_flags & INODE_INLINE) {
+        writeINode(fs, par_id, &par_inode);
+    }
     
-    // remove the entry from the inode cache
-    INodeEntry* iEntry = removeINodeCacheEntry(&fs->inodeCache, id);
-    if(iEntry != NULL) {
+    // remove the entry from the inode table unless the file is still open
+    iEntry = getINodeEntry(&fs->inodeTable, id);
+    if(iEntry != NULL && iEntry->_in_ref == 0) {
+        removeINodeEntry(&fs->inodeTable, id);
         #ifdef DEBUG
-        printf("l2_unlink removed entry id %d from inode cache\n", id);
+        printf("l2_unlink removed entry id %d from inode table\n", id);
         #endif
-        free(iEntry);
     }
 
     return 0;
 }
 
-INT l2_rename(FileSystem* fs, char* path, char* new_path) {
+INT l2_unlink(FileSystem* fs, char* path) {
+    beginCall(fs);
+    INT ret = doUnlink(fs, path);
+    return endCall(fs, ret);
+}
+
+static INT doRename(FileSystem* fs, char* path, char* new_path) {
     #ifdef DEBUG
     printf("l2_rename called from \"%s\" to \"%s\"\n", path, new_path);
     #endif
@@ -757,24 +986,26 @@ INT l2_rename(FileSystem* fs, char* path, char* new_path) {
     
     
     INT node_id;
-    for(UINT i = 0; i < par_inode._in_filesize; i += sizeof(DirEntry)) {
-        // search parent directory table
-        DirEntry entry;
-        readINodeData(fs, &par_inode, (BYTE*) &entry, i, sizeof(DirEntry));
-
+    DirScan scan;
+    DirEntry* entry;
+    for(entry = beginDirScan(&scan, fs, &par_inode, 0); entry != NULL; entry = nextDirScan(&scan)) {
         // directory entry found, mark it as removed
-        if (strcmp(entry.key, node_name) == 0){
+        if (strcmp(entry->key, node_name) == 0){
             #ifdef DEBUG_VERBOSE
-            printf("l2_rename removing file from parent directory at offset: %d\n", i);
+            printf("l2_rename removing file from parent directory at offset: %ld\n", scan.offset);
             #endif
-            node_id = entry.INodeID;
-            strcpy(entry.key, "");
-            entry.INodeID = -1;
+            node_id = entry->INodeID;
+            strcpy(entry->key, "");
+            entry->INodeID = -1;
 
             // update the parent directory table
-            writeINodeData(fs, &par_inode, (BYTE*) &entry, i, sizeof(DirEntry));
+            updateDirScan(&scan);
         }
     }
+    endDirScan(&scan);
+    if(par_inode._in_flags & INODE_INLINE) {
+        writeINode(fs, par_id, &par_inode);
+    }
 
     // find the new parent path
     new_ptr = strrchr(new_path, ch);
@@ -809,17 +1040,8 @@ INT l2_rename(FileSystem* fs, char* path, char* new_path) {
     printf("l2_rename node name = %s, node_id = %d\n", newEntry.key, newEntry.INodeID);
     #endif
 
-    UINT j;
-    for(j = 0; j < new_par_inode._in_filesize; j += sizeof(DirEntry)) {
-        // search parent directory table
-        DirEntry parEntry;
-        readINodeData(fs, &new_par_inode, (BYTE*) &parEntry, j, sizeof(DirEntry));
-        
-        // empty directory entry found, overwrite it
-        if (parEntry.INodeID == -1){
-            break;
-        }
-    }
+    // search parent directory table for an empty entry
+    UINT j = findFreeDirEntry(fs, &new_par_inode);
     
     LONG bytesWritten = writeINodeData(fs, &new_par_inode, (BYTE*) &newEntry, j, sizeof(DirEntry));
     
@@ -841,10 +1063,16 @@ INT l2_rename(FileSystem* fs, char* path, char* new_path) {
     return 0;
 }
 
+INT l2_rename(FileSystem* fs, char* path, char* new_path) {
+    beginCall(fs);
+    INT ret = doRename(fs, path, new_path);
+    return endCall(fs, ret);
+}
+
 //1. resolve path and read inode
 //2. check uid/gid
 //3. set uid/gid and write inode
-INT l2_chown(FileSystem *fs, char *path, uid_t uid, gid_t gid)
+static INT doChown(FileSystem *fs, char *path, uid_t uid, gid_t gid)
 {
     //1. resolve path
     INT INodeID = l2_namei(fs, path);
@@ -866,10 +1094,16 @@ INT l2_chown(FileSystem *fs, char *path, uid_t uid, gid_t gid)
     return 0;
 }
 
+INT l2_chown(FileSystem *fs, char *path, uid_t uid, gid_t gid) {
+    beginCall(fs);
+    INT ret = doChown(fs, path, uid, gid);
+    return endCall(fs, ret);
+}
+
 //1. resolve path and read inode
 //2. check uid/gid
 //3. set mode and write inode
-INT l2_chmod(FileSystem* fs, char* path, UINT mode)
+static INT doChmod(FileSystem* fs, char* path, UINT mode)
 {
     //1. resolve path
     INT INodeID = l2_namei(fs, path);
@@ -891,8 +1125,14 @@ INT l2_chmod(FileSystem* fs, char* path, UINT mode)
     return 0;
 }
 
+INT l2_chmod(FileSystem* fs, char* path, UINT mode) {
+    beginCall(fs);
+    INT ret = doChmod(fs, path, mode);
+    return endCall(fs, ret);
+}
+
 // truncate a file
-INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
+static INT doTruncate(FileSystem* fs, char* path, INT new_length) {
     // namei to find the inode
     // compare the filesize with new-length
     // if new_length > filesize, extend the file, balloc
@@ -914,7 +1154,19 @@ INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
         return -1;
     }
 
-    if (new_length > curINode._in_filesize) {
+    if (curINode._in_flags & INODE_INLINE) {
+        // an inline file only changes its size, growing past the inode moves
+        // it to data blocks and the bytes it grows by read as zeroes
+        if (new_length > fs->inlineSize) {
+            if (spillINodeData(fs, &curINode) == -1) {
+                return -1;
+            }
+        }
+        else if (new_length > curINode._in_filesize) {
+            memset(curINode._in_inline + curINode._in_filesize, 0, new_length - curINode._in_filesize);
+        }
+    }
+    else if (new_length > curINode._in_filesize) {
         /*
 #ifdef TRUNCATE_DEBUG
         printf("in l2_truncate, start extend the file to size %d\n", new_length);
@@ -923,20 +1175,20 @@ INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
         // len of bytes to be extended
         INT len = new_length - curINode._in_filesize;
         // next file blk to be allocated
-        UINT fileBlkId = (curINode._in_filesize - 1 + BLK_SIZE) / BLK_SIZE;
+        UINT fileBlkId = (curINode._in_filesize - 1 + fs->blkSize) / fs->blkSize;
 
         // special case, extend the filelength without allocating a new blk
-        if ((new_length - 1 + BLK_SIZE) / BLK_SIZE == (curINode._in_filesize -1 + BLK_SIZE) / BLK_SIZE) {
+        if ((new_length - 1 + fs->blkSize) / fs->blkSize == (curINode._in_filesize -1 + fs->blkSize) / fs->blkSize) {
         //    curINode._in_filesize = new_length;
             len = 0;
         }
         else {
-            len -= fileBlkId * BLK_SIZE - curINode._in_filesize;
+            len -= fileBlkId * fs->blkSize - curINode._in_filesize;
         //    fileBlkId ++;
         }
 
         INT dataBlkId;
-        while (len > 0 && fileBlkId < MAX_FILE_BLKS)  {
+        while (len > 0 && fileBlkId < fs->maxFileBlks)  {
             dataBlkId = balloc(fs, &curINode, fileBlkId);
 #ifdef TRUNCATE_DEBUG
             printf("fileblk %d is extended! \n", fileBlkId);
@@ -946,12 +1198,12 @@ INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
                 return -1;
             }
 
-            if(len <= BLK_SIZE) {
+            if(len <= fs->blkSize) {
                 len = 0;
             }
             else {
 
-                len -= BLK_SIZE;
+                len -= fs->blkSize;
                 fileBlkId ++;
             }
         }
@@ -969,16 +1221,16 @@ INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
         // len of bytes to be truncated
         LONG len = curINode._in_filesize - new_length;
         // next file blk to be truncated
-        LONG fileBlkId = (curINode._in_filesize -1 + BLK_SIZE) / BLK_SIZE - 1;
+        LONG fileBlkId = (curINode._in_filesize -1 + fs->blkSize) / fs->blkSize - 1;
         #ifdef DEBUG_VERBOSE
         printf("l2_truncate found first fileblk to be truncated: %d\n", fileBlkId);
         #endif
-        if ((new_length - 1 + BLK_SIZE) / BLK_SIZE == (curINode._in_filesize -1 + BLK_SIZE) / BLK_SIZE) {
+        if ((new_length - 1 + fs->blkSize) / fs->blkSize == (curINode._in_filesize -1 + fs->blkSize) / fs->blkSize) {
         //    curINode._in_filesize = new_length;
             len = 0;
         }
         else {
-            len -= curINode._in_filesize - fileBlkId * BLK_SIZE;
+            len -= curINode._in_filesize - fileBlkId * fs->blkSize;
             bfree(fs, &curINode, fileBlkId);
             #ifdef DEBUG_VERBOSE
             printf("l2_truncate truncated fileblk: %d\n", fileBlkId);
@@ -988,7 +1240,7 @@ INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
         
         while (len > 0 && fileBlkId >= 0)  {
 
-            if(len <BLK_SIZE) {
+            if(len <fs->blkSize) {
                 len = 0;
             }
             else {
@@ -996,7 +1248,7 @@ INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
                 #ifdef DEBUG_VERBOSE
                 printf("l2_truncate truncated fileblk: %d\n", fileBlkId);
                 #endif
-                len -= BLK_SIZE;
+                len -= fs->blkSize;
                 fileBlkId --;
             }
         }
@@ -1011,7 +1263,13 @@ INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
     return 0;
 }
 
-INT l2_open(FileSystem* fs, char* path, enum FILE_OP fileOp) {
+INT l2_truncate(FileSystem* fs, char* path, INT new_length) {
+    beginCall(fs);
+    INT ret = doTruncate(fs, path, new_length);
+    return endCall(fs, ret);
+}
+
+static INT doOpen(FileSystem* fs, char* path, enum FILE_OP fileOp) {
     #ifdef DEBUG
     printf("Opening file \"%s\" for operation: %d\n", path, fileOp);
     #endif
@@ -1031,7 +1289,7 @@ INT l2_open(FileSystem* fs, char* path, enum FILE_OP fileOp) {
         //update open file opcount
         UINT opcount = addOpenFileOperation(fileEntry, fileOp);
         //update inode refcount
-        fileEntry->inodeEntry->_in_ref++;
+        refINodeEntry(&fs->inodeTable, fileEntry->inodeEntry);
         #ifdef DEBUG
         printf("Updated open file table with new opcount %d and inode refcount %d\n", opcount, fileEntry->inodeEntry->_in_ref);
         #endif
@@ -1040,43 +1298,31 @@ INT l2_open(FileSystem* fs, char* path, enum FILE_OP fileOp) {
         return 0;
     }
 
-    //update or insert inode entry into table
+    //find inode entry in table
     INodeEntry* inodeEntry = getINodeEntry(&fs->inodeTable, inodeId);
     if(inodeEntry != NULL) {
         #ifdef DEBUG_VERBOSE
         printf("INode found in inode table, updating existing entry...\n");
         #endif
     }
+    //otherwise, load inode from disk and put in table
     else {
-        //look in inode cache to see if inode was previously cached
-        inodeEntry = removeINodeCacheEntry(&fs->inodeCache, inodeId);
-        if(inodeEntry != NULL) {
-            #ifdef DEBUG_VERBOSE
-            printf("INode found in inode cache, moving to inode table...\n");
-            #endif
-            
-            //add to table
-            putINodeEntry(&fs->inodeTable, inodeEntry);
-        }
-        //otherwise, load inode from disk and put in table
-        else {
-            #ifdef DEBUG_VERBOSE
-            printf("INode not found in inode cache, creating new entry in inode table...\n");
-            #endif
-            
-            //read from disk, bypassing cache
-            INode inode;
-            INT readSucc = readINodeNoCache(fs, inodeId, &inode);
-            assert(readSucc == 0);
-            
-            //add to table
-            inodeEntry = putINode(&fs->inodeTable, inodeId, &inode);
-            assert(inodeEntry != NULL);
-        }
+        #ifdef DEBUG_VERBOSE
+        printf("INode not found in inode table, creating new entry...\n");
+        #endif
+        
+        //read from disk, bypassing cache
+        INode inode;
+        INT readSucc = readINodeNoCache(fs, inodeId, &inode);
+        assert(readSucc == 0);
+        
+        //add to table
+        inodeEntry = putINode(&fs->inodeTable, inodeId, &inode);
+        assert(inodeEntry != NULL);
     }
     
-    //update the refcount for the now open inode
-    inodeEntry->_in_ref++;
+    //update the refcount for the now open inode, taking it off the LRU list
+    refINodeEntry(&fs->inodeTable, inodeEntry);
 
     //initialize new open file entry and link to inode entry
     #ifdef DEBUG_VERBOSE
@@ -1095,7 +1341,13 @@ INT l2_open(FileSystem* fs, char* path, enum FILE_OP fileOp) {
     return 0;
 }
 
-INT l2_close(FileSystem* fs, char* path, enum FILE_OP fileOp) {
+INT l2_open(FileSystem* fs, char* path, enum FILE_OP fileOp) {
+    beginCall(fs);
+    INT ret = doOpen(fs, path, fileOp);
+    return endCall(fs, ret);
+}
+
+static INT doClose(FileSystem* fs, char* path, enum FILE_OP fileOp) {
     #ifdef DEBUG
     printf("Closing file \"%s\" with operation: %d\n", path, fileOp);
     #endif
@@ -1116,7 +1368,11 @@ INT l2_close(FileSystem* fs, char* path, enum FILE_OP fileOp) {
     assert(iEntry->_in_ref > 0);
     
     //update open file table opcount and inode table refcount
-    iEntry->_in_ref--;
+    //note: at refcount 0 the entry joins the LRU list and may be evicted
+    //later, so only its id is used past this point
+    UINT id = iEntry->_in_id;
+    BOOL unlinked = iEntry->_in_node._in_linkcount == 0;
+    unrefINodeEntry(&fs->inodeTable, iEntry);
     UINT opcount = removeOpenFileOperation(fileEntry, fileOp);
     #ifdef DEBUG
     printf("Updated open file table with new opcount %d and inode refcount %d\n", opcount, iEntry->_in_ref);
@@ -1132,32 +1388,29 @@ INT l2_close(FileSystem* fs, char* path, enum FILE_OP fileOp) {
         assert(succ);
         
         //if linkcount was already 0, unlink the file and remove inode entry
-        if(iEntry->_in_node._in_linkcount == 0) {
+        //otherwise the entry stays in the table on the LRU list
+        if(unlinked) {
             #ifdef DEBUG_VERBOSE
-            printf("Refcount and linkcount on inode %d reached 0, freeing inode...\n", iEntry->_in_id);
+            printf("Refcount and linkcount on inode %d reached 0, freeing inode...\n", id);
             #endif
-            freeINode(fs, iEntry->_in_id);
-            removeINodeEntry(&fs->inodeTable, iEntry->_in_id);
-            free(iEntry);
-        }
-        //otherwise, move inode entry from table to cache
-        else {                
-            #ifdef DEBUG_VERBOSE
-            printf("Refcount on inode %d reached 0, moving from inode table to cache...\n", iEntry->_in_id);
-            #endif
-            removeINodeEntry(&fs->inodeTable, iEntry->_in_id);
-            cacheINodeEntry(&fs->inodeCache, iEntry);
+            freeINode(fs, id);
+            removeINodeEntry(&fs->inodeTable, id);
         }
     }
     return 0;
 }
 
+INT l2_close(FileSystem* fs, char* path, enum FILE_OP fileOp) {
+    beginCall(fs);
+    INT ret = doClose(fs, path, fileOp);
+    return endCall(fs, ret);
+}
+
 // read file from offset for numBytes
 // 1/2/3. look in open file table for entry
-// 4. modify modtime
+// 4. update the access time as the atime mount option says
 // 5. call readINodeData on current INode, offset to the buf for numBytes
-// 6. write back inode
-INT l2_read(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes) {
+static INT doRead(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes) {
   //look in open file table for entry
   OpenFileEntry* fileEntry = getOpenFileEntry(&fs->openFileTable, path);
   if(fileEntry == NULL || (fileEntry->fileOp[OP_READ] == 0 && fileEntry->fileOp[OP_READWRITE] == 0)) {
@@ -1166,15 +1419,13 @@ INT l2_read(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes) {
   }
 
   //retrieve inode from inode table
-  UINT curINodeID = fileEntry->inodeEntry->_in_id;
   INode* curINode = &fileEntry->inodeEntry->_in_node;
 
-  //4. curINode._in_modtime
-  curINode->_in_accesstime = time(NULL);
-  //5. readINodeData
+  //4. atime, in core only
+  touchATime(fs, fileEntry->inodeEntry);
+  //5. readINodeData, after prefetching for a sequential stream
+  readAhead(fs, curINode, &fileEntry->readAhead, offset, numBytes);
   LONG returnSize = readINodeData(fs, curINode, buf, offset, numBytes);
-  //6. write back INode
-  writeINode(fs, curINodeID, curINode);
 
   #ifdef DEBUG
   printf("l2_read successfully read %d bytes\n", returnSize);
@@ -1182,13 +1433,19 @@ INT l2_read(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes) {
   return returnSize; 
 }
 
+INT l2_read(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes) {
+    beginCall(fs);
+    INT ret = doRead(fs, path, offset, buf, numBytes);
+    return endCall(fs, ret);
+}
+
 //write file from offset for numBytes
 //1. resolve path
 //2. get INodeTable Entry
 //3. load inode
 //4. call writeINodeData
 //5. modify inode if necessary
-INT l2_write(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes) {
+static INT doWrite(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes) {
   //look in open file table for entry
   OpenFileEntry* fileEntry = getOpenFileEntry(&fs->openFileTable, path);
   if(fileEntry == NULL || (fileEntry->fileOp[OP_WRITE] == 0 && fileEntry->fileOp[OP_READWRITE] == 0)) {
@@ -1231,6 +1488,12 @@ INT l2_write(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes)
   return bytesWritten;
 }
 
+INT l2_write(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes) {
+    beginCall(fs);
+    INT ret = doWrite(fs, path, offset, buf, numBytes);
+    return endCall(fs, ret);
+}
+
 //update mod/access time of a file
 //1. resolve path
 //1. check permission (*)
@@ -1238,7 +1501,7 @@ INT l2_write(FileSystem* fs, char* path, LONG offset, BYTE* buf, LONG numBytes)
 //3. sync inode (*)
 //4. load inode
 //5. write inode
-INT l2_utimens(FileSystem *fs, char *path, struct timespec tv[2]) 
+static INT doUtimens(FileSystem *fs, char *path, struct timespec tv[2]) 
 {
   INT curINodeID = l2_namei(fs, path);
   if (curINodeID < 0) {
@@ -1254,6 +1517,12 @@ INT l2_utimens(FileSystem *fs, char *path, struct timespec tv[2])
   return 0;
 }
 
+INT l2_utimens(FileSystem *fs, char *path, struct timespec tv[2]) {
+    beginCall(fs);
+    INT ret = doUtimens(fs, path, tv);
+    return endCall(fs, ret);
+}
+
 //resolve a path to its corresponding inode id
 //1. parse the path
 //2. traverse along the tokens from the root, assuming root is 0
@@ -1261,7 +1530,7 @@ INT l2_utimens(FileSystem *fs, char *path, struct timespec tv[2])
 // 2.1 check type
 // 2.2 read in the data
 // 3. scan through to find next tok's id
-INT l2_namei(FileSystem *fs, char *path)
+static INT doNamei(FileSystem *fs, char *path)
 {
   #ifdef DEBUG_VERBOSE
   printf("l2_namei resolving path: %s\n", path);
@@ -1283,11 +1552,9 @@ INT l2_namei(FileSystem *fs, char *path)
   UINT curID = fs->superblock.rootINodeID; //root
   // memory for INode
   INode curINode;
-  // pointer to dir entry
-  UINT curDirEntry = 0;
-  // memory for current directory
-  // DirEntry curDir[MAX_FILE_NUM_IN_DIR];
-  BYTE *curDir;
+  // scan over the entries of the current directory, on its cached blocks
+  DirScan scan;
+  DirEntry *DEntry;
   
   // flag for scan result
   BOOL entryFound = false;
@@ -1303,26 +1570,18 @@ INT l2_namei(FileSystem *fs, char *path)
       THROW(__FILE__, __LINE__, __func__);
       return -ENOTDIR;
     }
-    // alloc space for curDir
-    curDir = (BYTE *)malloc(curINode._in_filesize);
-    //2.2 read in the directory
-    memset(curDir, 0, curINode._in_filesize);
-    readINodeData(fs, &curINode, curDir, 0, curINode._in_filesize);
-    
-    //3 scan through the dir
+    //2.2 and 3 scan through the dir
     entryFound = false;
-    // Given the assumption that all blocks are initialized to be 0
-    //  while (strcmp((curDir[curDirEntry]).key, "") != 0) 
-    for (curDirEntry = 0; curDirEntry < (curINode._in_filesize / sizeof(DirEntry)) && !entryFound; curDirEntry ++) {
-      DirEntry *DEntry = (DirEntry *) (curDir + curDirEntry*sizeof(DirEntry));
+    for (DEntry = beginDirScan(&scan, fs, &curINode, 0); DEntry != NULL; DEntry = nextDirScan(&scan)) {
       if (strcmp(tok, DEntry->key) == 0 && DEntry->INodeID != -1) {
         entryFound = true;
         curID = DEntry->INodeID; // move pointer to the next inode of dir or file
         //printf("find the inode for %s, its inode id = %d\n", tok, curID);
+        break;
       }
     }
-    //release curDir
-    free(curDir);
+    //release the pinned block
+    endDirScan(&scan);
     //exception: dir does not contain target tok
     if (!entryFound) {
       _err_last = _fs_NonExistFile;
@@ -1339,3 +1598,24 @@ INT l2_namei(FileSystem *fs, char *path)
   return curID;
 }
 
+INT l2_namei(FileSystem *fs, char *path) {
+    beginCall(fs);
+    INT ret = doNamei(fs, path);
+    return endCall(fs, ret);
+}
+
+LONG l2_fstrim(FileSystem* fs) {
+    beginCall(fs);
+    LONG nTrimmed = trimFreeDBlks(fs);
+    endCall(fs, 0);
+    return nTrimmed;
+}
+
+INT l2_sync(FileSystem* fs) {
+    beginCall(fs);
+    INT ret = syncINodes(fs, true);
+    if(syncDBlks(fs) != 0) {
+        ret = -1;
+    }
+    return endCall(fs, ret);
+}
@@ -10,13 +10,19 @@
 #include "sys/types.h"
 
 // mounts a filesystem from a device
-INT l2_mount(FileSystem* fs);
+// options may be NULL for the defaults
+INT l2_mount(FileSystem* fs, MountOptions* opts);
+
+// mounts a filesystem with the defaults changed by a comma separated
+// option string, see parseMountOptions; fails on an unknown option
+INT l2_mountWithOptions(FileSystem* fs, const char* optString);
 
 // unmounts a filesystem into a device
 INT l2_unmount(FileSystem* fs);
 
 // makes a new filesystem with a root directory
-INT l2_initfs(LONG nDBlks, UINT nINodes, FileSystem* fs);
+// block and inode sizes may be 0 for the defaults, options may be NULL
+INT l2_initfs(LONG nDBlks, UINT nINodes, UINT blkSize, UINT inodeSize, MountOptions* opts, FileSystem* fs);
 
 // getattr
 INT l2_getattr(FileSystem* fs, char *path, struct stat *stbuf);
@@ -60,3 +66,10 @@ INT l2_utimens(FileSystem* fs, char* path, struct timespec tv[2]);
 
 //resolve path to inode id
 INT l2_namei(FileSystem *, char *);
+
+// discards the free data blocks of the filesystem, like fstrim
+// returns the # of blocks discarded, -1 if the disk cannot discard
+LONG l2_fstrim(FileSystem* fs);
+
+// writes every dirty data block back, like sync
+INT l2_sync(FileSystem* fs);
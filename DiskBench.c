@@ -0,0 +1,194 @@
+/**
+ * Benchmarks the disk backends with a metadata heavy workload
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Directories.h"
+
+#define BENCH_DIRS 16
+#define BENCH_FILE_BLKS 2
+
+typedef struct BenchResult {
+    double create;
+    double lookup;
+    double io;
+    double unlink;
+    //disk requests per l2 call of each phase
+    double createIO;
+    double lookupIO;
+    double ioIO;
+    double unlinkIO;
+} BenchResult;
+
+// current time in ms, the simulated time of the device when it is modeled
+static double now(FileSystem* fs) {
+    if(fs->options.diskModel != DSK_MODEL_NONE)
+        return getDiskSimTime(fs->disk) / 1000000.0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// # of disk requests so far
+static LONG diskOps(FileSystem* fs) {
+    DiskStats stats;
+    getDiskStats(fs->disk, &stats);
+    return stats._st_reads + stats._st_writes;
+}
+
+// runs the workload on a freshly made and remounted filesystem
+static INT runBench(LONG nDBlks, UINT nINodes, UINT blkSize, UINT nFiles, MountOptions* opts, BenchResult* res) {
+    FileSystem fs;
+    char path[64];
+    LONG fileSize = BENCH_FILE_BLKS * blkSize;
+    BYTE buf[fileSize];
+    double start;
+    LONG ops;
+
+    if(l2_initfs(nDBlks, nINodes, blkSize, 0, opts, &fs) != 0 || l2_unmount(&fs) != 0) {
+        fprintf(stderr, "Error: failed to make filesystem\n");
+        return -1;
+    }
+    if(l2_mount(&fs, opts) != 0) {
+        fprintf(stderr, "Error: failed to mount filesystem\n");
+        return -1;
+    }
+
+    //create directories and files, each file gets a small body
+    ops = diskOps(&fs);
+    start = now(&fs);
+    for(UINT d = 0; d < BENCH_DIRS; d++) {
+        sprintf(path, "/%d", d);
+        l2_mkdir(&fs, path, 0, 0);
+    }
+    for(UINT i = 0; i < nFiles; i++) {
+        sprintf(path, "/%d/%d", i % BENCH_DIRS, i);
+        if(l2_mknod(&fs, path, 0, 0) == -1) {
+            fprintf(stderr, "Error: failed to create %s\n", path);
+            return -1;
+        }
+    }
+    res->create = now(&fs) - start;
+    res->createIO = (diskOps(&fs) - ops) / (double)(BENCH_DIRS + nFiles);
+
+    //path lookups walk the directory blocks and inodes
+    ops = diskOps(&fs);
+    start = now(&fs);
+    for(UINT r = 0; r < 4; r++) {
+        for(UINT i = 0; i < nFiles; i++) {
+            sprintf(path, "/%d/%d", i % BENCH_DIRS, i);
+            if(l2_namei(&fs, path) == -1) {
+                fprintf(stderr, "Error: failed to look up %s\n", path);
+                return -1;
+            }
+        }
+    }
+    res->lookup = now(&fs) - start;
+    res->lookupIO = (diskOps(&fs) - ops) / (4.0 * nFiles);
+
+    //small writes and reads, dominated by inode updates
+    memset(buf, 0xab, fileSize);
+    ops = diskOps(&fs);
+    start = now(&fs);
+    for(UINT i = 0; i < nFiles; i++) {
+        sprintf(path, "/%d/%d", i % BENCH_DIRS, i);
+        l2_open(&fs, path, OP_READWRITE);
+        l2_write(&fs, path, 0, buf, fileSize);
+        l2_read(&fs, path, 0, buf, fileSize);
+        l2_close(&fs, path, OP_READWRITE);
+    }
+    res->io = now(&fs) - start;
+    res->ioIO = (diskOps(&fs) - ops) / (4.0 * nFiles);
+
+    ops = diskOps(&fs);
+    start = now(&fs);
+    for(UINT i = 0; i < nFiles; i++) {
+        sprintf(path, "/%d/%d", i % BENCH_DIRS, i);
+        l2_unlink(&fs, path);
+    }
+    res->unlink = now(&fs) - start;
+    res->unlinkIO = (diskOps(&fs) - ops) / (double)nFiles;
+
+    return l2_unmount(&fs);
+}
+
+static void printResult(const char* name, BenchResult* res) {
+    printf("%-7s create %9.2f ms  lookup %9.2f ms  io %9.2f ms  unlink %9.2f ms  total %9.2f ms\n",
+           name, res->create, res->lookup, res->io, res->unlink,
+           res->create + res->lookup + res->io + res->unlink);
+}
+
+static void printIO(const char* name, BenchResult* res) {
+    printf("%-7s create %9.2f     lookup %9.2f     io %9.2f     unlink %9.2f     disk requests per call\n",
+           name, res->createIO, res->lookupIO, res->ioIO, res->unlinkIO);
+}
+
+int main(int args, char* argv[])
+{
+    if (args < 3) {
+        printf("Usage: DiskBench FS_NUM_DATA_BLOCKS FS_NUM_INODES [FS_BLOCK_SIZE]\n");
+        exit(1);
+    }
+
+    LONG nDBlks = atol(argv[1]);
+    UINT nINodes = atoi(argv[2]);
+    UINT blkSize = args > 3 ? atoi(argv[3]) : DEFAULT_BLK_SIZE;
+    if(nINodes < BENCH_DIRS + 2) {
+        printf("Not enough inodes for the benchmark!\n");
+        exit(1);
+    }
+    UINT nFiles = nINodes - BENCH_DIRS - 1;
+
+    MountOptions fdOpts, mmapOpts, directOpts, hddOpts, ssdOpts, hddWtOpts, hddWbOpts;
+    initMountOptions(&fdOpts);
+    initMountOptions(&mmapOpts);
+    initMountOptions(&directOpts);
+    initMountOptions(&hddOpts);
+    initMountOptions(&ssdOpts);
+    initMountOptions(&hddWtOpts);
+    initMountOptions(&hddWbOpts);
+    mmapOpts.diskFlags |= DSK_MMAP;
+    directOpts.diskFlags |= DSK_DIRECT;
+    hddOpts.diskModel = DSK_MODEL_HDD;
+    ssdOpts.diskModel = DSK_MODEL_SSD;
+    hddWtOpts.diskModel = DSK_MODEL_HDD;
+    hddWtOpts.schedDepth = 0;
+    hddWbOpts.diskModel = DSK_MODEL_HDD;
+    hddWbOpts.writeBack = true;
+
+    BenchResult fdRes, mmapRes, directRes, hddRes, ssdRes, hddWtRes, hddWbRes;
+    printf("Running %d files in %d directories on %ld data blocks of %d bytes\n", nFiles, BENCH_DIRS, nDBlks, blkSize);
+    if(runBench(nDBlks, nINodes, blkSize, nFiles, &fdOpts, &fdRes) != 0)
+        exit(1);
+    if(runBench(nDBlks, nINodes, blkSize, nFiles, &mmapOpts, &mmapRes) != 0)
+        exit(1);
+    if(runBench(nDBlks, nINodes, blkSize, nFiles, &directOpts, &directRes) != 0)
+        exit(1);
+    if(runBench(nDBlks, nINodes, blkSize, nFiles, &hddOpts, &hddRes) != 0)
+        exit(1);
+    if(runBench(nDBlks, nINodes, blkSize, nFiles, &ssdOpts, &ssdRes) != 0)
+        exit(1);
+    if(runBench(nDBlks, nINodes, blkSize, nFiles, &hddWtOpts, &hddWtRes) != 0)
+        exit(1);
+    if(runBench(nDBlks, nINodes, blkSize, nFiles, &hddWbOpts, &hddWbRes) != 0)
+        exit(1);
+
+    printResult("fd", &fdRes);
+    printResult("mmap", &mmapRes);
+    printResult("direct", &directRes);
+    //simulated device time, identical from run to run
+    printResult("simHDD", &hddRes);
+    printResult("simSSD", &ssdRes);
+    //same HDD with every block write going straight to disk, no scheduler
+    printResult("hddWT", &hddWtRes);
+    //same HDD with data block writes held dirty in the cache
+    printResult("hddWB", &hddWbRes);
+    printIO("fd", &fdRes);
+    printIO("hddWT", &hddWtRes);
+    printIO("hddWB", &hddWbRes);
+    return 0;
+}
@@ -3,6 +3,7 @@
  * by Weilong
  */
 
+#define _GNU_SOURCE
 #include "DiskEmulator.h"
 #include "Utility.h"
 #include <stdio.h>
@@ -11,127 +12,927 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 
-void openDisk(DiskArray *disk, LONG diskSize)
+#ifndef IOV_MAX
+#define IOV_MAX (1024) //linux UIO_MAXIOV
+#endif
+
+//maps the whole image file for the DSK_MMAP backend
+static void mapDisk(DiskArray *disk)
 {
-  disk->_dsk_dskArray = open(DISK_PATH, O_RDWR, 0666);
-  if (disk->_dsk_dskArray == -1)
-    printf("Disk open error %s\n", strerror(errno));
-  disk->_dsk_size = diskSize;
-  disk->_dsk_numBlk = diskSize / BLK_SIZE;
+  disk->_dsk_map = NULL;
+  if (!(disk->_dsk_flags & DSK_MMAP) || disk->_dsk_dskArray == -1)
+    return;
+
+  BYTE *map = mmap(NULL, disk->_dsk_size, PROT_READ|PROT_WRITE, MAP_SHARED, disk->_dsk_dskArray, 0);
+  if (map == MAP_FAILED) {
+    //keep serving the disk through the file descriptor
+    printf("Disk mmap error %s, falling back to fd backend\n", strerror(errno));
+    disk->_dsk_flags &= ~DSK_MMAP;
+    return;
+  }
+  disk->_dsk_map = map;
 }
 
-/*void initDisk(DiskArray *disk, UINT diskSize)
+//path of member i of the disk, member 0 is the DISK_PATH image
+static void memberPath(UINT i, char *path)
 {
-  FILE *mapFile;
-  mapFile = fopen("diskFile", "w+r");
-  if (mapFile == NULL)
-  {
-        printf("Disk map file open failed!\n");
-	exit(1);
+  if (i == 0)
+    strcpy(path, DISK_PATH);
+  else
+    sprintf(path, DISK_MEMBER_PATH_FMT, i);
+}
+
+//the logical sector size of a device image, DSK_DEFAULT_SECTOR when the
+//image is a file on a filesystem that cannot tell
+static UINT sectorSize(INT fd)
+{
+#ifdef BLKSSZGET
+  struct stat st;
+  INT size = 0;
+  if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode) && ioctl(fd, BLKSSZGET, &size) == 0 && size > 0)
+    return size;
+#endif
+  return DSK_DEFAULT_SECTOR;
+}
+
+//opens an image file, O_DIRECT is dropped when the host filesystem
+//cannot do direct transfers of our block size
+static INT openImage(DiskArray *disk, const char *path, INT oflags)
+{
+  if (!(disk->_dsk_flags & DSK_DIRECT))
+    return open(path, oflags, 0666);
+
+  //a mapping would go through the page cache we are trying to avoid
+  disk->_dsk_flags &= ~DSK_MMAP;
+  INT fd = open(path, oflags | O_DIRECT, 0666);
+  if (fd == -1 && errno == EINVAL) {
+    printf("Disk O_DIRECT unsupported, falling back to buffered transfers\n");
+    disk->_dsk_flags &= ~DSK_DIRECT;
+    return open(path, oflags, 0666);
   }
-  //truncate the file to the right size
-  ftruncate(fileno(mapFile), diskSize);
-  
-  //create the memory map
-  disk->_dsk_dskArray = mmap(NULL, diskSize, PROT_READ|PROT_WRITE, MAP_SHARED, fileno(mapFile), 0);
+  if (fd == -1)
+    return -1;
 
-  //no need for file stream anymore
-  fclose(mapFile);
+  //every transfer starts and ends on a block boundary, so blocks must be
+  //a whole # of the offset alignment
+  UINT align = DSK_DEFAULT_ALIGN;
+  UINT offsetAlign = 0;
+#ifdef STATX_DIOALIGN
+  struct statx stx;
+  if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN)) {
+    //a 0 offset alignment means no direct transfers at all
+    if (stx.stx_dio_offset_align == 0) {
+      printf("Disk O_DIRECT unsupported, falling back to buffered transfers\n");
+      close(fd);
+      disk->_dsk_flags &= ~DSK_DIRECT;
+      return open(path, oflags, 0666);
+    }
+    offsetAlign = stx.stx_dio_offset_align;
+    align = stx.stx_dio_mem_align > sizeof(void *) ? stx.stx_dio_mem_align : sizeof(void *);
+  }
+#endif
+  if (offsetAlign == 0) {
+    offsetAlign = sectorSize(fd);
+    if (offsetAlign > align)
+      align = offsetAlign;
+  }
+  if (offsetAlign > disk->_dsk_blkSize || disk->_dsk_blkSize % offsetAlign != 0) {
+    printf("Disk O_DIRECT needs %u byte alignment, falling back to buffered transfers\n", offsetAlign);
+    close(fd);
+    disk->_dsk_flags &= ~DSK_DIRECT;
+    return open(path, oflags, 0666);
+  }
+  if (align > disk->_dsk_align)
+    disk->_dsk_align = align;
+  return fd;
+}
 
-  if (disk->_dsk_dskArray == MAP_FAILED)
-  {
-	printf("mmap failed!\n");
-	exit(1);
+//distance between two pool buffers, a block rounded up to the alignment
+static LONG bufStride(DiskArray *disk)
+{
+  return (disk->_dsk_blkSize + disk->_dsk_align - 1) / disk->_dsk_align * disk->_dsk_align;
+}
+
+//carves the aligned buffer pool out of one allocation
+static void initBufPool(DiskArray *disk)
+{
+  pthread_mutex_init(&disk->_dsk_poolLock, NULL);
+  disk->_dsk_nFreeBufs = 0;
+  if (posix_memalign((void **)&disk->_dsk_pool, disk->_dsk_align, DSK_BUF_POOL_SIZE * bufStride(disk)) != 0) {
+    disk->_dsk_pool = NULL;
+    return;
+  }
+  for (UINT i = 0; i < DSK_BUF_POOL_SIZE; i++)
+    disk->_dsk_freeBufs[disk->_dsk_nFreeBufs++] = disk->_dsk_pool + i * bufStride(disk);
+}
+
+//starts every disk without a model
+static void initModel(DiskArray *disk)
+{
+  pthread_mutex_init(&disk->_dsk_modelLock, NULL);
+  memset(&disk->_dsk_model, 0, sizeof(DiskModel));
+  disk->_dsk_model._mdl_type = DSK_MODEL_NONE;
+  disk->_dsk_head = 0;
+  disk->_dsk_simNs = 0;
+  disk->_dsk_rand = 0;
+}
+
+static void initStats(DiskArray *disk)
+{
+  pthread_mutex_init(&disk->_dsk_statsLock, NULL);
+  memset(&disk->_dsk_stats, 0, sizeof(DiskStats));
+  disk->_dsk_lastEnd = 0;
+}
+
+static void *memberWorker(void *arg);
+
+//sets up the member workers, none running yet
+static void initWorkers(DiskArray *disk)
+{
+  pthread_mutex_init(&disk->_dsk_stripeLock, NULL);
+  pthread_mutex_init(&disk->_dsk_jobLock, NULL);
+  pthread_cond_init(&disk->_dsk_jobReady, NULL);
+  pthread_cond_init(&disk->_dsk_jobDone, NULL);
+  disk->_dsk_stopWorkers = false;
+  disk->_dsk_nWorkers = 0;
+  disk->_dsk_workerPid = 0;
+}
+
+//serializes the spawning of the member workers of every disk
+static pthread_mutex_t workerStartLock = PTHREAD_MUTEX_INITIALIZER;
+
+//spawns one worker per member past the first for the calling process,
+//unless it has them already; after a fork the workers of the parent are
+//gone and the locks and conditions they used start afresh
+static void startWorkers(DiskArray *disk)
+{
+  pid_t pid = getpid();
+  if (__atomic_load_n(&disk->_dsk_workerPid, __ATOMIC_ACQUIRE) == pid)
+    return;
+  pthread_mutex_lock(&workerStartLock);
+  if (disk->_dsk_workerPid != pid) {
+    if (disk->_dsk_workerPid != 0)
+      initWorkers(disk);
+    for (UINT i = 1; i < disk->_dsk_nMembers; i++) {
+      disk->_dsk_jobs[i]._job_pending = false;
+      disk->_dsk_jobs[i]._job_member = i;
+      disk->_dsk_jobs[i]._job_disk = disk;
+      if (pthread_create(&disk->_dsk_workers[i], NULL, memberWorker, &disk->_dsk_jobs[i]) != 0)
+        break;
+      disk->_dsk_nWorkers++;
+    }
+    __atomic_store_n(&disk->_dsk_workerPid, pid, __ATOMIC_RELEASE);
   }
+  pthread_mutex_unlock(&workerStartLock);
+}
 
-  memset(disk->_dsk_dskArray, 0, diskSize);
+//opens (or creates) the member images and checks they hold the whole disk
+static INT openMembers(DiskArray *disk, BOOL create)
+{
+  char path[MAX_PATH_LEN];
+  LONG memberSize = (LONG)disk->_dsk_memberBlks * disk->_dsk_blkSize;
+  disk->_dsk_align = sizeof(void *);
+  for (UINT i = 0; i < DSK_MAX_MEMBERS; i++)
+    disk->_dsk_members[i] = -1;
+  for (UINT i = 0; i < disk->_dsk_nMembers; i++) {
+    memberPath(i, path);
+    disk->_dsk_members[i] = openImage(disk, path, create ? O_RDWR | O_CREAT : O_RDWR);
+    if (disk->_dsk_members[i] == -1) {
+      printf("Disk open error %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+    struct stat st;
+    if (create)
+      ftruncate(disk->_dsk_members[i], disk->_dsk_nMembers == 1 ? disk->_dsk_size : memberSize);
+    else if (fstat(disk->_dsk_members[i], &st) == 0 && st.st_size < memberSize) {
+      printf("Disk member %s holds %ld bytes, the stripe layout needs %ld\n", path, (LONG)st.st_size, memberSize);
+      return -1;
+    }
+  }
+  //a member that could not do O_DIRECT turns it off for all of them
+  if (!(disk->_dsk_flags & DSK_DIRECT)) {
+    disk->_dsk_align = sizeof(void *);
+    for (UINT i = 0; i < disk->_dsk_nMembers; i++)
+      fcntl(disk->_dsk_members[i], F_SETFL, fcntl(disk->_dsk_members[i], F_GETFL) & ~O_DIRECT);
+  }
+  return 0;
+}
+
+static INT setupDisk(DiskArray *disk, LONG diskSize, UINT blkSize, UINT flags, UINT nMembers, UINT stripeUnit, BOOL create)
+{
+  if (nMembers == 0)
+    nMembers = 1;
+  if (nMembers > DSK_MAX_MEMBERS) {
+    printf("Disk cannot stripe over %u members, at most %u\n", nMembers, DSK_MAX_MEMBERS);
+    return -1;
+  }
+  disk->_dsk_flags = flags;
+  disk->_dsk_blkSize = blkSize;
   disk->_dsk_size = diskSize;
-  disk->_dsk_numBlk = diskSize / BLK_SIZE;
-}*/
+  disk->_dsk_numBlk = diskSize / blkSize;
+  disk->_dsk_nMembers = nMembers;
+  disk->_dsk_stripeUnit = stripeUnit == 0 ? DSK_DEFAULT_STRIPE_UNIT : stripeUnit;
+  if (nMembers == 1) {
+    disk->_dsk_memberBlks = disk->_dsk_numBlk;
+  }
+  else {
+    //whole rows of stripe units, the last one partly used
+    LONG rowBlks = (LONG)disk->_dsk_stripeUnit * nMembers;
+    disk->_dsk_memberBlks = (disk->_dsk_numBlk + rowBlks - 1) / rowBlks * disk->_dsk_stripeUnit;
+    //the mapping would only cover the first member
+    disk->_dsk_flags &= ~DSK_MMAP;
+  }
+  INT ret = openMembers(disk, create);
+  disk->_dsk_dskArray = disk->_dsk_members[0];
+
+  initBufPool(disk);
+  initModel(disk);
+  initStats(disk);
+  mapDisk(disk);
+
+  //the member workers start with the first transfer over several members
+  initWorkers(disk);
+  return ret;
+}
+
+INT openStripedDisk(DiskArray *disk, LONG diskSize, UINT blkSize, UINT flags, UINT nMembers, UINT stripeUnit)
+{
+  return setupDisk(disk, diskSize, blkSize, flags, nMembers, stripeUnit, false);
+}
+
+INT initStripedDisk(DiskArray *disk, LONG diskSize, UINT blkSize, UINT flags, UINT nMembers, UINT stripeUnit)
+{
+  return setupDisk(disk, diskSize, blkSize, flags, nMembers, stripeUnit, true);
+}
 
-void initDisk(DiskArray *disk, LONG diskSize)
+void openDisk(DiskArray *disk, LONG diskSize, UINT blkSize, UINT flags)
 {
-  disk->_dsk_dskArray = open(DISK_PATH, O_RDWR | O_CREAT, 0666);
-  if (disk->_dsk_dskArray == -1)
-    printf("Disk init error %s\n", strerror(errno));
-  ftruncate(disk->_dsk_dskArray, diskSize);
-  if (disk->_dsk_dskArray == -1)
+  openStripedDisk(disk, diskSize, blkSize, flags, 1, 0);
+}
+
+void initDisk(DiskArray *disk, LONG diskSize, UINT blkSize, UINT flags)
+{
+  if (initStripedDisk(disk, diskSize, blkSize, flags, 1, 0) != 0)
   {
 	_err_last = _dsk_initFail;
 	THROW(__FILE__, __LINE__, __func__);
   	exit(1);
   }
-  disk->_dsk_size = diskSize;
-  disk->_dsk_numBlk = diskSize / BLK_SIZE;
 }
 
-/*void destroyDisk(DiskArray *disk)
+INT syncDisk(DiskArray *disk)
 {
   //Sync operation force consistancy of the mapped file
-  msync(disk->_dsk_dskArray, disk->_dsk_size, MS_SYNC);
-  munmap(disk->_dsk_dskArray, disk->_dsk_size);
-}*/
+  if (disk->_dsk_map != NULL)
+    return msync(disk->_dsk_map, disk->_dsk_size, MS_SYNC);
+  INT ret = 0;
+  for (UINT i = 0; i < disk->_dsk_nMembers; i++) {
+    if (fsync(disk->_dsk_members[i]) == -1)
+      ret = -1;
+  }
+  return ret;
+}
 
 void closeDisk(DiskArray *disk)
 {
-  close(disk->_dsk_dskArray);
+  if (disk->_dsk_map != NULL) {
+    msync(disk->_dsk_map, disk->_dsk_size, MS_SYNC);
+    munmap(disk->_dsk_map, disk->_dsk_size);
+    disk->_dsk_map = NULL;
+  }
+  //workers spawned before a fork are not this process's to stop
+  if (disk->_dsk_workerPid != 0 && disk->_dsk_workerPid != getpid())
+    initWorkers(disk);
+  pthread_mutex_lock(&disk->_dsk_jobLock);
+  disk->_dsk_stopWorkers = true;
+  pthread_cond_broadcast(&disk->_dsk_jobReady);
+  pthread_mutex_unlock(&disk->_dsk_jobLock);
+  for (UINT i = 1; i <= disk->_dsk_nWorkers; i++)
+    pthread_join(disk->_dsk_workers[i], NULL);
+  pthread_cond_destroy(&disk->_dsk_jobReady);
+  pthread_cond_destroy(&disk->_dsk_jobDone);
+  pthread_mutex_destroy(&disk->_dsk_jobLock);
+  pthread_mutex_destroy(&disk->_dsk_stripeLock);
+  for (UINT i = 0; i < disk->_dsk_nMembers; i++) {
+    if (disk->_dsk_members[i] != -1)
+      close(disk->_dsk_members[i]);
+  }
+  free(disk->_dsk_pool);
+  disk->_dsk_pool = NULL;
+  pthread_mutex_destroy(&disk->_dsk_poolLock);
+  pthread_mutex_destroy(&disk->_dsk_modelLock);
+  pthread_mutex_destroy(&disk->_dsk_statsLock);
 }
 
-LONG bid2Offset(LONG bid)
+BYTE *getBlkBuf(DiskArray *disk)
 {
-  return (bid * BLK_SIZE);
+  BYTE *buf = NULL;
+  pthread_mutex_lock(&disk->_dsk_poolLock);
+  if (disk->_dsk_nFreeBufs > 0)
+    buf = disk->_dsk_freeBufs[--disk->_dsk_nFreeBufs];
+  pthread_mutex_unlock(&disk->_dsk_poolLock);
+  if (buf == NULL && posix_memalign((void **)&buf, disk->_dsk_align, disk->_dsk_blkSize) != 0)
+    return NULL;
+  return buf;
 }
 
-/*INT readBlk(DiskArray *disk, UINT bid, BYTE *buf)
+void putBlkBuf(DiskArray *disk, BYTE *buf)
 {
-  if (bid > disk->_dsk_numBlk - 1) {
-    _err_last = _dsk_readOutOfBoundry;
-    THROW(__FILE__, __LINE__, __func__);
-    return -1;
+  //buffers allocated past an empty pool are not kept
+  if (disk->_dsk_pool == NULL || buf < disk->_dsk_pool || buf >= disk->_dsk_pool + DSK_BUF_POOL_SIZE * bufStride(disk)) {
+    free(buf);
+    return;
   }
-  UINT offset = bid2Offset(bid);
-  for (UINT i=0; i<BLK_SIZE; i++)
-    *(buf + i) = *(disk->_dsk_dskArray + offset + i);
-  return 0;
-}*/
+  pthread_mutex_lock(&disk->_dsk_poolLock);
+  disk->_dsk_freeBufs[disk->_dsk_nFreeBufs++] = buf;
+  pthread_mutex_unlock(&disk->_dsk_poolLock);
+}
+
+BOOL isBlkBufAligned(DiskArray *disk, const BYTE *buf, LONG len)
+{
+  if (!(disk->_dsk_flags & DSK_DIRECT))
+    return true;
+  return ((uintptr_t)buf % disk->_dsk_align == 0) && (len % disk->_dsk_blkSize == 0);
+}
+
+void initDiskModel(DiskModel *model, DSK_MODEL type)
+{
+  memset(model, 0, sizeof(DiskModel));
+  model->_mdl_type = type;
+  model->_mdl_seed = 1;
+  switch (type) {
+    case DSK_MODEL_HDD:
+      //7200rpm, 1ms track to track, 15ms full stroke, 150MB/s media rate,
+      //0.5% of requests hit a 20ms retry
+      model->_mdl_reqNs = 50000;
+      model->_mdl_seekMinNs = 1000000;
+      model->_mdl_seekMaxNs = 15000000;
+      model->_mdl_rotateNs = 4166667;
+      model->_mdl_xferNsPerKB = 6510;
+      model->_mdl_tailPermille = 5;
+      model->_mdl_tailNs = 20000000;
+      break;
+    case DSK_MODEL_SSD:
+      //25us per command, 2GB/s, 1% of requests stall 2ms behind garbage collection
+      model->_mdl_reqNs = 25000;
+      model->_mdl_xferNsPerKB = 488;
+      model->_mdl_tailPermille = 10;
+      model->_mdl_tailNs = 2000000;
+      break;
+    default:
+      break;
+  }
+}
+
+void setDiskModel(DiskArray *disk, const DiskModel *model)
+{
+  pthread_mutex_lock(&disk->_dsk_modelLock);
+  disk->_dsk_model = *model;
+  disk->_dsk_head = 0;
+  disk->_dsk_simNs = 0;
+  disk->_dsk_rand = model->_mdl_seed != 0 ? model->_mdl_seed : 1;
+  pthread_mutex_unlock(&disk->_dsk_modelLock);
+
+  //requests that bypass the model would make the simulated time meaningless
+  if (model->_mdl_type != DSK_MODEL_NONE && disk->_dsk_map != NULL) {
+    munmap(disk->_dsk_map, disk->_dsk_size);
+    disk->_dsk_map = NULL;
+    disk->_dsk_flags &= ~DSK_MMAP;
+  }
+}
+
+//integer square root
+static LONG isqrt(LONG n)
+{
+  LONG x = n, y = (x + 1) / 2;
+  while (y < x) {
+    x = y;
+    y = (x + n / x) / 2;
+  }
+  return x;
+}
+
+LONG chargeDiskModel(DiskArray *disk, LONG bid, LONG nBlks)
+{
+  DiskModel *model = &disk->_dsk_model;
+  if (model->_mdl_type == DSK_MODEL_NONE || nBlks <= 0)
+    return 0;
+
+  pthread_mutex_lock(&disk->_dsk_modelLock);
+  LONG cost = model->_mdl_reqNs + nBlks * disk->_dsk_blkSize / 1024 * model->_mdl_xferNsPerKB;
+  if (bid != disk->_dsk_head && model->_mdl_seekMaxNs > 0) {
+    //seek curve scaled to the full stroke, in 1/1024ths
+    LONG dist = bid > disk->_dsk_head ? bid - disk->_dsk_head : disk->_dsk_head - bid;
+    LONG frac = isqrt(dist * 1048576 / disk->_dsk_numBlk);
+    cost += model->_mdl_seekMinNs + (model->_mdl_seekMaxNs - model->_mdl_seekMinNs) * frac / 1024
+          + model->_mdl_rotateNs;
+  }
+  if (model->_mdl_tailPermille > 0) {
+    //xorshift32
+    disk->_dsk_rand ^= disk->_dsk_rand << 13;
+    disk->_dsk_rand ^= disk->_dsk_rand >> 17;
+    disk->_dsk_rand ^= disk->_dsk_rand << 5;
+    if (disk->_dsk_rand % 1000 < model->_mdl_tailPermille)
+      cost += model->_mdl_tailNs;
+  }
+  disk->_dsk_simNs += cost;
+  disk->_dsk_head = bid + nBlks;
+  pthread_mutex_unlock(&disk->_dsk_modelLock);
+  return cost;
+}
+
+LONG getDiskSimTime(DiskArray *disk)
+{
+  pthread_mutex_lock(&disk->_dsk_modelLock);
+  LONG simNs = disk->_dsk_simNs;
+  pthread_mutex_unlock(&disk->_dsk_modelLock);
+  return simNs;
+}
+
+LONG diskClockNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+//floor of log2, the histogram bucket of a latency
+static UINT latBucket(LONG ns)
+{
+  UINT b = 0;
+  while (ns > 1 && b < DSK_LAT_BUCKETS - 1) {
+    ns >>= 1;
+    b++;
+  }
+  return b;
+}
+
+void recordDiskRequest(DiskArray *disk, LONG bid, LONG nBlks, BOOL isWrite, INT result, LONG modelNs, LONG startNs)
+{
+  LONG ns = disk->_dsk_model._mdl_type != DSK_MODEL_NONE ? modelNs : diskClockNs() - startNs;
+  LONG bytes = nBlks * disk->_dsk_blkSize;
+  DiskStats *stats = &disk->_dsk_stats;
+
+  pthread_mutex_lock(&disk->_dsk_statsLock);
+  if (result != 0)
+    stats->_st_errors++;
+  if (isWrite) {
+    stats->_st_writes++;
+    stats->_st_writeBytes += bytes;
+    stats->_st_writeNs += ns;
+    stats->_st_writeLat[latBucket(ns)]++;
+  }
+  else {
+    stats->_st_reads++;
+    stats->_st_readBytes += bytes;
+    stats->_st_readNs += ns;
+    stats->_st_readLat[latBucket(ns)]++;
+  }
+  if (bid >= disk->_dsk_lastEnd && bid - disk->_dsk_lastEnd <= DSK_SEQ_WINDOW)
+    stats->_st_seq++;
+  else
+    stats->_st_rand++;
+  disk->_dsk_lastEnd = bid + nBlks;
+  pthread_mutex_unlock(&disk->_dsk_statsLock);
+}
+
+void getDiskStats(DiskArray *disk, DiskStats *stats)
+{
+  pthread_mutex_lock(&disk->_dsk_statsLock);
+  *stats = disk->_dsk_stats;
+  pthread_mutex_unlock(&disk->_dsk_statsLock);
+}
+
+void resetDiskStats(DiskArray *disk)
+{
+  pthread_mutex_lock(&disk->_dsk_statsLock);
+  memset(&disk->_dsk_stats, 0, sizeof(DiskStats));
+  disk->_dsk_lastEnd = 0;
+  pthread_mutex_unlock(&disk->_dsk_statsLock);
+}
+
+static void printLatHistogram(FILE *out, const char *name, const LONG *lat)
+{
+  for (UINT b = 0; b < DSK_LAT_BUCKETS; b++) {
+    if (lat[b] > 0)
+      fprintf(out, "  %s >= %12ld ns: %ld\n", name, 1L << b, lat[b]);
+  }
+}
+
+void fprintDiskStats(FILE *out, const DiskStats *stats)
+{
+  fprintf(out, "reads %ld (%ld bytes, %ld ns), writes %ld (%ld bytes, %ld ns)\n",
+          stats->_st_reads, stats->_st_readBytes, stats->_st_readNs,
+          stats->_st_writes, stats->_st_writeBytes, stats->_st_writeNs);
+  fprintf(out, "sequential %ld, random %ld, errors %ld\n", stats->_st_seq, stats->_st_rand, stats->_st_errors);
+  fprintf(out, "discards %ld (%ld bytes)\n", stats->_st_discards, stats->_st_discardBytes);
+  printLatHistogram(out, "read ", stats->_st_readLat);
+  printLatHistogram(out, "write", stats->_st_writeLat);
+}
+
+void printDiskStats(const DiskStats *stats)
+{
+  fprintDiskStats(stdout, stats);
+}
+
+BYTE *mapBlk(DiskArray *disk, LONG bid)
+{
+  if (disk->_dsk_map == NULL || bid < 0 || bid > disk->_dsk_numBlk - 1)
+    return NULL;
+  return disk->_dsk_map + bid2Offset(disk, bid);
+}
+
+LONG bid2Offset(DiskArray *disk, LONG bid)
+{
+  return (bid * disk->_dsk_blkSize);
+}
 
 INT readBlk(DiskArray *disk, LONG bid, BYTE *buf)
 {
-  if (bid > disk->_dsk_numBlk - 1) {
-    _err_last = _dsk_readOutOfBoundry;
+  return readBlks(disk, bid, 1, buf);
+}
+
+INT writeBlk(DiskArray *disk, LONG bid, BYTE *buf)
+{
+  return writeBlks(disk, bid, 1, buf);
+}
+
+//positional transfer of iovcnt vectors starting at byte offset
+//short transfers are resumed, so iov is consumed (callers pass a copy)
+static INT transferv(INT fd, LONG offset, struct iovec *iov, INT iovcnt, BOOL isWrite)
+{
+  while (iovcnt > 0) {
+    INT cnt = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+    ssize_t done = isWrite ? pwritev(fd, iov, cnt, offset) : preadv(fd, iov, cnt, offset);
+    if (done < 0 && errno == EINTR)
+      continue;
+    if (done <= 0)
+      return -1;
+    offset += done;
+    //skip the vectors fully transferred, trim the one partially transferred
+    while (iovcnt > 0 && (size_t)done >= iov->iov_len) {
+      done -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (done > 0) {
+      iov->iov_base = (BYTE *)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
+  }
+  return 0;
+}
+
+//copies the vectors into one contiguous buffer
+static void gatherv(BYTE *dst, const struct iovec *iov, INT iovcnt)
+{
+  for (INT i = 0; i < iovcnt; i++) {
+    memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+    dst += iov[i].iov_len;
+  }
+}
+
+//copies one contiguous buffer out to the vectors
+static void scatterv(const BYTE *src, const struct iovec *iov, INT iovcnt)
+{
+  for (INT i = 0; i < iovcnt; i++) {
+    memcpy(iov[i].iov_base, src, iov[i].iov_len);
+    src += iov[i].iov_len;
+  }
+}
+
+//copies iovcnt vectors from/to the mapped image starting at byte offset
+static void mapTransferv(DiskArray *disk, LONG offset, const struct iovec *iov, INT iovcnt, BOOL isWrite)
+{
+  if (isWrite)
+    gatherv(disk->_dsk_map + offset, iov, iovcnt);
+  else
+    scatterv(disk->_dsk_map + offset, iov, iovcnt);
+}
+
+//moves nBlks blocks through an aligned copy of the vectors
+static INT bounceBlks(DiskArray *disk, LONG bid, LONG nBlks, const struct iovec *iov, INT iovcnt, BOOL isWrite)
+{
+  BYTE *bounce = nBlks == 1 ? getBlkBuf(disk) : NULL;
+  if (bounce == NULL && posix_memalign((void **)&bounce, disk->_dsk_align, (size_t)nBlks * disk->_dsk_blkSize) != 0) {
+    _err_last = _dsk_ioFail;
     THROW(__FILE__, __LINE__, __func__);
     return -1;
   }
-  LONG offset = bid2Offset(bid);
-  lseek(disk->_dsk_dskArray, offset, SEEK_SET);
-  read(disk->_dsk_dskArray, buf, BLK_SIZE);
-  return 0;
+  struct iovec whole = { bounce, (size_t)nBlks * disk->_dsk_blkSize };
+  if (isWrite)
+    gatherv(bounce, iov, iovcnt);
+
+  INT ret = transferv(disk->_dsk_dskArray, bid2Offset(disk, bid), &whole, 1, isWrite);
+  if (ret == -1) {
+    _err_last = _dsk_ioFail;
+    THROW(__FILE__, __LINE__, __func__);
+  }
+  else if (!isWrite)
+    scatterv(bounce, iov, iovcnt);
+
+  if (nBlks == 1)
+    putBlkBuf(disk, bounce);
+  else
+    free(bounce);
+  return ret;
 }
 
-/*INT writeBlk(DiskArray *disk, UINT bid, BYTE *buf)
+//moves one member's share of a striped transfer, through an aligned
+//copy when a direct transfer cannot take the vectors as they are
+static INT runShare(DiskArray *disk, StripeJob *job)
 {
-  if (bid > disk->_dsk_numBlk - 1) {
-    _err_last = _dsk_writeOutOfBoundry;
+  INT fd = disk->_dsk_members[job->_job_member];
+  BOOL aligned = true;
+  LONG len = 0;
+  for (INT i = 0; i < job->_job_iovcnt; i++) {
+    aligned = aligned && isBlkBufAligned(disk, job->_job_iov[i].iov_base, job->_job_iov[i].iov_len);
+    len += job->_job_iov[i].iov_len;
+  }
+  if (aligned)
+    return transferv(fd, job->_job_offset, job->_job_iov, job->_job_iovcnt, job->_job_write);
+
+  BYTE *bounce;
+  if (posix_memalign((void **)&bounce, disk->_dsk_align, len) != 0)
+    return -1;
+  struct iovec whole = { bounce, len };
+  if (job->_job_write)
+    gatherv(bounce, job->_job_iov, job->_job_iovcnt);
+  INT ret = transferv(fd, job->_job_offset, &whole, 1, job->_job_write);
+  if (ret == 0 && !job->_job_write)
+    scatterv(bounce, job->_job_iov, job->_job_iovcnt);
+  free(bounce);
+  return ret;
+}
+
+static void *memberWorker(void *arg)
+{
+  StripeJob *job = arg;
+  DiskArray *disk = job->_job_disk;
+  pthread_mutex_lock(&disk->_dsk_jobLock);
+  while (true) {
+    while (!job->_job_pending && !disk->_dsk_stopWorkers)
+      pthread_cond_wait(&disk->_dsk_jobReady, &disk->_dsk_jobLock);
+    if (!job->_job_pending)
+      break;
+    pthread_mutex_unlock(&disk->_dsk_jobLock);
+
+    INT result = runShare(disk, job);
+
+    pthread_mutex_lock(&disk->_dsk_jobLock);
+    job->_job_result = result;
+    job->_job_pending = false;
+    pthread_cond_broadcast(&disk->_dsk_jobDone);
+  }
+  pthread_mutex_unlock(&disk->_dsk_jobLock);
+  return NULL;
+}
+
+//moves nBlks blocks of a striped disk; the blocks of each member form one
+//contiguous range of its image, so every member gets a single vectored
+//transfer and the members move in parallel
+static INT stripeTransfer(DiskArray *disk, LONG bid, LONG nBlks, const struct iovec *iov, INT iovcnt, BOOL isWrite)
+{
+  UINT nMembers = disk->_dsk_nMembers;
+  LONG unit = disk->_dsk_stripeUnit;
+  LONG blkSize = disk->_dsk_blkSize;
+
+  //a member share takes at most one slice per stripe unit plus one per
+  //input vector boundary
+  LONG nUnits = (bid % unit + nBlks + unit - 1) / unit;
+  LONG maxSlices = nUnits + iovcnt;
+  struct iovec *slices = malloc(nMembers * maxSlices * sizeof(struct iovec));
+  if (slices == NULL)
+    return -1;
+  StripeJob shares[DSK_MAX_MEMBERS];
+  for (UINT m = 0; m < nMembers; m++) {
+    shares[m]._job_member = m;
+    shares[m]._job_iov = slices + m * maxSlices;
+    shares[m]._job_iovcnt = 0;
+    shares[m]._job_write = isWrite;
+    shares[m]._job_result = 0;
+  }
+
+  //walk the range one stripe unit at a time, cutting the input vectors
+  INT v = 0;
+  LONG vOff = 0;
+  UINT nShares = 0;
+  for (LONG cur = bid; cur < bid + nBlks; ) {
+    LONG stripe = cur / unit;
+    LONG chunk = unit - cur % unit;
+    if (chunk > bid + nBlks - cur)
+      chunk = bid + nBlks - cur;
+    StripeJob *share = &shares[stripe % nMembers];
+    if (share->_job_iovcnt == 0) {
+      share->_job_offset = ((stripe / nMembers) * unit + cur % unit) * blkSize;
+      nShares++;
+    }
+    for (LONG left = chunk * blkSize; left > 0; ) {
+      LONG take = iov[v].iov_len - vOff < (size_t)left ? (LONG)(iov[v].iov_len - vOff) : left;
+      share->_job_iov[share->_job_iovcnt++] = (struct iovec) { (BYTE *)iov[v].iov_base + vOff, take };
+      left -= take;
+      vOff += take;
+      if (vOff == iov[v].iov_len) {
+        v++;
+        vOff = 0;
+      }
+    }
+    cur += chunk;
+  }
+
+  INT ret = 0;
+  if (nShares == 1) {
+    for (UINT m = 0; m < nMembers; m++) {
+      if (shares[m]._job_iovcnt > 0)
+        ret = runShare(disk, &shares[m]);
+    }
+    free(slices);
+    return ret;
+  }
+
+  //hand the shares to the member workers and move the first one here,
+  //along with any share of a member whose worker could not be spawned
+  startWorkers(disk);
+  pthread_mutex_lock(&disk->_dsk_stripeLock);
+  pthread_mutex_lock(&disk->_dsk_jobLock);
+  for (UINT m = 1; m <= disk->_dsk_nWorkers; m++) {
+    if (shares[m]._job_iovcnt == 0)
+      continue;
+    StripeJob *job = &disk->_dsk_jobs[m];
+    job->_job_offset = shares[m]._job_offset;
+    job->_job_iov = shares[m]._job_iov;
+    job->_job_iovcnt = shares[m]._job_iovcnt;
+    job->_job_write = isWrite;
+    job->_job_pending = true;
+  }
+  pthread_cond_broadcast(&disk->_dsk_jobReady);
+  pthread_mutex_unlock(&disk->_dsk_jobLock);
+
+  for (UINT m = 0; m < nMembers; m++) {
+    if (shares[m]._job_iovcnt > 0 && (m == 0 || m > disk->_dsk_nWorkers) && runShare(disk, &shares[m]) != 0)
+      ret = -1;
+  }
+
+  pthread_mutex_lock(&disk->_dsk_jobLock);
+  for (UINT m = 1; m <= disk->_dsk_nWorkers; m++) {
+    if (shares[m]._job_iovcnt == 0)
+      continue;
+    while (disk->_dsk_jobs[m]._job_pending)
+      pthread_cond_wait(&disk->_dsk_jobDone, &disk->_dsk_jobLock);
+    if (disk->_dsk_jobs[m]._job_result != 0)
+      ret = -1;
+  }
+  pthread_mutex_unlock(&disk->_dsk_jobLock);
+  pthread_mutex_unlock(&disk->_dsk_stripeLock);
+
+  free(slices);
+  return ret;
+}
+
+//checks the range and moves nBlks blocks starting from bid with one syscall
+//(or plain memory copies on the mmap backend)
+static INT transferBlks(DiskArray *disk, LONG bid, LONG nBlks, struct iovec *iov, INT iovcnt, BOOL isWrite)
+{
+  if (bid < 0 || nBlks < 0 || bid + nBlks > disk->_dsk_numBlk) {
+    _err_last = isWrite ? _dsk_writeOutOfBoundry : _dsk_readOutOfBoundry;
+    THROW(__FILE__, __LINE__, __func__);
+    return -1;
+  }
+  if (disk->_dsk_map != NULL) {
+    mapTransferv(disk, bid2Offset(disk, bid), iov, iovcnt, isWrite);
+    return 0;
+  }
+  if (disk->_dsk_nMembers > 1) {
+    if (stripeTransfer(disk, bid, nBlks, iov, iovcnt, isWrite) == -1) {
+      _err_last = _dsk_ioFail;
+      THROW(__FILE__, __LINE__, __func__);
+      return -1;
+    }
+    return 0;
+  }
+  //direct transfers of unaligned buffers go through an aligned bounce buffer
+  BOOL aligned = true;
+  for (INT i = 0; i < iovcnt && aligned; i++)
+    aligned = isBlkBufAligned(disk, iov[i].iov_base, iov[i].iov_len);
+  if (!aligned)
+    return bounceBlks(disk, bid, nBlks, iov, iovcnt, isWrite);
+
+  if (transferv(disk->_dsk_dskArray, bid2Offset(disk, bid), iov, iovcnt, isWrite) == -1) {
+    _err_last = _dsk_ioFail;
     THROW(__FILE__, __LINE__, __func__);
     return -1;
   }
-  UINT offset = bid2Offset(bid);
-  for (UINT i=0; i<BLK_SIZE; i++)
-    *(disk->_dsk_dskArray + offset + i) = *(buf + i);
   return 0;
-}*/
+}
 
-INT writeBlk(DiskArray *disk, LONG bid, BYTE *buf)
+INT transferBlksNoModel(DiskArray *disk, LONG bid, UINT nBlks, BYTE *buf, BOOL isWrite)
 {
-  if (bid > disk->_dsk_numBlk - 1) {
+  struct iovec iov = { buf, (size_t)nBlks * disk->_dsk_blkSize };
+  return transferBlks(disk, bid, nBlks, &iov, 1, isWrite);
+}
+
+//charges, moves and counts one request
+static INT accountedTransfer(DiskArray *disk, LONG bid, LONG nBlks, struct iovec *iov, INT iovcnt, BOOL isWrite)
+{
+  LONG modelNs = chargeDiskModel(disk, bid, nBlks);
+  LONG startNs = diskClockNs();
+  INT ret = transferBlks(disk, bid, nBlks, iov, iovcnt, isWrite);
+  recordDiskRequest(disk, bid, nBlks, isWrite, ret, modelNs, startNs);
+  return ret;
+}
+
+INT readBlks(DiskArray *disk, LONG bid, UINT nBlks, BYTE *buf)
+{
+  struct iovec iov = { buf, (size_t)nBlks * disk->_dsk_blkSize };
+  return accountedTransfer(disk, bid, nBlks, &iov, 1, false);
+}
+
+INT writeBlks(DiskArray *disk, LONG bid, UINT nBlks, BYTE *buf)
+{
+  struct iovec iov = { buf, (size_t)nBlks * disk->_dsk_blkSize };
+  return accountedTransfer(disk, bid, nBlks, &iov, 1, true);
+}
+
+//sums up the vector lengths, -1 if they do not add up to whole blocks
+static LONG iovBlks(DiskArray *disk, const struct iovec *iov, INT iovcnt)
+{
+  LONG nBytes = 0;
+  for (INT i = 0; i < iovcnt; i++)
+    nBytes += iov[i].iov_len;
+  return (nBytes % disk->_dsk_blkSize == 0) ? nBytes / disk->_dsk_blkSize : -1;
+}
+
+INT readBlksv(DiskArray *disk, LONG bid, const struct iovec *iov, INT iovcnt)
+{
+  struct iovec vec[iovcnt];
+  memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+  return accountedTransfer(disk, bid, iovBlks(disk, iov, iovcnt), vec, iovcnt, false);
+}
+
+INT writeBlksv(DiskArray *disk, LONG bid, const struct iovec *iov, INT iovcnt)
+{
+  struct iovec vec[iovcnt];
+  memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+  return accountedTransfer(disk, bid, iovBlks(disk, iov, iovcnt), vec, iovcnt, true);
+}
+
+//punches one range of a member image
+static INT punchHole(INT fd, LONG offset, LONG len)
+{
+  INT ret;
+  do {
+    ret = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+  } while (ret == -1 && errno == EINTR);
+  return ret;
+}
+
+INT discardBlks(DiskArray *disk, LONG bid, LONG nBlks)
+{
+  if (bid < 0 || nBlks <= 0 || bid + nBlks > disk->_dsk_numBlk) {
     _err_last = _dsk_writeOutOfBoundry;
     THROW(__FILE__, __LINE__, __func__);
     return -1;
   }
-  LONG offset = bid2Offset(bid);
-  lseek(disk->_dsk_dskArray, offset, SEEK_SET);
-  write(disk->_dsk_dskArray, buf, BLK_SIZE);
+  LONG blkSize = disk->_dsk_blkSize;
+  INT ret = 0;
+  if (disk->_dsk_nMembers == 1) {
+    ret = punchHole(disk->_dsk_dskArray, bid2Offset(disk, bid), nBlks * blkSize);
+  }
+  else {
+    //the blocks of each member form one contiguous range of its image
+    LONG unit = disk->_dsk_stripeUnit;
+    LONG start[DSK_MAX_MEMBERS], len[DSK_MAX_MEMBERS];
+    for (UINT m = 0; m < disk->_dsk_nMembers; m++)
+      len[m] = 0;
+    for (LONG cur = bid; cur < bid + nBlks; ) {
+      LONG stripe = cur / unit;
+      LONG chunk = unit - cur % unit;
+      if (chunk > bid + nBlks - cur)
+        chunk = bid + nBlks - cur;
+      UINT m = stripe % disk->_dsk_nMembers;
+      if (len[m] == 0)
+        start[m] = ((stripe / disk->_dsk_nMembers) * unit + cur % unit) * blkSize;
+      len[m] += chunk * blkSize;
+      cur += chunk;
+    }
+    for (UINT m = 0; m < disk->_dsk_nMembers; m++) {
+      if (len[m] > 0 && punchHole(disk->_dsk_members[m], start[m], len[m]) == -1)
+        ret = -1;
+    }
+  }
+  if (ret == -1)
+    return -1;
+
+  pthread_mutex_lock(&disk->_dsk_statsLock);
+  disk->_dsk_stats._st_discards++;
+  disk->_dsk_stats._st_discardBytes += nBlks * blkSize;
+  pthread_mutex_unlock(&disk->_dsk_statsLock);
   return 0;
 }
 
@@ -169,9 +970,9 @@ void printDisk(DiskArray *disk)
 #ifdef DEBUG
 void printBlk(DiskArray *disk, UINT bid)
 {
-  BYTE buf[BLK_SIZE];
+  BYTE buf[disk->_dsk_blkSize];
   readBlk(disk, bid, buf);
-  for (UINT i=0; i<BLK_SIZE; i+=4)
+  for (UINT i=0; i<disk->_dsk_blkSize; i+=4)
     printf("%d ", buf[i]);
   printf("\n");
 }
@@ -4,35 +4,272 @@
  * by Weilong
  */
 
+#pragma once
 #include "Globals.h"
+#include <stdio.h>
+#include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <pthread.h>
 
-typedef struct
+//disk open flags
+#define DSK_MMAP (0x1) //map the image file, block accesses become memory copies
+#define DSK_DIRECT (0x2) //open the image with O_DIRECT, bypassing the host page cache
+
+//# of aligned block buffers kept by each disk
+#define DSK_BUF_POOL_SIZE (64)
+//buffer alignment when the filesystem does not report one
+#define DSK_DEFAULT_ALIGN (4096)
+//direct transfer offset and length alignment when neither the filesystem
+//nor the device reports one, the largest logical sector in common use
+#define DSK_DEFAULT_SECTOR (4096)
+
+//most images a disk can be striped over, and the default stripe unit in blocks
+#define DSK_MAX_MEMBERS (8)
+#define DSK_DEFAULT_STRIPE_UNIT (16)
+
+//# of latency histogram buckets, bucket i counts requests that took
+//[2^i, 2^(i+1)) ns, the last one everything longer
+#define DSK_LAT_BUCKETS (32)
+//a request starting at most this many blocks past the end of the
+//previous one counts as sequential
+#define DSK_SEQ_WINDOW (8)
+
+struct DiskArray;
+
+//one member's share of a striped transfer, a contiguous range of the
+//member image moved from/to a list of vectors
+typedef struct StripeJob
+{
+  struct DiskArray *_job_disk;
+  UINT _job_member;
+  LONG _job_offset;
+  struct iovec *_job_iov;
+  INT _job_iovcnt;
+  BOOL _job_write;
+  INT _job_result;
+  BOOL _job_pending;
+} StripeJob;
+
+//device performance models, charged per request in simulated time
+typedef enum {
+  DSK_MODEL_NONE, //no model, simulated time stays 0
+  DSK_MODEL_HDD,  //7200rpm disk, seeks dominate
+  DSK_MODEL_SSD,  //flash, flat per request cost
+} DSK_MODEL;
+
+//cost parameters of a model, all times in ns
+typedef struct DiskModel
+{
+  DSK_MODEL _mdl_type;
+
+  //charged on every request
+  LONG _mdl_reqNs;
+
+  //charged when a request does not start where the previous one ended,
+  //grows with the square root of the distance from min up to max (full stroke)
+  LONG _mdl_seekMinNs;
+  LONG _mdl_seekMaxNs;
+
+  //rotational delay charged along with a seek
+  LONG _mdl_rotateNs;
+
+  //transfer time of one KB
+  LONG _mdl_xferNsPerKB;
+
+  //tailNs is added to tailPermille out of 1000 requests, picked by a
+  //generator started from seed so that runs repeat exactly
+  UINT _mdl_tailPermille;
+  LONG _mdl_tailNs;
+  UINT _mdl_seed;
+} DiskModel;
+
+//request counters of a disk, requests are counted once however many
+//members or syscalls they take, accesses through mapBlk are not counted
+typedef struct DiskStats
+{
+  LONG _st_reads;
+  LONG _st_writes;
+  LONG _st_readBytes;
+  LONG _st_writeBytes;
+  //judged by the distance from the end of the previous request
+  LONG _st_seq;
+  LONG _st_rand;
+  LONG _st_errors;
+  //discarded ranges and their size
+  LONG _st_discards;
+  LONG _st_discardBytes;
+  //service times, simulated when the disk is modeled and wall clock
+  //otherwise, in total and as log2 histograms
+  LONG _st_readNs;
+  LONG _st_writeNs;
+  LONG _st_readLat[DSK_LAT_BUCKETS];
+  LONG _st_writeLat[DSK_LAT_BUCKETS];
+} DiskStats;
+
+typedef struct DiskArray
 {
   //# of total disk space in bytes
   LONG _dsk_size;
 
   //# of total blocks on this disk
   UINT _dsk_numBlk;
+
+  //block size in bytes
+  UINT _dsk_blkSize;
   
-  //The actual array of the disk
+  //The actual array of the disk, the first member of a striped disk
   INT _dsk_dskArray;
+
+  //striping, logical blocks go round robin over the member images in
+  //units of stripeUnit blocks, each member holding memberBlks blocks
+  UINT _dsk_nMembers;
+  UINT _dsk_stripeUnit;
+  LONG _dsk_memberBlks;
+  INT _dsk_members[DSK_MAX_MEMBERS];
+
+  //workers moving the shares of members past the first in parallel,
+  //stripeLock lets one striped transfer use them at a time; the first
+  //transfer over several members of a process spawns them, threads do not
+  //survive the fork of a FUSE daemon
+  pthread_t _dsk_workers[DSK_MAX_MEMBERS];
+  StripeJob _dsk_jobs[DSK_MAX_MEMBERS];
+  UINT _dsk_nWorkers;
+  pid_t _dsk_workerPid;
+  BOOL _dsk_stopWorkers;
+  pthread_mutex_t _dsk_stripeLock;
+  pthread_mutex_t _dsk_jobLock;
+  pthread_cond_t _dsk_jobReady;
+  pthread_cond_t _dsk_jobDone;
+
+  //open flags (DSK_*)
+  UINT _dsk_flags;
+
+  //the mapped image, NULL unless on the DSK_MMAP backend
+  BYTE *_dsk_map;
+
+  //memory alignment direct transfers need
+  UINT _dsk_align;
+
+  //pool of aligned block buffers
+  BYTE *_dsk_pool;
+  BYTE *_dsk_freeBufs[DSK_BUF_POOL_SIZE];
+  UINT _dsk_nFreeBufs;
+  pthread_mutex_t _dsk_poolLock;
+
+  //performance model, the block after the last request and the simulated
+  //time charged so far
+  DiskModel _dsk_model;
+  LONG _dsk_head;
+  LONG _dsk_simNs;
+  UINT _dsk_rand;
+  pthread_mutex_t _dsk_modelLock;
+
+  //statistics and the block after the last request counted
+  DiskStats _dsk_stats;
+  LONG _dsk_lastEnd;
+  pthread_mutex_t _dsk_statsLock;
 } DiskArray;
 
 //opens a disk arrary from file
-void openDisk(DiskArray *, LONG);
+//args: device,
+//      size,
+//      block size,
+//      open flags
+void openDisk(DiskArray *, LONG, UINT, UINT);
 
 //initialize a disk array in memory
 //args: device,
-//      size
-void initDisk(DiskArray *, LONG);
+//      size,
+//      block size,
+//      open flags
+void initDisk(DiskArray *, LONG, UINT, UINT);
+
+//opens a disk striped over nMembers images, DISK_PATH and DISK_PATH.1 ...
+//returns -1 if a member is missing or too small for the layout
+//args: device,
+//      size,
+//      block size,
+//      open flags,
+//      # of member images (1 for a single image),
+//      stripe unit in blocks (0 for the default)
+INT openStripedDisk(DiskArray *, LONG, UINT, UINT, UINT, UINT);
+
+//creates a disk striped over nMembers images
+//args: same as openStripedDisk
+INT initStripedDisk(DiskArray *, LONG, UINT, UINT, UINT, UINT);
+
+//flush the disk array to the backing file
+INT syncDisk(DiskArray *);
 
 //destroy the in-memory disk array
 void closeDisk(DiskArray *);
 
+//pointer to block bid inside the mapped image, NULL unless on the
+//DSK_MMAP backend; writes through it land directly on the disk
+BYTE *mapBlk(DiskArray *, LONG);
+
+//takes a block sized buffer aligned for direct transfers from the pool,
+//falls back to a fresh allocation when the pool is empty
+BYTE *getBlkBuf(DiskArray *);
+
+//returns a buffer taken with getBlkBuf
+void putBlkBuf(DiskArray *, BYTE *);
+
+//true if len bytes at buf can be transferred without a bounce buffer
+BOOL isBlkBufAligned(DiskArray *, const BYTE *, LONG);
+
+//fills in the parameters of a device type
+void initDiskModel(DiskModel *, DSK_MODEL);
+
+//charges the requests of the disk to a model from now on and restarts
+//simulated time, DSK_MODEL_NONE turns the model off
+//a modeled disk is not mapped, every access is a request
+void setDiskModel(DiskArray *, const DiskModel *);
+
+//charges a request of nBlks blocks starting from bid to the model
+//returns the simulated ns charged, 0 without a model
+//args: device,
+//      first block id,
+//      number of blocks
+LONG chargeDiskModel(DiskArray *, LONG, LONG);
+
+//simulated ns the modeled device has spent so far
+LONG getDiskSimTime(DiskArray *);
+
+//monotonic clock in ns requests are timed with
+LONG diskClockNs(void);
+
+//counts a finished request in the statistics
+//args: device,
+//      first block id,
+//      number of blocks,
+//      write or read,
+//      result of the transfer,
+//      simulated ns charged for it,
+//      diskClockNs() when it started
+void recordDiskRequest(DiskArray *, LONG, LONG, BOOL, INT, LONG, LONG);
+
+//copies out the statistics gathered since the disk was opened or reset
+void getDiskStats(DiskArray *, DiskStats *);
+
+//clears the statistics
+void resetDiskStats(DiskArray *);
+
+//prints the counters and the non empty latency buckets to stdout
+void printDiskStats(const DiskStats *);
+
+//printDiskStats to the given stream
+void fprintDiskStats(FILE *, const DiskStats *);
+
+//moves nBlks blocks like readBlks/writeBlks without charging the model
+//or counting the request, for engines that do both at submission and
+//completion themselves
+INT transferBlksNoModel(DiskArray *, LONG, UINT, BYTE *, BOOL);
+
 //convert block id to disk array offset
-LONG bid2Offset(LONG);
+LONG bid2Offset(DiskArray *, LONG);
 
 //read a block from logical id i
 //args: device, 
@@ -45,6 +282,42 @@ INT readBlk(DiskArray *, LONG, BYTE *);
 //      content buf
 INT writeBlk(DiskArray *, LONG, BYTE *);
 
+//read a run of contiguous blocks starting from logical id i
+//args: device,
+//      first block id,
+//      number of blocks,
+//      content buf (nBlks * blkSize bytes)
+INT readBlks(DiskArray *, LONG, UINT, BYTE *);
+
+//write a run of contiguous blocks starting from logical id i
+//args: device,
+//      first block id,
+//      number of blocks,
+//      content buf (nBlks * blkSize bytes)
+INT writeBlks(DiskArray *, LONG, UINT, BYTE *);
+
+//scatter read of contiguous blocks starting from logical id i
+//args: device,
+//      first block id,
+//      io vectors, each a multiple of the block size long,
+//      number of io vectors
+INT readBlksv(DiskArray *, LONG, const struct iovec *, INT);
+
+//discards nBlks blocks starting from logical id i, punching a hole in
+//the image so they no longer take space on the host and read back as 0
+//returns -1 if the range is invalid or the host cannot punch holes
+//args: device,
+//      first block id,
+//      number of blocks
+INT discardBlks(DiskArray *, LONG, LONG);
+
+//gather write of contiguous blocks starting from logical id i
+//args: device,
+//      first block id,
+//      io vectors, each a multiple of the block size long,
+//      number of io vectors
+INT writeBlksv(DiskArray *, LONG, const struct iovec *, INT);
+
 #ifdef DEBUG
 //dump the disk to a per block file
 void dumpDisk();
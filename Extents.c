@@ -0,0 +1,359 @@
+/*
+ * Implementation of the extent trees of extent mapped inodes
+ */
+
+#include "FileSystem.h"
+#include "Extents.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+//a node on the path from the root to a leaf; the root is in the inode and
+//the nodes below it are pinned cache blocks
+typedef struct ExtentNode {
+    ExtentHeader* hdr;
+    //data block of the node, -1 for the root
+    LONG blkId;
+    //# of entries the node has room for
+    UINT cap;
+    //entry the path goes through, -1 before the first one in a leaf
+    INT idx;
+    BOOL modified;
+} ExtentNode;
+
+static Extent* entries(ExtentHeader* hdr) {
+    return (Extent*) (hdr + 1);
+}
+
+//the root has the inline area of the inode, which starts with the block
+//pointers
+static UINT rootCap(FileSystem* fs) {
+    return (fs->inlineSize - sizeof(ExtentHeader)) / sizeof(Extent);
+}
+
+static UINT blkCap(FileSystem* fs) {
+    return (fs->blkSize - sizeof(ExtentHeader)) / sizeof(Extent);
+}
+
+void initExtentRoot(INode* inode) {
+    ExtentHeader* hdr = (ExtentHeader*) inode->_in_inline;
+    hdr->_eh_nEntries = 0;
+    hdr->_eh_depth = 0;
+}
+
+//last entry starting at or before a file block, -1 if there is none
+static INT findEntry(ExtentHeader* hdr, LONG fileBlk) {
+    Extent* ex = entries(hdr);
+    INT lo = 0, hi = (INT) hdr->_eh_nEntries;
+    while(lo < hi) {
+        INT mid = (lo + hi) / 2;
+        if(ex[mid]._ex_fileBlk <= fileBlk) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+//unpins the nodes of a path below the root, writing the changed ones
+static INT release(FileSystem* fs, ExtentNode* path, INT depth) {
+    INT succ = 0;
+    for(INT level = depth; level > 0; level--) {
+        if(putDBlk(fs, path[level].blkId, (BYTE*) path[level].hdr, path[level].modified) == -1) {
+            succ = -1;
+        }
+    }
+    return succ;
+}
+
+//walks from the root to the leaf a file block belongs in; a block before
+//the first child of a node goes to the first child
+//returns the level of the leaf, -1 if a node cannot be read
+static INT descend(FileSystem* fs, INode* inode, LONG fileBlk, ExtentNode* path) {
+    path[0] = (ExtentNode) { .hdr = (ExtentHeader*) inode->_in_inline, .blkId = -1, .cap = rootCap(fs), .modified = false };
+    INT level = 0;
+    while(true) {
+        ExtentNode* node = &path[level];
+        node->idx = findEntry(node->hdr, fileBlk);
+        if(node->hdr->_eh_depth == 0) {
+            return level;
+        }
+        assert(node->hdr->_eh_nEntries > 0 && level < EXTENT_MAX_DEPTH);
+        if(node->idx < 0) {
+            node->idx = 0;
+        }
+        LONG child = entries(node->hdr)[node->idx]._ex_blk;
+        BYTE* blk = getDBlk(fs, child, DBLK_META);
+        if(blk == NULL) {
+            fprintf(stderr, "Error: failed to read extent tree block %ld\n", child);
+            release(fs, path, level);
+            return -1;
+        }
+        level++;
+        path[level] = (ExtentNode) { .hdr = (ExtentHeader*) blk, .blkId = child, .cap = blkCap(fs), .modified = false };
+    }
+}
+
+static void insertAt(ExtentHeader* hdr, INT pos, Extent e) {
+    Extent* ex = entries(hdr);
+    memmove(ex + pos + 1, ex + pos, (hdr->_eh_nEntries - pos) * sizeof(Extent));
+    ex[pos] = e;
+    hdr->_eh_nEntries++;
+}
+
+static void removeAt(ExtentHeader* hdr, INT pos) {
+    Extent* ex = entries(hdr);
+    memmove(ex + pos, ex + pos + 1, (hdr->_eh_nEntries - pos - 1) * sizeof(Extent));
+    hdr->_eh_nEntries--;
+}
+
+//# of blocks an insertion into the leaf of a path takes, one for every full
+//node from the leaf up
+static UINT splitBlks(ExtentNode* path, INT depth) {
+    UINT n = 0;
+    for(INT level = depth; level >= 0 && path[level].hdr->_eh_nEntries == path[level].cap; level--) {
+        n++;
+    }
+    return n;
+}
+
+//inserts an entry into a node of a path, a full node splits and passes an
+//entry for its new half up to its parent, a full root moves down whole
+static INT insertEntry(FileSystem* fs, ExtentNode* path, INT level, INT pos, Extent e) {
+    ExtentNode* node = &path[level];
+    node->modified = true;
+    if(node->hdr->_eh_nEntries < node->cap) {
+        insertAt(node->hdr, pos, e);
+        return 0;
+    }
+    if(level == 0 && node->hdr->_eh_depth == EXTENT_MAX_DEPTH) {
+        fprintf(stderr, "Error: extent tree is at its maximum depth!\n");
+        return -1;
+    }
+    LONG newId = allocDBlk(fs);
+    if(newId == -1) {
+        return -1;
+    }
+    BYTE buf[fs->blkSize];
+    memset(buf, 0, fs->blkSize);
+    ExtentHeader* newHdr = (ExtentHeader*) buf;
+    newHdr->_eh_depth = node->hdr->_eh_depth;
+
+    if(level == 0) {
+        //the new block takes every entry of the root, which is left with
+        //the one entry pointing to it
+        memcpy(entries(newHdr), entries(node->hdr), node->hdr->_eh_nEntries * sizeof(Extent));
+        newHdr->_eh_nEntries = node->hdr->_eh_nEntries;
+        insertAt(newHdr, pos, e);
+        node->hdr->_eh_depth++;
+        node->hdr->_eh_nEntries = 1;
+        entries(node->hdr)[0] = (Extent) { ._ex_fileBlk = entries(newHdr)[0]._ex_fileBlk, ._ex_blk = newId, ._ex_len = 0 };
+        #ifdef DEBUG_VERBOSE
+        printf("insertEntry moved the extent tree root down into block %ld, depth %u\n", newId, node->hdr->_eh_depth);
+        #endif
+        return writeDBlk(fs, newId, buf, DBLK_META);
+    }
+
+    //the upper half moves to the new block; an entry appended at the end
+    //starts the new block alone so that nodes filled in order stay full
+    UINT n = node->hdr->_eh_nEntries;
+    UINT keep = (UINT) pos == n ? n : n / 2;
+    memcpy(entries(newHdr), entries(node->hdr) + keep, (n - keep) * sizeof(Extent));
+    newHdr->_eh_nEntries = n - keep;
+    node->hdr->_eh_nEntries = keep;
+    if((UINT) pos <= keep && keep < n) {
+        insertAt(node->hdr, pos, e);
+    }
+    else {
+        insertAt(newHdr, pos - keep, e);
+    }
+    #ifdef DEBUG_VERBOSE
+    printf("insertEntry split extent tree block %ld at depth %u, new block %ld\n", node->blkId, newHdr->_eh_depth, newId);
+    #endif
+    if(writeDBlk(fs, newId, buf, DBLK_META) == -1) {
+        return -1;
+    }
+    Extent up = { ._ex_fileBlk = entries(newHdr)[0]._ex_fileBlk, ._ex_blk = newId, ._ex_len = 0 };
+    return insertEntry(fs, path, level - 1, path[level - 1].idx + 1, up);
+}
+
+//a file block before the first one of the leftmost child of a node lowers
+//the node's first key so that later walks find it
+static void lowerKeys(ExtentNode* path, INT depth, LONG fileBlk) {
+    for(INT level = 0; level < depth; level++) {
+        Extent* key = &entries(path[level].hdr)[path[level].idx];
+        if(key->_ex_fileBlk > fileBlk) {
+            key->_ex_fileBlk = fileBlk;
+            path[level].modified = true;
+        }
+    }
+}
+
+LONG extentBmap(FileSystem* fs, INode* inode, LONG fileBlk, Extent* found) {
+    ExtentNode path[EXTENT_MAX_DEPTH + 1];
+    INT depth = descend(fs, inode, fileBlk, path);
+    if(depth < 0) {
+        return -1;
+    }
+    LONG blk = -1;
+    ExtentNode* leaf = &path[depth];
+    if(leaf->idx >= 0) {
+        Extent* ex = &entries(leaf->hdr)[leaf->idx];
+        if(fileBlk < ex->_ex_fileBlk + ex->_ex_len) {
+            blk = ex->_ex_blk + fileBlk - ex->_ex_fileBlk;
+            if(found) {
+                *found = *ex;
+            }
+        }
+    }
+    release(fs, path, depth);
+    return blk;
+}
+
+LONG extentBalloc(FileSystem* fs, INode* inode, LONG fileBlk) {
+    ExtentNode path[EXTENT_MAX_DEPTH + 1];
+    INT depth = descend(fs, inode, fileBlk, path);
+    if(depth < 0) {
+        return -1;
+    }
+    ExtentNode* leaf = &path[depth];
+    Extent* ex = entries(leaf->hdr);
+    INT i = leaf->idx;
+    if(i >= 0 && fileBlk < ex[i]._ex_fileBlk + ex[i]._ex_len) {
+        LONG blk = ex[i]._ex_blk + fileBlk - ex[i]._ex_fileBlk;
+        release(fs, path, depth);
+        return blk;
+    }
+
+    LONG blk = allocDBlk(fs);
+    if(blk == -1) {
+        release(fs, path, depth);
+        return -1;
+    }
+    //the block continues the extent before it, the one after it or both
+    BOOL after = i >= 0 && ex[i]._ex_fileBlk + ex[i]._ex_len == fileBlk && ex[i]._ex_blk + ex[i]._ex_len == blk;
+    BOOL before = i + 1 < (INT) leaf->hdr->_eh_nEntries && ex[i + 1]._ex_fileBlk == fileBlk + 1 && ex[i + 1]._ex_blk == blk + 1;
+    INT succ = 0;
+    leaf->modified = true;
+    if(after && before) {
+        ex[i]._ex_len += 1 + ex[i + 1]._ex_len;
+        removeAt(leaf->hdr, i + 1);
+    }
+    else if(after) {
+        ex[i]._ex_len++;
+    }
+    else if(before) {
+        lowerKeys(path, depth, fileBlk);
+        ex[i + 1]._ex_fileBlk--;
+        ex[i + 1]._ex_blk--;
+        ex[i + 1]._ex_len++;
+    }
+    //a new extent, unless the splits it needs cannot get their blocks
+    else if(fs->superblock.nFreeDBlks < splitBlks(path, depth)) {
+        succ = -1;
+    }
+    else {
+        lowerKeys(path, depth, fileBlk);
+        succ = insertEntry(fs, path, depth, i + 1, (Extent) { ._ex_fileBlk = fileBlk, ._ex_blk = blk, ._ex_len = 1 });
+    }
+    if(release(fs, path, depth) == -1) {
+        succ = -1;
+    }
+    if(succ == -1) {
+        freeDBlk(fs, blk);
+        return -1;
+    }
+    return blk;
+}
+
+INT extentBfree(FileSystem* fs, INode* inode, LONG fileBlk) {
+    ExtentNode path[EXTENT_MAX_DEPTH + 1];
+    INT depth = descend(fs, inode, fileBlk, path);
+    if(depth < 0) {
+        return -1;
+    }
+    ExtentNode* leaf = &path[depth];
+    Extent* ex = leaf->idx >= 0 ? &entries(leaf->hdr)[leaf->idx] : NULL;
+    if(ex == NULL || fileBlk >= ex->_ex_fileBlk + ex->_ex_len) {
+        release(fs, path, depth);
+        fprintf(stderr, "Cannot free an unallocated fileBlkId %ld\n", fileBlk);
+        return -1;
+    }
+    LONG blk = ex->_ex_blk + fileBlk - ex->_ex_fileBlk;
+    LONG deadBlks[EXTENT_MAX_DEPTH];
+    UINT nDead = 0;
+    INT succ = 0;
+    leaf->modified = true;
+    if(ex->_ex_len == 1) {
+        //an emptied node goes, and its entry in the parent with it; an
+        //emptied root is a leaf again
+        removeAt(leaf->hdr, leaf->idx);
+        INT level = depth;
+        while(level > 0 && path[level].hdr->_eh_nEntries == 0) {
+            deadBlks[nDead++] = path[level].blkId;
+            path[level].modified = false;
+            level--;
+            removeAt(path[level].hdr, path[level].idx);
+            path[level].modified = true;
+        }
+        if(path[0].hdr->_eh_nEntries == 0) {
+            path[0].hdr->_eh_depth = 0;
+        }
+    }
+    else if(fileBlk == ex->_ex_fileBlk) {
+        ex->_ex_fileBlk++;
+        ex->_ex_blk++;
+        ex->_ex_len--;
+    }
+    else if(fileBlk == ex->_ex_fileBlk + ex->_ex_len - 1) {
+        ex->_ex_len--;
+    }
+    //a block inside an extent splits it in two, which fails before any
+    //change if the splits of the tree cannot get their blocks
+    else if(fs->superblock.nFreeDBlks < splitBlks(path, depth)) {
+        fprintf(stderr, "Error: no data block left to split the extent of fileBlkId %ld\n", fileBlk);
+        release(fs, path, depth);
+        return -1;
+    }
+    else {
+        Extent tail = { ._ex_fileBlk = fileBlk + 1, ._ex_blk = blk + 1, ._ex_len = ex->_ex_fileBlk + ex->_ex_len - fileBlk - 1 };
+        ex->_ex_len = fileBlk - ex->_ex_fileBlk;
+        succ = insertEntry(fs, path, depth, leaf->idx + 1, tail);
+    }
+    if(release(fs, path, depth) == -1) {
+        succ = -1;
+    }
+    for(UINT i = 0; i < nDead; i++) {
+        freeDBlk(fs, deadBlks[i]);
+    }
+    freeDBlk(fs, blk);
+    return succ;
+}
+
+static LONG countNode(FileSystem* fs, ExtentHeader* hdr, LONG* nTreeBlks) {
+    if(hdr->_eh_depth == 0) {
+        return hdr->_eh_nEntries;
+    }
+    LONG n = 0;
+    for(UINT i = 0; i < hdr->_eh_nEntries; i++) {
+        LONG child = entries(hdr)[i]._ex_blk;
+        BYTE* blk = getDBlk(fs, child, DBLK_META);
+        if(blk == NULL) {
+            continue;
+        }
+        (*nTreeBlks)++;
+        n += countNode(fs, (ExtentHeader*) blk, nTreeBlks);
+        putDBlk(fs, child, blk, false);
+    }
+    return n;
+}
+
+LONG countExtents(FileSystem* fs, INode* inode, LONG* nTreeBlks) {
+    if(!(inode->_in_flags & INODE_EXTENTS) || (inode->_in_flags & INODE_INLINE)) {
+        return 0;
+    }
+    return countNode(fs, (ExtentHeader*) inode->_in_inline, nTreeBlks);
+}
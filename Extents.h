@@ -0,0 +1,56 @@
+/*
+ * Extent mapped inodes
+ * An inode flagged INODE_EXTENTS maps its file blocks by extents, runs of
+ * file blocks stored in contiguous data blocks, instead of by direct and
+ * indirect block pointers.  The extents are the leaves of a tree whose root
+ * takes the place of the block pointers in the inode; a full node splits in
+ * two and a full root moves down into a data block of its own
+ */
+
+#pragma once
+#include "INode.h"
+
+struct FileSystem;
+
+//deepest an extent tree gets, far past what the file block ids reach
+#define EXTENT_MAX_DEPTH (5)
+
+//starts every extent tree node
+typedef struct ExtentHeader {
+
+    //# of entries following the header
+    UINT _eh_nEntries;
+
+    //# of levels of nodes below this one, 0 in a leaf
+    UINT _eh_depth;
+
+} ExtentHeader;
+
+//an entry of an extent tree node; in a leaf, _ex_len file blocks from
+//_ex_fileBlk on stored from data block _ex_blk on; above the leaves, the
+//child node in data block _ex_blk, holding the file blocks from
+//_ex_fileBlk up to the next entry's, with _ex_len unused
+typedef struct Extent {
+    LONG _ex_fileBlk;
+    LONG _ex_blk;
+    LONG _ex_len;
+} Extent;
+
+// starts an empty extent tree in an inode
+void initExtentRoot(INode*);
+
+// the data block holding a file block, -1 if it is not allocated; the
+// extent holding it goes to the last argument unless it is NULL
+LONG extentBmap(struct FileSystem*, INode*, LONG, Extent*);
+
+// the data block holding a file block, allocating it if needed; a block
+// right after the last one of the extent before it grows that extent
+// returns -1 if no data block is left
+LONG extentBalloc(struct FileSystem*, INode*, LONG);
+
+// frees a file block, shrinking its extent or splitting it in two
+INT extentBfree(struct FileSystem*, INode*, LONG);
+
+// # of extents of an inode, adding the # of tree blocks holding them to
+// the last argument
+LONG countExtents(struct FileSystem*, INode*, LONG*);
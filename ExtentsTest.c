@@ -0,0 +1,255 @@
+/**
+ * Tests the block mapping of files: extent trees, the bmap translation
+ * cache and the mapping of a range of blocks in one pass
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Directories.h"
+#include "Extents.h"
+
+static void fillBlk(BYTE* blk, UINT file, LONG fileBlk) {
+    for(UINT i = 0; i < DEFAULT_BLK_SIZE; i += sizeof(LONG)) {
+        *(LONG*) (blk + i) = fileBlk * 4 + file;
+    }
+}
+
+//writes a file block by block from the start
+static void writeSeq(FileSystem* fs, char* path, LONG nBlks) {
+    BYTE blk[DEFAULT_BLK_SIZE];
+    assert(l2_mknod(fs, path, 0, 0) >= 0);
+    assert(l2_open(fs, path, OP_WRITE) == 0);
+    for(LONG i = 0; i < nBlks; i++) {
+        memset(blk, (BYTE) i, sizeof(blk));
+        assert(l2_write(fs, path, i * sizeof(blk), blk, sizeof(blk)) == sizeof(blk));
+    }
+    l2_close(fs, path, OP_WRITE);
+}
+
+//a file written in order is a single extent in its inode and takes no
+//block for its mapping, where block pointers past the direct ones do
+static void testSequentialExtents() {
+    FileSystem fs;
+    MountOptions opts;
+    INode inode;
+    BYTE blk[DEFAULT_BLK_SIZE];
+    initMountOptions(&opts);
+    opts.extents = true;
+    assert(l2_initfs(4096, 64, 0, 0, &opts, &fs) == 0);
+    LONG nBlks = INODE_NUM_DIRECT_BLKS + fs.nPtrsPerBlk + 100;
+    LONG nFree = fs.superblock.nFreeDBlks;
+    writeSeq(&fs, "/seq", nBlks);
+    assert(fs.superblock.nFreeDBlks == nFree - nBlks);
+    l2_unmount(&fs);
+
+    assert(l2_mount(&fs, &opts) == 0);
+    LONG treeBlks = 0;
+    Extent ex;
+    assert(readINode(&fs, l2_namei(&fs, "/seq"), &inode) == 0 && (inode._in_flags & INODE_EXTENTS));
+    assert(countExtents(&fs, &inode, &treeBlks) == 1 && treeBlks == 0);
+    LONG first = extentBmap(&fs, &inode, 0, &ex);
+    assert(ex._ex_fileBlk == 0 && ex._ex_blk == first && ex._ex_len == nBlks);
+    assert(bmap(&fs, &inode, nBlks - 1) == first + nBlks - 1 && bmap(&fs, &inode, nBlks) == -1);
+    assert(l2_open(&fs, "/seq", OP_READ) == 0);
+    for(LONG i = 0; i < nBlks; i += 97) {
+        assert(l2_read(&fs, "/seq", i * sizeof(blk), blk, sizeof(blk)) == sizeof(blk) && blk[0] == (BYTE) i);
+    }
+    l2_close(&fs, "/seq", OP_READ);
+
+    //the same file mapped by block pointers needs its pointer blocks
+    fs.options.extents = false;
+    nFree = fs.superblock.nFreeDBlks;
+    writeSeq(&fs, "/ptr", nBlks);
+    assert(readINode(&fs, l2_namei(&fs, "/ptr"), &inode) == 0 && !(inode._in_flags & INODE_EXTENTS));
+    assert(inode._in_sIndirectBlocks[0] != -1 && inode._in_dIndirectBlocks[0] != -1);
+    assert(fs.superblock.nFreeDBlks < nFree - nBlks);
+    l2_unmount(&fs);
+}
+
+static void testExtents() {
+    //interleaved files get one extent per block, and a file written back
+    //to front inserts each in front of the others; the trees grow two levels
+    FileSystem fs;
+    MountOptions opts;
+    INode inode;
+    BYTE blk[DEFAULT_BLK_SIZE], back[DEFAULT_BLK_SIZE];
+    char* paths[3] = { "/f", "/g", "/h" };
+    initMountOptions(&opts);
+    opts.extents = true;
+    assert(l2_initfs(8192, 64, 0, 0, &opts, &fs) == 0);
+    LONG nFree = fs.superblock.nFreeDBlks;
+    LONG nBlks = 1800;
+    for(UINT f = 0; f < 3; f++) {
+        assert(l2_mknod(&fs, paths[f], 0, 0) >= 0);
+        assert(l2_open(&fs, paths[f], OP_WRITE) == 0);
+    }
+    for(LONG i = 0; i < nBlks; i++) {
+        fillBlk(blk, 0, i);
+        assert(l2_write(&fs, "/f", i * sizeof(blk), blk, sizeof(blk)) == sizeof(blk));
+        fillBlk(blk, 1, i);
+        assert(l2_write(&fs, "/g", i * sizeof(blk), blk, sizeof(blk)) == sizeof(blk));
+        if(i < 400) {
+            fillBlk(blk, 2, 399 - i);
+            assert(l2_write(&fs, "/h", (399 - i) * sizeof(blk), blk, sizeof(blk)) == sizeof(blk));
+        }
+    }
+    for(UINT f = 0; f < 3; f++) {
+        l2_close(&fs, paths[f], OP_WRITE);
+    }
+    l2_unmount(&fs);
+
+    assert(l2_mount(&fs, &opts) == 0);
+    for(UINT f = 0; f < 3; f++) {
+        LONG treeBlks = 0;
+        assert(readINode(&fs, l2_namei(&fs, paths[f]), &inode) == 0);
+        LONG nExtents = countExtents(&fs, &inode, &treeBlks);
+        assert(nExtents == inode._in_filesize / DEFAULT_BLK_SIZE && treeBlks > 1);
+        assert(l2_open(&fs, paths[f], OP_READ) == 0);
+        for(LONG i = 0; i < inode._in_filesize / DEFAULT_BLK_SIZE; i++) {
+            fillBlk(blk, f, i);
+            assert(l2_read(&fs, paths[f], i * sizeof(back), back, sizeof(back)) == sizeof(back));
+            assert(memcmp(blk, back, sizeof(blk)) == 0);
+        }
+        l2_close(&fs, paths[f], OP_READ);
+    }
+
+    //freeing a block inside an extent splits it, one at its end shrinks it
+    assert(l2_mknod(&fs, "/s", 0, 0) >= 0);
+    assert(l2_open(&fs, "/s", OP_WRITE) == 0);
+    for(LONG i = 0; i < 64; i++) {
+        fillBlk(blk, 3, i);
+        assert(l2_write(&fs, "/s", i * sizeof(blk), blk, sizeof(blk)) == sizeof(blk));
+    }
+    l2_close(&fs, "/s", OP_WRITE);
+    UINT id = l2_namei(&fs, "/s");
+    LONG treeBlks = 0;
+    assert(readINode(&fs, id, &inode) == 0 && countExtents(&fs, &inode, &treeBlks) == 1);
+    LONG blk10 = bmap(&fs, &inode, 10);
+    assert(bfree(&fs, &inode, 20) == 0 && bfree(&fs, &inode, 63) == 0);
+    assert(countExtents(&fs, &inode, &treeBlks) == 2 && treeBlks == 0);
+    assert(bmap(&fs, &inode, 20) == -1 && bmap(&fs, &inode, 21) == blk10 + 11 && bmap(&fs, &inode, 63) == -1);
+    inode._in_filesize = 63 * DEFAULT_BLK_SIZE;
+    assert(writeINode(&fs, id, &inode) == 0);
+
+    //truncating and unlinking give back every data and tree block
+    assert(l2_truncate(&fs, "/f", 100 * DEFAULT_BLK_SIZE) == 0);
+    assert(readINode(&fs, l2_namei(&fs, "/f"), &inode) == 0 && countExtents(&fs, &inode, &treeBlks) == 100);
+    for(UINT f = 0; f < 3; f++) {
+        assert(l2_unlink(&fs, paths[f]) == 0);
+    }
+    assert(l2_unlink(&fs, "/s") == 0);
+    assert(fs.superblock.nFreeDBlks == nFree);
+    l2_unmount(&fs);
+}
+
+//bmap notes the run of contiguous blocks and the pointer block a
+//translation came from in the inode; the blocks after it in the run map
+//from the inode alone and agree with a lookup through the pointers
+static void testBmapCache() {
+    FileSystem fs;
+    MountOptions opts;
+    INode inode;
+    initMountOptions(&opts);
+    assert(l2_initfs(8192, 64, 0, 0, &opts, &fs) == 0);
+    LONG nBlks = INODE_NUM_DIRECT_BLKS + fs.nPtrsPerBlk + 600;
+    writeSeq(&fs, "/seq", nBlks);
+    l2_unmount(&fs);
+
+    assert(l2_mount(&fs, &opts) == 0);
+    UINT id = l2_namei(&fs, "/seq");
+    assert(readINode(&fs, id, &inode) == 0);
+    BmapCache* bc = &inode._in_bmap;
+    assert(bc->_bc_len == 0 && bc->_bc_ptrFileBlk == -1);
+
+    //a block in the double indirect range
+    LONG f = INODE_NUM_DIRECT_BLKS + fs.nPtrsPerBlk + 10;
+    LONG blk = bmap(&fs, &inode, f);
+    assert(blk >= 0 && bc->_bc_fileBlk <= f && f + 1 < bc->_bc_fileBlk + bc->_bc_len);
+    assert(bc->_bc_blk + f - bc->_bc_fileBlk == blk);
+    assert(bc->_bc_ptrFileBlk != -1 && bc->_bc_ptrFileBlk <= f && f < bc->_bc_ptrFileBlk + fs.nPtrsPerBlk);
+    LONG lookups = fs.dCache._dCache_hits + fs.dCache._dCache_misses;
+    assert(bmap(&fs, &inode, f + 1) == blk + 1);
+    assert(fs.dCache._dCache_hits + fs.dCache._dCache_misses == lookups);
+    INode cold = inode;
+    clearBmapCache(&cold);
+    assert(bmap(&fs, &cold, f + 1) == blk + 1);
+
+    //a freed block leaves the translations, a new one joins them
+    assert(bfree(&fs, &inode, f + 1) == 0);
+    assert(bmap(&fs, &inode, f + 1) == -1);
+    assert(!(bc->_bc_fileBlk <= f + 1 && f + 1 < bc->_bc_fileBlk + bc->_bc_len));
+    cold = inode;
+    clearBmapCache(&cold);
+    assert(bmap(&fs, &inode, f + 2) == bmap(&fs, &cold, f + 2));
+    LONG newBlk = balloc(&fs, &inode, f + 1);
+    assert(newBlk >= 0 && bmap(&fs, &inode, f + 1) == newBlk);
+    clearBmapCache(&cold);
+    assert(bmap(&fs, &cold, f + 1) == newBlk);
+    assert(writeINode(&fs, id, &inode) == 0);
+
+    //a truncate takes the blocks past the end out of the cached runs
+    assert(bmap(&fs, &inode, INODE_NUM_DIRECT_BLKS + 3) >= 0);
+    assert(l2_truncate(&fs, "/seq", (INODE_NUM_DIRECT_BLKS + 3) * DEFAULT_BLK_SIZE) == 0);
+    assert(readINode(&fs, id, &inode) == 0);
+    assert(bmap(&fs, &inode, INODE_NUM_DIRECT_BLKS + 3) == -1);
+    l2_unmount(&fs);
+}
+
+//ballocRange maps a run of new file blocks across the direct, single and
+//double indirect ranges in one pass, writing each pointer block once;
+//mapping the run again allocates nothing
+static void testRangeMapping() {
+    FileSystem fs;
+    MountOptions opts;
+    DiskStats stats;
+    INode inode;
+    initMountOptions(&opts);
+    opts.schedDepth = 0;
+    opts.inlineData = false;
+    assert(l2_initfs(4096, 64, 0, 0, &opts, &fs) == 0);
+    assert(l2_mknod(&fs, "/big", 0, 0) >= 0);
+    UINT id = l2_namei(&fs, "/big");
+    assert(readINode(&fs, id, &inode) == 0);
+    LONG first = INODE_NUM_DIRECT_BLKS - 4;
+    LONG n = fs.nPtrsPerBlk + 8;
+    LONG blks[n], again[n];
+    LONG nFree = fs.superblock.nFreeDBlks;
+
+    resetDiskStats(fs.disk);
+    assert(ballocRange(&fs, &inode, first, n, blks) == n);
+    getDiskStats(fs.disk, &stats);
+    //the single indirect block, the double indirect one and its first
+    //pointer block, and nothing of the data
+    assert(fs.superblock.nFreeDBlks == nFree - n - 3);
+    assert(stats._st_writes <= 3 + 2);
+    for(LONG i = 0; i < n; i++) {
+        assert(blks[i] >= 0 && bmap(&fs, &inode, first + i) == blks[i]);
+    }
+
+    assert(ballocRange(&fs, &inode, first, n, again) == n);
+    assert(memcmp(blks, again, sizeof(blks)) == 0 && fs.superblock.nFreeDBlks == nFree - n - 3);
+    inode._in_filesize = (first + n) * DEFAULT_BLK_SIZE;
+    assert(writeINode(&fs, id, &inode) == 0);
+    l2_unmount(&fs);
+
+    assert(l2_mount(&fs, &opts) == 0);
+    assert(readINode(&fs, id, &inode) == 0);
+    for(LONG i = 0; i < n; i++) {
+        assert(bmap(&fs, &inode, first + i) == blks[i]);
+    }
+    l2_unmount(&fs);
+}
+
+int main() {
+    printf("Verifying extent mapped files...\n");
+    testSequentialExtents();
+    testExtents();
+    printf("Verifying the bmap translation cache...\n");
+    testBmapCache();
+    printf("Verifying range mapping...\n");
+    testRangeMapping();
+    return 0;
+}
@@ -4,6 +4,8 @@
  */
 
 #include "FileSystem.h"
+#include "Extents.h"
+#include "Directory.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,10 +13,47 @@
 #include <time.h>
 #include <inttypes.h>
 
-INT makefs(LONG nDBlks, UINT nINodes, FileSystem* fs) {
+INT initGeometry(FileSystem* fs, UINT blkSize, UINT inodeSize) {
+    if(blkSize == 0)
+        blkSize = DEFAULT_BLK_SIZE;
+    if(inodeSize == 0)
+        inodeSize = DEFAULT_INODE_SIZE;
+
+    //both sizes are powers of two so that inodes pack whole blocks
+    if(blkSize < MIN_BLK_SIZE || blkSize > MAX_BLK_SIZE || (blkSize & (blkSize - 1)) != 0) {
+        fprintf(stderr, "Error: block size %d must be a power of two between %d and %d!\n", blkSize, MIN_BLK_SIZE, MAX_BLK_SIZE);
+        return -1;
+    }
+    if(inodeSize < INODE_MIN_SIZE || inodeSize > MAX_INODE_SIZE || inodeSize > blkSize || (inodeSize & (inodeSize - 1)) != 0) {
+        fprintf(stderr, "Error: inode size %d must be a power of two between %ld and %d!\n", inodeSize, INODE_MIN_SIZE, MAX_INODE_SIZE);
+        return -1;
+    }
+
+    fs->blkSize = blkSize;
+    fs->inodeSize = inodeSize;
+    fs->inodesPerBlk = blkSize / inodeSize;
+    //the in core fields at the end of an inode never reach the disk
+    fs->diskINodeSize = inodeSize < offsetof(INode, _in_bmap) ? inodeSize : offsetof(INode, _in_bmap);
+    fs->inlineSize = fs->diskINodeSize - offsetof(INode, _in_inline);
+    fs->nPtrsPerBlk = blkSize / sizeof(LONG);
+
+    LONG n = fs->nPtrsPerBlk;
+    fs->maxFileBlks = INODE_NUM_DIRECT_BLKS + INODE_NUM_S_INDIRECT_BLKS * n
+            + INODE_NUM_D_INDIRECT_BLKS * n * n + INODE_NUM_T_INDIRECT_BLKS * n * n * n;
+    fs->maxFileSize = fs->maxFileBlks * blkSize;
+    fs->maxFileNumInDir = fs->maxFileSize / (FILE_NAME_LENGTH + sizeof(INT));
+    return 0;
+}
+
+INT makefs(LONG nDBlks, UINT nINodes, UINT blkSize, UINT inodeSize, MountOptions* opts, FileSystem* fs) {
     #ifdef DEBUG 
-    printf("makefs(%d, %d, %p)\n", nDBlks, nINodes, (void*) fs); 
+    printf("makefs(%d, %d, %d, %d, %p)\n", nDBlks, nINodes, blkSize, inodeSize, (void*) fs); 
     #endif
+
+    memset(&fs->superblock, 0, sizeof(SuperBlock));
+    if(initGeometry(fs, blkSize, inodeSize) != 0) {
+        return 1;
+    }
     
     //validate file system parameters
     #ifndef DEBUG
@@ -22,36 +61,40 @@ INT makefs(LONG nDBlks, UINT nINodes, FileSystem* fs) {
         fprintf(stderr, "Error: must have a positive number of data blocks/inodes!\n");
         return 1;
     }
-    else if(nDBlks < FREE_DBLK_CACHE_SIZE) {
-        fprintf(stderr, "Error: must have at least %ld data blocks!\n", FREE_DBLK_CACHE_SIZE);
+    else if(nDBlks < fs->nPtrsPerBlk) {
+        fprintf(stderr, "Error: must have at least %d data blocks!\n", fs->nPtrsPerBlk);
         return 1;
     }
-    else if(nINodes < FREE_INODE_CACHE_SIZE) {
-        fprintf(stderr, "Error: must have at least %d inodes!\n", FREE_INODE_CACHE_SIZE);
+    else if(nINodes == 0) {
+        fprintf(stderr, "Error: must have at least one inode!\n");
         return 1;
     }
-    else if(nINodes % INODES_PER_BLK != 0) {
+    else if(nINodes % fs->inodesPerBlk != 0) {
         fprintf(stderr, "Error: inodes must divide evenly into blocks!\n");
         return 1;
     }
     #endif
 
     //compute file system size 
-    LONG nBytes = BLK_SIZE + nINodes * INODE_SIZE + (nDBlks * BLK_SIZE);
+    LONG nBytes = fs->blkSize + (LONG)nINodes * fs->inodeSize
+            + (LONG)iBitmapBlks(nINodes, fs->blkSize) * fs->blkSize + (nDBlks * fs->blkSize);
     #ifdef DEBUG
-    printf("BLK_SIZE: %d, INODE_SIZE: %d, nINodes: %d, nDBlks: %d\n", BLK_SIZE, INODE_SIZE, nINodes, nDBlks);
+    printf("blkSize: %d, inodeSize: %d, nINodes: %d, nDBlks: %d\n", fs->blkSize, fs->inodeSize, nINodes, nDBlks);
     printf("Computing file system size...nBytes = %" PRIu64 "\n", nBytes); 
     #endif
     if(nBytes > MAX_FS_SIZE) {
         fprintf(stderr, "Error: file system size %" PRIu64 " exceeds max allowed size %" PRIu64 "!\n", nBytes, MAX_FS_SIZE);
         return 1;
     }
-    //fs->nBytes = (BLK_SIZE + nINodes * INODE_SIZE + nDBlks * BLK_SIZE);
     
     fs->nBytes = nBytes;
-    //compute offsets for inode/data blocks
-    fs->diskINodeBlkOffset = SUPERBLOCK_OFFSET + 1;
-    fs->diskDBlkOffset = fs->diskINodeBlkOffset + nINodes / INODES_PER_BLK;
+    if(opts != NULL)
+        fs->options = *opts;
+    else
+        initMountOptions(&fs->options);
+
+    //compute offsets for inode/bitmap/data blocks
+    setLayout(fs, nINodes);
 
     //initialize in-memory superblock
     #ifdef DEBUG 
@@ -59,43 +102,46 @@ INT makefs(LONG nDBlks, UINT nINodes, FileSystem* fs) {
     #endif
     fs->superblock.nDBlks = nDBlks;
     fs->superblock.nFreeDBlks = nDBlks;
-    fs->superblock.pFreeDBlksHead = 0;
-    fs->superblock.pNextFreeDBlk = FREE_DBLK_CACHE_SIZE - 1;
+    fs->superblock.pNextFreeDBlk = fs->nPtrsPerBlk - 1;
     
     fs->superblock.nINodes = nINodes;
     fs->superblock.nFreeINodes = nINodes;
-    fs->superblock.pNextFreeINode = fs->superblock.nINodes >= FREE_INODE_CACHE_SIZE
-            ? FREE_INODE_CACHE_SIZE - 1 : fs->superblock.nINodes - 1;
+    fs->superblock.nextFreeINodeGroup = 0;
 
-    fs->superblock.modified = true;
+    fs->superblock.blkSize = fs->blkSize;
+    fs->superblock.inodeSize = fs->inodeSize;
 
-    //initialize superblock free inode cache
-    #ifdef DEBUG 
-    printf("Initializing superblock free inode cache...\n");
-    #endif
-    if(fs->superblock.nINodes < FREE_INODE_CACHE_SIZE) {
-        //special case: not enough inodes to fill cache
-        fprintf(stderr, "Warning: %d inodes do not fill cache of size %d!\n", fs->superblock.nINodes, FREE_INODE_CACHE_SIZE);
-        for(UINT i = 0; i < fs->superblock.nINodes; i++) {
-            fs->superblock.freeINodeCache[i] = i;
-        }
-        for(UINT i = fs->superblock.nINodes; i < FREE_INODE_CACHE_SIZE; i++) {
-            fs->superblock.freeINodeCache[i] = -1;
-        }
-    }
-    else {
-        //typical case: fill cache with first inodes
-        for(UINT i = 0; i < FREE_INODE_CACHE_SIZE; i++) {
-            fs->superblock.freeINodeCache[i] = i;
-        }
+    //stripe layout, checked again at every mount
+    fs->superblock.stripeWidth = fs->options.stripeWidth == 0 ? 1 : fs->options.stripeWidth;
+    fs->superblock.stripeUnit = fs->options.stripeUnit == 0 ? DSK_DEFAULT_STRIPE_UNIT : fs->options.stripeUnit;
+    if(fs->superblock.stripeWidth > DSK_MAX_MEMBERS) {
+        fprintf(stderr, "Error: cannot stripe over more than %d images!\n", DSK_MAX_MEMBERS);
+        return 1;
     }
+
+    fs->superblock.modified = true;
     
     //initialize the disk
     #ifdef DEBUG 
     printf("Initializing disk emulator...\n"); 
     #endif
     fs->disk = malloc(sizeof(DiskArray));
-    initDisk(fs->disk, fs->nBytes);
+    if(initStripedDisk(fs->disk, fs->nBytes, fs->blkSize, fs->options.diskFlags,
+                       fs->superblock.stripeWidth, fs->superblock.stripeUnit) != 0) {
+        fprintf(stderr, "Error: failed to create the disk images!\n");
+        closeDisk(fs->disk);
+        free(fs->disk);
+        return 1;
+    }
+    if(fs->options.diskModel != DSK_MODEL_NONE) {
+        DiskModel model;
+        initDiskModel(&model, fs->options.diskModel);
+        setDiskModel(fs->disk, &model);
+    }
+    initAsyncDisk(&fs->aio, fs->disk, fs->options.ioEngine, fs->options.ioDepth);
+    initIOSched(&fs->sched, fs->disk, &fs->aio, fs->options.schedDepth);
+    fs->nDiscards = 0;
+    fs->lastTrimNs = diskClockNs();
 
     //create inode list on disk
     #ifdef DEBUG 
@@ -103,164 +149,421 @@ INT makefs(LONG nDBlks, UINT nINodes, FileSystem* fs) {
     #endif
     UINT nextINodeId = 0;
     UINT nextINodeBlkId = fs->diskINodeBlkOffset;
-    BYTE nextINodeBlkBuf[INODES_PER_BLK * INODE_SIZE]; //note that this zeroes out the buffer
+    BYTE nextINodeBlkBuf[fs->blkSize];
+    memset(nextINodeBlkBuf, 0, fs->blkSize);
 
     while(nextINodeBlkId < fs->diskDBlkOffset) {
         //fill inode blocks one at a time
-        for(UINT i = 0; i < INODES_PER_BLK; i++) {
-            INode* inode = (INode*) &nextINodeBlkBuf[i * INODE_SIZE];
-            initializeINode(inode, nextINodeId++);
-            inode->_in_type = FREE;
+        //only the on-disk part of each inode fits its slot
+        for(UINT i = 0; i < fs->inodesPerBlk; i++) {
+            INode inode;
+            initializeINode(&inode, nextINodeId++);
+            inode._in_type = FREE;
+            memcpy(&nextINodeBlkBuf[i * fs->inodeSize], &inode, fs->diskINodeSize);
         }
 
         writeBlk(fs->disk, nextINodeBlkId, nextINodeBlkBuf);
 
         nextINodeBlkId++;
     }
+
+    //create the free inode bitmap on disk, every inode free
+    #ifdef DEBUG 
+    printf("Creating disk free inode bitmap...\n"); 
+    #endif
+    initINodeBitmap(&fs->iBitmap, nINodes, fs->blkSize, 0);
+    for(UINT blk = 0; blk < fs->iBitmap._ib_nBlks; blk++) {
+        writeBlk(fs->disk, fs->diskIBitmapOffset + blk, iBitmapBlk(&fs->iBitmap, blk));
+    }
     
     //initialize datablk cache
     #ifdef DEBUG 
     printf("Initializing DBlkCache...\n"); 
     #endif
-    initDBlkCache(&fs->dCache);
+    setupDBlkCache(fs);
+    initWriteBack(fs);
+    initWarmUp(fs, false);
 
     //create free block list on disk
     #ifdef DEBUG 
     printf("Creating disk free block list...\n"); 
     #endif
+    //each list block heads a group of nPtrsPerBlk blocks and is the last
+    //block of its group, with the rest of the group enumerated from the top slot
+    //down, so that a fresh filesystem hands out data blocks in ascending order
     LONG nextListBlk = 0;
-    LONG freeDBlkList[FREE_DBLK_CACHE_SIZE];
+    LONG freeDBlkList[fs->nPtrsPerBlk];
+    fs->superblock.pFreeDBlksHead = (fs->superblock.nDBlks < fs->nPtrsPerBlk
+            ? fs->superblock.nDBlks : fs->nPtrsPerBlk) - 1;
     
     while(nextListBlk < fs->superblock.nDBlks) {
-        if(fs->superblock.nDBlks < nextListBlk + FREE_DBLK_CACHE_SIZE) {
-            //special case: not enough data blocks to fill another cache block
-            fprintf(stderr, "Warning: %ld data blocks do not divide evenly into caches of size %ld!\n", fs->superblock.nDBlks, FREE_DBLK_CACHE_SIZE);
+        LONG listHead;
+        if(fs->superblock.nDBlks <= nextListBlk + fs->nPtrsPerBlk) {
+            //special case: last cache block, the head goes out last from slot 0 or
+            //the lowest filled slot, unfilled slots are marked -1
             UINT remaining = fs->superblock.nDBlks - nextListBlk;
-            UINT offset = FREE_DBLK_CACHE_SIZE - remaining;
-            for(int i = 0; i < offset; i++) {
-                freeDBlkList[i] = -1;
+            if(remaining < fs->nPtrsPerBlk) {
+                fprintf(stderr, "Warning: %ld data blocks do not divide evenly into caches of size %d!\n", fs->superblock.nDBlks, fs->nPtrsPerBlk);
             }
-            for(int i = offset; i < FREE_DBLK_CACHE_SIZE; i++) {
-                freeDBlkList[i] = nextListBlk + i - offset;
+            for(UINT i = 0; i < fs->nPtrsPerBlk; i++) {
+                freeDBlkList[i] = -1;
             }
-        }
-        else if(fs->superblock.nDBlks == nextListBlk + FREE_DBLK_CACHE_SIZE) {
-            //special case: exactly enough data blocks to fill last cache block
-            for(UINT i = 0; i < FREE_DBLK_CACHE_SIZE; i++) {
-                freeDBlkList[i] = nextListBlk + i;
+            for(UINT k = 0; k < remaining; k++) {
+                freeDBlkList[fs->nPtrsPerBlk - 1 - k] = nextListBlk + k;
             }
+            listHead = nextListBlk + remaining - 1;
         }
         else {
             //typical case: fill next cache block
             //next head pointer goes in first entry
-            freeDBlkList[0] = nextListBlk + FREE_DBLK_CACHE_SIZE;
+            listHead = nextListBlk + fs->nPtrsPerBlk - 1;
+            LONG nextRemaining = fs->superblock.nDBlks - nextListBlk - fs->nPtrsPerBlk;
+            freeDBlkList[0] = listHead + (nextRemaining < fs->nPtrsPerBlk ? nextRemaining : fs->nPtrsPerBlk);
 
-            //rest of free blocks are enumerated in order
-            for(UINT i = 1; i < FREE_DBLK_CACHE_SIZE; i++) {
-                freeDBlkList[i] = nextListBlk + i;
+            //rest of free blocks are enumerated in reverse, lowest id on top
+            for(UINT k = 0; k < fs->nPtrsPerBlk - 1; k++) {
+                freeDBlkList[fs->nPtrsPerBlk - 1 - k] = nextListBlk + k;
             }
         }
 
         //write completed block and advance to next head
-        writeDBlk(fs, nextListBlk, (BYTE*) freeDBlkList);
-        nextListBlk += FREE_DBLK_CACHE_SIZE;
+        writeDBlk(fs, listHead, (BYTE*) freeDBlkList, DBLK_META);
+        nextListBlk += fs->nPtrsPerBlk;
     }
     
     //write superblock to disk
     #ifdef DEBUG 
     printf("Writing superblock to disk...\n"); 
     #endif
-    BYTE superblockBuf[BLK_SIZE];
+    BYTE superblockBuf[fs->blkSize];
+    memset(superblockBuf, 0, fs->blkSize);
     blockify(&fs->superblock, superblockBuf);
     writeBlk(fs->disk, SUPERBLOCK_OFFSET, superblockBuf);
     fs->superblock.modified = false;
     
     //load free block cache into superblock
-    readDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache));
+    readDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache), DBLK_META);
 
     //initialize in-core caches (open file table, inode table, inode cache)
     initOpenFileTable(&fs->openFileTable);
-    initINodeTable(&fs->inodeTable);
-    initINodeCache(&fs->inodeCache);
+    setupINodeTable(fs);
     
     return 0;
 }
 
+void setLayout(FileSystem* fs, UINT nINodes) {
+    fs->diskINodeBlkOffset = SUPERBLOCK_OFFSET + 1;
+    fs->diskIBitmapOffset = fs->diskINodeBlkOffset + nINodes / fs->inodesPerBlk;
+    fs->diskDBlkOffset = fs->diskIBitmapOffset + iBitmapBlks(nINodes, fs->blkSize);
+}
+
+INT loadINodeBitmap(FileSystem* fs) {
+    initINodeBitmap(&fs->iBitmap, fs->superblock.nINodes, fs->blkSize, fs->superblock.nextFreeINodeGroup);
+    for(UINT blk = 0; blk < fs->iBitmap._ib_nBlks; blk++) {
+        if(schedReadBlk(&fs->sched, fs->diskIBitmapOffset + blk, iBitmapBlk(&fs->iBitmap, blk)) == -1) {
+            fprintf(stderr, "Error: failed to read free inode bitmap blk %d\n", blk);
+            destroyINodeBitmap(&fs->iBitmap);
+            return -1;
+        }
+        loadINodeBitmapBlk(&fs->iBitmap, blk);
+    }
+
+    //the bitmap is what allocation goes by, the count follows it
+    UINT nFree = 0;
+    for(UINT g = 0; g < fs->iBitmap._ib_nGroups; g++) {
+        nFree += fs->iBitmap._ib_groupFree[g];
+    }
+    if(nFree != fs->superblock.nFreeINodes) {
+        fprintf(stderr, "Warning: free inode bitmap has %d free inodes, superblock counts %d\n", nFree, fs->superblock.nFreeINodes);
+        fs->superblock.nFreeINodes = nFree;
+    }
+    return 0;
+}
+
 INT closefs(FileSystem* fs) {
+    stopFlusher(fs);
+    stopWarmUp(fs);
+    INT succ = syncINodes(fs, true);
+    if(syncDBlks(fs) != 0) {
+        succ = -1;
+    }
+    if(closeIOSched(&fs->sched) != 0) {
+        succ = -1;
+    }
+    closeAsyncDisk(&fs->aio);
     closeDisk(fs->disk);
     free(fs->disk);
+    destroyDBlkCache(&fs->dCache);
+    destroyINodeTable(&fs->inodeTable);
+    destroyINodeBitmap(&fs->iBitmap);
+    pthread_cond_destroy(&fs->flushCond);
+    pthread_mutex_destroy(&fs->lock);
+    return succ;
+}
+
+//the cache writes dirty blocks back through the scheduler, so a flush
+//goes out sorted and merged
+static INT writeBackDBlk(void* ctx, LONG id, BYTE* buf) {
+    FileSystem* fs = (FileSystem*) ctx;
+    return schedWriteBlk(&fs->sched, id + fs->diskDBlkOffset, buf);
+}
+
+void setupDBlkCache(FileSystem* fs) {
+    initDBlkCache(&fs->dCache, fs->blkSize, fs->options.dCacheBlks, fs->options.dCacheWays, fs->options.dCachePolicy);
+    UINT nBlks = fs->dCache._dCache_nSets * fs->dCache._dCache_nWays;
+    setDBlkCacheMetaBlks(&fs->dCache, fs->options.dCacheMetaBlks > 0 ? fs->options.dCacheMetaBlks : nBlks / 4);
+}
+
+//writes back the dirty in-core inodes of one inode block, and the lazy
+//ones along with them or when lazy is set; the block is read first only
+//when some of its inodes are not in core
+static INT flushINodeBlk(FileSystem* fs, UINT blk, BOOL lazy) {
+    UINT first = (blk - fs->diskINodeBlkOffset) * fs->inodesPerBlk;
+    INodeEntry* entries[fs->inodesPerBlk];
+    UINT nInCore = 0, nDirty = 0, nLazy = 0;
+    for(UINT i = 0; i < fs->inodesPerBlk; i++) {
+        entries[i] = first + i < fs->superblock.nINodes ? findINodeEntry(&fs->inodeTable, first + i) : NULL;
+        nInCore += entries[i] != NULL;
+        nDirty += entries[i] != NULL && entries[i]->_in_dirty;
+        nLazy += entries[i] != NULL && entries[i]->_in_lazy;
+    }
+    if(nDirty == 0 && (!lazy || nLazy == 0)) {
+        return 0;
+    }
+
+    //on the mmap backend, update the inodes in place
+    BYTE* mapped = mapBlk(fs->disk, blk);
+    BYTE* buf = mapped != NULL ? mapped : getBlkBuf(fs->disk);
+    if(mapped == NULL && nInCore < fs->inodesPerBlk) {
+        if(schedReadBlk(&fs->sched, blk, buf) == -1) {
+            fprintf(stderr, "Error: flushINodeBlk failed to read blk %d from disk\n", blk);
+            putBlkBuf(fs->disk, buf);
+            return -1;
+        }
+    }
+    else if(mapped == NULL) {
+        memset(buf, 0, fs->blkSize);
+    }
+    for(UINT i = 0; i < fs->inodesPerBlk; i++) {
+        if(entries[i] != NULL && (entries[i]->_in_dirty || entries[i]->_in_lazy || nInCore == fs->inodesPerBlk)) {
+            memcpy(buf + i * fs->inodeSize, &entries[i]->_in_node, fs->diskINodeSize);
+        }
+    }
+    #ifdef DEBUG_VERBOSE
+    printf("flushINodeBlk writing %u dirty and %u lazy inodes of blk %d, %u of %u in core\n", nDirty, nLazy, blk, nInCore, fs->inodesPerBlk);
+    #endif
+    if(mapped == NULL) {
+        INT succ = schedWriteBlk(&fs->sched, blk, buf);
+        putBlkBuf(fs->disk, buf);
+        if(succ == -1) {
+            fprintf(stderr, "Error: flushINodeBlk failed to write blk %d to disk\n", blk);
+            return -1;
+        }
+    }
+    for(UINT i = 0; i < fs->inodesPerBlk; i++) {
+        if(entries[i] != NULL) {
+            cleanINodeEntry(&fs->inodeTable, entries[i]);
+        }
+    }
+    fs->nINodeBlkFlushes++;
+    return 0;
+}
+
+//the inode table writes an inode back with the rest of its block
+static INT writeBackINode(void* ctx, INodeEntry* entry) {
+    FileSystem* fs = (FileSystem*) ctx;
+    return flushINodeBlk(fs, fs->diskINodeBlkOffset + entry->_in_id / fs->inodesPerBlk, true);
+}
+
+void setupINodeTable(FileSystem* fs) {
+    initINodeTable(&fs->inodeTable, fs->options.inodeCacheSize);
+    setINodeTableWriteBack(&fs->inodeTable, writeBackINode, fs);
+    fs->nINodeBlkFlushes = 0;
+}
+
+void initWriteBack(FileSystem* fs) {
+    UINT nBlks = fs->dCache._dCache_nSets * fs->dCache._dCache_nWays;
+    fs->dirtyLimit = fs->options.dirtyBytes > 0 ? fs->options.dirtyBytes / fs->blkSize : nBlks / 2;
+    fs->dirtyBgLimit = fs->options.dirtyBgBytes > 0 ? fs->options.dirtyBgBytes / fs->blkSize : nBlks / 4;
+    if(fs->dirtyBgLimit > fs->dirtyLimit) {
+        fs->dirtyBgLimit = fs->dirtyLimit;
+    }
+    setDBlkCacheWriteBack(&fs->dCache, writeBackDBlk, fs);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&fs->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&fs->flushCond, NULL);
+    fs->flusherRunning = false;
+    fs->flusherStop = false;
+}
+
+//writes back the blocks dirtied at or before olderThanNs and the oldest
+//others down to maxDirty, returns the # written back or -1
+static LONG flushDirtyDBlks(FileSystem* fs, LONG olderThanNs, UINT maxDirty) {
+    plugIOSched(&fs->sched);
+    LONG nFlushed = flushDBlkCache(&fs->dCache, olderThanNs, maxDirty);
+    if(unplugIOSched(&fs->sched) != 0) {
+        nFlushed = -1;
+    }
+    #ifdef DEBUG_VERBOSE
+    printf("flushDirtyDBlks wrote back %ld blocks, %u still dirty\n", nFlushed, fs->dCache._dCache_nDirty);
+    #endif
+    return nFlushed;
+}
+
+static void* flusherMain(void* arg) {
+    FileSystem* fs = (FileSystem*) arg;
+    pthread_mutex_lock(&fs->lock);
+    while(!fs->flusherStop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        LONG ns = deadline.tv_nsec + (LONG)fs->options.flushIntervalMs * 1000000L;
+        deadline.tv_sec += ns / 1000000000L;
+        deadline.tv_nsec = ns % 1000000000L;
+        pthread_cond_timedwait(&fs->flushCond, &fs->lock, &deadline);
+        if(fs->flusherStop) {
+            break;
+        }
+        LONG expired = diskClockNs() - (LONG)fs->options.dirtyExpireMs * 1000000L;
+        if(flushDirtyDBlks(fs, expired, fs->dirtyBgLimit) < 0) {
+            fprintf(stderr, "Error: flusher failed to write back dirty data blocks!\n");
+        }
+        if(syncINodes(fs, false) != 0) {
+            fprintf(stderr, "Error: flusher failed to write back dirty inodes!\n");
+        }
+    }
+    pthread_mutex_unlock(&fs->lock);
+    return NULL;
+}
+
+INT startFlusher(FileSystem* fs) {
+    if(fs->flusherRunning) {
+        return 0;
+    }
+    fs->flusherStop = false;
+    if(pthread_create(&fs->flusher, NULL, flusherMain, fs) != 0) {
+        fprintf(stderr, "Error: failed to start the flusher, dirty blocks are written back under pressure only\n");
+        return -1;
+    }
+    fs->flusherRunning = true;
     return 0;
 }
 
+void stopFlusher(FileSystem* fs) {
+    if(!fs->flusherRunning) {
+        return;
+    }
+    pthread_mutex_lock(&fs->lock);
+    fs->flusherStop = true;
+    pthread_cond_signal(&fs->flushCond);
+    pthread_mutex_unlock(&fs->lock);
+    pthread_join(fs->flusher, NULL);
+    fs->flusherRunning = false;
+}
+
+INT syncDBlks(FileSystem* fs) {
+    return flushDirtyDBlks(fs, INT64_MAX, 0) < 0 ? -1 : 0;
+}
+
+static int compareBlks(const void *a, const void *b) {
+    UINT x = *(const UINT*) a, y = *(const UINT*) b;
+    return (x > y) - (x < y);
+}
+
+//writes back the changed free inode bitmap blocks
+static INT flushINodeBitmap(FileSystem* fs) {
+    INT succ = 0;
+    for(UINT blk = 0; blk < fs->iBitmap._ib_nBlks && fs->iBitmap._ib_nDirty > 0; blk++) {
+        if(!fs->iBitmap._ib_dirty[blk]) {
+            continue;
+        }
+        if(schedWriteBlk(&fs->sched, fs->diskIBitmapOffset + blk, iBitmapBlk(&fs->iBitmap, blk)) == -1) {
+            fprintf(stderr, "Error: failed to write free inode bitmap blk %d\n", blk);
+            succ = -1;
+            continue;
+        }
+        cleanINodeBitmapBlk(&fs->iBitmap, blk);
+    }
+    return succ;
+}
+
+INT syncINodes(FileSystem* fs, BOOL lazy) {
+    UINT nDirty = fs->inodeTable.nDirty + (lazy ? fs->inodeTable.nLazy : 0);
+    if(nDirty == 0) {
+        return flushINodeBitmap(fs);
+    }
+
+    //the inode blocks holding dirty inodes, each once, in order
+    UINT* blks = malloc(nDirty * sizeof(UINT));
+    assert(blks != NULL);
+    UINT nBlks = 0;
+    for(UINT b = 0; b < fs->inodeTable.nBins && nBlks < nDirty; b++) {
+        for(INodeEntry* entry = fs->inodeTable.hashQ[b]; entry != NULL; entry = entry->next) {
+            if(entry->_in_dirty || (lazy && entry->_in_lazy)) {
+                blks[nBlks++] = fs->diskINodeBlkOffset + entry->_in_id / fs->inodesPerBlk;
+            }
+        }
+    }
+    qsort(blks, nBlks, sizeof(UINT), compareBlks);
+
+    plugIOSched(&fs->sched);
+    INT succ = flushINodeBitmap(fs);
+    for(UINT i = 0; i < nBlks; i++) {
+        if((i == 0 || blks[i] != blks[i - 1]) && flushINodeBlk(fs, blks[i], lazy) != 0) {
+            succ = -1;
+        }
+    }
+    if(unplugIOSched(&fs->sched) != 0) {
+        succ = -1;
+    }
+    free(blks);
+    #ifdef DEBUG_VERBOSE
+    printf("syncINodes wrote back %u dirty inodes, %u still dirty\n", nDirty, fs->inodeTable.nDirty);
+    #endif
+    return succ;
+}
+
 //input: none
 //output: INode id
-//function: allocate a free inode
-INT allocINode(FileSystem* fs, INode* inode) {
+//function: allocate a free inode of the given type
+INT allocINode(FileSystem* fs, INode* inode, enum FILE_TYPE type) {
 
     if(fs->superblock.nFreeINodes == 0) {
         fprintf(stderr, "Error: no more free inodes available!\n");
         return -1;
     }
 
-    INT nextFreeINodeID;
-
-    // the inode cache is empty
-    if(fs->superblock.pNextFreeINode < 0) {
-    
-        #ifdef DEBUG
-        printf("INode cache empty, scanning disk for more free inodes\n");
-        #endif
-        
-        // scan inode list and fill the inode cache list to capacity
-        UINT nextINodeBlk = fs->diskINodeBlkOffset;
-        BYTE nextINodeBlkBuf[BLK_SIZE];
-        
-        UINT k = 0; // index in inode cache 
-        BOOL FULL = false;
-        while(nextINodeBlk < fs->diskDBlkOffset && !FULL)  {
-            
-            // read the whole block out into a byte array
-            readBlk(fs->disk, nextINodeBlk, nextINodeBlkBuf);
-
-            // check inodes one at a time
-            for(UINT i = 0; i < INODES_PER_BLK && !FULL; i++) {
-                
-                // cast the byte array to INode structures
-                INode* inode_d = (INode*) (nextINodeBlkBuf + i*INODE_SIZE);
-
-                // found a free inode
-                if(inode_d->_in_type == FREE) {
-                    fs->superblock.freeINodeCache[k] = (nextINodeBlk - fs->diskINodeBlkOffset) * INODES_PER_BLK + i;
-                    k ++;
-                        
-                    fs->superblock.pNextFreeINode ++;
-
-                    // inode cache full
-                    if(k == FREE_INODE_CACHE_SIZE) {
-                        FULL = true;
-                    }
-                }
-            }
-            
-            nextINodeBlk ++;
-        }
+    // take the first free inode of the bitmap from the next free group on
+    INT nextFreeINodeID = allocINodeBit(&fs->iBitmap);
+    if(nextFreeINodeID == -1) {
+        fprintf(stderr, "Error: free inode bitmap has no free inode but the superblock counts %d!\n", fs->superblock.nFreeINodes);
+        return -1;
     }
-   
-    // the inode cache not emply, allocate one inode from the cache
-    nextFreeINodeID = fs->superblock.freeINodeCache[fs->superblock.pNextFreeINode]; 
+    fs->superblock.nextFreeINodeGroup = fs->iBitmap._ib_nextGroup;
     
     // initialize the inode
     initializeINode(inode, nextFreeINodeID);
+    inode->_in_type = type;
+    if(fs->options.extents) {
+        inode->_in_flags |= INODE_EXTENTS;
+    }
+    //a new inode keeps its data inline until it outgrows the inode, a
+    //directory only if its . and .. entries fit
+    if(fs->options.inlineData && (type != DIRECTORY || fs->inlineSize >= 2 * sizeof(DirEntry))) {
+        inode->_in_flags |= INODE_INLINE;
+    }
+    else if(inode->_in_flags & INODE_EXTENTS) {
+        initExtentRoot(inode);
+    }
     
     // write the inode back to disk
     if(writeINode(fs, nextFreeINodeID, inode) == -1){
         fprintf(stderr, "error: write inode %d to disk\n", nextFreeINodeID);
         return -1;
     }
-    
-    // update the inode cache list and stack pointer
-    fs->superblock.freeINodeCache[fs->superblock.pNextFreeINode] = -1;
-    fs->superblock.pNextFreeINode --;
 
     // decrement the free inodes count
     fs->superblock.nFreeINodes --;
@@ -271,14 +574,13 @@ INT allocINode(FileSystem* fs, INode* inode) {
 
 // input: inode number
 // output: none
-// function: free a inode, which updates the inode cache and/or inode table
+// function: free a inode, which updates the free inode bitmap and the inode table
 INT freeINode(FileSystem* fs, UINT id) {
     assert(id < fs->superblock.nINodes);
 
-    // if inode cache not full, store the inode number in the list
-    if (fs->superblock.pNextFreeINode < FREE_INODE_CACHE_SIZE - 1){
-        fs->superblock.freeINodeCache[fs->superblock.pNextFreeINode + 1] = id;
-        fs->superblock.pNextFreeINode ++;
+    if(isINodeFree(&fs->iBitmap, id)) {
+        fprintf(stderr, "Error: freeINode called on free inode %d\n", id);
+        return -1;
     }
 
     // update the inode table to mark the inode free
@@ -289,85 +591,14 @@ INT freeINode(FileSystem* fs, UINT id) {
         return -1;
     }
    
-        // truncate it to 0
+        // truncate it to 0, an inline inode has no blocks to free
         // next file blk to be truncated
-        LONG fileBlkId = (inode._in_filesize -1 + BLK_SIZE) / BLK_SIZE;
+        LONG fileBlkId = (inode._in_flags & INODE_INLINE) ? -1 : (inode._in_filesize -1 + fs->blkSize) / fs->blkSize;
         while (fileBlkId >= 0)  {
             bfree(fs, &inode, fileBlkId);
             fileBlkId --;
         }
 
-    // free all data blocks associated with this inode 
-    /*for (UINT i = 0; i < INODE_NUM_DIRECT_BLKS; i ++) {
-        if (inode._in_directBlocks[i] != -1) {
-            freeDBlk(fs,inode._in_directBlocks[i]);
-        }
-    }
-    for (UINT i = 0; i < INODE_NUM_S_INDIRECT_BLKS; i ++) {
-        if (inode._in_sIndirectBlocks[i] != -1) {
-            LONG buf[BLK_SIZE/sizeof(LONG)];
-            readDBlk(fs, inode._in_sIndirectBlocks[i], (BYTE *)buf);
-            for (UINT j = 0; j < (BLK_SIZE / sizeof(INT)); j ++) {
-                // free the actual data blocks
-                if(buf[j] != -1)
-                    freeDBlk(fs, buf[j]);
-            }
-            // free the indirect data block
-            freeDBlk(fs, inode._in_sIndirectBlocks[i]);
-        }
-    }
-    for (UINT i = 0; i < INODE_NUM_D_INDIRECT_BLKS; i ++) {
-        if(inode._in_dIndirectBlocks[i] != -1) {
-            INT buf_d[BLK_SIZE/sizeof(INT)];
-            readDBlk(fs, inode._in_dIndirectBlocks[i], (BYTE*)buf_d);
-            for (UINT j = 0; j < (BLK_SIZE / sizeof(INT)); j ++) {
-                if(buf_d[j] != -1) {
-                    INT buf_s[BLK_SIZE/sizeof(INT)];
-                    readDBlk(fs, buf_d[j], (BYTE*) buf_s);
-                    for (UINT k = 0; k < (BLK_SIZE / sizeof(INT)); k ++) {
-                        // free the actual data blocks
-                        if(buf_s[k] != -1)
-                            freeDBlk(fs, buf_s[k]);
-                    }
-                    // free the single indirect blocks
-                    freeDBlk(fs, buf_d[j]);
-                }
-            }
-            // free the double indirect blocks
-            freeDBlk(fs, inode._in_dIndirectBlocks[i]);
-        }
-    }
-    for (UINT i = 0; i < INODE_NUM_T_INDIRECT_BLKS; i ++) {
-        if(inode._in_tIndirectBlocks[i] != -1) {
-            INT buf_t[BLK_SIZE/sizeof(INT)];
-            readDBlk(fs, inode._in_tIndirectBlocks[i], (BYTE*)buf_t);
-            for (UINT j = 0; j < (BLK_SIZE / sizeof(INT)); j ++) {
-                if(buf_t[j] != -1) {
-                    INT buf_d[BLK_SIZE/sizeof(INT)];
-                    readDBlk(fs, buf_t[j], (BYTE*) buf_d);
-                    for (UINT k = 0; k < (BLK_SIZE / sizeof(INT)); k ++) {
-                        // free the actual data blocks
-                        if(buf_d[k] != -1) {
-                            INT buf_s[BLK_SIZE/sizeof(INT)];
-                            readDBlk(fs, buf_d[k], (BYTE*) buf_s);
-                            for (UINT m = 0; m < (BLK_SIZE / sizeof(INT)); m ++) {
-                                // free the actual data blocks
-                                if(buf_s[m] != -1)
-                                    freeDBlk(fs, buf_s[m]);
-                            }
-                            // free the single indirect block
-                            freeDBlk(fs, buf_d[k]);
-                        }
-                    }
-                    // free the double indirect blocks
-                    freeDBlk(fs, buf_t[j]);
-                }
-            }
-            // free the triple indirect blocks
-            freeDBlk(fs, inode._in_tIndirectBlocks[i]);
-        }
-    }*/
-
     initializeINode(&inode, id);
     inode._in_type = FREE;
 
@@ -376,6 +607,10 @@ INT freeINode(FileSystem* fs, UINT id) {
         fprintf(stderr, "error: write inode %d to disk\n", id);
         return -1;
     }
+
+    // only a freed inode is marked free in the bitmap, so that a failure
+    // above never lets allocINode hand out an inode still in use
+    freeINodeBit(&fs->iBitmap, id);
     
     // increase file system free inode count
     fs->superblock.nFreeINodes ++;
@@ -393,7 +628,7 @@ INT readINode(FileSystem* fs, UINT id, INode* inode) {
     }
     assert(id < fs->superblock.nINodes);
     
-    //first, check the inode table to see if the inode is open
+    //first, check the inode table to see if the inode is in core
     INodeEntry* iEntry = getINodeEntry(&fs->inodeTable, id);
     if(iEntry != NULL) {
         #ifdef DEBUG_VERBOSE
@@ -403,23 +638,14 @@ INT readINode(FileSystem* fs, UINT id, INode* inode) {
         return 0;
     }
     
-    //next, check the inode cache to see if the inode is cached
-    iEntry = getINodeCacheEntry(&fs->inodeCache, id);
-    if(iEntry != NULL) {
-        #ifdef DEBUG_VERBOSE
-        printf("readINode found inode %d in inode cache, returning directly...\n", id);
-        #endif
-        memcpy(inode, &iEntry->_in_node, sizeof(INode));
-        return 0;
-    }
-    
     //otherwise, read the inode from disk
-    UINT blk_num = fs->diskINodeBlkOffset + id / INODES_PER_BLK;
-    UINT blk_offset = id % INODES_PER_BLK;
+    UINT blk_num = fs->diskINodeBlkOffset + id / fs->inodesPerBlk;
+    UINT blk_offset = id % fs->inodesPerBlk;
 
-    BYTE INodeBlkBuf[BLK_SIZE];
-    if(readBlk(fs->disk, blk_num, INodeBlkBuf) == -1) {
+    BYTE* INodeBlkBuf = getBlkBuf(fs->disk);
+    if(schedReadBlk(&fs->sched, blk_num, INodeBlkBuf) == -1) {
         fprintf(stderr, "Error: readINode failed to read blk %d from disk\n", blk_num);
+        putBlkBuf(fs->disk, INodeBlkBuf);
         return -1;
     }
 
@@ -427,14 +653,15 @@ INT readINode(FileSystem* fs, UINT id, INode* inode) {
     #ifdef DEBUG_VERBOSE
     printf("readINode found inode %d on disk, copying buffer...\n", id);
     #endif
-    INode* inode_d = (INode*) (INodeBlkBuf + blk_offset * INODE_SIZE);
-    memcpy(inode, inode_d, sizeof(INode));
+    memcpy(inode, INodeBlkBuf + blk_offset * fs->inodeSize, fs->diskINodeSize);
+    clearBmapCache(inode);
+    putBlkBuf(fs->disk, INodeBlkBuf);
     
-    //insert the completed inode into the cache
+    //insert the completed inode into the table, unreferenced
     #ifdef DEBUG_VERBOSE
-    printf("readINode adding inode %d to inode cache...\n", id);
+    printf("readINode adding inode %d to inode table...\n", id);
     #endif
-    INodeEntry* newEntry = cacheINode(&fs->inodeCache, id, inode_d);
+    INodeEntry* newEntry = putINode(&fs->inodeTable, id, inode);
     assert(newEntry != NULL);
 
     return 0;
@@ -448,21 +675,36 @@ INT readINodeNoCache(FileSystem* fs, UINT id, INode* inode) {
     assert(id < fs->superblock.nINodes);
     
     //read the inode from disk
-    UINT blk_num = fs->diskINodeBlkOffset + id / INODES_PER_BLK;
-    UINT blk_offset = id % INODES_PER_BLK;
+    UINT blk_num = fs->diskINodeBlkOffset + id / fs->inodesPerBlk;
+    UINT blk_offset = id % fs->inodesPerBlk;
+
+    //on the mmap backend, copy the inode straight out of the mapping
+    BYTE* mapped = mapBlk(fs->disk, blk_num);
+    if(mapped != NULL) {
+        memcpy(inode, mapped + blk_offset * fs->inodeSize, fs->diskINodeSize);
+        clearBmapCache(inode);
+        return 0;
+    }
 
-    BYTE INodeBlkBuf[BLK_SIZE];
-    if(readBlk(fs->disk, blk_num, INodeBlkBuf) == -1) {
+    BYTE* INodeBlkBuf = getBlkBuf(fs->disk);
+    if(schedReadBlk(&fs->sched, blk_num, INodeBlkBuf) == -1) {
         fprintf(stderr, "Error: readINodeNoCache failed to read blk %d from disk\n", blk_num);
+        putBlkBuf(fs->disk, INodeBlkBuf);
         return -1;
     }
 
-    INode* inode_d = (INode*) (INodeBlkBuf + blk_offset * INODE_SIZE);
-    memcpy(inode, inode_d, sizeof(INode));
+    memcpy(inode, INodeBlkBuf + blk_offset * fs->inodeSize, fs->diskINodeSize);
+    clearBmapCache(inode);
+    putBlkBuf(fs->disk, INodeBlkBuf);
 
     return 0;
 }
 
+//directory contents are cached as metadata
+static DBLK_CLASS inodeDBlkClass(INode* inode) {
+    return inode->_in_type == DIRECTORY ? DBLK_META : DBLK_DATA;
+}
+
 LONG readINodeData(FileSystem* fs, INode* inode, BYTE* buf, LONG offset, LONG len) {
     #ifdef DEBUG
     printf("readINodeData on inode of size %d for len %d at offset %d\n", inode->_in_filesize, len, offset);
@@ -480,12 +722,18 @@ LONG readINodeData(FileSystem* fs, INode* inode, BYTE* buf, LONG offset, LONG le
         len = inode->_in_filesize - offset;
     }
     
+    //the data of an inline inode is in the inode itself
+    if(inode->_in_flags & INODE_INLINE) {
+        memcpy(buf, inode->_in_inline + offset, len);
+        return len;
+    }
+
     //compute the number of file blocks allocated based on the file size
-    LONG nFileBlks = (inode->_in_filesize + BLK_SIZE - 1) / BLK_SIZE;
+    LONG nFileBlks = (inode->_in_filesize + fs->blkSize - 1) / fs->blkSize;
     
     //convert byte offset to logical id + block offset
-    LONG fileBlkId = offset / BLK_SIZE;
-    offset = offset % BLK_SIZE;
+    LONG fileBlkId = offset / fs->blkSize;
+    offset = offset % fs->blkSize;
     #ifdef DEBUG_VERBOSE
     printf("readINodeData starting at block %d out of %d with block offset %d with truncated len %d\n", 
         fileBlkId, nFileBlks, offset, len);
@@ -493,6 +741,7 @@ LONG readINodeData(FileSystem* fs, INode* inode, BYTE* buf, LONG offset, LONG le
     
     //return bytes read upon completion
     LONG bytesRead = 0;
+    DBLK_CLASS cls = inodeDBlkClass(inode);
     
     //compute start block id
     LONG dataBlkId = bmap(fs, inode, fileBlkId);
@@ -500,11 +749,11 @@ LONG readINodeData(FileSystem* fs, INode* inode, BYTE* buf, LONG offset, LONG le
     //special case to handle offset in the middle of first block
     if(offset > 0) {
         //entire read falls within first block
-        if(offset + len <= BLK_SIZE) {
+        if(offset + len <= fs->blkSize) {
             if (dataBlkId < 0)
                 memset(buf, 0, len);
             else
-                readDBlkOffset(fs, dataBlkId, buf, (UINT)offset, (UINT)len);
+                readDBlkOffset(fs, dataBlkId, buf, (UINT)offset, (UINT)len, cls);
                 
             bytesRead = len;
             len = 0;
@@ -512,47 +761,65 @@ LONG readINodeData(FileSystem* fs, INode* inode, BYTE* buf, LONG offset, LONG le
         //read is larger than first block
         else {
             if (dataBlkId < 0)
-                memset(buf, 0, BLK_SIZE - offset);
+                memset(buf, 0, fs->blkSize - offset);
             else
-                readDBlkOffset(fs, dataBlkId, buf, (UINT)offset, (UINT)(BLK_SIZE - offset));
+                readDBlkOffset(fs, dataBlkId, buf, (UINT)offset, (UINT)(fs->blkSize - offset), cls);
                 
-            bytesRead = BLK_SIZE - offset;
+            bytesRead = fs->blkSize - offset;
             len -= bytesRead;
             fileBlkId++;
         }
     }
     
-    //continue while more bytes to read AND end of inode not reached
-    while(len > 0 && fileBlkId < nFileBlks) {
+    //read whole blocks, one request per physically contiguous run,
+    //the runs are submitted to disk together
+    DiskRequest batch[DBLK_BATCH_SIZE];
+    UINT nBatch = 0;
+    while(len >= fs->blkSize && fileBlkId < nFileBlks) {
         //compute next data block id using bmap
         dataBlkId = bmap(fs, inode, fileBlkId);
         #ifdef DEBUG_VERBOSE
         //printf("readINodeData reading next fileBlkId %d with dataBlkId %d\n", fileBlkId, dataBlkId);
         #endif
-            
-        //end of read falls within block
-        if(len <= BLK_SIZE) {
-            if (dataBlkId < 0)
-                memset(buf + bytesRead, 0, len);
-            else
-                readDBlkOffset(fs, dataBlkId, buf + bytesRead, 0, (UINT)len);
-            
-            //update len (end of read)
-            bytesRead += len;
-            len = 0;
+
+        UINT runLen = 1;
+        if (dataBlkId < 0) {
+            memset(buf + bytesRead, 0, fs->blkSize);
         }
-        //read is larger than current block
         else {
-            if (dataBlkId < 0)
-                memset(buf + bytesRead, 0, BLK_SIZE);
-            else
-                readDBlk(fs, dataBlkId, buf + bytesRead);
-           
-            //update len and file block for remaining read
-            bytesRead += BLK_SIZE;
-            len -= BLK_SIZE;
-            fileBlkId++;
+            //extend the run while the following file blocks are physically adjacent,
+            //long runs are cut so that the pieces are in flight together
+            while(runLen < DBLK_BATCH_RUN_BLKS && len >= (LONG)(runLen + 1) * fs->blkSize && fileBlkId + runLen < nFileBlks
+                    && bmap(fs, inode, fileBlkId + runLen) == dataBlkId + runLen) {
+                runLen++;
+            }
+            batch[nBatch++] = (DiskRequest) { ._req_bid = dataBlkId, ._req_nBlks = runLen, ._req_buf = buf + bytesRead };
+            if(nBatch == DBLK_BATCH_SIZE) {
+                readDBlkBatch(fs, batch, nBatch, cls);
+                nBatch = 0;
+            }
         }
+
+        //update len and file block for remaining read
+        bytesRead += (LONG)runLen * fs->blkSize;
+        len -= (LONG)runLen * fs->blkSize;
+        fileBlkId += runLen;
+    }
+    if(nBatch > 0) {
+        readDBlkBatch(fs, batch, nBatch, cls);
+    }
+
+    //end of read falls within block
+    if(len > 0 && fileBlkId < nFileBlks) {
+        dataBlkId = bmap(fs, inode, fileBlkId);
+        if (dataBlkId < 0)
+            memset(buf + bytesRead, 0, len);
+        else
+            readDBlkOffset(fs, dataBlkId, buf + bytesRead, 0, (UINT)len, cls);
+
+        //update len (end of read)
+        bytesRead += len;
+        len = 0;
     }
     
     #ifdef DEBUG
@@ -571,131 +838,167 @@ INT writeINode(FileSystem* fs, UINT id, INode* inode) {
     }
     assert(id < fs->superblock.nINodes);
     
-    //first, check the inode table to see if the inode is open
+    //update the in-core copy, adding the inode to the table if it is not
+    //in core, and leave it dirty; the whole inode block is written back
+    //later with the other dirty inodes in it
     INodeEntry* iEntry = getINodeEntry(&fs->inodeTable, id);
     if(iEntry != NULL) {
         #ifdef DEBUG_VERBOSE
         printf("writeINode found inode %d in inode table, writing table copy...\n", id);
         #endif
-        memcpy(&iEntry->_in_node, inode, sizeof(INode));
-    }
-    //otherwise, check the inode cache to see if the inode is cached
-    else {
-        iEntry = getINodeCacheEntry(&fs->inodeCache, id);
-        if(iEntry != NULL) {
-            #ifdef DEBUG_VERBOSE
-            printf("writeINode found inode %d in inode cache, writing cache copy...\n", id);
-            #endif
+        if(inode != &iEntry->_in_node) {
             memcpy(&iEntry->_in_node, inode, sizeof(INode));
         }
     }
-    
-    //write the inode to disk
-    //note: if we have a proper fsync implementation, we don't need this
-    UINT blk_num = fs->diskINodeBlkOffset + id / INODES_PER_BLK;
-    UINT blk_offset = id % INODES_PER_BLK;
-    
-    BYTE INodeBlkBuf[BLK_SIZE];
-    if(readBlk(fs->disk, blk_num, INodeBlkBuf) == -1) {
-        fprintf(stderr, "error: read blk %d from disk\n", blk_num);
-        return -1;
+    else {
+        #ifdef DEBUG_VERBOSE
+        printf("writeINode adding inode %d to inode table...\n", id);
+        #endif
+        iEntry = putINode(&fs->inodeTable, id, inode);
     }
+    dirtyINodeEntry(&fs->inodeTable, iEntry);
     
-    //write the inode to buffer
-    #ifdef DEBUG_VERBOSE
-    printf("writeINode writing inode %d to disk...\n", id);
-    #endif
-    INode *inode_d = (INode*) (INodeBlkBuf + blk_offset * INODE_SIZE);
-    memcpy(inode_d, inode, sizeof(INode));
+    return 0;
+}
 
-    // write the entire inode block back to disk
-    if(writeBlk(fs->disk, blk_num, INodeBlkBuf) == -1) {
-        fprintf(stderr, "error: write blk %d from disk\n", blk_num);
-        return -1;
+void touchATime(FileSystem* fs, INodeEntry* entry) {
+    INode* inode = &entry->_in_node;
+    time_t now = time(NULL);
+    if(fs->options.atime == ATIME_NOATIME) {
+        return;
+    }
+    //relatime only moves an atime that is not newer than the last change,
+    //or a day old
+    if(fs->options.atime == ATIME_RELATIME && inode->_in_accesstime > inode->_in_modtime
+            && inode->_in_accesstime > inode->_in_changetime && now - inode->_in_accesstime < RELATIME_SECS) {
+        return;
+    }
+    if(inode->_in_accesstime == now) {
+        return;
+    }
+    inode->_in_accesstime = now;
+    if(fs->options.lazyTime) {
+        lazyINodeEntry(&fs->inodeTable, entry);
+    }
+    else {
+        dirtyINodeEntry(&fs->inodeTable, entry);
     }
-    
-    return 0;
 }
 
 LONG writeINodeData(FileSystem* fs, INode* inode, BYTE* buf, LONG offset, LONG len) {
     #ifdef DEBUG
     printf("writeINodeData: size %ld, offset %ld, len %ld\n", inode->_in_filesize, offset, len);
     #endif
-    assert(offset <= MAX_FILE_SIZE);
-    assert(offset + len <= MAX_FILE_SIZE);
+    assert(offset <= fs->maxFileSize);
+    assert(offset + len <= fs->maxFileSize);
     
+    //a write that still fits the inode goes into its inline data, the gap
+    //past the end of the file reading as zeroes
+    if(inode->_in_flags & INODE_INLINE) {
+        if(offset + len <= fs->inlineSize) {
+            if(offset > inode->_in_filesize) {
+                memset(inode->_in_inline + inode->_in_filesize, 0, offset - inode->_in_filesize);
+            }
+            memcpy(inode->_in_inline + offset, buf, len);
+            return len;
+        }
+        if(spillINodeData(fs, inode) == -1) {
+            return -1;
+        }
+    }
+
     //convert byte offset to logical id + block offset
-    LONG fileBlkId = offset / BLK_SIZE;
-    offset = offset % BLK_SIZE;
+    LONG fileBlkId = offset / fs->blkSize;
+    offset = offset % fs->blkSize;
     #ifdef DEBUG
     printf("writeINodeData: fileBlkId %ld, offset %ld\n", fileBlkId, offset);
     #endif
     
     //return bytes written upon completion
     LONG bytesWritten = 0;    
+    DBLK_CLASS cls = inodeDBlkClass(inode);
     
-    //compute start block id
-    LONG dataBlkId = balloc(fs, inode, fileBlkId);
+    //map every block of the write at once, so that each pointer block
+    //changed is written once for the whole write
+    LONG nBlks = (offset + len + fs->blkSize - 1) / fs->blkSize;
+    if(nBlks == 0) {
+        return 0;
+    }
+    LONG* blks = malloc(nBlks * sizeof(LONG));
+    assert(blks != NULL);
+    LONG nMapped = ballocRange(fs, inode, fileBlkId, nBlks, blks);
     #ifdef DEBUG 
-    printf("writeINodeData: dataBlkId: %ld\n", dataBlkId);
+    printf("writeINodeData: mapped %ld of %ld blocks\n", nMapped, nBlks);
     #endif
-    if(dataBlkId < 0) {
+    if(nMapped < 0) {
 	#ifdef DEBUG
         fprintf(stderr, "Warning: could not allocate more data blocks for write!\n");
 	#endif
+        free(blks);
         return -1;
     }
+    LONG b = 0;
     
     //special case to handle offset in the middle of first block
     if(offset > 0) {
-        if(offset + len <= BLK_SIZE) {
+        if(offset + len <= fs->blkSize) {
             //entire write falls within first block
-            writeDBlkOffset(fs, dataBlkId, buf, (UINT)offset, (UINT)len);
+            writeDBlkOffset(fs, blks[0], buf, (UINT)offset, (UINT)len, cls);
             bytesWritten = len;
             len = 0;
         }
         else {
             //write is larger than first block
-            writeDBlkOffset(fs, dataBlkId, buf, (UINT)offset, (UINT)(BLK_SIZE - offset));
-            bytesWritten = BLK_SIZE - offset;
+            writeDBlkOffset(fs, blks[0], buf, (UINT)offset, (UINT)(fs->blkSize - offset), cls);
+            bytesWritten = fs->blkSize - offset;
             len -= bytesWritten;
-            fileBlkId++;
+            b++;
         }
     }
     
-    //continue while more bytes to write AND max filesize not reached
-    while(len > 0 && fileBlkId < MAX_FILE_BLKS) {
-        //compute next data block id using balloc
-        dataBlkId = balloc(fs, inode, fileBlkId);
-        #ifdef DEBUG_VERBOSE
-        //printf("writeINodeData writing next fileBlkId %d with dataBlkId %d\n", fileBlkId, dataBlkId);
-        #endif
-
-        if(dataBlkId < 0) {
-	    #ifdef DEBUG 
-            printf("Warning: could not allocate more data blocks for write!\n");
-	    #endif
-            return -1;
+    //write whole blocks, one request per physically contiguous run,
+    //the runs are submitted to disk together
+    DiskRequest batch[DBLK_BATCH_SIZE];
+    UINT nBatch = 0;
+    while(len >= fs->blkSize && b < nMapped) {
+        //extend the run while the following file blocks land physically adjacent,
+        //a block allocated past the end of the run starts the next one
+        UINT runLen = 1;
+        while(runLen < DBLK_BATCH_RUN_BLKS && len >= (LONG)(runLen + 1) * fs->blkSize && b + runLen < nMapped
+                && blks[b + runLen] == blks[b] + runLen) {
+            runLen++;
         }
-        
-        //write next block from buf
-        if(len <= BLK_SIZE) {
-            //end of write falls within block
-            writeDBlkOffset(fs, dataBlkId, buf + bytesWritten, 0, (UINT)len);
-            
-            //update len (end of write)
-            bytesWritten += len;
-            len = 0;
-        }
-        else {
-            //write is larger than current block
-            writeDBlk(fs, dataBlkId, buf + bytesWritten);
-           
-            //update len and file block for remaining write
-            bytesWritten += BLK_SIZE;
-            len -= BLK_SIZE;
-            fileBlkId++;
+        batch[nBatch++] = (DiskRequest) { ._req_bid = blks[b], ._req_nBlks = runLen, ._req_buf = buf + bytesWritten };
+        if(nBatch == DBLK_BATCH_SIZE) {
+            writeDBlkBatch(fs, batch, nBatch, cls);
+            nBatch = 0;
         }
+
+        //update len and file block for remaining write
+        bytesWritten += (LONG)runLen * fs->blkSize;
+        len -= (LONG)runLen * fs->blkSize;
+        b += runLen;
+    }
+    if(nBatch > 0) {
+        writeDBlkBatch(fs, batch, nBatch, cls);
+    }
+
+    //end of write falls within block
+    if(len > 0 && b < nMapped) {
+        writeDBlkOffset(fs, blks[b], buf + bytesWritten, 0, (UINT)len, cls);
+
+        //update len (end of write)
+        bytesWritten += len;
+        len = 0;
+    }
+    free(blks);
+
+    //the disk filled up part way through
+    if(nMapped < nBlks) {
+	#ifdef DEBUG 
+        printf("Warning: could not allocate more data blocks for write!\n");
+	#endif
+        return -1;
     }
 
     #ifdef DEBUG
@@ -704,6 +1007,61 @@ LONG writeINodeData(FileSystem* fs, INode* inode, BYTE* buf, LONG offset, LONG l
     return bytesWritten;
 }
 
+INT spillINodeData(FileSystem* fs, INode* inode) {
+    BYTE data[INODE_INLINE_LEN];
+    LONG size = inode->_in_filesize;
+    memcpy(data, inode->_in_inline, size);
+    inode->_in_flags &= ~INODE_INLINE;
+    if(inode->_in_flags & INODE_EXTENTS) {
+        initExtentRoot(inode);
+    }
+    else {
+        clearBlkPtrs(inode);
+    }
+    clearBmapCache(inode);
+    #ifdef DEBUG_VERBOSE
+    printf("spillINodeData moving %ld inline bytes to data blocks\n", size);
+    #endif
+    if(size > 0 && writeINodeData(fs, inode, data, 0, size) != size) {
+        fprintf(stderr, "Error: failed to move inline data to a data block!\n");
+        //give back what the write mapped before the inode reverts to inline
+        for(LONG f = 0; f <= (size - 1) / fs->blkSize; f++) {
+            if(bmap(fs, inode, f) != -1) {
+                bfree(fs, inode, f);
+            }
+        }
+        clearBmapCache(inode);
+        memcpy(inode->_in_inline, data, size);
+        inode->_in_flags |= INODE_INLINE;
+        return -1;
+    }
+    return 0;
+}
+
+//a block handed out again must not be discarded afterwards
+static void cancelDiscard(FileSystem* fs, LONG id) {
+    for(UINT i = 0; i < fs->nDiscards; i++) {
+        if(fs->discardBatch[i] == id) {
+            fs->discardBatch[i] = fs->discardBatch[--fs->nDiscards];
+            return;
+        }
+    }
+}
+
+static void queueDiscard(FileSystem* fs, LONG id) {
+    //whatever is still queued for the block is dead now
+    schedDropBlks(&fs->sched, id + fs->diskDBlkOffset, 1);
+    fs->discardBatch[fs->nDiscards++] = id;
+    if(fs->nDiscards == DISCARD_BATCH_SIZE) {
+        flushDiscards(fs);
+    }
+}
+
+static int compareDBlkIds(const void* a, const void* b) {
+    LONG x = *(const LONG*) a, y = *(const LONG*) b;
+    return x < y ? -1 : x > y;
+}
+
 //Try to alloc a free data block from disk:
 //1. check if there are free DBlk at all
 //2. check the pNextFreeDBlk
@@ -738,10 +1096,10 @@ LONG allocDBlk(FileSystem* fs) {
         //retrieve next head and mark current block as allocated
         LONG nextHead = (fs->superblock.freeDBlkCache)[0];
         //zero out before allocation
-        for (UINT i=0; i<FREE_DBLK_CACHE_SIZE; i++) 	
+        for (UINT i=0; i<fs->nPtrsPerBlk; i++) 	
           (fs->superblock.freeDBlkCache)[i] = 0;
         //wipe cache and write to disk
-        writeDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache));
+        writeDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache), DBLK_META);
 
         //if we know more dblks are available on disk, load them into cache
         if(fs->superblock.nFreeDBlks > 1) {
@@ -751,12 +1109,13 @@ LONG allocDBlk(FileSystem* fs) {
             //move head in superblock
             fs->superblock.pFreeDBlksHead = nextHead;
             //load cache from next head
-            readDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache));
+            readDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache), DBLK_META);
             //reset stack pointer
-            fs->superblock.pNextFreeDBlk = FREE_DBLK_CACHE_SIZE - 1;
+            fs->superblock.pNextFreeDBlk = fs->nPtrsPerBlk - 1;
         }
     }
     fs->superblock.nFreeDBlks --;
+    cancelDiscard(fs, returnID);
     #ifdef DEBUG
     printf("allocDBlk: %ld\n", returnID);
     #endif
@@ -788,15 +1147,15 @@ INT freeDBlk(FileSystem* fs, LONG id) {
         fs->superblock.pNextFreeDBlk = 0;
     }
     // if current cache is full
-    else if (fs->superblock.pNextFreeDBlk == FREE_DBLK_CACHE_SIZE - 1) {
+    else if (fs->superblock.pNextFreeDBlk == fs->nPtrsPerBlk - 1) {
         #ifdef DEBUG
         printf("Free dblk cache full, dumping cache to disk at id: %d\n", fs->superblock.pFreeDBlksHead);
         #endif
         //write cache back
-        writeDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache));
+        writeDBlk(fs, fs->superblock.pFreeDBlksHead, (BYTE*) (fs->superblock.freeDBlkCache), DBLK_META);
         //init cache
         (fs->superblock.freeDBlkCache)[0] = fs->superblock.pFreeDBlksHead;
-        for (UINT i=1; i<FREE_DBLK_CACHE_SIZE; i++)
+        for (UINT i=1; i<fs->nPtrsPerBlk; i++)
             (fs->superblock.freeDBlkCache)[i] = -1;
         //move pNextFreeDBlk
         fs->superblock.pNextFreeDBlk = 0;
@@ -806,50 +1165,136 @@ INT freeDBlk(FileSystem* fs, LONG id) {
     else {
         fs->superblock.pNextFreeDBlk ++;
         (fs->superblock.freeDBlkCache)[fs->superblock.pNextFreeDBlk] = id;
+        //only blocks in cache slots are discarded, a new list head gets the
+        //cache written into it once the cache fills up
+        if(fs->options.discard) {
+            queueDiscard(fs, id);
+        }
     }
     fs->superblock.nFreeDBlks ++;
     return 0;
 }
 
-// Try to read out a block from disk
-// 1. convert logical id of DBlk to logical id of disk block
-// 2. read data
-INT readDBlk(FileSystem* fs, LONG id, BYTE* buf) {
-    if(id >= fs->superblock.nDBlks) {
-        fprintf(stderr, "Error: readDBlk received id %ld which exceeds nDBlks %ld\n", id, fs->superblock.nDBlks);
+INT flushDiscards(FileSystem* fs) {
+    if(fs->nDiscards == 0) {
+        return 0;
     }
-    assert(id < fs->superblock.nDBlks);
-    
-    // check if the datablock is in the dCache, if so, read it from the dCache
-    if(hasDBlkCacheEntry(&fs->dCache, id)) {
+    qsort(fs->discardBatch, fs->nDiscards, sizeof(LONG), compareDBlkIds);
+    INT succ = 0;
+    UINT start = 0;
+    for(UINT i = 1; i <= fs->nDiscards; i++) {
+        if(i < fs->nDiscards && fs->discardBatch[i] <= fs->discardBatch[i - 1] + 1) {
+            continue;
+        }
+        LONG nBlks = fs->discardBatch[i - 1] - fs->discardBatch[start] + 1;
         #ifdef DEBUG_VERBOSE
-        printf("readDBlk found id %d in cache, returning directly...\n", id);
+        printf("flushDiscards discarding %ld blocks from id %ld\n", nBlks, fs->discardBatch[start]);
         #endif
-        return getDBlkCacheEntry(&(fs->dCache), id, buf);
+        if(discardBlks(fs->disk, fs->discardBatch[start] + fs->diskDBlkOffset, nBlks) != 0) {
+            succ = -1;
+        }
+        start = i;
     }
-   
-    #ifdef DEBUG_VERBOSE
-    printf("readDBlk did not find id %d in cache, reading from disk...\n", id);
-    #endif
-    LONG bid = id + fs->diskDBlkOffset;
-    if (readBlk(fs->disk, bid, buf) == -1) {
+    fs->nDiscards = 0;
+    if(succ != 0 && fs->options.discard) {
+        fprintf(stderr, "Warning: the disk cannot discard blocks, turning discard off\n");
+        fs->options.discard = false;
+    }
+    return succ;
+}
+
+LONG trimFreeDBlks(FileSystem* fs) {
+    //queued discards and trimmed blocks go out in the same sorted batches
+    if(flushDiscards(fs) != 0) {
         return -1;
     }
-    else {
-        // also update in-core cache   
-        #ifdef DEBUG_VERBOSE
-        printf("readDBlk updating in-core DBlk cache with newly read copy...\n", id);
-        #endif
-        putDBlkCacheEntry(&fs->dCache, id, buf);
+    LONG nTrimmed = 0;
+    LONG nFree = fs->superblock.nFreeDBlks;
+    if(nFree == 0) {
+        fs->lastTrimNs = diskClockNs();
         return 0;
     }
-    //return readBlk(fs->disk, bid, buf);
+
+    //the in-core cache holds the current group, slots 1 to pNextFreeDBlk,
+    //every group further down the list is full and stored in its head
+    LONG head = fs->superblock.pFreeDBlksHead;
+    LONG list[fs->nPtrsPerBlk];
+    memcpy(list, fs->superblock.freeDBlkCache, fs->nPtrsPerBlk * sizeof(LONG));
+    UINT top = fs->superblock.pNextFreeDBlk;
+    LONG nGroups = fs->superblock.nDBlks / fs->nPtrsPerBlk + 1;
+    while(nGroups-- > 0) {
+        //the head itself is the last block of its group to go out
+        nFree--;
+        for(UINT i = top; i >= 1 && nFree > 0; i--) {
+            LONG id = list[i];
+            if(id < 0 || id == head || id >= fs->superblock.nDBlks) {
+                continue;
+            }
+            schedDropBlks(&fs->sched, id + fs->diskDBlkOffset, 1);
+            fs->discardBatch[fs->nDiscards++] = id;
+            if(fs->nDiscards == DISCARD_BATCH_SIZE && flushDiscards(fs) != 0) {
+                return -1;
+            }
+            nTrimmed++;
+            nFree--;
+        }
+        LONG next = list[0];
+        if(nFree <= 0 || next < 0 || next == head || next >= fs->superblock.nDBlks) {
+            break;
+        }
+        head = next;
+        if(readDBlk(fs, head, (BYTE*) list, DBLK_META) != 0) {
+            return -1;
+        }
+        top = fs->nPtrsPerBlk - 1;
+    }
+    if(flushDiscards(fs) != 0) {
+        return -1;
+    }
+    fs->lastTrimNs = diskClockNs();
+    #ifdef DEBUG
+    printf("trimFreeDBlks discarded %ld free blocks\n", nTrimmed);
+    #endif
+    return nTrimmed;
+}
+
+// Try to read out a block from disk
+// 1. convert logical id of DBlk to logical id of disk block
+// 2. read data
+INT readDBlk(FileSystem* fs, LONG id, BYTE* buf, DBLK_CLASS cls) {
+    if(id >= fs->superblock.nDBlks) {
+        fprintf(stderr, "Error: readDBlk received id %ld which exceeds nDBlks %ld\n", id, fs->superblock.nDBlks);
+    }
+    assert(id < fs->superblock.nDBlks);
+    
+    // read the block through its cache way so that concurrent misses on it
+    // read it from disk once
+    BYTE* blk = getDBlk(fs, id, cls);
+    if(blk == NULL) {
+        return -1;
+    }
+    memcpy(buf, blk, fs->blkSize);
+    return putDBlk(fs, id, blk, false);
+}
+
+//called after a block is dirtied, past the background limit the flusher
+//is woken, past the hard limit the writer writes the oldest blocks back
+//itself
+static INT throttleDirty(FileSystem* fs) {
+    UINT nDirty = fs->dCache._dCache_nDirty;
+    if(nDirty > fs->dirtyBgLimit && fs->flusherRunning) {
+        pthread_cond_signal(&fs->flushCond);
+    }
+    if(nDirty > fs->dirtyLimit && flushDirtyDBlks(fs, INT64_MIN, fs->dirtyBgLimit) < 0) {
+        return -1;
+    }
+    return 0;
 }
 
 // writes a data block to the disk
 // dBlkId: the data block logical id (not raw logical id!)
 // buf: the buffer to write (must be exactly block-sized)
-INT writeDBlk(FileSystem* fs, LONG id, BYTE* buf) {
+INT writeDBlk(FileSystem* fs, LONG id, BYTE* buf, DBLK_CLASS cls) {
     assert(id < fs->superblock.nDBlks);
     
     //Update the DBlkCache, ovewriting existing one if necessary
@@ -861,34 +1306,269 @@ INT writeDBlk(FileSystem* fs, LONG id, BYTE* buf) {
         printf("writeDBlk inserting new cache entry for id: %d\n", id);
     }
     #endif
-    putDBlkCacheEntry(&fs->dCache, id, buf);
+    LONG bid = id + fs->diskDBlkOffset;
+    if(fs->options.writeBack) {
+        if(writeDBlkCacheEntry(&fs->dCache, id, buf, cls, diskClockNs()) == 0) {
+            return throttleDirty(fs);
+        }
+        //the set is full of dirty blocks that cannot be written back
+        #ifdef DEBUG_VERBOSE
+        printf("writeDBlk could not hold id %d dirty, writing through\n", id);
+        #endif
+    }
+    else {
+        putDBlkCacheEntry(&fs->dCache, id, buf, cls);
+    }
     
     //printf("after calling put, &fs->dCache = %d\n", &fs->dCache);
     //printDBlkCache(&fs->dCache, id);
-    LONG bid = id + fs->diskDBlkOffset;
     #ifdef DEBUG_VERBOSE
     printf("writeDBlk write through, writing id %d to disk\n", id);
     #endif
-    return writeBlk(fs->disk, bid, buf);
+    return schedWriteBlk(&fs->sched, bid, buf);
+}
+
+BYTE* getDBlk(FileSystem* fs, LONG id, DBLK_CLASS cls) {
+    assert(id < fs->superblock.nDBlks);
+    BOOL claimed;
+    BYTE* blk = claimDBlkCacheEntry(&fs->dCache, id, cls, &claimed);
+    if(blk != NULL && !claimed) {
+        return blk;
+    }
+
+    //read the block straight into the way it claimed, other callers missing
+    //on it wait for this read, or into a disk buffer if every way of its
+    //set is pinned
+    if(blk == NULL) {
+        #ifdef DEBUG_VERBOSE
+        printf("getDBlk could not cache id %ld, using a private buffer\n", id);
+        #endif
+        blk = getBlkBuf(fs->disk);
+    }
+    INT succ = schedReadBlk(&fs->sched, id + fs->diskDBlkOffset, blk);
+    if(claimed) {
+        readyDBlkCacheEntry(&fs->dCache, blk, succ == 0);
+    }
+    if(succ == -1) {
+        fprintf(stderr, "Error: getDBlk failed to read data block %ld\n", id);
+        if(!claimed) {
+            putBlkBuf(fs->disk, blk);
+        }
+        return NULL;
+    }
+    return blk;
+}
+
+INT putDBlk(FileSystem* fs, LONG id, BYTE* blk, BOOL modified) {
+    LONG bid = id + fs->diskDBlkOffset;
+    if(!isDBlkCacheBlk(&fs->dCache, blk)) {
+        INT succ = modified ? schedWriteBlk(&fs->sched, bid, blk) : 0;
+        putBlkBuf(fs->disk, blk);
+        return succ;
+    }
+    INT succ = 0;
+    if(modified) {
+        if(fs->options.writeBack) {
+            dirtyDBlkCacheEntry(&fs->dCache, blk, diskClockNs());
+            succ = throttleDirty(fs);
+        }
+        else {
+            succ = schedWriteBlk(&fs->sched, bid, blk);
+        }
+    }
+    unpinDBlkCacheEntry(&fs->dCache, blk);
+    return succ;
+}
+
+// reads nBlks physically contiguous data blocks starting from id
+// blocks found in the DBlkCache are copied out, if any block misses the
+// whole run is read from disk with a single request, then the blocks with
+// writes queued in the I/O scheduler are patched in from the queue and
+// the cached ones, which may be dirty, from the cache
+INT readDBlks(FileSystem* fs, LONG id, UINT nBlks, BYTE* buf, DBLK_CLASS cls) {
+    assert(id + nBlks <= fs->superblock.nDBlks);
+    if(nBlks == 1) {
+        return readDBlk(fs, id, buf, cls);
+    }
+
+    DiskRequest req = { ._req_bid = id, ._req_nBlks = nBlks, ._req_buf = buf, ._req_write = false };
+    return readDBlkBatch(fs, &req, 1, cls);
+}
+
+// writes nBlks physically contiguous data blocks starting from id
+// the cache is updated block by block, the disk with a single request
+INT writeDBlks(FileSystem* fs, LONG id, UINT nBlks, BYTE* buf, DBLK_CLASS cls) {
+    DiskRequest req = { ._req_bid = id, ._req_nBlks = nBlks, ._req_buf = buf, ._req_write = true };
+    return writeDBlkBatch(fs, &req, 1, cls);
+}
+
+static int compareIds(const void *a, const void *b) {
+    LONG x = *(const LONG*) a, y = *(const LONG*) b;
+    return (x > y) - (x < y);
+}
+
+//index of a block id in a sorted array of distinct ids
+static UINT idIndex(LONG* ids, UINT n, LONG id) {
+    LONG* found = bsearch(&id, ids, n, sizeof(LONG), compareIds);
+    assert(found != NULL);
+    return (UINT)(found - ids);
+}
+
+INT readDBlkBatch(FileSystem* fs, DiskRequest* reqs, UINT nReqs, DBLK_CLASS cls) {
+    //every block of the batch is claimed in the cache first, a block some
+    //other caller is reading in is waited for rather than read twice; the
+    //claims are taken in id order so overlapping batches cannot deadlock
+    UINT nIds = 0;
+    for(UINT r = 0; r < nReqs; r++) {
+        assert(reqs[r]._req_bid + reqs[r]._req_nBlks <= fs->superblock.nDBlks);
+        nIds += reqs[r]._req_nBlks;
+    }
+    LONG* ids = malloc(nIds * sizeof(LONG));
+    BYTE** ways = malloc(nIds * sizeof(BYTE*));
+    BOOL* claimed = malloc(nIds * sizeof(BOOL));
+    BOOL* filled = calloc(nIds, sizeof(BOOL));
+    assert(ids != NULL && ways != NULL && claimed != NULL && filled != NULL);
+    nIds = 0;
+    for(UINT r = 0; r < nReqs; r++) {
+        for(UINT i = 0; i < reqs[r]._req_nBlks; i++) {
+            ids[nIds++] = reqs[r]._req_bid + i;
+        }
+    }
+    qsort(ids, nIds, sizeof(LONG), compareIds);
+    UINT n = 0;
+    for(UINT k = 0; k < nIds; k++) {
+        if(n == 0 || ids[n - 1] != ids[k]) {
+            ids[n++] = ids[k];
+        }
+    }
+    nIds = n;
+    for(UINT k = 0; k < nIds; k++) {
+        ways[k] = claimDBlkCacheEntry(&fs->dCache, ids[k], cls, &claimed[k]);
+    }
+
+    //runs entirely in cache are served right away, the rest go to disk
+    DiskRequest diskReqs[nReqs];
+    UINT origin[nReqs];
+    UINT nDiskReqs = 0;
+    for(UINT r = 0; r < nReqs; r++) {
+        DiskRequest* req = &reqs[r];
+        UINT first = idIndex(ids, nIds, req->_req_bid);
+        BOOL allCached = true;
+        for(UINT i = 0; i < req->_req_nBlks && allCached; i++) {
+            allCached = ways[first + i] != NULL && !claimed[first + i];
+        }
+        if(allCached) {
+            for(UINT i = 0; i < req->_req_nBlks; i++) {
+                memcpy(req->_req_buf + (LONG)i * fs->blkSize, ways[first + i], fs->blkSize);
+            }
+            req->_req_result = 0;
+            req->_req_done = true;
+            continue;
+        }
+        origin[nDiskReqs] = r;
+        diskReqs[nDiskReqs] = *req;
+        diskReqs[nDiskReqs]._req_bid += fs->diskDBlkOffset;
+        diskReqs[nDiskReqs]._req_write = false;
+        nDiskReqs++;
+    }
+
+    INT succ = 0;
+    if(nDiskReqs > 0) {
+        #ifdef DEBUG_VERBOSE
+        printf("readDBlkBatch submitting %u runs to disk...\n", nDiskReqs);
+        #endif
+        succ = runDiskRequests(&fs->aio, diskReqs, nDiskReqs);
+    }
+
+    //fill the claimed ways with what came back, blocks with writes still
+    //queued in the scheduler are newer there than on disk and cached
+    //blocks are newer in the cache
+    for(UINT d = 0; d < nDiskReqs; d++) {
+        DiskRequest* req = &reqs[origin[d]];
+        req->_req_result = diskReqs[d]._req_result;
+        req->_req_done = true;
+        if(req->_req_result != 0) {
+            continue;
+        }
+        schedPatchRead(&fs->sched, diskReqs[d]._req_bid, req->_req_nBlks, req->_req_buf);
+        UINT first = idIndex(ids, nIds, req->_req_bid);
+        for(UINT i = 0; i < req->_req_nBlks; i++) {
+            BYTE* blk = req->_req_buf + (LONG)i * fs->blkSize;
+            UINT k = first + i;
+            if(ways[k] == NULL) {
+                continue;
+            }
+            if(claimed[k]) {
+                memcpy(ways[k], blk, fs->blkSize);
+                filled[k] = true;
+            }
+            else {
+                memcpy(blk, ways[k], fs->blkSize);
+            }
+        }
+    }
+
+    for(UINT k = 0; k < nIds; k++) {
+        if(ways[k] == NULL) {
+            continue;
+        }
+        if(claimed[k]) {
+            readyDBlkCacheEntry(&fs->dCache, ways[k], filled[k]);
+        }
+        if(!claimed[k] || filled[k]) {
+            unpinDBlkCacheEntry(&fs->dCache, ways[k]);
+        }
+    }
+    free(ids);
+    free(ways);
+    free(claimed);
+    free(filled);
+    return succ;
+}
+
+INT writeDBlkBatch(FileSystem* fs, DiskRequest* reqs, UINT nReqs, DBLK_CLASS cls) {
+    DiskRequest diskReqs[nReqs];
+    for(UINT r = 0; r < nReqs; r++) {
+        DiskRequest* req = &reqs[r];
+        assert(req->_req_bid + req->_req_nBlks <= fs->superblock.nDBlks);
+        for(UINT i = 0; i < req->_req_nBlks; i++) {
+            putDBlkCacheEntry(&fs->dCache, req->_req_bid + i, req->_req_buf + (LONG)i * fs->blkSize, cls);
+        }
+        diskReqs[r] = *req;
+        diskReqs[r]._req_bid += fs->diskDBlkOffset;
+        diskReqs[r]._req_write = true;
+        //the direct write supersedes any queued copy of these blocks
+        schedDropBlks(&fs->sched, diskReqs[r]._req_bid, req->_req_nBlks);
+    }
+    #ifdef DEBUG_VERBOSE
+    printf("writeDBlkBatch write through, submitting %u runs to disk\n", nReqs);
+    #endif
+    INT succ = runDiskRequests(&fs->aio, diskReqs, nReqs);
+    for(UINT r = 0; r < nReqs; r++) {
+        reqs[r]._req_result = diskReqs[r]._req_result;
+        reqs[r]._req_done = true;
+    }
+    return succ;
 }
 
 // input: the data block logical id, the offset into that block, length of
 //        bytes to read in that block
 // output: a buffer that contains len bytes
 // function: read a data block with byte offset
-INT readDBlkOffset(FileSystem* fs, LONG id, BYTE* buf, UINT off, UINT len) {
+INT readDBlkOffset(FileSystem* fs, LONG id, BYTE* buf, UINT off, UINT len, DBLK_CLASS cls) {
     assert(id < fs->superblock.nDBlks);
-    assert(off < BLK_SIZE);
-    assert(off + len <= BLK_SIZE);
-
-    BYTE readBuf[BLK_SIZE];
+    assert(off < fs->blkSize);
+    assert(off + len <= fs->blkSize);
 
-    if (readDBlk(fs, id, readBuf) == -1) {
+    //copy straight out of the cached block
+    BYTE* blk = getDBlk(fs, id, cls);
+    if (blk == NULL) {
         fprintf(stderr, "In readDBlkOffset, fail to readDblk %ld!\n", id);
         return -1;
     }
     
-    memcpy(buf, readBuf + off, len);
+    memcpy(buf, blk + off, len);
+    putDBlk(fs, id, blk, false);
 
     return 0;
 }
@@ -897,21 +1577,21 @@ INT readDBlkOffset(FileSystem* fs, LONG id, BYTE* buf, UINT off, UINT len) {
 //        bytes to write in that block
 // output: the data block being updated
 // function: read a data block with byte offset
-INT writeDBlkOffset(FileSystem* fs, LONG id, BYTE* buf, UINT off, UINT len) {
+INT writeDBlkOffset(FileSystem* fs, LONG id, BYTE* buf, UINT off, UINT len, DBLK_CLASS cls) {
     assert(id < fs->superblock.nDBlks);
-    assert(off < BLK_SIZE);
-    assert(off + len <= BLK_SIZE);
+    assert(off < fs->blkSize);
+    assert(off + len <= fs->blkSize);
 
-    BYTE writeBuf[BLK_SIZE];
-
-    if (readDBlk(fs, id, writeBuf) == -1) {
+    //modify the cached block in place
+    BYTE* blk = getDBlk(fs, id, cls);
+    if (blk == NULL) {
         fprintf(stderr, "In writeDBlkOffset, fail to readDblk %ld!\n", id);
         return -1;
     }
 
-    memcpy(writeBuf + off, buf, len);
+    memcpy(blk + off, buf, len);
 
-    if (writeDBlk(fs, id, writeBuf) == -1) {
+    if (putDBlk(fs, id, blk, true) == -1) {
         fprintf(stderr, "In writeDBlkOffset, fail to writeDblk %ld!\n", id);
         return -1;
     }
@@ -919,374 +1599,688 @@ INT writeDBlkOffset(FileSystem* fs, LONG id, BYTE* buf, UINT off, UINT len) {
     return 0;
 }
 
+//reads entry index of an indirect block in place, -1 if the block cannot
+//be read
+static LONG readBlkPtr(FileSystem* fs, LONG blkId, UINT index) {
+    LONG* ptrs = (LONG*) getDBlk(fs, blkId, DBLK_META);
+    if (ptrs == NULL) {
+        return -1;
+    }
+    LONG ptr = ptrs[index];
+    putDBlk(fs, blkId, (BYTE*) ptrs, false);
+    return ptr;
+}
+
+//splits a file block into the pointer of the inode leading to it and
+//the entry to follow at each indirect level below it
+//returns the # of indirect levels, -1 past the largest file
+static INT blkPath(FileSystem* fs, INode* inode, LONG fileBlkId, LONG** top, UINT* idx) {
+    LONG n = fs->nPtrsPerBlk;
+    if(fileBlkId < INODE_NUM_DIRECT_BLKS) {
+        *top = &inode->_in_directBlocks[fileBlkId];
+        return 0;
+    }
+    fileBlkId -= INODE_NUM_DIRECT_BLKS;
+    if(fileBlkId < INODE_NUM_S_INDIRECT_BLKS * n) {
+        *top = &inode->_in_sIndirectBlocks[fileBlkId / n];
+        idx[0] = fileBlkId % n;
+        return 1;
+    }
+    fileBlkId -= INODE_NUM_S_INDIRECT_BLKS * n;
+    if(fileBlkId < INODE_NUM_D_INDIRECT_BLKS * n * n) {
+        *top = &inode->_in_dIndirectBlocks[fileBlkId / (n * n)];
+        fileBlkId %= n * n;
+        idx[0] = fileBlkId / n;
+        idx[1] = fileBlkId % n;
+        return 2;
+    }
+    fileBlkId -= INODE_NUM_D_INDIRECT_BLKS * n * n;
+    if(fileBlkId < INODE_NUM_T_INDIRECT_BLKS * n * n * n) {
+        *top = &inode->_in_tIndirectBlocks[fileBlkId / (n * n * n)];
+        fileBlkId %= n * n * n;
+        idx[0] = fileBlkId / (n * n);
+        idx[1] = fileBlkId / n % n;
+        idx[2] = fileBlkId % n;
+        return 3;
+    }
+    return -1;
+}
+
+//the pointer block holding the pointer to an indirect file block, the
+//one of the last lookup reused as is; its entry goes to the last argument
+//returns -1 with _err_last set if a block on the way is not allocated
+static LONG leafPtrBlk(FileSystem* fs, INode* inode, LONG fileBlkId, UINT* entry) {
+    //what is missing when the block at a given # of levels above the data
+    //is not allocated
+    static const ERROR missing[] = { _in_NonAllocDBlk, _in_NonAllocIndirectBlk, _in_NonAllocDIndirectBlk, _in_NonAllocTIndirectBlk };
+    BmapCache* bc = &inode->_in_bmap;
+    LONG n = fs->nPtrsPerBlk;
+    //pointer blocks map aligned ranges of n file blocks past the direct ones
+    LONG first = fileBlkId - (fileBlkId - INODE_NUM_DIRECT_BLKS) % n;
+    *entry = fileBlkId - first;
+    if(bc->_bc_ptrFileBlk == first) {
+        return bc->_bc_ptrBlk;
+    }
+
+    LONG* top;
+    UINT idx[3];
+    INT levels = blkPath(fs, inode, fileBlkId, &top, idx);
+    if(levels == -1) {
+        _err_last = _in_IndexOutOfRange;
+        THROW(__FILE__, __LINE__, __func__);
+        return -1;
+    }
+    LONG id = *top;
+    for(INT l = 0; id != -1 && l < levels - 1; l++) {
+        #ifdef DEBUG
+        printf("bmap: level %d block %ld entry %u\n", levels - l, id, idx[l]);
+        #endif
+        LONG child = readBlkPtr(fs, id, idx[l]);
+        if(child == -1) {
+            _err_last = missing[levels - l - 1];
+            THROW(__FILE__, __LINE__, __func__);
+            return -1;
+        }
+        id = child;
+    }
+    if(id == -1) {
+        _err_last = missing[levels];
+        THROW(__FILE__, __LINE__, __func__);
+        return -1;
+    }
+    bc->_bc_ptrFileBlk = first;
+    bc->_bc_ptrBlk = id;
+    return id;
+}
+
 // Functionality:
 // 	map internal index of an inode to its DBlk id
 // Errors:
 // 	1. internal index out of range
 // 	2. target block not allocated
 // Steps:
-// 	1. check direct range
-// 	2. check single indirect range
-// 	3. check double indirect range
-// 	4. if reach here, out of range
+// 	1. check the run of blocks cached in the inode
+// 	2. check direct range
+// 	3. find the pointer block of an indirect block, then its entry
+// 	4. remember the run of contiguous blocks starting at the block
 LONG bmap(FileSystem* fs, INode* inode, LONG fileBlkId) 
 {
     LONG DBlkID = -1;
+    //an inline inode has no blocks
+    if (inode->_in_flags & INODE_INLINE) {
+        return -1;
+    }
+    BmapCache* bc = &inode->_in_bmap;
+    if (fileBlkId >= bc->_bc_fileBlk && fileBlkId < bc->_bc_fileBlk + bc->_bc_len) {
+        return bc->_bc_blk + fileBlkId - bc->_bc_fileBlk;
+    }
+    if (inode->_in_flags & INODE_EXTENTS) {
+        Extent ex;
+        DBlkID = extentBmap(fs, inode, fileBlkId, &ex);
+        if (DBlkID != -1) {
+            bc->_bc_fileBlk = ex._ex_fileBlk;
+            bc->_bc_blk = ex._ex_blk;
+            bc->_bc_len = ex._ex_len;
+        }
+        return DBlkID;
+    }
+    LONG len = 1;
     if (fileBlkId < INODE_NUM_DIRECT_BLKS) {
         #ifdef DEBUG
 	printf("bmap direct blks: %ld\n", fileBlkId);
 	#endif
-        DBlkID = inode->_in_directBlocks[fileBlkId];
+        LONG* ptrs = inode->_in_directBlocks;
+        DBlkID = ptrs[fileBlkId];
         if (DBlkID == -1) {
 	    _err_last = _in_NonAllocDBlk;
 	    THROW(__FILE__, __LINE__, __func__);
 	    return -1;
         }
-	return DBlkID;
-    }
-    UINT entryNum = BLK_SIZE / sizeof (LONG);
-    fileBlkId -= (INODE_NUM_DIRECT_BLKS);
-    if (fileBlkId < INODE_NUM_S_INDIRECT_BLKS * entryNum) {
-	UINT S_index = fileBlkId / entryNum;
-	UINT S_offset = fileBlkId % entryNum;
-        LONG S_BlkID = inode -> _in_sIndirectBlocks[S_index];
-	#ifdef DEBUG
-        printf("bmap: S_index:%u, S_offset: %u, S_BlkID: %ld\n", S_index, S_offset, S_BlkID);
-        #endif
-	if (S_BlkID == -1) {
-	    _err_last = _in_NonAllocIndirectBlk;
-            THROW(__FILE__, __LINE__, __func__);
-	    return -1;
-	}
-        LONG blkBuf[entryNum];
-	readDBlk(fs, S_BlkID, (BYTE *)blkBuf);
-	if (blkBuf[S_offset] == -1) {
-	    _err_last = _in_NonAllocDBlk;
-            THROW(__FILE__, __LINE__, __func__);
-            return -1;
+        while (fileBlkId + len < INODE_NUM_DIRECT_BLKS && ptrs[fileBlkId + len] == DBlkID + len) {
+            len++;
         }
-        return *(blkBuf + S_offset);
     }
-    UINT entryNumS = entryNum * entryNum;
-    fileBlkId -= (INODE_NUM_S_INDIRECT_BLKS * entryNum);
-    if (fileBlkId < INODE_NUM_D_INDIRECT_BLKS * entryNumS) {
-        UINT D_index = fileBlkId / entryNumS;
-	fileBlkId -= D_index * entryNumS;
-	UINT S_Index = fileBlkId / entryNum;
-	UINT S_offset = fileBlkId % entryNum;
-        LONG D_BlkID = inode -> _in_dIndirectBlocks[D_index];
-	#ifdef DEBUG
-        printf("bmap: D_index: %u, S_index:%u, S_offset: %u, D_BlkID: %ld\n", D_index, S_Index, S_offset, D_BlkID);
-        #endif
-        if (D_BlkID == -1) {
-            _err_last = _in_NonAllocDIndirectBlk;
-            THROW(__FILE__, __LINE__, __func__);
+    else {
+        UINT entry;
+        LONG S_BlkID = leafPtrBlk(fs, inode, fileBlkId, &entry);
+        if (S_BlkID == -1) {
             return -1;
         }
-	LONG blkBuf[entryNum];
-	readDBlk(fs, D_BlkID, (BYTE *)blkBuf);
-	if (blkBuf[S_Index] == -1) {
-	    _err_last = _in_NonAllocIndirectBlk;
-            THROW(__FILE__, __LINE__, __func__);
-            return -1;
-	}
-        LONG S_BlkID = *(blkBuf + S_Index);
-	#ifdef DEBUG
-        printf("bmap: S_BlkID: %ld\n", S_BlkID);
-        #endif
-	readDBlk(fs, S_BlkID, (BYTE *)blkBuf);
-	if (blkBuf[S_offset] == -1) {
-	     _err_last = _in_NonAllocDBlk;
-            THROW(__FILE__, __LINE__, __func__);
-            return -1;
-	}
-	return *(blkBuf + S_offset);
-    }
-    UINT entryNumD = entryNumS * entryNum;
-    fileBlkId -= (INODE_NUM_D_INDIRECT_BLKS * entryNumS);
-    if (fileBlkId < INODE_NUM_T_INDIRECT_BLKS * entryNumD) {
-        UINT T_index = fileBlkId / entryNumD;
-        fileBlkId -= T_index * entryNumD;
-        UINT D_index = fileBlkId / entryNumS;
-	fileBlkId -= D_index * entryNumS;
-	UINT S_index = fileBlkId / entryNum;
-	UINT S_offset = fileBlkId % entryNum;
-        LONG T_BlkID = inode -> _in_tIndirectBlocks[T_index];
-	#ifdef DEBUG
-        printf("bmap: T_index: %u, D_index: %u, S_index:%u, S_offset: %u, T_BlkID: %ld\n", T_index, D_index, S_index, S_offset, T_BlkID);
+        #ifdef DEBUG
+        printf("bmap: S_BlkID: %ld, S_offset: %u\n", S_BlkID, entry);
         #endif
-        if (T_BlkID == -1) {
-            _err_last = _in_NonAllocTIndirectBlk;
-            THROW(__FILE__, __LINE__, __func__);
+        LONG* ptrs = (LONG*) getDBlk(fs, S_BlkID, DBLK_META);
+        if (ptrs == NULL) {
             return -1;
         }
-	LONG blkBuf[entryNum];
-	readDBlk(fs, T_BlkID, (BYTE *)blkBuf);
-	if (blkBuf[D_index] == -1) {
-	    _err_last = _in_NonAllocDIndirectBlk;
+        DBlkID = ptrs[entry];
+        while (DBlkID != -1 && entry + len < fs->nPtrsPerBlk && ptrs[entry + len] == DBlkID + len) {
+            len++;
+        }
+        putDBlk(fs, S_BlkID, (BYTE*) ptrs, false);
+        if (DBlkID == -1) {
+            _err_last = _in_NonAllocDBlk;
             THROW(__FILE__, __LINE__, __func__);
             return -1;
-	}
-        LONG D_BlkID = *(blkBuf + D_index);
+        }
+    }
+    bc->_bc_fileBlk = fileBlkId;
+    bc->_bc_blk = DBlkID;
+    bc->_bc_len = len;
+    return DBlkID;
+}
+
+//adds a block balloc just mapped to the cached run it continues, or
+//starts a new run with it
+static void noteBmap(INode* inode, LONG fileBlkId, LONG DBlkID) {
+    BmapCache* bc = &inode->_in_bmap;
+    if (bc->_bc_len > 0 && bc->_bc_fileBlk + bc->_bc_len == fileBlkId && bc->_bc_blk + bc->_bc_len == DBlkID) {
+        bc->_bc_len++;
+        return;
+    }
+    bc->_bc_fileBlk = fileBlkId;
+    bc->_bc_blk = DBlkID;
+    bc->_bc_len = 1;
+}
+
+//reads the blocks of ids missing from the cache into it, physically
+//adjacent ones with a single request and all the runs as one batch
+//returns the # of blocks read from disk
+static LONG fillDBlks(FileSystem* fs, LONG* ids, UINT n, DBLK_CLASS cls) {
+    //without a buffer nothing is prefetched, the reads fetch the blocks
+    //themselves
+    BYTE* buf = malloc((size_t)n * fs->blkSize);
+    if(buf == NULL) {
         #ifdef DEBUG
-        printf("bmap: D_BlkID: %ld\n", D_BlkID);
+        fprintf(stderr, "Warning: fillDBlks could not allocate a buffer for %u blocks!\n", n);
         #endif
-	readDBlk(fs, D_BlkID, (BYTE *)blkBuf);
-	if (blkBuf[S_index] == -1) {
-	    _err_last = _in_NonAllocIndirectBlk;
-            THROW(__FILE__, __LINE__, __func__);
-            return -1;
-	}
-        LONG S_BlkID = *(blkBuf + S_index);
-	#ifdef DEBUG
-        printf("bmap: S_BlkID: %ld\n", S_BlkID);
+        return 0;
+    }
+    DiskRequest reqs[n];
+    //the way reserved for each block read, in buffer order
+    BYTE* ways[n];
+    UINT nReqs = 0;
+    LONG nBlks = 0;
+    for(UINT i = 0; i < n; i++) {
+        //blocks cached or in flight already are left alone
+        BYTE* way = ids[i] < 0 ? NULL : reserveDBlkCacheEntry(&fs->dCache, ids[i], cls);
+        if(way == NULL) {
+            continue;
+        }
+        ways[nBlks] = way;
+        LONG bid = ids[i] + fs->diskDBlkOffset;
+        DiskRequest* run = nReqs > 0 ? &reqs[nReqs - 1] : NULL;
+        if(run != NULL && run->_req_bid + run->_req_nBlks == bid && run->_req_nBlks < DBLK_BATCH_RUN_BLKS) {
+            run->_req_nBlks++;
+        }
+        else {
+            reqs[nReqs++] = (DiskRequest) { ._req_bid = bid, ._req_nBlks = 1, ._req_buf = buf + nBlks * fs->blkSize, ._req_write = false };
+        }
+        nBlks++;
+    }
+    if(nReqs > 0) {
+        #ifdef DEBUG_VERBOSE
+        printf("fillDBlks submitting %ld blocks in %u runs to disk...\n", nBlks, nReqs);
         #endif
-	readDBlk(fs, S_BlkID, (BYTE *)blkBuf);
-	if (blkBuf[S_offset] == -1) {
-	     _err_last = _in_NonAllocDBlk;
-            THROW(__FILE__, __LINE__, __func__);
-            return -1;
-	}
-	return *(blkBuf + S_offset);
+        runDiskRequests(&fs->aio, reqs, nReqs);
+    }
+
+    //a failed run is only left out of the cache, the read that needs it
+    //reports the error
+    LONG nRead = 0;
+    for(UINT r = 0; r < nReqs; r++) {
+        BOOL ok = reqs[r]._req_done && reqs[r]._req_result == 0;
+        if(ok) {
+            schedPatchRead(&fs->sched, reqs[r]._req_bid, reqs[r]._req_nBlks, reqs[r]._req_buf);
+        }
+        for(UINT i = 0; i < reqs[r]._req_nBlks; i++) {
+            BYTE* way = ways[(reqs[r]._req_buf - buf) / fs->blkSize + i];
+            if(ok) {
+                memcpy(way, reqs[r]._req_buf + (LONG)i * fs->blkSize, fs->blkSize);
+            }
+            readyDBlkCacheEntry(&fs->dCache, way, ok);
+            if(ok) {
+                unpinDBlkCacheEntry(&fs->dCache, way);
+            }
+        }
+        nRead += ok ? reqs[r]._req_nBlks : 0;
+    }
+    free(buf);
+    return nRead;
+}
+
+//reads the indirect blocks mapping file blocks [from, to) a level at a
+//time, each level as one batch, so that bmap finds all of them cached
+static void fillPtrBlks(FileSystem* fs, INode* inode, LONG from, LONG to) {
+    //bmap reads the few blocks of an extent tree as it goes
+    if(inode->_in_flags & INODE_EXTENTS) {
+        return;
+    }
+    LONG ids[to - from];
+    for(INT level = 0; level < 3; level++) {
+        UINT n = 0;
+        for(LONG f = from; f < to; f++) {
+            LONG* top;
+            UINT idx[3];
+            if(blkPath(fs, inode, f, &top, idx) <= level) {
+                continue;
+            }
+            LONG id = *top;
+            //the levels above were read by the previous passes
+            for(INT l = 0; l < level && id >= 0; l++) {
+                id = readBlkPtr(fs, id, idx[l]);
+            }
+            if(id >= 0 && (n == 0 || ids[n - 1] != id)) {
+                ids[n++] = id;
+            }
+        }
+        if(n == 0) {
+            return;
+        }
+        fillDBlks(fs, ids, n, DBLK_META);
+    }
+}
+
+LONG readAhead(FileSystem* fs, INode* inode, ReadAhead* ra, LONG offset, LONG len) {
+    //the window never takes more than a quarter of the cache
+    UINT maxWindow = fs->options.readAheadBlks;
+    UINT capacity = fs->dCache._dCache_nSets * fs->dCache._dCache_nWays;
+    if(maxWindow > capacity / 4) {
+        maxWindow = capacity / 4;
+    }
+    if(maxWindow == 0 || len <= 0 || offset >= inode->_in_filesize || (inode->_in_flags & INODE_INLINE)) {
+        return 0;
+    }
+    if(offset + len > inode->_in_filesize) {
+        len = inode->_in_filesize - offset;
+    }
+    LONG nFileBlks = (inode->_in_filesize + fs->blkSize - 1) / fs->blkSize;
+    LONG first = offset / fs->blkSize;
+    LONG last = (offset + len - 1) / fs->blkSize;
+
+    //a read continuing where the last one ended, or inside its last block,
+    //extends the stream, anything else is a seek and shrinks the window
+    BOOL sequential = first == ra->_ra_next || first + 1 == ra->_ra_next;
+    ra->_ra_next = last + 1;
+    if(!sequential) {
+        ra->_ra_window /= 2;
+        if(ra->_ra_window < READAHEAD_MIN_BLKS) {
+            ra->_ra_window = 0;
+        }
+        ra->_ra_end = 0;
+        return 0;
+    }
+    if(ra->_ra_window == 0) {
+        ra->_ra_window = READAHEAD_MIN_BLKS < maxWindow ? READAHEAD_MIN_BLKS : maxWindow;
+        ra->_ra_end = first;
+    }
+
+    //refill once the reader gets within half a window of the prefetched
+    //end, a stream that keeps up gets a larger window each time
+    if(last + ra->_ra_window / 2 < ra->_ra_end) {
+        return 0;
+    }
+    if(ra->_ra_end > first) {
+        ra->_ra_window = 2 * ra->_ra_window < maxWindow ? 2 * ra->_ra_window : maxWindow;
+    }
+
+    //the blocks of the read itself go into the same batch unless there
+    //are more of them than a window
+    LONG from = ra->_ra_end > first ? ra->_ra_end : first;
+    if(last - first >= (LONG) maxWindow && from <= last) {
+        from = last + 1;
+    }
+    LONG to = last + 1 + ra->_ra_window;
+    if(to > nFileBlks) {
+        to = nFileBlks;
+    }
+    ra->_ra_end = to;
+    if(from >= to) {
+        return 0;
+    }
+
+    fillPtrBlks(fs, inode, from, to);
+    LONG ids[to - from];
+    for(LONG f = from; f < to; f++) {
+        ids[f - from] = bmap(fs, inode, f);
+    }
+    LONG nBlks = fillDBlks(fs, ids, (UINT)(to - from), inodeDBlkClass(inode));
+    ra->_ra_nIssued++;
+    ra->_ra_nBlks += nBlks;
+    #ifdef DEBUG_VERBOSE
+    printf("readAhead prefetched file blocks %ld to %ld, %ld from disk, window %u\n", from, to, nBlks, ra->_ra_window);
+    #endif
+    return nBlks;
+}
+
+void initWarmUp(FileSystem* fs, BOOL pending) {
+    fs->warmPending = pending;
+    fs->warmerRunning = false;
+    fs->warmerStop = false;
+    fs->nWarmBlks = 0;
+    fs->nWarmINodes = 0;
+}
+
+//caches the inodes of a sorted run of warm set ids sharing an inode block
+//that are neither open nor cached yet; called with fs->lock held
+static void warmINodeBlk(FileSystem* fs, LONG* ids, UINT n, BYTE* buf) {
+    UINT blk = fs->diskINodeBlkOffset + ids[0] / fs->inodesPerBlk;
+    BOOL read = false;
+    INode inode;
+    for(UINT i = 0; i < n; i++) {
+        UINT id = (UINT) ids[i];
+        if(hasINodeEntry(&fs->inodeTable, id)) {
+            continue;
+        }
+        if(!read && schedReadBlk(&fs->sched, blk, buf) == -1) {
+            return;
+        }
+        read = true;
+        memcpy(&inode, buf + id % fs->inodesPerBlk * fs->inodeSize, fs->diskINodeSize);
+        clearBmapCache(&inode);
+        putINode(&fs->inodeTable, id, &inode);
+        fs->nWarmINodes++;
+    }
+}
+
+static void* warmerMain(void* arg) {
+    FileSystem* fs = (FileSystem*) arg;
+    BYTE* buf = getBlkBuf(fs->disk);
+    if(schedReadBlk(&fs->sched, SUPERBLOCK_OFFSET, buf) == -1) {
+        fprintf(stderr, "Error: warm-up failed to read the superblock\n");
+        putBlkBuf(fs->disk, buf);
+        return NULL;
+    }
+    DWarmSet* warm = warmSetOf(buf);
+    UINT nIds = warm->nMetaBlks + warm->nDataBlks + warm->nINodes;
+    if(warm->magic != WARM_SET_MAGIC || nIds > warmSetCapacity(fs->blkSize)) {
+        putBlkBuf(fs->disk, buf);
+        return NULL;
+    }
+    UINT nMeta = warm->nMetaBlks, nData = warm->nDataBlks, nINodes = warm->nINodes;
+    LONG* ids = malloc(nIds * sizeof(LONG));
+    assert(ids != NULL);
+    memcpy(ids, warm->ids, nIds * sizeof(LONG));
+
+    //inodes first, a lookup needs them before it reads a directory; in id
+    //order so each inode block is read once
+    LONG* inodes = ids + nMeta + nData;
+    qsort(inodes, nINodes, sizeof(LONG), compareIds);
+    for(UINT i = 0; i < nINodes && inodes[i] < fs->superblock.nINodes; ) {
+        UINT j = i + 1;
+        while(j < nINodes && inodes[j] < fs->superblock.nINodes && inodes[j] / fs->inodesPerBlk == inodes[i] / fs->inodesPerBlk) {
+            j++;
+        }
+        pthread_mutex_lock(&fs->lock);
+        if(!fs->warmerStop) {
+            warmINodeBlk(fs, inodes + i, j - i, buf);
+        }
+        pthread_mutex_unlock(&fs->lock);
+        i = j;
+    }
+
+    //then the metadata blocks and the data blocks, in id order so that
+    //neighbours go out as one request
+    for(UINT c = 0; c < 2; c++) {
+        DBLK_CLASS cls = c == 0 ? DBLK_META : DBLK_DATA;
+        LONG* blks = c == 0 ? ids : ids + nMeta;
+        UINT n = c == 0 ? nMeta : nData;
+        for(UINT i = 0; i < n; i++) {
+            if(blks[i] < 0 || blks[i] >= fs->superblock.nDBlks) {
+                blks[i] = -1;
+            }
+        }
+        qsort(blks, n, sizeof(LONG), compareIds);
+        for(UINT i = 0; i < n; i += WARM_BATCH_BLKS) {
+            pthread_mutex_lock(&fs->lock);
+            if(!fs->warmerStop) {
+                fs->nWarmBlks += fillDBlks(fs, blks + i, n - i < WARM_BATCH_BLKS ? n - i : WARM_BATCH_BLKS, cls);
+            }
+            pthread_mutex_unlock(&fs->lock);
+        }
+    }
+    #ifdef DEBUG
+    printf("Warm-up read in %ld inodes and %ld data blocks\n", fs->nWarmINodes, fs->nWarmBlks);
+    #endif
+    free(ids);
+    putBlkBuf(fs->disk, buf);
+    return NULL;
+}
+
+INT startWarmUp(FileSystem* fs) {
+    if(!fs->warmPending) {
+        return 0;
+    }
+    fs->warmPending = false;
+    fs->warmerStop = false;
+    if(pthread_create(&fs->warmer, NULL, warmerMain, fs) != 0) {
+        fprintf(stderr, "Error: failed to start the warm-up, the caches fill on demand\n");
+        return -1;
     }
+    fs->warmerRunning = true;
+    return 0;
+}
 
-     _err_last = _in_IndexOutOfRange;
-     THROW(__FILE__, __LINE__, __func__);
-     return -1;
+void waitWarmUp(FileSystem* fs) {
+    if(!fs->warmerRunning) {
+        return;
+    }
+    pthread_join(fs->warmer, NULL);
+    fs->warmerRunning = false;
+}
+
+void stopWarmUp(FileSystem* fs) {
+    if(!fs->warmerRunning) {
+        return;
+    }
+    pthread_mutex_lock(&fs->lock);
+    fs->warmerStop = true;
+    pthread_mutex_unlock(&fs->lock);
+    waitWarmUp(fs);
+}
+
+void recordWarmSet(FileSystem* fs, BYTE* buf) {
+    DWarmSet* warm = warmSetOf(buf);
+    UINT capacity = warmSetCapacity(fs->blkSize);
+
+    //up to a quarter of the set is inodes: the root, the open ones and
+    //then the ones used last, from the head of the table's LRU list
+    UINT maxINodes = capacity / 4;
+    LONG inodes[maxINodes];
+    UINT nINodes = 0;
+    UINT root = fs->superblock.rootINodeID;
+    inodes[nINodes++] = root;
+    for(UINT b = 0; b < fs->inodeTable.nBins && nINodes < maxINodes; b++) {
+        for(INodeEntry* entry = fs->inodeTable.hashQ[b]; entry != NULL && nINodes < maxINodes; entry = entry->next) {
+            if(entry->_in_ref > 0 && entry->_in_id != root) {
+                inodes[nINodes++] = entry->_in_id;
+            }
+        }
+    }
+    for(INodeEntry* entry = fs->inodeTable.lruHead; entry != NULL && nINodes < maxINodes; entry = entry->lruNext) {
+        if(entry->_in_id != root) {
+            inodes[nINodes++] = entry->_in_id;
+        }
+    }
+
+    //the blocks take the rest, metadata first
+    warm->nMetaBlks = listDBlkCacheEntries(&fs->dCache, DBLK_META, warm->ids, capacity - nINodes);
+    warm->nDataBlks = listDBlkCacheEntries(&fs->dCache, DBLK_DATA, warm->ids + warm->nMetaBlks,
+                                           capacity - nINodes - warm->nMetaBlks);
+    warm->nINodes = nINodes;
+    memcpy(warm->ids + warm->nMetaBlks + warm->nDataBlks, inodes, nINodes * sizeof(LONG));
+    warm->magic = WARM_SET_MAGIC;
+    #ifdef DEBUG
+    printf("Recorded a warm set of %u metadata blocks, %u data blocks and %u inodes\n", warm->nMetaBlks, warm->nDataBlks, nINodes);
+    #endif
+}
+
+//a pointer block on the way down of ballocRange, copied in to be changed
+//in place and written back once the mapping moves past it
+typedef struct PtrBlk {
+    LONG id;
+    LONG* ptrs;
+    BOOL modified;
+} PtrBlk;
+
+//writes a pointer block of ballocRange back if it changed and lets it go
+static INT dropPtrBlk(FileSystem* fs, PtrBlk* blk) {
+    INT succ = 0;
+    if(blk->id != -1 && blk->modified) {
+        succ = writeDBlk(fs, blk->id, (BYTE*) blk->ptrs, DBLK_META);
+    }
+    blk->id = -1;
+    blk->modified = false;
+    return succ;
 }
 
 // Functionality:
-//     expand inode directories till fileBlkId, leave "holes" if necessary, return DBlkID
+//     maps fileBlkIds fileBlkId to fileBlkId + n - 1 into blks, allocating the
+//     data and pointer blocks missing, and returns how many were mapped
 // Errors:
-//     1. disk full (catched by allocDBlk)
-// Steps:
-LONG balloc(FileSystem *fs, INode* inode, LONG fileBlkId)
-{
+//     1. disk full part way (catched by allocDBlk), returns the blocks mapped so far
+//     2. nothing mapped, or a pointer block could not be written back, returns -1
+LONG ballocRange(FileSystem* fs, INode* inode, LONG fileBlkId, LONG n, LONG* blks) {
     #ifdef DEBUG
-    printf("balloc request for fileBlkId: %ld\n", fileBlkId);
+    printf("ballocRange request for fileBlkIds %ld to %ld\n", fileBlkId, fileBlkId + n - 1);
     #endif
-    UINT count = 0;
-    // shortcut: check if already allocated
-    LONG DBlkID = bmap(fs, inode, fileBlkId);
-    if (DBlkID !=  -1 ) {
-        #ifdef DEBUG_VERBOSE
-        printf("balloc already allocated fileBlkId %ld with DBlkId %ld\n", fileBlkId, DBlkID);
-        #endif
-        return DBlkID;
+    // the first block of an inline inode takes its data out of the inode
+    if ((inode->_in_flags & INODE_INLINE) && spillINodeData(fs, inode) == -1) {
+        return -1;
     }
-        
-    //UINT cur_internal_index = 0;
-    //for (cur_internal_index=0; bmap(fs, inode, cur_internal_index) != -1 && cur_internal_index < fileBlkId; cur_internal_index ++);
-    LONG cur_internal_index = fileBlkId;    
-
-    LONG newDBlkID = -1;
-    UINT entryNum = BLK_SIZE / sizeof(LONG);
-    UINT entryNumS = entryNum * entryNum;
-    UINT entryNumD = entryNumS * entryNum;
-    LONG blkBuf[entryNum];
-    LONG initBlk[entryNum];
-    for (int i=0; i<entryNum; i++)
-	initBlk[i] = -1;
-    // now, cur_internal_index holds the first unallocated entry
-    while (cur_internal_index <= fileBlkId) {
-        if (cur_internal_index < INODE_NUM_DIRECT_BLKS) {
-	    // alloc the DBlk
-	    if (cur_internal_index == fileBlkId) { //if this is the target writing block
-	        newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
-                }
-	    }
-	    else   //otherwise, creating holes
-		newDBlkID = -1;
-            inode->_in_directBlocks[cur_internal_index] = newDBlkID;
-	    count ++;
-	    cur_internal_index ++;
-	}
-	else if ((cur_internal_index - INODE_NUM_DIRECT_BLKS) < (INODE_NUM_S_INDIRECT_BLKS * entryNum)) {
-	    UINT S_index = (cur_internal_index - INODE_NUM_DIRECT_BLKS) / entryNum;
-	    UINT S_offset = (cur_internal_index - INODE_NUM_DIRECT_BLKS) % entryNum;
-	    // if this is the first alloc in this entry block, fisrt alloc the entry block
-	    if (inode->_in_sIndirectBlocks[S_index] == -1) {
-		newDBlkID = allocDBlk(fs);
-	        if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
-        	}
-		inode->_in_sIndirectBlocks[S_index] = newDBlkID;
-    		writeDBlk(fs, newDBlkID, (BYTE *)initBlk);
-	    }
-	    // now, alloc the DBlk
-	    if (cur_internal_index ==fileBlkId) {
-                newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
-                }
-	    }
-	    else
-		newDBlkID = -1;
-	    LONG S_DBlkID = inode->_in_sIndirectBlocks[S_index];
-	    readDBlk(fs, S_DBlkID, (BYTE *)blkBuf);
-	    *(blkBuf + S_offset) = newDBlkID;
-	    writeDBlk(fs, S_DBlkID, (BYTE *)blkBuf);
-	    count ++;
-	    cur_internal_index ++;
-	    
-	}
-	else if ((cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum) < (INODE_NUM_D_INDIRECT_BLKS * entryNumS)) {
-	    UINT D_index = (cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum) / entryNumS;
-	    UINT S_index = (cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum - D_index * entryNumS) / entryNum;
-	    UINT S_offset = (cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum - D_index * entryNumS) % entryNum;
-	    #ifdef DEBUG
-            printf("balloc: D_Index: %u, S_Index: %u, S_offset: %u, cur_internal_index: %u\n", D_index, S_index, S_offset, cur_internal_index);
-	    #endif
-	    if (inode->_in_dIndirectBlocks[D_index] == -1) {
-		newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
-                }
-		inode->_in_dIndirectBlocks[D_index] = newDBlkID;
-        writeDBlk(fs, newDBlkID, (BYTE *)initBlk);
-	    }
-	    LONG D_BlkID = inode->_in_dIndirectBlocks[D_index];
-	    #ifdef DEBUG
-	    printf("balloc: D_BlkID: %ld\n", D_BlkID);
-	    #endif
-	    readDBlk(fs, D_BlkID, (BYTE *)blkBuf);
-	    if (*(blkBuf + S_index) == -1) {
-	        newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
-                }
-		*(blkBuf + S_index) = newDBlkID;
-		writeDBlk(fs, D_BlkID, (BYTE *)blkBuf);
-                writeDBlk(fs, newDBlkID, (BYTE *)initBlk);
-	    }
-            //now, alloc the DBlk
-	    if (cur_internal_index == fileBlkId) {
-	        newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
-                }
-	    }
-	    else
-		newDBlkID = -1;
-	    LONG S_DBlkID = *(blkBuf + S_index);
-	    #ifdef DEBUG
-            printf("balloc: S_DBlkID: %ld\n", S_DBlkID);
-            #endif
-	    readDBlk(fs, S_DBlkID, (BYTE *)blkBuf);
-	    *(blkBuf + S_offset) = newDBlkID;
-	    writeDBlk(fs, S_DBlkID, (BYTE *)blkBuf);
-	    count ++;
-	    cur_internal_index ++;
-	}
-	else if ((cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum - INODE_NUM_D_INDIRECT_BLKS * entryNumS) 
-                < (INODE_NUM_T_INDIRECT_BLKS * entryNumD)) {
-            UINT T_index = (cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum - INODE_NUM_D_INDIRECT_BLKS * entryNumS) / entryNumD;
-	    UINT D_index = (cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum - INODE_NUM_D_INDIRECT_BLKS * entryNumS - T_index * entryNumD) / entryNumS;
-            assert(D_index < entryNum);
-	    UINT S_index = (cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum - INODE_NUM_D_INDIRECT_BLKS * entryNumS - T_index * entryNumD - D_index * entryNumS) / entryNum;
-            assert(S_index < entryNum);
-	    UINT S_offset = (cur_internal_index - INODE_NUM_DIRECT_BLKS - INODE_NUM_S_INDIRECT_BLKS * entryNum - INODE_NUM_D_INDIRECT_BLKS * entryNumS - T_index * entryNumD - D_index * entryNumS) % entryNum;
-	    
-            if (inode->_in_tIndirectBlocks[T_index] == -1) {
-		newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
+    LONG i = 0;
+    if (inode->_in_flags & INODE_EXTENTS) {
+        for (; i < n; i++) {
+            blks[i] = extentBalloc(fs, inode, fileBlkId + i);
+            if (blks[i] == -1) {
+                break;
+            }
+            noteBmap(inode, fileBlkId + i, blks[i]);
+        }
+        return i > 0 ? i : -1;
+    }
+
+    //the pointer blocks from the one the inode points to down to the one
+    //holding the data block pointers, kept while the blocks share them
+    LONG bufs[3][fs->nPtrsPerBlk];
+    PtrBlk path[3];
+    for (INT l = 0; l < 3; l++) {
+        path[l] = (PtrBlk) { .id = -1, .ptrs = bufs[l], .modified = false };
+    }
+    BmapCache* bc = &inode->_in_bmap;
+    for (; i < n; i++) {
+        LONG f = fileBlkId + i;
+        if (f >= bc->_bc_fileBlk && f < bc->_bc_fileBlk + bc->_bc_len) {
+            blks[i] = bc->_bc_blk + f - bc->_bc_fileBlk;
+            continue;
+        }
+        LONG* slot;
+        UINT idx[3];
+        INT levels = blkPath(fs, inode, f, &slot, idx);
+        if (levels == -1) {
+            _err_last = _in_IndexOutOfRange;
+            THROW(__FILE__, __LINE__, __func__);
+            break;
+        }
+        //follow the path down, allocating the pointer blocks missing on it
+        BOOL* holder = NULL;
+        INT l = 0;
+        for (; l < levels; l++) {
+            PtrBlk* blk = &path[l];
+            if (*slot == -1) {
+                LONG newBlk = allocDBlk(fs);
+                if (newBlk == -1) {
                     _err_last = _fs_DBlkOutOfNumber;
                     THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
+                    break;
                 }
-		inode->_in_tIndirectBlocks[T_index] = newDBlkID;
-                writeDBlk(fs, newDBlkID, (BYTE *)initBlk);
-	    }
-	    LONG T_BlkID = inode->_in_tIndirectBlocks[T_index];
-	    readDBlk(fs, T_BlkID, (BYTE *)blkBuf);
-	    if (*(blkBuf + D_index) == -1) {
-		newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
+                dropPtrBlk(fs, blk);
+                for (UINT e = 0; e < fs->nPtrsPerBlk; e++) {
+                    blk->ptrs[e] = -1;
                 }
-		*(blkBuf + D_index) = newDBlkID;
-		writeDBlk(fs, T_BlkID, (BYTE *)blkBuf);
-                writeDBlk(fs, newDBlkID, (BYTE *)initBlk);
-	    }
-	    LONG D_BlkID = *(blkBuf + D_index);
-	    readDBlk(fs, D_BlkID, (BYTE *)blkBuf);
-	    if (*(blkBuf + S_index) == -1) {
-	        newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
+                blk->id = *slot = newBlk;
+                blk->modified = true;
+                if (holder != NULL) {
+                    *holder = true;
                 }
-		*(blkBuf + S_index) = newDBlkID;
-		writeDBlk(fs, D_BlkID, (BYTE *)blkBuf);
-                writeDBlk(fs, newDBlkID, (BYTE *)initBlk);
-	    }
-            //now, alloc the DBlk
-	    if (cur_internal_index == fileBlkId) {
-	        newDBlkID = allocDBlk(fs);
-                if (newDBlkID == -1) {
-                    _err_last = _fs_DBlkOutOfNumber;
-                    THROW(__FILE__, __LINE__, __func__);
-                    return newDBlkID;
+            }
+            else if (blk->id != *slot) {
+                dropPtrBlk(fs, blk);
+                if (readDBlk(fs, *slot, (BYTE*) blk->ptrs, DBLK_META) == -1) {
+                    break;
                 }
-	    }
-	    else
-		newDBlkID = -1;
-	    LONG S_DBlkID = *(blkBuf + S_index);
-	    readDBlk(fs, S_DBlkID, (BYTE *)blkBuf);
-	    *(blkBuf + S_offset) = newDBlkID;
-	    writeDBlk(fs, S_DBlkID, (BYTE *)blkBuf);
-	    count ++;
-	    cur_internal_index ++;
-	}
-	else {
-	    _err_last = _in_IndexOutOfRange;
-	    THROW(__FILE__, __LINE__, __func__);
-	    return -1;
-	}
+                blk->id = *slot;
+            }
+            slot = &blk->ptrs[idx[l]];
+            holder = &blk->modified;
+        }
+        if (l < levels) {
+            break;
+        }
+        if (*slot == -1) {
+            LONG newBlk = allocDBlk(fs);
+            if (newBlk == -1) {
+                _err_last = _fs_DBlkOutOfNumber;
+                THROW(__FILE__, __LINE__, __func__);
+                break;
+            }
+            *slot = newBlk;
+            if (holder != NULL) {
+                *holder = true;
+            }
+        }
+        blks[i] = *slot;
+        noteBmap(inode, f, blks[i]);
     }
 
+    //the pointer blocks changed go out once each
+    for (INT l = 0; l < 3; l++) {
+        if (dropPtrBlk(fs, &path[l]) == -1) {
+            return -1;
+        }
+    }
     #ifdef DEBUG_VERBOSE
-    printf("balloc allocated for fileBlkId %ld new DBlkID %ld\n", fileBlkId, newDBlkID);
-    #endif 
-    return newDBlkID;
+    printf("ballocRange mapped %ld of %ld blocks\n", i, n);
+    #endif
+    return i > 0 ? i : -1;
+}
 
+LONG balloc(FileSystem *fs, INode* inode, LONG fileBlkId)
+{
+    LONG DBlkID;
+    if (ballocRange(fs, inode, fileBlkId, 1, &DBlkID) != 1) {
+        return -1;
+    }
+    #ifdef DEBUG_VERBOSE
+    printf("balloc mapped fileBlkId %ld to DBlkID %ld\n", fileBlkId, DBlkID);
+    #endif
+    return DBlkID;
 }
 
 INT bfree(FileSystem *fs, INode* inode, LONG fileBlkId) {
     #ifdef DEBUG_VERBOSE
     printf("bfree requested for fileBlkId: %u\n", fileBlkId);
     #endif
+    if (inode->_in_flags & INODE_EXTENTS) {
+        clearBmapCache(inode);
+        return extentBfree(fs, inode, fileBlkId);
+    }
     LONG DBlkID = bmap(fs, inode, fileBlkId);
     if (DBlkID ==  -1 ) {
         fprintf(stderr, "Cannot free an unallocated fileBlkId %ld\n", fileBlkId);
         return -1;
     }
+    //the block, and maybe its pointer blocks, leave the cached translations
+    clearBmapCache(inode);
     #ifdef DEBUG_VERBOSE
     printf("bfree resolved fileBlkId %d to DBlkId %d\n", fileBlkId, DBlkID);
     #endif
 
     LONG cur_internal_index = fileBlkId;    
     
-    UINT entryNum = BLK_SIZE / sizeof(LONG);
-    UINT entryNumS = entryNum * entryNum;
-    UINT entryNumD = entryNumS * entryNum;
+    UINT entryNum = fs->nPtrsPerBlk;
+    LONG entryNumS = (LONG)entryNum * entryNum;
+    LONG entryNumD = entryNumS * entryNum;
     LONG blkBuf_t[entryNum];
     LONG blkBuf_d[entryNum];
     LONG blkBuf_s[entryNum];
@@ -1305,34 +2299,34 @@ INT bfree(FileSystem *fs, INode* inode, LONG fileBlkId) {
         UINT S_offset = (cur_internal_index - INODE_NUM_DIRECT_BLKS) % entryNum;
 	    
         LONG T_BlkID = inode->_in_tIndirectBlocks[T_index];
-        readDBlk(fs, T_BlkID, (BYTE*) blkBuf_t);
+        readDBlk(fs, T_BlkID, (BYTE*) blkBuf_t, DBLK_META);
         if (blkBuf_t[D_index] == -1) {
             fprintf(stderr, "ERROR: unallocated triple indirect block\n");
             return -1;
         }
         LONG D_BlkID = blkBuf_t[D_index];
-        readDBlk(fs, D_BlkID, (BYTE *)blkBuf_d);
+        readDBlk(fs, D_BlkID, (BYTE *)blkBuf_d, DBLK_META);
         if (blkBuf_d[S_index] == -1) {
             fprintf(stderr, "ERROR: unallocated double indirect block\n");
             return -1;
         }
         LONG S_BlkID = blkBuf_d[S_index];
-        readDBlk(fs, S_BlkID, (BYTE *)blkBuf_s);
+        readDBlk(fs, S_BlkID, (BYTE *)blkBuf_s, DBLK_META);
 
         // free the data block
         freeDBlk(fs, blkBuf_s[S_offset]);
         // mark the corresponding entry in the S_indirecct blk as -1
         blkBuf_s[S_offset] = -1;
-        writeDBlk(fs, S_BlkID, (BYTE *)blkBuf_s);
+        writeDBlk(fs, S_BlkID, (BYTE *)blkBuf_s, DBLK_META);
 
         if(S_offset == 0) {
             freeDBlk(fs, S_BlkID);
             blkBuf_d[S_index] = -1;
-            writeDBlk(fs, D_BlkID, (BYTE *)blkBuf_d);
+            writeDBlk(fs, D_BlkID, (BYTE *)blkBuf_d, DBLK_META);
             if (S_index == 0) {
                 freeDBlk(fs, D_BlkID);
                 blkBuf_t[D_index] = -1;
-                writeDBlk(fs, T_BlkID, (BYTE *)blkBuf_t);
+                writeDBlk(fs, T_BlkID, (BYTE *)blkBuf_t, DBLK_META);
                 if(D_index == 0) {
                     freeDBlk(fs, T_BlkID);
                     inode->_in_tIndirectBlocks[T_index] = -1;
@@ -1348,24 +2342,24 @@ INT bfree(FileSystem *fs, INode* inode, LONG fileBlkId) {
         UINT S_offset = (cur_internal_index - INODE_NUM_DIRECT_BLKS) % entryNum;
         
         LONG D_BlkID = inode->_in_dIndirectBlocks[D_index];
-        readDBlk(fs, D_BlkID, (BYTE *)blkBuf_d);
+        readDBlk(fs, D_BlkID, (BYTE *)blkBuf_d, DBLK_META);
         if (blkBuf_d[S_index] == -1) {
             fprintf(stderr, "ERROR: unallocated double indirect block\n");
             return -1;
         }
         LONG S_BlkID = blkBuf_d[S_index];
-        readDBlk(fs, S_BlkID, (BYTE *)blkBuf_s);
+        readDBlk(fs, S_BlkID, (BYTE *)blkBuf_s, DBLK_META);
 
         // free the data block
         freeDBlk(fs, blkBuf_s[S_offset]);
         // mark the corresponding entry in the S_indirecct blk as -1
         blkBuf_s[S_offset] = -1;
-        writeDBlk(fs, S_BlkID, (BYTE *)blkBuf_s);
+        writeDBlk(fs, S_BlkID, (BYTE *)blkBuf_s, DBLK_META);
 
         if(S_offset == 0) {
             freeDBlk(fs, S_BlkID);
             blkBuf_d[S_index] = -1;
-            writeDBlk(fs, D_BlkID, (BYTE *)blkBuf_d);
+            writeDBlk(fs, D_BlkID, (BYTE *)blkBuf_d, DBLK_META);
             if (S_index == 0) {
                 freeDBlk(fs, D_BlkID);
                 inode->_in_dIndirectBlocks[D_index] = -1;
@@ -1381,7 +2375,7 @@ INT bfree(FileSystem *fs, INode* inode, LONG fileBlkId) {
         printf("bfree in the range of single indirect block, S_index = %u, S_offset = %u\n", S_index, S_offset);
         #endif
         LONG S_BlkID = inode->_in_sIndirectBlocks[S_index];
-        readDBlk(fs, S_BlkID, (BYTE *)blkBuf_s);
+        readDBlk(fs, S_BlkID, (BYTE *)blkBuf_s, DBLK_META);
 
         // free the data block
         #ifdef DEBUG_VERBOSE
@@ -1390,7 +2384,7 @@ INT bfree(FileSystem *fs, INode* inode, LONG fileBlkId) {
         freeDBlk(fs, blkBuf_s[S_offset]);
         // mark the corresponding entry in the S_indirecct blk as -1
         blkBuf_s[S_offset] = -1;
-        writeDBlk(fs, S_BlkID, (BYTE *)blkBuf_s);
+        writeDBlk(fs, S_BlkID, (BYTE *)blkBuf_s, DBLK_META);
 
         if(S_offset == 0) {
             #ifdef DEBUG_VERBOSE
@@ -1420,26 +2414,26 @@ void printINodes(FileSystem* fs) {
     }
 }
 
-void printDBlkInts(BYTE *buf)
+void printDBlkInts(FileSystem* fs, BYTE *buf)
 {
-    for(UINT k = 0; k < BLK_SIZE; k+=sizeof(UINT)) {
+    for(UINT k = 0; k < fs->blkSize; k+=sizeof(UINT)) {
         UINT* val = (UINT*) (buf + k);
         printf("%d ", *val);
     }
     printf("\n");
 }
 
-void printDBlkBytes(BYTE *buf)
+void printDBlkBytes(FileSystem* fs, BYTE *buf)
 {
-    for(UINT k = 0; k < BLK_SIZE; k++) {
+    for(UINT k = 0; k < fs->blkSize; k++) {
         printf("%x ", buf[k]);
     }
     printf("\n");
 }
 
-void printDBlkChars(BYTE *buf)
+void printDBlkChars(FileSystem* fs, BYTE *buf)
 {
-    for(UINT k = 0; k < BLK_SIZE; k++) {
+    for(UINT k = 0; k < fs->blkSize; k++) {
         printf("%c ", (char) buf[k]);
     }
     printf("\n");
@@ -1447,10 +2441,10 @@ void printDBlkChars(BYTE *buf)
 
 void printDBlks(FileSystem* fs) {
     for(UINT i = 0; i < fs->superblock.nDBlks; i++) {
-        BYTE buf[BLK_SIZE];
-        readDBlk(fs, i, buf);
+        BYTE buf[fs->blkSize];
+        readDBlk(fs, i, buf, DBLK_DATA);
         printf("%d\t| ", i);
-        printDBlkInts(buf);
+        printDBlkInts(fs, buf);
     }
 }
 #endif
@@ -5,12 +5,19 @@
  */
 
 #include "DiskEmulator.h"
+#include "AsyncDisk.h"
+#include "IOSched.h"
 #include "OpenFileTable.h"
-#include "INodeCache.h"
 #include "INodeTable.h"
+#include "INodeBitmap.h"
 #include "DBlkCache.h"
 #include "SuperBlock.h"
+#include "MountOptions.h"
 #include "Utility.h"
+#include <pthread.h>
+
+//# of freed data blocks collected before they are discarded together
+#define DISCARD_BATCH_SIZE (64)
 
 typedef struct FileSystem {
 
@@ -23,17 +30,37 @@ typedef struct FileSystem {
     //logical id of the first inode block
     UINT diskINodeBlkOffset;
 
+    //logical id of the first free inode bitmap block, which follow the
+    //inode blocks
+    UINT diskIBitmapOffset;
+
     //logical id of the first data block
     UINT diskDBlkOffset;
+
+    //geometry, the block and inode sizes come from the superblock and the
+    //rest is derived from them at make/mount time
+    UINT blkSize;
+    UINT inodeSize;
+    UINT inodesPerBlk;
+    //bytes of the in-core inode an inode slot holds, and of them the ones
+    //left for inline data
+    UINT diskINodeSize;
+    UINT inlineSize;
+    //# of block ids in a block, the fan-out of indirect blocks and the
+    //size of a free data block group
+    UINT nPtrsPerBlk;
+    LONG maxFileBlks;
+    LONG maxFileSize;
+    LONG maxFileNumInDir;
     
     //the open file table of the filesystem
     OpenFileTable openFileTable;
     
     //the inode table of the filesystem
     INodeTable inodeTable;
-    
-    //the inode cache of the filesystem
-    INodeCache inodeCache;
+
+    //the free inode bitmap, in core whole
+    INodeBitmap iBitmap;
     
     //the datablk cache of the filesystem
     DBlkCache dCache;
@@ -41,17 +68,127 @@ typedef struct FileSystem {
     //the disk device of the filesystem
     //in Phase 1, this is an in-memory array
     DiskArray* disk;
+
+    //asynchronous engine batched block transfers go through
+    AsyncDisk aio;
+
+    //scheduler block writes are queued and merged in between plug/unplug
+    IOSched sched;
+
+    //the options the filesystem was made or mounted with
+    MountOptions options;
+
+    //freed data blocks waiting to be discarded, in discard mode
+    LONG discardBatch[DISCARD_BATCH_SIZE];
+    UINT nDiscards;
+
+    //diskClockNs() of the last trim pass
+    LONG lastTrimNs;
+
+    //write-back, # of dirty data blocks past which the flusher is woken
+    //and past which a writer flushes itself
+    UINT dirtyBgLimit;
+    UINT dirtyLimit;
+
+    //serializes the l2 calls and the flusher passes, recursive since l2
+    //calls nest
+    pthread_mutex_t lock;
+
+    //background thread writing dirty data blocks back
+    pthread_t flusher;
+    pthread_cond_t flushCond;
+    BOOL flusherRunning;
+    BOOL flusherStop;
+
+    //background thread prefetching the warm set of the last unmount,
+    //pending from the mount until it is started
+    pthread_t warmer;
+    BOOL warmPending;
+    BOOL warmerRunning;
+    BOOL warmerStop;
+    //# of data blocks and inodes the warm-up read in
+    LONG nWarmBlks;
+    LONG nWarmINodes;
+
+    //# of inode block writes dirty inodes went out in
+    LONG nINodeBlkFlushes;
     
 } FileSystem;
 
 // creates the file system
-INT makefs(LONG, UINT, FileSystem*);
+// args: # of data blocks,
+//       # of inodes,
+//       block size (0 for DEFAULT_BLK_SIZE),
+//       inode size (0 for DEFAULT_INODE_SIZE),
+//       options, may be NULL for the defaults,
+//       file system
+INT makefs(LONG, UINT, UINT, UINT, MountOptions*, FileSystem*);
+
+// checks the block and inode sizes and derives the rest of the geometry
+// returns -1 if the sizes are not usable
+INT initGeometry(FileSystem*, UINT, UINT);
+
+// sets the inode, free inode bitmap and data block offsets of a
+// filesystem with the given # of inodes, from the geometry
+void setLayout(FileSystem*, UINT);
 
-// destroys a file system
+// reads the free inode bitmap in at mount and counts the free inodes of
+// each group
+INT loadINodeBitmap(FileSystem*);
+
+// destroys a file system, writing back the dirty inodes and data blocks
+// first
 INT closefs(FileSystem*);
 
-// allocate a free inode
-INT allocINode(FileSystem*, INode*);
+// sets up the data block cache from the options
+void setupDBlkCache(FileSystem*);
+
+// sets up the inode table from the options and the callback it writes
+// dirty inodes back through
+void setupINodeTable(FileSystem*);
+
+// sets up the write-back state, the dirty limits from the options and
+// the callback the data block cache writes back through
+void initWriteBack(FileSystem*);
+
+// starts the flusher, which wakes every flushIntervalMs or when a writer
+// passes dirtyBgLimit and, holding fs->lock, writes back the blocks dirty
+// for longer than dirtyExpireMs and then the oldest down to dirtyBgLimit
+INT startFlusher(FileSystem*);
+
+// stops the flusher, the dirty blocks stay in the cache
+void stopFlusher(FileSystem*);
+
+// writes every dirty data block back
+INT syncDBlks(FileSystem*);
+
+// writes every dirty inode back, each inode block once with all of its
+// dirty inodes, in block order; the inodes with only lazily kept
+// timestamp changes go along in those blocks, and all of them when lazy
+// is set; the changed free inode bitmap blocks are written too
+INT syncINodes(FileSystem*, BOOL);
+
+// sets up the warm-up state, pending when the warm set of the last
+// unmount is to be prefetched
+void initWarmUp(FileSystem*, BOOL);
+
+// starts the pending warm-up, which reads the warm set out of the
+// superblock block and prefetches its inodes and then its blocks in small
+// batches, each holding fs->lock, so the filesystem is usable meanwhile
+INT startWarmUp(FileSystem*);
+
+// waits for the warm-up to finish
+void waitWarmUp(FileSystem*);
+
+// stops the warm-up after the batch it is on
+void stopWarmUp(FileSystem*);
+
+// notes the hottest cached blocks and inodes in the warm set of a
+// superblock block buffer
+void recordWarmSet(FileSystem*, BYTE*);
+
+// allocate a free inode of the given type
+INT allocINode(FileSystem*, INode*, enum FILE_TYPE);
 
 // free an allocated inode
 INT freeINode(FileSystem*, UINT);
@@ -68,30 +205,95 @@ INT readINodeNoCache(FileSystem*, UINT, INode*);
 // returns the number of bytes read, -1 on failure
 LONG readINodeData(FileSystem*, INode*, BYTE*, LONG, LONG);
 
-// writes to an inode
+// called before a read of an open file with its readahead state, on a
+// sequential stream reads the read's blocks and a window past them, with
+// the indirect blocks mapping them, into the cache as one batch
+// args: file system, inode, readahead state, offset, length
+// returns the # of blocks read from disk
+LONG readAhead(FileSystem*, INode*, ReadAhead*, LONG, LONG);
+
+// writes to an inode, the in-core copy only; the inode stays dirty in the
+// inode table until syncINodes, the flusher or its eviction writes it back
 INT writeINode(FileSystem*, UINT, INode*);
 
-// writes to the file section of the inode
+// sets the access time of an inode read through an open file entry as the
+// atime mount option says; the change does not touch the ctime and under
+// lazytime is kept in core until the inode block is written for another
+// reason, a sync or the entry's eviction
+void touchATime(FileSystem*, INodeEntry*);
+
+// writes to the file section of the inode, an inline inode whose data
+// outgrows the inode is moved out to data blocks first
 // returns the number of bytes written, -1 on failure
 LONG writeINodeData(FileSystem*, INode*, BYTE*, LONG, LONG);
 
+// moves the data of an inline inode out to data blocks
+// returns 0 on success, -1 if no block could be allocated
+INT spillINodeData(FileSystem*, INode*);
+
 // allocate a free data block
 LONG allocDBlk(FileSystem*);
 
 // free an allocated data block
 INT freeDBlk(FileSystem*, LONG);
 
+// discards the data blocks collected by freeDBlk in discard mode,
+// sorted and merged into runs
+INT flushDiscards(FileSystem*);
+
+// discards every block on the free data block list except the list
+// blocks themselves, like fstrim
+// returns the # of blocks discarded, -1 if the disk cannot discard
+LONG trimFreeDBlks(FileSystem*);
+
+// the data block calls take the class the block is cached as, DBLK_META
+// for indirect, directory and free list blocks and DBLK_DATA for file
+// contents
+
 // reads a data block
-INT readDBlk(FileSystem*, LONG, BYTE*);
+INT readDBlk(FileSystem*, LONG, BYTE*, DBLK_CLASS);
+
+// writes a data block, in write-back mode the block is only marked dirty
+// in the cache
+INT writeDBlk(FileSystem*, LONG, BYTE*, DBLK_CLASS); 
+
+// pins a data block in the cache and returns its bytes, reading it on a
+// miss, so the caller reads and changes the cached block in place
+// the bytes stay valid until putDBlk, NULL if the block cannot be read
+BYTE* getDBlk(FileSystem*, LONG, DBLK_CLASS);
+
+// releases a block from getDBlk; if it was modified it is written, or
+// only marked dirty in write-back mode
+// args: file system, block id, the bytes getDBlk returned, modified
+INT putDBlk(FileSystem*, LONG, BYTE*, BOOL);
 
-// writes a data block
-INT writeDBlk(FileSystem*, LONG, BYTE*); 
+// reads a run of physically contiguous data blocks
+INT readDBlks(FileSystem*, LONG, UINT, BYTE*, DBLK_CLASS);
+
+// writes a run of physically contiguous data blocks
+INT writeDBlks(FileSystem*, LONG, UINT, BYTE*, DBLK_CLASS);
+
+//max # of runs readINodeData/writeINodeData submit in one batch
+#define DBLK_BATCH_SIZE (32)
+//runs longer than this are cut into several requests kept in flight together
+#define DBLK_BATCH_RUN_BLKS (32)
+//# of warm set blocks the warm-up reads in per hold of fs->lock
+#define WARM_BATCH_BLKS (16)
+
+// reads a set of data block runs, each request names a data block id, a
+// run length and a buffer; the runs missing from the cache are submitted
+// together and waited on as one batch
+INT readDBlkBatch(FileSystem*, DiskRequest*, UINT, DBLK_CLASS);
+
+// writes a set of data block runs as one batch, straight to disk even in
+// write-back mode
+INT writeDBlkBatch(FileSystem*, DiskRequest*, UINT, DBLK_CLASS);
 
 // reads certain number of bytes from a block with offset
-INT readDBlkOffset(FileSystem*, LONG, BYTE*, UINT, UINT);
+INT readDBlkOffset(FileSystem*, LONG, BYTE*, UINT, UINT, DBLK_CLASS);
 
 // writes certain number of bytes of a block with offset
-INT writeDBlkOffset(FileSystem*, LONG, BYTE*, UINT, UINT); 
+INT writeDBlkOffset(FileSystem*, LONG, BYTE*, UINT, UINT, DBLK_CLASS); 
 
 // converts file byte offset in inode to logical block ID
 LONG bmap(FileSystem* fs, INode* inode, LONG fileBlkId);
@@ -99,6 +301,14 @@ LONG bmap(FileSystem* fs, INode* inode, LONG fileBlkId);
 // map flattened index to internal index of the inode
 LONG balloc(FileSystem*, INode *, LONG);
 
+// maps the file blocks from the third argument on into the data blocks
+// given back in the last argument, allocating the missing ones; every
+// pointer block on the way is changed in memory and written out once
+// args: file system, inode, first file block, # of blocks, data blocks
+// returns the # of blocks mapped, fewer when the disk fills, -1 if none
+// or if a pointer block could not be written back
+LONG ballocRange(FileSystem*, INode*, LONG, LONG, LONG*);
+
 // free file blk in an inode
 INT bfree(FileSystem*, INode *, LONG);
 
@@ -106,11 +316,11 @@ INT bfree(FileSystem*, INode *, LONG);
 // prints all the inodes for debugging
 void printINodes(FileSystem*);
 
-void printDBlkInts(BYTE *buf);
+void printDBlkInts(FileSystem*, BYTE *buf);
 
-void printDBlkBytes(BYTE *buf);
+void printDBlkBytes(FileSystem*, BYTE *buf);
 
-void printDBlkChars(BYTE *buf);
+void printDBlkChars(FileSystem*, BYTE *buf);
 
 // prints all the data blocks for debugging
 void printDBlks(FileSystem*);
@@ -18,6 +18,7 @@
 
 //disk partition path
 #define DISK_PATH "diskFile"
+#define DISK_MEMBER_PATH_FMT DISK_PATH ".%u" //members of a striped disk past the first
 
 //Architecture specific
 #define UINT uint32_t
@@ -29,14 +30,18 @@
 //File system specific
 #define MAX_FS_SIZE (1099511627776) //Maximum supported filesystem size (1TB)
 
-#define BLK_SIZE (2048) //Block size in bytes
-#define INODE_SIZE (512) //INode size in bytes
-#define INODES_PER_BLK (BLK_SIZE / INODE_SIZE) //INodes per block (computed)
+//the block and inode sizes are chosen by makefs and recorded in the superblock,
+//the geometry derived from them (inodes per block, indirect fan-out, free block
+//cache size, max file size) lives in the FileSystem
+#define DEFAULT_BLK_SIZE (2048) //Block size in bytes used unless makefs is given one
+#define MIN_BLK_SIZE (1024) //Smallest block size, must hold the disk superblock
+#define MAX_BLK_SIZE (65536) //Largest block size
+#define DEFAULT_INODE_SIZE (512) //INode size in bytes used unless makefs is given one
+#define MAX_INODE_SIZE (1024) //Largest inode size, bounds the inline data kept in each in core inode
 
 #define SUPERBLOCK_OFFSET (0) //superblock id, default 0
 
-#define FREE_DBLK_CACHE_SIZE (BLK_SIZE / sizeof(LONG)) //In-memory free block cache size, 1 block of int_64
-#define FREE_INODE_CACHE_SIZE (4) //In-memory inode cache size, 100 = 400 bytes of superblock
+#define MAX_FREE_DBLK_CACHE_SIZE (MAX_BLK_SIZE / sizeof(LONG)) //In-memory free block cache capacity, 1 block of int_64
 
 #define INODE_OWNER_NAME_LEN (10) // number of characters of the owner name 
 #define INODE_NUM_DIRECT_BLKS (20) // number of direct blocks per inode 
@@ -45,15 +50,8 @@
 #define INODE_NUM_T_INDIRECT_BLKS (1) // number of triple direct blocks per inode 
 
 #define OPEN_FILE_TABLE_LENGTH (1024)   //length of open file table
-#define INODE_TABLE_LENGTH (1024)   //number of bins in the hash queue of in core INodeTable
-#define INODE_CACHE_LENGTH (1024)   //number of inodes to keep in cache queue (cached inodes with 0 refcount)
+#define INODE_CACHE_LENGTH (1024)   //default number of inodes with 0 refcount kept in the in core INodeTable
 #define FILE_NAME_LENGTH (256)      //number of bytes in the file name in bytes
 
 #define MAX_PATH_LEN (512) //maximum length of the path
-#define MAX_FILE_SIZE (BLK_SIZE * INODE_NUM_DIRECT_BLKS + BLK_SIZE * INODE_NUM_S_INDIRECT_BLKS * FREE_DBLK_CACHE_SIZE + BLK_SIZE * INODE_NUM_D_INDIRECT_BLKS * FREE_DBLK_CACHE_SIZE * FREE_DBLK_CACHE_SIZE + BLK_SIZE * INODE_NUM_T_INDIRECT_BLKS * FREE_DBLK_CACHE_SIZE * FREE_DBLK_CACHE_SIZE * FREE_DBLK_CACHE_SIZE) 
-#define MAX_FILE_BLKS (MAX_FILE_SIZE / BLK_SIZE) //max number of data blocks allocatable per file
-#define MAX_FILE_NUM_IN_DIR (MAX_FILE_SIZE / (FILE_NAME_LENGTH + sizeof(INT))) //maximum number of files in a directory
-//#define MAX_FILE_NUM_IN_DIR 10 //maximum number of files in a directory
-#define MAX_DIR_TABLE_SIZE (MAX_FILE_NUM_IN_DIR * (FILE_NAME_LENGTH + sizeof(INT)))
 
-#define DBLK_CACHE_SET_NUM 1024
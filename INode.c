@@ -15,6 +15,15 @@ UINT initializeINode(INode *inode, UINT id) {
     inode->_in_filesize = 0;
     inode->_in_linkcount = 0;
 
+    //allocINode picks the inline and extent flags of a new file
+    inode->_in_flags = 0;
+    clearBlkPtrs(inode);
+    clearBmapCache(inode);
+
+    return 0;
+}
+
+void clearBlkPtrs(INode* inode) {
     //since we are storing logical data blk id, 0 could be a valid blk
     for (UINT i = 0; i < INODE_NUM_DIRECT_BLKS; i ++) {
         inode->_in_directBlocks[i] = -1;
@@ -28,11 +37,17 @@ UINT initializeINode(INode *inode, UINT id) {
     for (UINT i = 0; i < INODE_NUM_T_INDIRECT_BLKS; i ++) {
         inode->_in_tIndirectBlocks[i] = -1;
     }
+}
 
-    return 0;
+void clearBmapCache(INode* inode) {
+    inode->_in_bmap._bc_fileBlk = -1;
+    inode->_in_bmap._bc_blk = -1;
+    inode->_in_bmap._bc_len = 0;
+    inode->_in_bmap._bc_ptrFileBlk = -1;
+    inode->_in_bmap._bc_ptrBlk = -1;
 }
 
 void printINode(INode* inode) {
-    printf("[INode: type = %d, owner = %s, permissions = %d, modtime = %lu, accesstime = %lu, filesize = %ld, linkcount = %d]\n",
-        inode->_in_type, inode->_in_owner, inode->_in_permissions, inode->_in_modtime, inode->_in_accesstime, inode->_in_filesize, inode->_in_linkcount);
+    printf("[INode: type = %d, owner = %s, permissions = %d, modtime = %lu, accesstime = %lu, filesize = %ld, linkcount = %d, flags = %x]\n",
+        inode->_in_type, inode->_in_owner, inode->_in_permissions, inode->_in_modtime, inode->_in_accesstime, inode->_in_filesize, inode->_in_linkcount, inode->_in_flags);
 }
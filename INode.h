@@ -7,6 +7,7 @@
 #include "time.h"
 #include "string.h"
 #include "sys/types.h"
+#include <stddef.h>
 
 enum FILE_TYPE {
         FREE = -1,
@@ -18,6 +19,29 @@ enum FILE_TYPE {
 	BLOCK = 6
 };
 
+//recent block translations of an inode; a run of file blocks found in
+//contiguous data blocks and the pointer block mapping a range of file
+//blocks, so that a sequential pass maps most blocks without a lookup
+typedef struct BmapCache {
+
+	//file blocks [_bc_fileBlk, _bc_fileBlk + _bc_len) are in data blocks
+	//from _bc_blk on
+	LONG _bc_fileBlk;
+	LONG _bc_blk;
+	LONG _bc_len;
+
+	//the pointer block holding the pointers of the file blocks from
+	//_bc_ptrFileBlk on, -1 if none is known
+	LONG _bc_ptrFileBlk;
+	LONG _bc_ptrBlk;
+
+} BmapCache;
+
+//bytes of an inode ahead of its block pointers, and the inline bytes an
+//inode of the largest size has room for
+#define INODE_HEADER_LEN (72)
+#define INODE_INLINE_LEN (MAX_INODE_SIZE - INODE_HEADER_LEN)
+
 typedef struct INode {
 
 	//disk fields
@@ -43,17 +67,53 @@ typedef struct INode {
     
         UINT _in_linkcount;
 
-	LONG _in_directBlocks[INODE_NUM_DIRECT_BLKS];
+	//INODE_ flags below
+	UINT _in_flags;
+
+	//the data of an inline inode takes the place of its block pointers and
+	//runs on into the spare bytes of the inode slot, only the first
+	//inlineSize bytes of the array fit on disk; so does the extent tree
+	//root of an extent mapped inode
+	union {
+		struct {
+			LONG _in_directBlocks[INODE_NUM_DIRECT_BLKS];
+
+			LONG _in_sIndirectBlocks[INODE_NUM_S_INDIRECT_BLKS];
 
-	LONG _in_sIndirectBlocks[INODE_NUM_S_INDIRECT_BLKS];
+			LONG _in_dIndirectBlocks[INODE_NUM_D_INDIRECT_BLKS];
 
-	LONG _in_dIndirectBlocks[INODE_NUM_D_INDIRECT_BLKS];
+			LONG _in_tIndirectBlocks[INODE_NUM_T_INDIRECT_BLKS];
+		};
+		BYTE _in_inline[INODE_INLINE_LEN];
+	};
 
-        LONG _in_tIndirectBlocks[INODE_NUM_T_INDIRECT_BLKS];
+	//in core fields, never written to disk
+
+	//the last bmap translations, kept next to the block pointers they
+	//come from so that a copy of the inode carries its own
+	BmapCache _in_bmap;
 
 } INode;
 
+_Static_assert(offsetof(INode, _in_inline) == INODE_HEADER_LEN, "INODE_HEADER_LEN does not match the INode fields");
+
+//the file data is kept in the inode instead of data blocks
+#define INODE_INLINE (0x1)
+//the blocks are mapped by an extent tree rooted where the block pointers
+//would be, see Extents.h
+#define INODE_EXTENTS (0x2)
+
+//bytes of an inode slot up to the end of its block pointers
+#define INODE_MIN_SIZE (offsetof(INode, _in_tIndirectBlocks) + INODE_NUM_T_INDIRECT_BLKS * sizeof(LONG))
+
 UINT initializeINode(INode*, UINT);
 
+// marks every block pointer of an inode unallocated
+void clearBlkPtrs(INode*);
+
+// forgets the bmap translations of an inode, on any change to its mapping
+// other than a new block and whenever it comes from disk
+void clearBmapCache(INode*);
+
 // prints an inode out for debugging
 void printINode(INode*);
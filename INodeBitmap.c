@@ -0,0 +1,143 @@
+/*
+ * Implementation of the free inode bitmap
+ */
+
+#include "INodeBitmap.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORD_BITS (64)
+#define GROUP_WORDS (INODE_GROUP_SIZE / WORD_BITS)
+
+UINT iBitmapBlks(UINT nINodes, UINT blkSize) {
+    UINT bitsPerBlk = blkSize * 8;
+    return (nINodes + bitsPerBlk - 1) / bitsPerBlk;
+}
+
+//group bits past the last inode are in use, so they are never handed out
+static void reserveTail(INodeBitmap* map) {
+    UINT nBits = map->_ib_nBlks * map->_ib_blkSize * 8;
+    for(UINT id = map->_ib_nINodes; id < nBits; id++) {
+        map->_ib_bits[id / WORD_BITS] |= 1ULL << (id % WORD_BITS);
+    }
+}
+
+static UINT countGroupFree(INodeBitmap* map, UINT group) {
+    UINT nFree = 0;
+    for(UINT w = group * GROUP_WORDS; w < (group + 1) * GROUP_WORDS; w++) {
+        nFree += WORD_BITS - __builtin_popcountll(map->_ib_bits[w]);
+    }
+    return nFree;
+}
+
+static void markDirty(INodeBitmap* map, UINT id) {
+    UINT blk = id / (map->_ib_blkSize * 8);
+    if(!map->_ib_dirty[blk]) {
+        map->_ib_dirty[blk] = true;
+        map->_ib_nDirty++;
+    }
+}
+
+void initINodeBitmap(INodeBitmap* map, UINT nINodes, UINT blkSize, UINT nextGroup) {
+    assert(blkSize * 8 % INODE_GROUP_SIZE == 0);
+    map->_ib_nINodes = nINodes;
+    map->_ib_blkSize = blkSize;
+    map->_ib_nBlks = iBitmapBlks(nINodes, blkSize);
+    map->_ib_bits = calloc(map->_ib_nBlks, blkSize);
+    map->_ib_dirty = calloc(map->_ib_nBlks, sizeof(BOOL));
+    map->_ib_nDirty = 0;
+    map->_ib_nGroups = (nINodes + INODE_GROUP_SIZE - 1) / INODE_GROUP_SIZE;
+    map->_ib_groupFree = malloc(map->_ib_nGroups * sizeof(UINT));
+    assert(map->_ib_bits != NULL && map->_ib_dirty != NULL && map->_ib_groupFree != NULL);
+    map->_ib_nextGroup = nextGroup < map->_ib_nGroups ? nextGroup : 0;
+    reserveTail(map);
+    for(UINT g = 0; g < map->_ib_nGroups; g++) {
+        map->_ib_groupFree[g] = countGroupFree(map, g);
+    }
+}
+
+void destroyINodeBitmap(INodeBitmap* map) {
+    free(map->_ib_bits);
+    free(map->_ib_dirty);
+    free(map->_ib_groupFree);
+    map->_ib_bits = NULL;
+    map->_ib_dirty = NULL;
+    map->_ib_groupFree = NULL;
+}
+
+BYTE* iBitmapBlk(INodeBitmap* map, UINT blk) {
+    assert(blk < map->_ib_nBlks);
+    return (BYTE*) map->_ib_bits + (LONG) blk * map->_ib_blkSize;
+}
+
+void loadINodeBitmapBlk(INodeBitmap* map, UINT blk) {
+    reserveTail(map);
+    UINT groupsPerBlk = map->_ib_blkSize * 8 / INODE_GROUP_SIZE;
+    for(UINT g = blk * groupsPerBlk; g < (blk + 1) * groupsPerBlk && g < map->_ib_nGroups; g++) {
+        map->_ib_groupFree[g] = countGroupFree(map, g);
+    }
+}
+
+INT allocINodeBit(INodeBitmap* map) {
+    //full groups are passed over by their counts, the hint keeps later
+    //allocations from passing them again
+    UINT group = map->_ib_nextGroup;
+    for(UINT n = 0; map->_ib_groupFree[group] == 0; n++) {
+        if(n == map->_ib_nGroups) {
+            return -1;
+        }
+        group = group + 1 < map->_ib_nGroups ? group + 1 : 0;
+    }
+    map->_ib_nextGroup = group;
+
+    for(UINT w = group * GROUP_WORDS; w < (group + 1) * GROUP_WORDS; w++) {
+        if(~map->_ib_bits[w] != 0) {
+            UINT bit = __builtin_ctzll(~map->_ib_bits[w]);
+            map->_ib_bits[w] |= 1ULL << bit;
+            map->_ib_groupFree[group]--;
+            UINT id = w * WORD_BITS + bit;
+            markDirty(map, id);
+            return id;
+        }
+    }
+    assert(false);
+    return -1;
+}
+
+INT freeINodeBit(INodeBitmap* map, UINT id) {
+    assert(id < map->_ib_nINodes);
+    uint64_t mask = 1ULL << (id % WORD_BITS);
+    if((map->_ib_bits[id / WORD_BITS] & mask) == 0) {
+        return -1;
+    }
+    map->_ib_bits[id / WORD_BITS] &= ~mask;
+    map->_ib_groupFree[id / INODE_GROUP_SIZE]++;
+    markDirty(map, id);
+    return 0;
+}
+
+BOOL isINodeFree(INodeBitmap* map, UINT id) {
+    assert(id < map->_ib_nINodes);
+    return (map->_ib_bits[id / WORD_BITS] & (1ULL << (id % WORD_BITS))) == 0;
+}
+
+void cleanINodeBitmapBlk(INodeBitmap* map, UINT blk) {
+    if(map->_ib_dirty[blk]) {
+        map->_ib_dirty[blk] = false;
+        map->_ib_nDirty--;
+    }
+}
+
+#ifdef DEBUG
+void printINodeBitmap(INodeBitmap* map) {
+    printf("[INodeBitmap: %d inodes in %d groups, %d blocks, %d dirty, next group %d]\n",
+           map->_ib_nINodes, map->_ib_nGroups, map->_ib_nBlks, map->_ib_nDirty, map->_ib_nextGroup);
+    for(UINT g = 0; g < map->_ib_nGroups; g++) {
+        printf("%d ", map->_ib_groupFree[g]);
+    }
+    printf("\n");
+}
+#endif
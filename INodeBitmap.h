@@ -0,0 +1,65 @@
+/*
+ * Free inode bitmap, one bit per inode, set while the inode is in use
+ * Kept whole in core and written back to the bitmap blocks on disk a
+ * block at a time; the inodes are split in groups with a free count each
+ * and allocation starts at the group the last one came from
+ */
+
+#pragma once
+#include "Globals.h"
+
+//# of inodes in a group, a multiple of 64
+#define INODE_GROUP_SIZE (512)
+
+typedef struct INodeBitmap {
+
+  //# of inodes, bitmap block size in bytes and # of bitmap blocks
+  UINT _ib_nINodes;
+  UINT _ib_blkSize;
+  UINT _ib_nBlks;
+
+  //the bits, _ib_nBlks blocks of them; the bits past the last inode are set
+  uint64_t* _ib_bits;
+
+  //which bitmap blocks changed since they were written back
+  BOOL* _ib_dirty;
+  UINT _ib_nDirty;
+
+  //# of groups, free inodes per group and the group allocation starts at
+  UINT _ib_nGroups;
+  UINT* _ib_groupFree;
+  UINT _ib_nextGroup;
+
+} INodeBitmap;
+
+// # of bitmap blocks the inodes take
+UINT iBitmapBlks(UINT nINodes, UINT blkSize);
+
+// sets up an all free bitmap
+// args: bitmap, # of inodes, block size, group to allocate from first
+void initINodeBitmap(INodeBitmap*, UINT, UINT, UINT);
+
+void destroyINodeBitmap(INodeBitmap*);
+
+// the bytes of bitmap block blk, to read it from or write it to disk
+BYTE* iBitmapBlk(INodeBitmap*, UINT);
+
+// recounts the free inodes of the groups of a bitmap block just read
+// from disk, setting the bits past the last inode
+void loadINodeBitmapBlk(INodeBitmap*, UINT);
+
+// takes the first free inode at or past the next group, returns its id
+// or -1 if none is free
+INT allocINodeBit(INodeBitmap*);
+
+// marks an inode free, returns -1 if it was free already
+INT freeINodeBit(INodeBitmap*, UINT);
+
+BOOL isINodeFree(INodeBitmap*, UINT);
+
+// marks a bitmap block written back
+void cleanINodeBitmapBlk(INodeBitmap*, UINT);
+
+#ifdef DEBUG
+void printINodeBitmap(INodeBitmap*);
+#endif
@@ -19,8 +19,20 @@ struct INodeEntry {
 //pointer to in-core inode
   INode _in_node;
 
-//pointer to the next entry in this bin
+//the in-core inode changed since it was last written to disk
+  BOOL _in_dirty;
+
+//only the timestamps changed, under lazytime they are written back with
+//the next write of the inode block for another reason
+  BOOL _in_lazy;
+
+//pointer to the next entry in this bin, or on the free list of the
+//allocator while the entry is unused
   INodeEntry *next;
+
+//neighbours on the LRU list, which holds the entries with refcount 0
+  INodeEntry *lruPrev;
+  INodeEntry *lruNext;
 };
 
 #ifdef DEBUG
@@ -3,123 +3,258 @@
 
 #include "INodeTable.h"
 
+#include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 
-#ifdef DEBUG
-#include <assert.h>
-#endif
+void initINodeTable(INodeTable* iTable, UINT capacity)
+{
+  if(capacity == 0)
+    capacity = INODE_CACHE_LENGTH;
+  iTable->nINodes = 0;
+  iTable->nUnused = 0;
+  iTable->nDirty = 0;
+  iTable->nLazy = 0;
+  iTable->capacity = capacity;
 
-void initINodeTable(INodeTable* iTable)
+  //about two bins per entry kept, the open entries come on top
+  iTable->nBins = 1;
+  while(iTable->nBins < 2 * capacity)
+    iTable->nBins <<= 1;
+  iTable->hashQ = calloc(iTable->nBins, sizeof(INodeEntry*));
+  assert(iTable->hashQ != NULL);
+
+  iTable->lruHead = NULL;
+  iTable->lruTail = NULL;
+  iTable->slabs = NULL;
+  iTable->nSlabs = 0;
+  iTable->freeEntries = NULL;
+  iTable->writeBack = NULL;
+  iTable->writeBackCtx = NULL;
+  iTable->nHits = 0;
+  iTable->nMisses = 0;
+  iTable->nEvictions = 0;
+}
+
+void destroyINodeTable(INodeTable* iTable)
 {
+  for(UINT i = 0; i < iTable->nSlabs; i++)
+    free(iTable->slabs[i]);
+  free(iTable->slabs);
+  free(iTable->hashQ);
+  iTable->slabs = NULL;
+  iTable->nSlabs = 0;
+  iTable->hashQ = NULL;
+  iTable->freeEntries = NULL;
   iTable->nINodes = 0;
-  for(UINT bin = 0; bin < INODE_TABLE_LENGTH; bin++) {
-    iTable->hashQ[bin] = NULL;
+  iTable->nUnused = 0;
+  iTable->nDirty = 0;
+  iTable->nLazy = 0;
+}
+
+void setINodeTableWriteBack(INodeTable* iTable, INodeWriteBack writeBack, void *ctx)
+{
+  iTable->writeBack = writeBack;
+  iTable->writeBackCtx = ctx;
+}
+
+static UINT binOf(INodeTable *iTable, UINT id)
+{
+  return id & (iTable->nBins - 1);
+}
+
+//takes an entry off the free list, carving a new slab when it is empty
+static INodeEntry* allocEntry(INodeTable *iTable)
+{
+  if(iTable->freeEntries == NULL) {
+    INodeEntry *slab = malloc(INODE_SLAB_ENTRIES * sizeof(INodeEntry));
+    INodeEntry **slabs = realloc(iTable->slabs, (iTable->nSlabs + 1) * sizeof(INodeEntry*));
+    assert(slab != NULL && slabs != NULL);
+    iTable->slabs = slabs;
+    iTable->slabs[iTable->nSlabs++] = slab;
+    for(UINT i = 0; i < INODE_SLAB_ENTRIES; i++) {
+      slab[i].next = iTable->freeEntries;
+      iTable->freeEntries = &slab[i];
+    }
+  }
+  INodeEntry *entry = iTable->freeEntries;
+  iTable->freeEntries = entry->next;
+  return entry;
+}
+
+static void freeEntry(INodeTable *iTable, INodeEntry *entry)
+{
+  entry->next = iTable->freeEntries;
+  iTable->freeEntries = entry;
+}
+
+static void lruUnlink(INodeTable *iTable, INodeEntry *entry)
+{
+  if(entry->lruPrev != NULL)
+    entry->lruPrev->lruNext = entry->lruNext;
+  else
+    iTable->lruHead = entry->lruNext;
+  if(entry->lruNext != NULL)
+    entry->lruNext->lruPrev = entry->lruPrev;
+  else
+    iTable->lruTail = entry->lruPrev;
+  entry->lruPrev = entry->lruNext = NULL;
+  iTable->nUnused--;
+}
+
+static void lruPush(INodeTable *iTable, INodeEntry *entry)
+{
+  entry->lruPrev = NULL;
+  entry->lruNext = iTable->lruHead;
+  if(iTable->lruHead != NULL)
+    iTable->lruHead->lruPrev = entry;
+  else
+    iTable->lruTail = entry;
+  iTable->lruHead = entry;
+  iTable->nUnused++;
+}
+
+//unlinks an entry from its bin and frees it, a dirty or lazy entry is
+//written back first
+static void dropEntry(INodeTable *iTable, INodeEntry *entry)
+{
+  BOOL changed = entry->_in_dirty || entry->_in_lazy;
+  if(changed && iTable->writeBack != NULL && iTable->writeBack(iTable->writeBackCtx, entry) != 0)
+    fprintf(stderr, "Error: failed to write back inode %d, its changes are lost\n", entry->_in_id);
+  cleanINodeEntry(iTable, entry);
+
+  INodeEntry **link = &iTable->hashQ[binOf(iTable, entry->_in_id)];
+  while(*link != entry)
+    link = &(*link)->next;
+  *link = entry->next;
+  if(entry->_in_ref == 0)
+    lruUnlink(iTable, entry);
+  iTable->nINodes--;
+  freeEntry(iTable, entry);
+}
+
+//evicts the least recently used entries past the capacity, never the
+//most recently used one
+static void trimLRU(INodeTable *iTable)
+{
+  while(iTable->nUnused > iTable->capacity && iTable->lruTail != iTable->lruHead) {
+    dropEntry(iTable, iTable->lruTail);
+    iTable->nEvictions++;
   }
 }
 
 INodeEntry* putINode(INodeTable *iTable, UINT id, INode *inode)
 {
-  #ifdef DEBUG
   assert(!hasINodeEntry(iTable, id));
-  #endif
 
-  //hash id to bin
-  UINT bin = id % INODE_TABLE_LENGTH;
-  
   //initialize new entry
-  INodeEntry *newEntry;
-  newEntry = malloc(sizeof(INodeEntry));
+  INodeEntry *newEntry = allocEntry(iTable);
   newEntry->_in_id = id;
   memcpy(&newEntry->_in_node, inode, sizeof(INode));
   newEntry->_in_ref = 0;
+  newEntry->_in_dirty = false;
+  newEntry->_in_lazy = false;
 
-  //insert to table
+  //insert to table, unreferenced
+  UINT bin = binOf(iTable, id);
   newEntry->next = iTable->hashQ[bin];
   iTable->hashQ[bin] = newEntry;
   iTable->nINodes++;
-  
+  lruPush(iTable, newEntry);
+  trimLRU(iTable);
   return newEntry;
 }
 
-void putINodeEntry(INodeTable *iTable, INodeEntry *entry)
+INodeEntry* findINodeEntry(INodeTable *iTable, UINT id)
 {
-  #ifdef DEBUG
-  assert(!hasINodeEntry(iTable, entry->_in_id));
-  #endif
-
-  //hash id to bin
-  UINT bin = entry->_in_id % INODE_TABLE_LENGTH;
-  
-  //insert to table
-  entry->next = iTable->hashQ[bin];
-  iTable->hashQ[bin] = entry;
-  iTable->nINodes++;
+  INodeEntry *curEntry = iTable->hashQ[binOf(iTable, id)];
+  while (curEntry != NULL && curEntry->_in_id != id)
+    curEntry = curEntry->next;
+  return curEntry;
 }
 
 INodeEntry* getINodeEntry(INodeTable *iTable, UINT id)
 {
-  //hash id to bin
-  UINT bin = id % INODE_TABLE_LENGTH;
-  
-  //search bin
-  INodeEntry *curEntry = iTable->hashQ[bin]; 
-  while (curEntry != NULL) {
-    if (curEntry->_in_id == id ) {
-      return curEntry;
-    }
-    curEntry = curEntry->next;
+  INodeEntry *entry = findINodeEntry(iTable, id);
+  if(entry == NULL) {
+    iTable->nMisses++;
+    return NULL;
+  }
+  iTable->nHits++;
+  if(entry->_in_ref == 0 && entry != iTable->lruHead) {
+    lruUnlink(iTable, entry);
+    lruPush(iTable, entry);
   }
-  
-  return NULL;
+  return entry;
 }
 
 BOOL hasINodeEntry(INodeTable *iTable, UINT id)
 {
-  //hash id to bin
-  UINT bin = id % INODE_TABLE_LENGTH;
+  return findINodeEntry(iTable, id) != NULL;
+}
 
-  //search bin
-  INodeEntry *curEntry = iTable->hashQ[bin];
-  while (curEntry != NULL) {
-    if (curEntry->_in_id == id)
-      return true;
-    curEntry = curEntry->next;
+void dirtyINodeEntry(INodeTable *iTable, INodeEntry *entry)
+{
+  if(entry->_in_lazy) {
+    entry->_in_lazy = false;
+    iTable->nLazy--;
   }
-  return false;
-}
-
-INodeEntry* removeINodeEntry(INodeTable *iTable, UINT id)
-{
-  //hash id to bin
-  UINT bin = id % INODE_TABLE_LENGTH;
-
-  //search bin
-  INodeEntry *prevEntry = NULL;
-  INodeEntry *curEntry = iTable->hashQ[bin];
-  while (curEntry != NULL) {
-    if (curEntry->_in_id == id) {
-      //linked list remove
-      if(prevEntry == NULL) 
-        iTable->hashQ[bin] = curEntry->next;
-      else
-        prevEntry->next = curEntry->next;
-        
-      iTable->nINodes--;
-      return curEntry;
-    }
-    
-    prevEntry = curEntry;
-    curEntry = curEntry->next;
+  if(!entry->_in_dirty) {
+    entry->_in_dirty = true;
+    iTable->nDirty++;
+  }
+}
+
+void lazyINodeEntry(INodeTable *iTable, INodeEntry *entry)
+{
+  if(!entry->_in_dirty && !entry->_in_lazy) {
+    entry->_in_lazy = true;
+    iTable->nLazy++;
+  }
+}
+
+void cleanINodeEntry(INodeTable *iTable, INodeEntry *entry)
+{
+  if(entry->_in_dirty) {
+    entry->_in_dirty = false;
+    iTable->nDirty--;
   }
-  return NULL;
+  if(entry->_in_lazy) {
+    entry->_in_lazy = false;
+    iTable->nLazy--;
+  }
+}
+
+void refINodeEntry(INodeTable *iTable, INodeEntry *entry)
+{
+  if(entry->_in_ref++ == 0)
+    lruUnlink(iTable, entry);
+}
+
+void unrefINodeEntry(INodeTable *iTable, INodeEntry *entry)
+{
+  assert(entry->_in_ref > 0);
+  if(--entry->_in_ref == 0) {
+    lruPush(iTable, entry);
+    trimLRU(iTable);
+  }
+}
+
+BOOL removeINodeEntry(INodeTable *iTable, UINT id)
+{
+  INodeEntry *entry = findINodeEntry(iTable, id);
+  if(entry == NULL)
+    return false;
+  dropEntry(iTable, entry);
+  return true;
 }
 
 #ifdef DEBUG
-#include <stdio.h>
 void printINodeTable(INodeTable *iTable)
 {
-  printf("[INodeTable: nINodes = %d]\n", iTable->nINodes);
-  for(INT bin = 0; bin < INODE_TABLE_LENGTH; bin++) {
+  printf("[INodeTable: nINodes = %d, %d unreferenced of %d, %d dirty, %d lazy, hits %ld, misses %ld, evictions %ld]\n",
+         iTable->nINodes, iTable->nUnused, iTable->capacity, iTable->nDirty, iTable->nLazy, iTable->nHits, iTable->nMisses, iTable->nEvictions);
+  for(UINT bin = 0; bin < iTable->nBins; bin++) {
     INodeEntry *curEntry = iTable->hashQ[bin];
     while (curEntry != NULL) {
       printINodeEntry(curEntry);
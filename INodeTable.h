@@ -1,33 +1,100 @@
 // This is the in core INodeTable
+// Holds every inode in core, the open ones (refcount > 0) and the ones
+// read but not opened (i.e. namei) or closed, which are kept on an LRU
+// list bounded by the table capacity and evicted from its tail
 
 #pragma once
 #include "INodeEntry.h"
 
+//writes a dirty entry back, called before a dirty entry leaves the table
+typedef INT (*INodeWriteBack)(void *ctx, INodeEntry *entry);
+
+//# of entries the allocator carves out of each slab
+#define INODE_SLAB_ENTRIES (64)
+
 typedef struct INodeTable {
+  //# of entries in the table and how many of them have refcount 0
   UINT nINodes;
-  INodeEntry* hashQ[INODE_TABLE_LENGTH];
+  UINT nUnused;
+
+  //# of entries changed in core and not written back yet
+  UINT nDirty;
+  //# of entries with only lazily kept timestamp changes
+  UINT nLazy;
+
+  //max # of entries with refcount 0 kept
+  UINT capacity;
+
+  //hash bins, a power of two
+  UINT nBins;
+  INodeEntry** hashQ;
+
+  //LRU list of the entries with refcount 0, most recently used first
+  INodeEntry* lruHead;
+  INodeEntry* lruTail;
+
+  //entries come from slabs of INODE_SLAB_ENTRIES, the unused ones are
+  //chained on a free list
+  INodeEntry** slabs;
+  UINT nSlabs;
+  INodeEntry* freeEntries;
+
+  //how dirty entries are written back before they are evicted or removed
+  INodeWriteBack writeBack;
+  void *writeBackCtx;
+
+  //counters
+  LONG nHits;
+  LONG nMisses;
+  LONG nEvictions;
 } INodeTable;
 
-//initializes all the bin entries to null
-//MUST be called at filesystem init time since arrays do not default to NULL
-void initINodeTable(INodeTable*);
+//sets up an empty table
+//MUST be called at filesystem init time
+//args: table, max # of entries with refcount 0 kept (0 for INODE_CACHE_LENGTH)
+void initINodeTable(INodeTable*, UINT);
+
+//frees the entries and the slabs, dirty entries are dropped, the caller
+//writes them back first
+void destroyINodeTable(INodeTable*);
 
-//adds an inode to the table, creating the entry
+//sets the callback dirty entries are written back through
+void setINodeTableWriteBack(INodeTable*, INodeWriteBack, void *);
+
+//adds an inode to the table with refcount 0, evicting the least recently
+//used unreferenced entry past the capacity after writing it back if it is
+//dirty or lazy
 //returns the entry that was added
 INodeEntry* putINode(INodeTable *iTable, UINT id, INode *inode);
 
-//adds an inode entry to the cache
-void putINodeEntry(INodeTable *iTable, INodeEntry *entry);
-
-//interface to layer2 funcs, return the pointer to an INodeEntry
+//interface to layer2 funcs, return the pointer to an INodeEntry, NULL if
+//the inode is not in core; an unreferenced entry becomes the most
+//recently used, hits and misses are counted
 //args: table, inode id, return pointer to entry
 INodeEntry* getINodeEntry(INodeTable *iTable, UINT id);
 
-//check if a certain entry is already loaded
+//check if a certain entry is already loaded, without counting or touching it
 BOOL hasINodeEntry(INodeTable *, UINT);
 
-//removes an inode entry, returning the entry if successful
-INodeEntry* removeINodeEntry(INodeTable *, UINT);
+//returns the entry of an inode without counting or touching it, NULL if
+//the inode is not in core
+INodeEntry* findINodeEntry(INodeTable *, UINT);
+
+//marks an entry changed in core, with only its timestamps changed, or
+//written back
+void dirtyINodeEntry(INodeTable *, INodeEntry *);
+void lazyINodeEntry(INodeTable *, INodeEntry *);
+void cleanINodeEntry(INodeTable *, INodeEntry *);
+
+//takes a reference on an entry, a referenced entry is never evicted
+void refINodeEntry(INodeTable *, INodeEntry *);
+
+//drops a reference, at refcount 0 the entry joins the LRU list
+void unrefINodeEntry(INodeTable *, INodeEntry *);
+
+//removes an entry, writing it back first if it is dirty or lazy, returning true
+//if it was in the table
+BOOL removeINodeEntry(INodeTable *, UINT);
 
 #ifdef DEBUG
 void printINodeTable(INodeTable *);
@@ -0,0 +1,179 @@
+/**
+ * Tests the in core inode table, the free inode bitmap and the write back
+ * of dirty inodes
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Directories.h"
+
+static void testINodeTable() {
+    INodeTable table;
+    INode inode;
+    memset(&inode, 0, sizeof(INode));
+    initINodeTable(&table, 8);
+    for(UINT id = 0; id < 8; id++) {
+        inode._in_filesize = id;
+        putINode(&table, id, &inode);
+    }
+    //an open entry is never evicted, touching an unreferenced one keeps it
+    INodeEntry* open = getINodeEntry(&table, 0);
+    refINodeEntry(&table, open);
+    assert(getINodeEntry(&table, 1) != NULL);
+    for(UINT id = 8; id < 4096; id++) {
+        inode._in_filesize = id;
+        putINode(&table, id, &inode);
+        if(id % 2 == 0) {
+            assert(getINodeEntry(&table, 1) != NULL);
+        }
+    }
+    assert(table.nUnused == 8 && table.nINodes == 9);
+    assert(table.nEvictions == 4096 - 9);
+    assert(hasINodeEntry(&table, 0) && hasINodeEntry(&table, 1) && !hasINodeEntry(&table, 2));
+    assert(getINodeEntry(&table, 4095)->_in_node._in_filesize == 4095);
+
+    //the entries of the evicted inodes were recycled, not allocated again
+    assert(table.nSlabs <= 2);
+
+    //closing the open inode puts it back on the LRU list
+    unrefINodeEntry(&table, open);
+    assert(table.nUnused == 8 && table.nINodes == 8 && hasINodeEntry(&table, 0));
+    assert(removeINodeEntry(&table, 0) && !removeINodeEntry(&table, 0));
+    destroyINodeTable(&table);
+}
+
+static void testINodeBitmap() {
+    INodeBitmap map;
+    initINodeBitmap(&map, 2000, 1024, 0);
+    assert(map._ib_nBlks == 1 && map._ib_nGroups == 4 && map._ib_groupFree[3] == 2000 - 3 * INODE_GROUP_SIZE);
+    for(INT id = 0; id < 2000; id++) {
+        assert(allocINodeBit(&map) == id);
+    }
+    assert(allocINodeBit(&map) == -1);
+    //a freed inode is found through the group counts, past the full groups
+    assert(freeINodeBit(&map, 700) == 0 && freeINodeBit(&map, 700) == -1);
+    assert(isINodeFree(&map, 700) && map._ib_groupFree[1] == 1);
+    assert(allocINodeBit(&map) == 700 && map._ib_nextGroup == 1);
+    destroyINodeBitmap(&map);
+}
+
+//allocINode finds a free inode in the bitmap without reading an inode
+//block, and freeINode gives the inode back only once
+static void testINodeAlloc() {
+    FileSystem fs;
+    MountOptions opts;
+    DiskStats stats;
+    INode inode;
+    UINT nINodes = 4096;
+    initMountOptions(&opts);
+    assert(l2_initfs(4096, nINodes, 0, 0, &opts, &fs) == 0);
+    for(UINT i = 1; i < nINodes; i++) {
+        assert(allocINode(&fs, &inode, REGULAR) == i);
+    }
+    assert(allocINode(&fs, &inode, REGULAR) == -1);
+    assert(freeINode(&fs, 3001) == 0 && freeINode(&fs, 3001) == -1);
+    assert(isINodeFree(&fs.iBitmap, 3001) && fs.superblock.nFreeINodes == 1);
+    assert(l2_sync(&fs) == 0);
+
+    //the inode blocks are left out of the cache, so a read would show
+    removeINodeEntry(&fs.inodeTable, 3001);
+    for(LONG blk = fs.diskINodeBlkOffset; blk < fs.diskIBitmapOffset; blk++) {
+        if(hasDBlkCacheEntry(&fs.dCache, blk)) {
+            removeDBlkCacheEntry(&fs.dCache, blk);
+        }
+    }
+    resetDiskStats(fs.disk);
+    assert(allocINode(&fs, &inode, REGULAR) == 3001);
+    getDiskStats(fs.disk, &stats);
+    assert(stats._st_reads == 0);
+    UINT nextGroup = fs.iBitmap._ib_nextGroup;
+    l2_unmount(&fs);
+
+    //the bitmap, the free count and the hint survive a remount
+    assert(l2_mount(&fs, NULL) == 0);
+    assert(fs.superblock.nFreeINodes == 0 && fs.iBitmap._ib_nextGroup == nextGroup);
+    assert(allocINode(&fs, &inode, REGULAR) == -1);
+    assert(freeINode(&fs, 2042) == 0 && allocINode(&fs, &inode, REGULAR) == 2042);
+    l2_unmount(&fs);
+}
+
+//the on-disk copy of an inode, read past the caches
+static void readDiskINode(FileSystem* fs, UINT id, INode* inode) {
+    BYTE* buf = getBlkBuf(fs->disk);
+    assert(readBlk(fs->disk, fs->diskINodeBlkOffset + id / fs->inodesPerBlk, buf) == 0);
+    memset(inode, 0, sizeof(INode));
+    memcpy(inode, buf + id % fs->inodesPerBlk * fs->inodeSize, fs->diskINodeSize);
+    putBlkBuf(fs->disk, buf);
+}
+
+//small writes change only the in core inodes, which stay dirty until the
+//sync writes each of their inode blocks once
+static void testINodeWriteBack() {
+    FileSystem fs;
+    MountOptions opts;
+    DiskStats stats;
+    INode inode;
+    struct stat st;
+    char path[32];
+    UINT ids[40];
+    BYTE buf[64];
+    initMountOptions(&opts);
+    assert(l2_initfs(4096, 256, 0, 0, &opts, &fs) == 0);
+    for(UINT i = 0; i < 40; i++) {
+        sprintf(path, "/f%u", i);
+        assert(l2_mknod(&fs, path, 0, 0) >= 0);
+        ids[i] = l2_namei(&fs, path);
+    }
+    assert(l2_sync(&fs) == 0);
+
+    //the data of a small file is inline, the inode is all the write changes
+    resetDiskStats(fs.disk);
+    for(UINT i = 0; i < 40; i++) {
+        sprintf(path, "/f%u", i);
+        assert(l2_open(&fs, path, OP_WRITE) == 0);
+        memset(buf, i, sizeof(buf));
+        assert(l2_write(&fs, path, 0, buf, sizeof(buf)) == sizeof(buf));
+        l2_close(&fs, path, OP_WRITE);
+    }
+    getDiskStats(fs.disk, &stats);
+    assert(stats._st_writes == 0 && fs.inodeTable.nDirty >= 40);
+    for(UINT i = 0; i < 40; i++) {
+        assert(getINodeEntry(&fs.inodeTable, ids[i])->_in_dirty);
+        readDiskINode(&fs, ids[i], &inode);
+        assert(inode._in_filesize == 0);
+    }
+
+    LONG flushes = fs.nINodeBlkFlushes;
+    assert(l2_sync(&fs) == 0);
+    UINT nINodeBlks = ids[39] / fs.inodesPerBlk - ids[0] / fs.inodesPerBlk + 1;
+    assert(fs.inodeTable.nDirty == 0);
+    assert(fs.nINodeBlkFlushes - flushes <= nINodeBlks + 1);
+    for(UINT i = 0; i < 40; i++) {
+        assert(!getINodeEntry(&fs.inodeTable, ids[i])->_in_dirty);
+        readDiskINode(&fs, ids[i], &inode);
+        assert(inode._in_filesize == sizeof(buf) && inode._in_inline[0] == i);
+    }
+    l2_unmount(&fs);
+
+    //the inodes written back are what the next mount finds
+    assert(l2_mount(&fs, &opts) == 0);
+    for(UINT i = 0; i < 40; i++) {
+        sprintf(path, "/f%u", i);
+        assert(l2_getattr(&fs, path, &st) == 0 && st.st_size == sizeof(buf));
+    }
+    l2_unmount(&fs);
+}
+
+int main() {
+    printf("Verifying the inode table...\n");
+    testINodeTable();
+    printf("Verifying the free inode bitmap...\n");
+    testINodeBitmap();
+    testINodeAlloc();
+    printf("Verifying the write back of dirty inodes...\n");
+    testINodeWriteBack();
+    return 0;
+}
@@ -0,0 +1,276 @@
+/*
+ * Implementation of the request merging I/O scheduler
+ */
+
+#include "IOSched.h"
+#include "Utility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//dispatch keys pack the block id above the slot index, sorting the keys
+//sorts the slots by block id
+#define SLOT_BITS (11)
+
+static UINT bucketOf(IOSched *sched, LONG bid)
+{
+  return (UINT)((unsigned long)bid * 0x9e3779b97f4a7c15UL >> 32) & (sched->_sch_nBuckets - 1);
+}
+
+static INT findSlot(IOSched *sched, LONG bid)
+{
+  INT slot = sched->_sch_buckets[bucketOf(sched, bid)];
+  while (slot >= 0 && sched->_sch_bids[slot] != bid)
+    slot = sched->_sch_next[slot];
+  return slot;
+}
+
+static BYTE *slotBuf(IOSched *sched, INT slot)
+{
+  return sched->_sch_bufs + (LONG)slot * sched->_sch_disk->_dsk_blkSize;
+}
+
+static void unlinkSlot(IOSched *sched, INT slot)
+{
+  INT *link = &sched->_sch_buckets[bucketOf(sched, sched->_sch_bids[slot])];
+  while (*link != slot)
+    link = &sched->_sch_next[*link];
+  *link = sched->_sch_next[slot];
+  sched->_sch_bids[slot] = -1;
+}
+
+static int compareKeys(const void *a, const void *b)
+{
+  LONG x = *(const LONG *)a, y = *(const LONG *)b;
+  return x < y ? -1 : x > y;
+}
+
+//frees the queue, the scheduler writes blocks through afterwards
+static void freeQueue(IOSched *sched)
+{
+  free(sched->_sch_bids);
+  free(sched->_sch_next);
+  free(sched->_sch_order);
+  free(sched->_sch_reqs);
+  free(sched->_sch_buckets);
+  free(sched->_sch_bufs);
+  free(sched->_sch_staging);
+  sched->_sch_bids = sched->_sch_order = NULL;
+  sched->_sch_next = sched->_sch_buckets = NULL;
+  sched->_sch_reqs = NULL;
+  sched->_sch_bufs = sched->_sch_staging = NULL;
+  sched->_sch_depth = 0;
+}
+
+INT initIOSched(IOSched *sched, DiskArray *disk, AsyncDisk *aio, UINT depth)
+{
+  memset(sched, 0, sizeof(IOSched));
+  sched->_sch_disk = disk;
+  sched->_sch_aio = aio;
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&sched->_sch_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (depth > IOSCHED_MAX_DEPTH)
+    depth = IOSCHED_MAX_DEPTH;
+  if (depth == 0)
+    return 0;
+
+  UINT blkSize = disk->_dsk_blkSize;
+  sched->_sch_nBuckets = 1;
+  while (sched->_sch_nBuckets < 2 * depth)
+    sched->_sch_nBuckets <<= 1;
+  sched->_sch_bids = malloc(depth * sizeof(LONG));
+  sched->_sch_next = malloc(depth * sizeof(INT));
+  sched->_sch_order = malloc(depth * sizeof(LONG));
+  sched->_sch_reqs = malloc(depth * sizeof(DiskRequest));
+  sched->_sch_buckets = malloc(sched->_sch_nBuckets * sizeof(INT));
+  sched->_sch_bufs = malloc((size_t)depth * blkSize);
+  if (posix_memalign((void **)&sched->_sch_staging, disk->_dsk_align, (size_t)depth * blkSize) != 0)
+    sched->_sch_staging = NULL;
+  if (sched->_sch_bids == NULL || sched->_sch_next == NULL || sched->_sch_order == NULL ||
+      sched->_sch_reqs == NULL || sched->_sch_buckets == NULL || sched->_sch_bufs == NULL ||
+      sched->_sch_staging == NULL) {
+    fprintf(stderr, "Error: failed to allocate an I/O scheduler queue of %u blocks\n", depth);
+    freeQueue(sched);
+    return -1;
+  }
+  memset(sched->_sch_buckets, -1, sched->_sch_nBuckets * sizeof(INT));
+  sched->_sch_depth = depth;
+  return 0;
+}
+
+INT closeIOSched(IOSched *sched)
+{
+  INT succ = dispatchIOSched(sched);
+  freeQueue(sched);
+  pthread_mutex_destroy(&sched->_sch_lock);
+  return succ;
+}
+
+void plugIOSched(IOSched *sched)
+{
+  pthread_mutex_lock(&sched->_sch_lock);
+  sched->_sch_plugged++;
+  pthread_mutex_unlock(&sched->_sch_lock);
+}
+
+INT unplugIOSched(IOSched *sched)
+{
+  pthread_mutex_lock(&sched->_sch_lock);
+  if (sched->_sch_plugged > 0)
+    sched->_sch_plugged--;
+  INT succ = sched->_sch_plugged > 0 ? 0 : dispatchIOSched(sched);
+  pthread_mutex_unlock(&sched->_sch_lock);
+  return succ;
+}
+
+//sorts, merges and writes the queue; called with the queue locked
+static INT dispatchQueue(IOSched *sched)
+{
+  if (sched->_sch_nQueued == 0)
+    return 0;
+
+  UINT blkSize = sched->_sch_disk->_dsk_blkSize;
+  UINT n = 0;
+  for (UINT slot = 0; slot < sched->_sch_nQueued; slot++) {
+    if (sched->_sch_bids[slot] >= 0)
+      sched->_sch_order[n++] = sched->_sch_bids[slot] << SLOT_BITS | slot;
+  }
+  qsort(sched->_sch_order, n, sizeof(LONG), compareKeys);
+
+  //lay the blocks out in id order and cut the layout where ids stop being adjacent
+  UINT nReqs = 0;
+  for (UINT i = 0; i < n; i++) {
+    LONG bid = sched->_sch_order[i] >> SLOT_BITS;
+    INT slot = sched->_sch_order[i] & ((1 << SLOT_BITS) - 1);
+    BYTE *dst = sched->_sch_staging + (LONG)i * blkSize;
+    memcpy(dst, slotBuf(sched, slot), blkSize);
+    DiskRequest *last = nReqs > 0 ? &sched->_sch_reqs[nReqs - 1] : NULL;
+    if (last != NULL && last->_req_bid + last->_req_nBlks == bid) {
+      last->_req_nBlks++;
+      continue;
+    }
+    memset(&sched->_sch_reqs[nReqs], 0, sizeof(DiskRequest));
+    sched->_sch_reqs[nReqs]._req_bid = bid;
+    sched->_sch_reqs[nReqs]._req_nBlks = 1;
+    sched->_sch_reqs[nReqs]._req_buf = dst;
+    sched->_sch_reqs[nReqs]._req_write = true;
+    nReqs++;
+  }
+
+  #ifdef DEBUG_VERBOSE
+  printf("dispatchIOSched merged %u queued blocks into %u requests\n", n, nReqs);
+  #endif
+  INT succ = nReqs > 0 ? runDiskRequests(sched->_sch_aio, sched->_sch_reqs, nReqs) : 0;
+  sched->_sch_nDispatched += nReqs;
+  sched->_sch_nDispatchedBlks += n;
+
+  for (UINT slot = 0; slot < sched->_sch_nQueued; slot++) {
+    if (sched->_sch_bids[slot] >= 0)
+      unlinkSlot(sched, slot);
+  }
+  sched->_sch_nQueued = 0;
+  if (succ != 0) {
+    fprintf(stderr, "Error: I/O scheduler failed to write back %u queued blocks\n", n);
+    _err_last = _dsk_ioFail;
+    THROW(__FILE__, __LINE__, __func__);
+    return -1;
+  }
+  return 0;
+}
+
+INT dispatchIOSched(IOSched *sched)
+{
+  pthread_mutex_lock(&sched->_sch_lock);
+  INT succ = dispatchQueue(sched);
+  pthread_mutex_unlock(&sched->_sch_lock);
+  return succ;
+}
+
+INT schedReadBlk(IOSched *sched, LONG bid, BYTE *buf)
+{
+  pthread_mutex_lock(&sched->_sch_lock);
+  if (sched->_sch_nQueued > 0) {
+    INT slot = findSlot(sched, bid);
+    if (slot >= 0) {
+      memcpy(buf, slotBuf(sched, slot), sched->_sch_disk->_dsk_blkSize);
+      pthread_mutex_unlock(&sched->_sch_lock);
+      return 0;
+    }
+  }
+  //the disk serializes its own transfers
+  pthread_mutex_unlock(&sched->_sch_lock);
+  return readBlk(sched->_sch_disk, bid, buf);
+}
+
+//queues a block or writes it through; called with the queue locked
+static INT queueBlk(IOSched *sched, LONG bid, BYTE *buf)
+{
+  if (sched->_sch_plugged == 0 || sched->_sch_depth == 0)
+    return writeBlk(sched->_sch_disk, bid, buf);
+
+  UINT blkSize = sched->_sch_disk->_dsk_blkSize;
+  INT slot = findSlot(sched, bid);
+  if (slot >= 0) {
+    memcpy(slotBuf(sched, slot), buf, blkSize);
+    sched->_sch_nWrites++;
+    sched->_sch_nAbsorbed++;
+    return 0;
+  }
+
+  //queue full, write it all back before taking more
+  if (sched->_sch_nQueued == sched->_sch_depth && dispatchQueue(sched) != 0)
+    return -1;
+
+  slot = sched->_sch_nQueued++;
+  UINT bucket = bucketOf(sched, bid);
+  sched->_sch_bids[slot] = bid;
+  sched->_sch_next[slot] = sched->_sch_buckets[bucket];
+  sched->_sch_buckets[bucket] = slot;
+  memcpy(slotBuf(sched, slot), buf, blkSize);
+  sched->_sch_nWrites++;
+  return 0;
+}
+
+INT schedWriteBlk(IOSched *sched, LONG bid, BYTE *buf)
+{
+  pthread_mutex_lock(&sched->_sch_lock);
+  INT succ = queueBlk(sched, bid, buf);
+  pthread_mutex_unlock(&sched->_sch_lock);
+  return succ;
+}
+
+void schedPatchRead(IOSched *sched, LONG bid, UINT nBlks, BYTE *buf)
+{
+  pthread_mutex_lock(&sched->_sch_lock);
+  UINT blkSize = sched->_sch_disk->_dsk_blkSize;
+  for (UINT i = 0; i < nBlks && sched->_sch_nQueued > 0; i++) {
+    INT slot = findSlot(sched, bid + i);
+    if (slot >= 0)
+      memcpy(buf + (LONG)i * blkSize, slotBuf(sched, slot), blkSize);
+  }
+  pthread_mutex_unlock(&sched->_sch_lock);
+}
+
+void schedDropBlks(IOSched *sched, LONG bid, UINT nBlks)
+{
+  pthread_mutex_lock(&sched->_sch_lock);
+  for (UINT i = 0; i < nBlks && sched->_sch_nQueued > 0; i++) {
+    INT slot = findSlot(sched, bid + i);
+    if (slot >= 0)
+      unlinkSlot(sched, slot);
+  }
+  pthread_mutex_unlock(&sched->_sch_lock);
+}
+
+void resetIOSchedStats(IOSched *sched)
+{
+  pthread_mutex_lock(&sched->_sch_lock);
+  sched->_sch_nWrites = 0;
+  sched->_sch_nAbsorbed = 0;
+  sched->_sch_nDispatched = 0;
+  sched->_sch_nDispatchedBlks = 0;
+  pthread_mutex_unlock(&sched->_sch_lock);
+}
@@ -0,0 +1,87 @@
+/*
+ * Request merging I/O scheduler. While plugged, block writes are queued
+ * instead of going to disk, a later write of a queued block replaces the
+ * queued copy. On unplug the queue is sorted by block id and adjacent
+ * blocks are merged into single requests on the async engine.
+ */
+
+#pragma once
+#include "AsyncDisk.h"
+
+#define IOSCHED_DEFAULT_DEPTH (128)
+#define IOSCHED_MAX_DEPTH (1024)
+
+typedef struct IOSched
+{
+  DiskArray *_sch_disk;
+  AsyncDisk *_sch_aio;
+
+  //guards the queue, recursive since a full queue dispatches from a write
+  pthread_mutex_t _sch_lock;
+
+  //max # of blocks queued, 0 writes every block through right away
+  UINT _sch_depth;
+
+  //plug nesting level, the queue is dispatched when it drops to 0
+  UINT _sch_plugged;
+
+  //queued blocks, slot i holds block _sch_bids[i] (-1 once dropped)
+  //with its data at _sch_bufs + i * blkSize
+  UINT _sch_nQueued;
+  LONG *_sch_bids;
+  BYTE *_sch_bufs;
+
+  //hash chains from block id to slot
+  UINT _sch_nBuckets;
+  INT *_sch_buckets;
+  INT *_sch_next;
+
+  //aligned staging area the sorted queue is copied into for dispatch
+  BYTE *_sch_staging;
+  //dispatch order and the merged requests of the current dispatch
+  LONG *_sch_order;
+  DiskRequest *_sch_reqs;
+
+  //counters, writes queued, writes absorbed by a queued copy of the
+  //same block, requests sent to disk and the blocks they carried
+  LONG _sch_nWrites;
+  LONG _sch_nAbsorbed;
+  LONG _sch_nDispatched;
+  LONG _sch_nDispatchedBlks;
+} IOSched;
+
+//sets up a scheduler on an opened disk and its engine
+//args: scheduler,
+//      disk,
+//      engine the merged requests are run on,
+//      queue depth in blocks (0 disables queueing)
+INT initIOSched(IOSched *, DiskArray *, AsyncDisk *, UINT);
+
+//dispatches what is queued and frees the scheduler
+INT closeIOSched(IOSched *);
+
+//starts holding block writes back
+void plugIOSched(IOSched *);
+
+//ends one plug, the queue is dispatched when the outermost plug ends
+//returns -1 if a dispatched request failed
+INT unplugIOSched(IOSched *);
+
+//sends everything queued to disk now, sorted and merged
+INT dispatchIOSched(IOSched *);
+
+//reads a block, from the queue when a newer copy is held there
+INT schedReadBlk(IOSched *, LONG, BYTE *);
+
+//writes a block, queued while plugged and written through otherwise
+INT schedWriteBlk(IOSched *, LONG, BYTE *);
+
+//copies the queued blocks of a range over a buffer just read from disk
+//args: scheduler, first block, # of blocks, buffer of the range
+void schedPatchRead(IOSched *, LONG, UINT, BYTE *);
+
+//forgets the queued copies of a range about to be written directly
+void schedDropBlks(IOSched *, LONG, UINT);
+
+//clears the counters
+void resetIOSchedStats(IOSched *);
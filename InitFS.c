@@ -12,8 +12,11 @@ UINT MEGA = 1024 * 1024;
 int main(int args, char* argv[])
 {
     FileSystem fs;
+    //optional block and inode sizes, the defaults otherwise
+    UINT blkSize = args > 1 ? atoi(argv[1]) : DEFAULT_BLK_SIZE;
+    UINT inodeSize = args > 2 ? atoi(argv[2]) : DEFAULT_INODE_SIZE;
     printf("Initializing file system with initfs...\n");
-    UINT succ = l2_initfs(15*GIGA/BLK_SIZE, MEGA, &fs);
+    UINT succ = l2_initfs(15*GIGA/blkSize, MEGA, blkSize, inodeSize, NULL, &fs);
     if (succ != 0) {
         printf("Error: initfs failed with error code: %d\n", succ);
     }
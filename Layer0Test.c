@@ -4,11 +4,13 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include <string.h>
-#include"DiskEmulator.h"
+#include <unistd.h>
+#include <sys/wait.h>
+#include"IOSched.h"
 
 void PrintBlock(BYTE *buf)
 {
-  for (UINT i=0; i<BLK_SIZE; i++) {
+  for (UINT i=0; i<DEFAULT_BLK_SIZE; i++) {
     printf("%x ", *(buf + i));
   }
   printf("\n");
@@ -33,17 +35,32 @@ int main(int args, char* argv[])
   //Declare a disk
   DiskArray disk;
   
-  initDisk(&disk, diskSize);
+  //optional backend selection
+  UINT flags = 0;
+  if (args > 2 && strcmp(argv[2], "mmap") == 0)
+    flags |= DSK_MMAP;
+  if (args > 2 && strcmp(argv[2], "direct") == 0)
+    flags |= DSK_DIRECT;
+  //"stripe" spreads the disk over 3 images in units of 2 blocks
+  BOOL striped = args > 2 && strcmp(argv[2], "stripe") == 0;
+  if (striped) {
+    if (initStripedDisk(&disk, diskSize, DEFAULT_BLK_SIZE, flags, 3, 2) != 0) {
+      printf("Striped disk init failed!\n");
+      exit(1);
+    }
+  }
+  else
+    initDisk(&disk, diskSize, DEFAULT_BLK_SIZE, flags);
   
   printf("Disk created with size: %d, %d block(s)\n", diskSize, disk._dsk_numBlk);
 
   BYTE writeBuf[1024];
-  BYTE readBuf[BLK_SIZE];
+  BYTE readBuf[DEFAULT_BLK_SIZE];
 
   memset(writeBuf, 0xff, 1024);
   
   writeBlk(&disk, 1, writeBuf); 
-  writeBlk(&disk, 2, writeBuf + BLK_SIZE);  
+  writeBlk(&disk, 2, writeBuf + DEFAULT_BLK_SIZE);  
 
   if (readBlk(&disk, 0, readBuf) == 0)
     PrintBlock(readBuf);
@@ -54,6 +71,274 @@ int main(int args, char* argv[])
   if (readBlk(&disk, 2, readBuf) == 0)
     PrintBlock(readBuf);
   
+  //multi-block and vectored transfers
+  if (disk._dsk_numBlk >= 4) {
+    BYTE runBuf[3 * DEFAULT_BLK_SIZE];
+    BYTE runRead[3 * DEFAULT_BLK_SIZE];
+    for (UINT i=0; i<3 * DEFAULT_BLK_SIZE; i++)
+      runBuf[i] = i % 251;
+
+    struct iovec iov[2] = { { runBuf, DEFAULT_BLK_SIZE }, { runBuf + DEFAULT_BLK_SIZE, 2 * DEFAULT_BLK_SIZE } };
+    writeBlksv(&disk, 1, iov, 2);
+    readBlks(&disk, 1, 3, runRead);
+    if (memcmp(runBuf, runRead, 3 * DEFAULT_BLK_SIZE) != 0) {
+      printf("Multi-block read back mismatch!\n");
+      exit(1);
+    }
+
+    //a run crossing the end of the disk must be rejected
+    if (readBlks(&disk, disk._dsk_numBlk - 1, 2, runRead) != -1) {
+      printf("Out of bound multi-block read not rejected!\n");
+      exit(1);
+    }
+    printf("Multi-block transfers verified\n");
+  }
+
+  //the mapped backend hands out block pointers that alias the transfers
+  if (disk._dsk_flags & DSK_MMAP) {
+    BYTE *blk = mapBlk(&disk, 1);
+    readBlk(&disk, 1, readBuf);
+    if (blk == NULL || memcmp(blk, readBuf, DEFAULT_BLK_SIZE) != 0) {
+      printf("Mapped block does not match read back!\n");
+      exit(1);
+    }
+    if (syncDisk(&disk) != 0) {
+      printf("Disk sync failed!\n");
+      exit(1);
+    }
+    printf("Mapped backend verified\n");
+  }
+
+  //direct transfers from pool buffers and from unaligned buffers
+  if (disk._dsk_flags & DSK_DIRECT) {
+    BYTE *poolBuf = getBlkBuf(&disk);
+    BYTE unaligned[DEFAULT_BLK_SIZE + 1];
+    memset(poolBuf, 0x5a, DEFAULT_BLK_SIZE);
+    if (!isBlkBufAligned(&disk, poolBuf, DEFAULT_BLK_SIZE) || writeBlk(&disk, 3, poolBuf) != 0
+        || readBlk(&disk, 3, unaligned + 1) != 0 || memcmp(poolBuf, unaligned + 1, DEFAULT_BLK_SIZE) != 0) {
+      printf("Direct transfer mismatch!\n");
+      exit(1);
+    }
+    putBlkBuf(&disk, poolBuf);
+    printf("Direct backend verified\n");
+  }
+
+  //batched asynchronous transfers on every engine
+  if (disk._dsk_numBlk >= 12) {
+    AIO_ENGINE engines[] = { AIO_ENGINE_URING, AIO_ENGINE_THREADS, AIO_ENGINE_SYNC };
+    BYTE batchBuf[8][DEFAULT_BLK_SIZE];
+    BYTE batchRead[8][DEFAULT_BLK_SIZE];
+    for (UINT e = 0; e < 3; e++) {
+      AsyncDisk aio;
+      initAsyncDisk(&aio, &disk, engines[e], 4);
+
+      //more requests than the queue depth, out of order on disk
+      DiskRequest reqs[8];
+      for (UINT i = 0; i < 8; i++) {
+        memset(batchBuf[i], e * 8 + i, DEFAULT_BLK_SIZE);
+        reqs[i] = (DiskRequest) { ._req_bid = 4 + (i * 3) % 8, ._req_nBlks = 1, ._req_buf = batchBuf[i], ._req_write = true };
+      }
+      if (runDiskRequests(&aio, reqs, 8) != 0) {
+        printf("Batched write failed on %s engine!\n", asyncDiskEngineName(&aio));
+        exit(1);
+      }
+      for (UINT i = 0; i < 8; i++)
+        reqs[i] = (DiskRequest) { ._req_bid = 4 + (i * 3) % 8, ._req_nBlks = 1, ._req_buf = batchRead[i], ._req_write = false };
+      if (runDiskRequests(&aio, reqs, 8) != 0 || memcmp(batchBuf, batchRead, sizeof(batchBuf)) != 0) {
+        printf("Batched read back mismatch on %s engine!\n", asyncDiskEngineName(&aio));
+        exit(1);
+      }
+
+      //a request past the end of the disk fails alone
+      reqs[1]._req_bid = disk._dsk_numBlk;
+      if (runDiskRequests(&aio, reqs, 2) != -1 || reqs[0]._req_result != 0 || reqs[1]._req_result != -1) {
+        printf("Out of bound batched read not rejected on %s engine!\n", asyncDiskEngineName(&aio));
+        exit(1);
+      }
+      printf("Batched transfers verified on %s engine\n", asyncDiskEngineName(&aio));
+      closeAsyncDisk(&aio);
+    }
+
+    //a child forked after the workers started, as a FUSE daemon is after
+    //the mount, gets workers of its own
+    AsyncDisk aio;
+    initAsyncDisk(&aio, &disk, AIO_ENGINE_THREADS, 4);
+    DiskRequest req = { ._req_bid = 4, ._req_nBlks = 1, ._req_buf = batchRead[0], ._req_write = false };
+    if (runDiskRequests(&aio, &req, 1) != 0) {
+      printf("Batched read failed on %s engine!\n", asyncDiskEngineName(&aio));
+      exit(1);
+    }
+    pid_t child = fork();
+    if (child == 0) {
+      alarm(10);
+      INT succ = runDiskRequests(&aio, &req, 1);
+      closeAsyncDisk(&aio);
+      _exit(succ == 0 ? 0 : 1);
+    }
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      printf("Batched read hung or failed after a fork!\n");
+      exit(1);
+    }
+    closeAsyncDisk(&aio);
+    printf("Batched transfers verified after a fork\n");
+  }
+
+  //the scheduler absorbs rewrites of queued blocks and merges adjacent ones
+  if (disk._dsk_numBlk >= 32) {
+    AsyncDisk aio;
+    IOSched sched;
+    BYTE schedBuf[DEFAULT_BLK_SIZE];
+    BYTE schedRead[DEFAULT_BLK_SIZE];
+    initAsyncDisk(&aio, &disk, AIO_ENGINE_AUTO, 4);
+    initIOSched(&sched, &disk, &aio, 4);
+    plugIOSched(&sched);
+    LONG bids[] = { 22, 20, 21, 20, 28 };
+    for (UINT i = 0; i < 5; i++) {
+      memset(schedBuf, 0x40 + i, DEFAULT_BLK_SIZE);
+      schedWriteBlk(&sched, bids[i], schedBuf);
+    }
+    //queued blocks read back from the queue before they reach the disk
+    if (schedReadBlk(&sched, 20, schedRead) != 0 || schedRead[0] != 0x43 || sched._sch_nQueued != 4) {
+      printf("Scheduler queue mismatch!\n");
+      exit(1);
+    }
+    if (unplugIOSched(&sched) != 0 || sched._sch_nAbsorbed != 1
+        || sched._sch_nDispatched != 2 || sched._sch_nDispatchedBlks != 4) {
+      printf("Scheduler did not merge the queued writes!\n");
+      exit(1);
+    }
+    BYTE expect[] = { 0x43, 0x42, 0x40 };
+    for (UINT i = 0; i < 3; i++) {
+      readBlk(&disk, 20 + i, schedRead);
+      if (schedRead[0] != expect[i]) {
+        printf("Scheduler wrote block %d out of order!\n", 20 + i);
+        exit(1);
+      }
+    }
+    //a full queue is dispatched before it takes more
+    plugIOSched(&sched);
+    for (UINT i = 0; i < 6; i++)
+      schedWriteBlk(&sched, 24 + i, schedBuf);
+    if (sched._sch_nQueued != 2 || unplugIOSched(&sched) != 0 || sched._sch_nDispatched != 4) {
+      printf("Scheduler overflow mismatch!\n");
+      exit(1);
+    }
+    closeIOSched(&sched);
+    closeAsyncDisk(&aio);
+    printf("I/O scheduler verified\n");
+  }
+
+  //every request is counted once, sequential when it follows the last one
+  if (disk._dsk_numBlk >= 32) {
+    BYTE statsBuf[4 * DEFAULT_BLK_SIZE];
+    DiskStats stats;
+    resetDiskStats(&disk);
+    for (UINT i = 0; i < 8; i++)
+      readBlk(&disk, i, statsBuf);
+    readBlk(&disk, 20, statsBuf);
+    readBlk(&disk, 5, statsBuf);
+    writeBlks(&disk, 0, 4, statsBuf);
+    getDiskStats(&disk, &stats);
+    LONG readLat = 0, writeLat = 0;
+    for (UINT b = 0; b < DSK_LAT_BUCKETS; b++) {
+      readLat += stats._st_readLat[b];
+      writeLat += stats._st_writeLat[b];
+    }
+    if (stats._st_reads != 10 || stats._st_writes != 1 || stats._st_readBytes != 10 * DEFAULT_BLK_SIZE
+        || stats._st_writeBytes != 4 * DEFAULT_BLK_SIZE || stats._st_seq != 8 || stats._st_rand != 3
+        || readLat != 10 || writeLat != 1 || stats._st_errors != 0) {
+      printf("Disk statistics mismatch!\n");
+      printDiskStats(&stats);
+      exit(1);
+    }
+    printf("Disk statistics verified\n");
+
+    //discarded blocks read back as 0, their neighbours are kept
+    memset(statsBuf, 0x77, sizeof(statsBuf));
+    writeBlks(&disk, 24, 4, statsBuf);
+    if (discardBlks(&disk, 25, 2) != 0 || readBlks(&disk, 24, 4, statsBuf) != 0
+        || statsBuf[0] != 0x77 || statsBuf[DEFAULT_BLK_SIZE] != 0 || statsBuf[3 * DEFAULT_BLK_SIZE - 1] != 0
+        || statsBuf[3 * DEFAULT_BLK_SIZE] != 0x77) {
+      printf("Discard mismatch!\n");
+      exit(1);
+    }
+    getDiskStats(&disk, &stats);
+    if (stats._st_discards != 1 || stats._st_discardBytes != 2 * DEFAULT_BLK_SIZE) {
+      printf("Discard not counted!\n");
+      exit(1);
+    }
+    printf("Discard verified\n");
+  }
+
+  //striped blocks land round robin on the members, runs crossing several
+  //members read back whole
+  if (striped && disk._dsk_numBlk >= 24) {
+    BYTE stripeBuf[12 * DEFAULT_BLK_SIZE];
+    BYTE stripeRead[12 * DEFAULT_BLK_SIZE];
+    for (UINT i = 0; i < 12 * DEFAULT_BLK_SIZE; i++)
+      stripeBuf[i] = i / DEFAULT_BLK_SIZE + 1;
+    struct iovec iov[2] = { { stripeBuf, 5 * DEFAULT_BLK_SIZE }, { stripeBuf + 5 * DEFAULT_BLK_SIZE, 7 * DEFAULT_BLK_SIZE } };
+    if (writeBlksv(&disk, 11, iov, 2) != 0 || readBlks(&disk, 11, 12, stripeRead) != 0
+        || memcmp(stripeBuf, stripeRead, sizeof(stripeBuf)) != 0) {
+      printf("Striped run read back mismatch!\n");
+      exit(1);
+    }
+    //block 11 is unit 5, the second unit of member 2
+    BYTE memberBlk[DEFAULT_BLK_SIZE];
+    if (pread(disk._dsk_members[2], memberBlk, DEFAULT_BLK_SIZE, 3 * DEFAULT_BLK_SIZE) != DEFAULT_BLK_SIZE
+        || memcmp(memberBlk, stripeBuf, DEFAULT_BLK_SIZE) != 0) {
+      printf("Striped block not found on its member!\n");
+      exit(1);
+    }
+    printf("Striped backend verified over %d members\n", disk._dsk_nMembers);
+
+    //a child forked after the member workers started, as a FUSE daemon
+    //is after the mount, moves its runs with workers of its own
+    pid_t child = fork();
+    if (child == 0) {
+      alarm(10);
+      memset(stripeRead, 0, sizeof(stripeRead));
+      _exit(readBlks(&disk, 11, 12, stripeRead) == 0 && memcmp(stripeBuf, stripeRead, sizeof(stripeBuf)) == 0 ? 0 : 1);
+    }
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      printf("Striped run hung or failed after a fork!\n");
+      exit(1);
+    }
+    printf("Striped backend verified after a fork\n");
+  }
+
+  //the performance model repeats exactly and charges for seeks
+  if (disk._dsk_numBlk >= 32) {
+    DSK_MODEL models[] = { DSK_MODEL_HDD, DSK_MODEL_SSD };
+    const char *names[] = { "HDD", "SSD" };
+    for (UINT m = 0; m < 2; m++) {
+      DiskModel model;
+      initDiskModel(&model, models[m]);
+      LONG seqNs[2], randNs[2];
+      for (UINT r = 0; r < 2; r++) {
+        setDiskModel(&disk, &model);
+        for (UINT i = 0; i < 16; i++)
+          readBlk(&disk, i, readBuf);
+        seqNs[r] = getDiskSimTime(&disk);
+        setDiskModel(&disk, &model);
+        for (UINT i = 0; i < 16; i++)
+          readBlk(&disk, (i * 7) % 32, readBuf);
+        randNs[r] = getDiskSimTime(&disk);
+      }
+      if (seqNs[0] != seqNs[1] || randNs[0] != randNs[1] || seqNs[0] == 0 || seqNs[0] > randNs[0]) {
+        printf("Simulated %s times inconsistent: sequential %ld/%ld ns, random %ld/%ld ns\n",
+               names[m], seqNs[0], seqNs[1], randNs[0], randNs[1]);
+        exit(1);
+      }
+      printf("Simulated %s: 16 sequential reads %ld us, 16 random reads %ld us\n", names[m], seqNs[0] / 1000, randNs[0] / 1000);
+    }
+    DiskModel none;
+    initDiskModel(&none, DSK_MODEL_NONE);
+    setDiskModel(&disk, &none);
+  }
+
   #ifdef DEBUG
   //dumpDisk(&disk);
   #endif
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include "FileSystem.h"
 
@@ -60,7 +61,7 @@ void testDBlks(UINT nDBlks, UINT nINodes) {
     //test makefs
     printf("\n---- makefs ----\n");
     FileSystem fs;
-    UINT succ = makefs(nDBlks, nINodes, &fs);
+    UINT succ = makefs(nDBlks, nINodes, 0, 0, NULL, &fs);
     if(succ == 0) {
         printf("makefs succeeded with filesystem size: %d\n", fs.nBytes);
     }
@@ -71,13 +72,14 @@ void testDBlks(UINT nDBlks, UINT nINodes) {
     printINodes(&fs);
     printf("\nData blocks:\n");
     printDBlks(&fs);
-    printf("\nFree inode cache:\n");
-    printFreeINodeCache(&fs.superblock);
+    printf("\nFree inode bitmap:\n");
+    printINodeBitmap(&fs.iBitmap);
     printf("\nFree dblk cache:\n");
     printFreeDBlkCache(&fs.superblock);
 
     assert(fs.diskINodeBlkOffset == 1);
-    assert(fs.diskDBlkOffset == 1 + nINodes / INODES_PER_BLK);
+    assert(fs.diskIBitmapOffset == 1 + nINodes / fs.inodesPerBlk);
+    assert(fs.diskDBlkOffset == fs.diskIBitmapOffset + iBitmapBlks(nINodes, fs.blkSize));
 
     //test allocDBlk until no free dblks are left
     printf("\n---- allocDBlk ----\n");
@@ -158,7 +160,7 @@ void testDBlks(UINT nDBlks, UINT nINodes) {
         printf("\nError: must have at least %d dblks to do read/write test!\n", NUM_TEST_DBLKS);
         exit(1);
     }
-    BYTE dblks[NUM_TEST_DBLKS][BLK_SIZE];
+    BYTE dblks[NUM_TEST_DBLKS][fs.blkSize];
     UINT dblkIds[NUM_TEST_DBLKS];
     for(int i = 0; i < NUM_TEST_DBLKS; i++) {
         dblkIds[i] = -1;
@@ -181,12 +183,12 @@ void testDBlks(UINT nDBlks, UINT nINodes) {
     printf("\n---- writeDBlk ----\n");
     for(int i = 0; i < NUM_TEST_DBLKS; i++) {
         UINT* buf = (UINT*) &dblks[i];
-        for(int j = 0; j < BLK_SIZE / sizeof(UINT); j++) {
+        for(int j = 0; j < fs.blkSize / sizeof(UINT); j++) {
             buf[j] = -j;
         }
 
         printf("Writing test data to dblk id: %d\n", dblkIds[i]);
-        succ = writeDBlk(&fs, dblkIds[i], dblks[i]);
+        succ = writeDBlk(&fs, dblkIds[i], dblks[i], DBLK_DATA);
         assert(succ == 0);
     }
 
@@ -197,15 +199,15 @@ void testDBlks(UINT nDBlks, UINT nINodes) {
     printf("\n---- readDBlk ----\n");
         
     for(int i = 0; i < NUM_TEST_DBLKS; i++) {
-        BYTE testDBlk[BLK_SIZE];
+        BYTE testDBlk[fs.blkSize];
         
         printf("Reading test data from dblk id: %d\n", dblkIds[i]);
-        succ = readDBlk(&fs, dblkIds[i], testDBlk);
-        printDBlkInts(testDBlk);
+        succ = readDBlk(&fs, dblkIds[i], testDBlk, DBLK_DATA);
+        printDBlkInts(&fs, testDBlk);
         assert(succ == 0);
         
         UINT* buf = (UINT*) &testDBlk;
-        for(int j = 0; j < BLK_SIZE / sizeof(UINT); j++) {
+        for(int j = 0; j < fs.blkSize / sizeof(UINT); j++) {
             assert(buf[j] == -j);
         }
     }
@@ -219,7 +221,7 @@ void testDBlks(UINT nDBlks, UINT nINodes) {
         }
 
         printf("Writing test data to dblk id: %d, with offset: %d, and length: %d\n", dblkIds[i], TEST_DBLK_BYTE_OFF, TEST_DBLK_BYTE_LEN);
-        succ = writeDBlkOffset(&fs, dblkIds[i], (BYTE*) buf, TEST_DBLK_BYTE_OFF, TEST_DBLK_BYTE_LEN);
+        succ = writeDBlkOffset(&fs, dblkIds[i], (BYTE*) buf, TEST_DBLK_BYTE_OFF, TEST_DBLK_BYTE_LEN, DBLK_DATA);
         assert(succ == 0);
     }
 
@@ -229,7 +231,7 @@ void testDBlks(UINT nDBlks, UINT nINodes) {
     for(int i = 0; i < NUM_TEST_DBLKS; i++) {
         BYTE testDBlkOff[TEST_DBLK_BYTE_LEN];
         printf("Reading test data from dblk id: %d, with offset: %d, and length: %d\n", dblkIds[i], TEST_DBLK_BYTE_OFF, TEST_DBLK_BYTE_LEN);
-        succ = readDBlkOffset(&fs, dblkIds[i], testDBlkOff, TEST_DBLK_BYTE_OFF, TEST_DBLK_BYTE_LEN);
+        succ = readDBlkOffset(&fs, dblkIds[i], testDBlkOff, TEST_DBLK_BYTE_OFF, TEST_DBLK_BYTE_LEN, DBLK_DATA);
         assert(succ == 0);
         
         UINT* buf = (UINT*) &testDBlkOff;
@@ -244,28 +246,66 @@ void testDBlks(UINT nDBlks, UINT nINodes) {
     printf("\n---- modify read/writeDBlk ----\n");
     printDBlks(&fs);
     for(int i = NUM_TEST_DBLKS - 1; i >= 0; i--) {
-        succ = readDBlk(&fs, dblkIds[i], dblks[i]);
+        succ = readDBlk(&fs, dblkIds[i], dblks[i], DBLK_DATA);
         assert(succ == 0);
 
         printf("Modifying dblk id: %d\n", dblkIds[i]);
         UINT* buf = (UINT*) &dblks[i];
-        for(int j = 0; j < BLK_SIZE / sizeof(UINT); j++) {
+        for(int j = 0; j < fs.blkSize / sizeof(UINT); j++) {
             buf[j] = dblkIds[i];
         }
-        succ = writeDBlk(&fs, dblkIds[i], dblks[i]);
+        succ = writeDBlk(&fs, dblkIds[i], dblks[i], DBLK_DATA);
         assert(succ == 0);
 
-        BYTE testDBlk2[BLK_SIZE];
-        succ = readDBlk(&fs, dblkIds[i], testDBlk2);
-        printDBlkInts(testDBlk2);
+        BYTE testDBlk2[fs.blkSize];
+        succ = readDBlk(&fs, dblkIds[i], testDBlk2, DBLK_DATA);
+        printDBlkInts(&fs, testDBlk2);
         assert(succ == 0);
         
         UINT* buf2 = (UINT*) &testDBlk2;
-        for(int j = 0; j < BLK_SIZE / sizeof(UINT); j++) {
+        for(int j = 0; j < fs.blkSize / sizeof(UINT); j++) {
             assert(buf2[j] == dblkIds[i]);
         }
     }
     
+    //test discard of freed dblks, every freed block is punched out of the
+    //image except the blocks that take the free list
+    printf("\n---- discard ----\n");
+    LONG nFree = fs.superblock.nFreeDBlks;
+    LONG held[nFree];
+    BYTE pattern[fs.blkSize];
+    memset(pattern, 0x5a, fs.blkSize);
+    for(LONG i = 0; i < nFree; i++) {
+        held[i] = allocDBlk(&fs);
+        assert(held[i] >= 0);
+        assert(writeDBlk(&fs, held[i], pattern, DBLK_DATA) == 0);
+    }
+    struct stat before, after;
+    assert(stat(DISK_PATH, &before) == 0);
+
+    fs.options.discard = true;
+    for(LONG i = 0; i < nFree; i++) {
+        assert(freeDBlk(&fs, held[i]) == 0);
+    }
+    LONG nTrimmed = trimFreeDBlks(&fs);
+    printf("trimFreeDBlks discarded %ld of %ld free blocks\n", nTrimmed, nFree);
+    assert(nTrimmed > 0 && nTrimmed < nFree);
+    assert(stat(DISK_PATH, &after) == 0);
+    assert(after.st_blocks < before.st_blocks);
+
+    //the list survives, every block is handed out once and none keeps its data
+    for(LONG i = 0; i < nFree; i++) {
+        held[i] = allocDBlk(&fs);
+        assert(held[i] >= 0);
+        for(LONG j = 0; j < i; j++) {
+            assert(held[j] != held[i]);
+        }
+        BYTE data[fs.blkSize];
+        assert(readDBlk(&fs, held[i], data, DBLK_DATA) == 0);
+        assert(memcmp(data, pattern, fs.blkSize) != 0);
+    }
+    assert(fs.superblock.nFreeDBlks == 0);
+
     printf("\n---- closefs ----\n");
     succ = closefs(&fs);
     assert(succ == 0);
@@ -279,7 +319,7 @@ void testINodes(UINT nDBlks, UINT nINodes) {
     //test makefs
     printf("\n---- makefs ----\n");
     FileSystem fs;
-    UINT succ = makefs(nDBlks, nINodes, &fs);
+    UINT succ = makefs(nDBlks, nINodes, 0, 0, NULL, &fs);
     if(succ == 0) {
         printf("makefs succeeded with filesystem size: %d\n", fs.nBytes);
     }
@@ -290,19 +330,20 @@ void testINodes(UINT nDBlks, UINT nINodes) {
     printINodes(&fs);
     printf("\nData blocks:\n");
     printDBlks(&fs);
-    printf("\nFree inode cache:\n");
-    printFreeINodeCache(&fs.superblock);
+    printf("\nFree inode bitmap:\n");
+    printINodeBitmap(&fs.iBitmap);
     printf("\nFree dblk cache:\n");
     printFreeDBlkCache(&fs.superblock);
 
     assert(fs.diskINodeBlkOffset == 1);
-    assert(fs.diskDBlkOffset == 1 + nINodes / INODES_PER_BLK);
+    assert(fs.diskIBitmapOffset == 1 + nINodes / fs.inodesPerBlk);
+    assert(fs.diskDBlkOffset == fs.diskIBitmapOffset + iBitmapBlks(nINodes, fs.blkSize));
 
     //test allocINode until no free inodes are left
     printf("\n---- allocINode ----\n");
     for(int i = 0; i < nINodes; i++) {
         INode testINode;
-        UINT id = allocINode(&fs, &testINode);
+        UINT id = allocINode(&fs, &testINode, REGULAR);
         printf("allocINode call %d returned ID %d\n", i, id);
         printINode(&testINode);
     }
@@ -311,7 +352,7 @@ void testINodes(UINT nDBlks, UINT nINodes) {
 
     //allocINode should fail gracefully when no free inodes are left
     INode testINode;
-    UINT id = allocINode(&fs, &testINode);
+    UINT id = allocINode(&fs, &testINode, REGULAR);
     printf("Invalid allocINode call returned ID %d\n", id);
     assert(id == -1);
 
@@ -319,8 +360,8 @@ void testINodes(UINT nDBlks, UINT nINodes) {
     printSuperBlock(&fs.superblock);
     printf("\nINodes:\n");
     printINodes(&fs);
-    printf("\nFree inode cache:\n");
-    printFreeINodeCache(&fs.superblock);
+    printf("\nFree inode bitmap:\n");
+    printINodeBitmap(&fs.iBitmap);
 
     //test random freeINode
     printf("\n---- random freeINode ----\n");
@@ -344,14 +385,14 @@ void testINodes(UINT nDBlks, UINT nINodes) {
     printSuperBlock(&fs.superblock);
     printf("\nINodes:\n");
     printINodes(&fs);
-    printf("\nFree inode cache:\n");
-    printFreeINodeCache(&fs.superblock);
+    printf("\nFree inode bitmap:\n");
+    printINodeBitmap(&fs.iBitmap);
 
     //test allocINode until no free inodes are left
     printf("\n---- allocINode ----\n");
     for(int i = 0; i < nINodes; i++) {
         INode testINode;
-        UINT id = allocINode(&fs, &testINode);
+        UINT id = allocINode(&fs, &testINode, REGULAR);
         printf("allocINode call %d returned ID %d\n", i, id);
     }
 
@@ -371,8 +412,8 @@ void testINodes(UINT nDBlks, UINT nINodes) {
     printSuperBlock(&fs.superblock);
     printf("\nINodes:\n");
     printINodes(&fs);
-    printf("\nFree inode cache:\n");
-    printFreeINodeCache(&fs.superblock);
+    printf("\nFree inode bitmap:\n");
+    printINodeBitmap(&fs.iBitmap);
 
     //temporary variables for read/write test
     if(nINodes < NUM_TEST_INODES) {
@@ -388,7 +429,7 @@ void testINodes(UINT nDBlks, UINT nINodes) {
     //test allocINode
     printf("\n---- allocINode (2) ----\n");
     for(int i = 0; i < NUM_TEST_INODES; i++) {
-        inodeIds[i] = allocINode(&fs, &inodes[i]);
+        inodeIds[i] = allocINode(&fs, &inodes[i], REGULAR);
         printf("allocINode call %d returned ID %d\n", i, inodeIds[i]);
         printINode(&inodes[i]);
 
@@ -15,7 +15,7 @@ void PrintBlock(BYTE *buf)
 int main(int args, char* argv[])
 {
     FileSystem *fs;
-    makefs(10000, 500, fs);
+    makefs(10000, 500, NULL, fs);
 //    printf("Created a file system with %d inodes, %d data blocks\n", fs->superblock.nINodes, fs->superblock.nDBlks);
 /*
   if (args < 2)
@@ -34,7 +34,7 @@ int main(int args, char* argv[])
   //Declare a disk
   DiskArray disk;
   
-  initDisk(&disk, diskSize);
+  initDisk(&disk, diskSize, 0);
   
   printf("Disk created with size: %d, %d block(s)\n", diskSize, disk._dsk_numBlk);
 
@@ -10,6 +10,11 @@
 #include "Directories.h"
 
 void testBlockify();
+void testMountOptions();
+void testATime();
+void testInlineData();
+void testReadAhead();
+void testWarmUp();
 
 int main(int args, char* argv[])
 {
@@ -22,6 +27,8 @@ int main(int args, char* argv[])
 
     printf("Verifying blockify works properly...\n");
     testBlockify();
+    printf("Verifying mount options parse properly...\n");
+    testMountOptions();
 
     UINT nDBlks = atoi(argv[1]);
     UINT nINodes = atoi(argv[2]);
@@ -29,7 +36,7 @@ int main(int args, char* argv[])
     //initialize dummy file system
     FileSystem fs;
     printf("Initializing file system with initfs...\n");
-    UINT succ = l2_initfs(nDBlks, nINodes, &fs);
+    UINT succ = l2_initfs(nDBlks, nINodes, 0, 0, NULL, &fs);
     if(succ == 0) {
         printf("initfs succeeded with filesystem size: %d\n", fs.nBytes);
     }
@@ -44,8 +51,8 @@ int main(int args, char* argv[])
     printINodes(&fs);
     printf("\nData blocks:\n");
     printDBlks(&fs);
-    printf("\nFree inode cache:\n");
-    printFreeINodeCache(&fs.superblock);
+    printf("\nFree inode bitmap:\n");
+    printINodeBitmap(&fs.iBitmap);
     printf("\nFree dblk cache:\n");
     printFreeDBlkCache(&fs.superblock);
     
@@ -56,7 +63,7 @@ int main(int args, char* argv[])
     
     for(int i = 0; i < nINodes - 1; i++) {
         INode testINode;
-        allocINode(&fs, &testINode);
+        allocINode(&fs, &testINode, REGULAR);
     }
 
     printf("\n==== Filesystem state before unmount ====\n");
@@ -66,8 +73,8 @@ int main(int args, char* argv[])
     printINodes(&fs);
     printf("\nData blocks:\n");
     printDBlks(&fs);
-    printf("\nFree inode cache:\n");
-    printFreeINodeCache(&fs.superblock);
+    printf("\nFree inode bitmap:\n");
+    printINodeBitmap(&fs.iBitmap);
     printf("\nFree dblk cache:\n");
     printFreeDBlkCache(&fs.superblock);
 
@@ -77,7 +84,7 @@ int main(int args, char* argv[])
     //open disk file and try mount
     printf("\nAttempting filesystem mount from disk file...\n");
     FileSystem fs_mounted;
-    UINT msucc = l2_mount(&fs_mounted);
+    UINT msucc = l2_mount(&fs_mounted, NULL);
     if(msucc == 0) {
         printf("Successfully mounted filesystem!\n");
     }
@@ -93,16 +100,29 @@ int main(int args, char* argv[])
     printINodes(&fs_mounted);
     printf("\nData blocks:\n");
     printDBlks(&fs_mounted);
-    printf("\nFree inode cache:\n");
-    printFreeINodeCache(&fs_mounted.superblock);
+    printf("\nFree inode bitmap:\n");
+    printINodeBitmap(&fs_mounted.iBitmap);
     printf("\nFree dblk cache:\n");
     printFreeDBlkCache(&fs_mounted.superblock);
     
     assert(fs_mounted.nBytes == fs.nBytes);
     assert(fs_mounted.diskINodeBlkOffset == fs.diskINodeBlkOffset);
     assert(fs_mounted.diskDBlkOffset == fs.diskDBlkOffset);
+    assert(fs_mounted.blkSize == fs.blkSize);
+    assert(fs_mounted.inodeSize == fs.inodeSize);
+    assert(fs_mounted.maxFileBlks == fs.maxFileBlks);
     
     assert(memcmp(&fs_mounted.superblock, &fs.superblock, sizeof(SuperBlock)) == 0);
+    l2_unmount(&fs_mounted);
+
+    printf("Verifying the atime mount options...\n");
+    testATime();
+    printf("Verifying inline data...\n");
+    testInlineData();
+    printf("Verifying readahead...\n");
+    testReadAhead();
+    printf("Verifying the warm-up after a mount...\n");
+    testWarmUp();
     
     #endif
     return 0;
@@ -118,17 +138,16 @@ void testBlockify() {
     sb.pNextFreeDBlk = 20;
     sb.nINodes = 100;
     sb.nFreeINodes = 10;
-    sb.pNextFreeINode = 2;
+    sb.nextFreeINodeGroup = 2;
+    sb.blkSize = 4096;
+    sb.inodeSize = 1024;
     sb.modified = true;
 
-    for(UINT i = 0; i < FREE_INODE_CACHE_SIZE; i++) {
-        sb.freeINodeCache[i] = i;
-    }
 
     printf("\nSuperblock:\n");
     printSuperBlock(&sb);
 
-    BYTE buf[BLK_SIZE];
+    BYTE buf[MIN_BLK_SIZE];
     blockify(&sb, buf);
     SuperBlock sb_unblockified;
     unblockify(buf, &sb_unblockified);
@@ -142,11 +161,281 @@ void testBlockify() {
     assert(sb_unblockified.pNextFreeDBlk == sb.pNextFreeDBlk);
     assert(sb_unblockified.nINodes == sb.nINodes);
     assert(sb_unblockified.nFreeINodes == sb.nFreeINodes);
-    assert(sb_unblockified.pNextFreeINode == sb.pNextFreeINode);
+    assert(sb_unblockified.nextFreeINodeGroup == sb.nextFreeINodeGroup);
+    assert(sb_unblockified.blkSize == sb.blkSize);
+    assert(sb_unblockified.inodeSize == sb.inodeSize);
     assert(sb_unblockified.modified == false);
+    #endif
+}
+
+void testMountOptions() {
+    #ifdef DEBUG
+    MountOptions opts;
+    char rest[64];
+    initMountOptions(&opts);
+    assert(opts.atime == ATIME_RELATIME && !opts.lazyTime);
+
+    assert(parseMountOptions(&opts, "noatime,lazytime,dcache_blks=4096,dcache_policy=2q,nowarmup,dirty_bytes=0x100000", NULL, 0) == 0);
+    assert(opts.atime == ATIME_NOATIME && opts.lazyTime && !opts.warmUp);
+    assert(opts.dCacheBlks == 4096 && opts.dCachePolicy == DBLK_CACHE_2Q && opts.dirtyBytes == 0x100000);
+    assert(parseMountOptions(&opts, "strictatime,nolazytime,mmap", NULL, 0) == 0);
+    assert(opts.atime == ATIME_STRICT && !opts.lazyTime && (opts.diskFlags & DSK_MMAP));
+
+    //options for FUSE are handed back, bad values and unknown options fail
+    assert(parseMountOptions(&opts, "allow_other,relatime,max_read=4096", rest, sizeof(rest)) == 0);
+    assert(opts.atime == ATIME_RELATIME && strcmp(rest, "allow_other,max_read=4096") == 0);
+    assert(parseMountOptions(&opts, "allow_other", NULL, 0) == -1);
+    assert(parseMountOptions(&opts, "dcache_blks=lots", NULL, 0) == -1);
+    assert(parseMountOptions(&opts, "dcache_policy=fifo", NULL, 0) == -1);
+    assert(opts.dCachePolicy == DBLK_CACHE_2Q);
+    #endif
+}
+
+#ifdef DEBUG
+//reads a file with an atime mode and returns the # of inodes left
+//dirty or lazy
+static UINT readOnce(const char* optString, BOOL* lazy) {
+    FileSystem fs;
+    BYTE buf[16];
+    assert(l2_mountWithOptions(&fs, optString) == 0);
+    assert(l2_open(&fs, "/f", OP_READ) == 0);
+    INodeEntry* entry = getOpenFileEntry(&fs.openFileTable, "/f")->inodeEntry;
+    //an atime well in the past, older than the last change
+    entry->_in_node._in_accesstime = entry->_in_node._in_modtime - 2 * RELATIME_SECS;
+    assert(l2_sync(&fs) == 0);
+    assert(l2_read(&fs, "/f", 0, buf, sizeof(buf)) == sizeof(buf));
+    UINT nDirty = fs.inodeTable.nDirty + fs.inodeTable.nLazy;
+    *lazy = entry->_in_lazy;
+    l2_close(&fs, "/f", OP_READ);
+    l2_unmount(&fs);
+    return nDirty;
+}
+#endif
+
+void testATime() {
+    #ifdef DEBUG
+    FileSystem fs;
+    BYTE buf[16];
+    memset(buf, 7, sizeof(buf));
+    assert(l2_initfs(256, 64, 0, 0, NULL, &fs) == 0);
+    assert(l2_mknod(&fs, "/f", 0, 0) >= 0);
+    assert(l2_open(&fs, "/f", OP_WRITE) == 0);
+    assert(l2_write(&fs, "/f", 0, buf, sizeof(buf)) == sizeof(buf));
+    l2_close(&fs, "/f", OP_WRITE);
+    l2_unmount(&fs);
+
+    BOOL lazy;
+    assert(readOnce("noatime", &lazy) == 0);
+    assert(readOnce("relatime", &lazy) == 1 && !lazy);
+    assert(readOnce("strictatime", &lazy) == 1 && !lazy);
+    assert(readOnce("lazytime", &lazy) == 1 && lazy);
+
+    //the lazy atime was written back at unmount
+    struct stat st;
+    assert(l2_mount(&fs, NULL) == 0);
+    assert(l2_getattr(&fs, "/f", &st) == 0 && st.st_atime > st.st_mtime - RELATIME_SECS);
+    l2_unmount(&fs);
+    #endif
+}
+
+void testInlineData() {
+    #ifdef DEBUG
+    FileSystem fs;
+    MountOptions opts;
+    BYTE buf[2200], back[2200];
+    initMountOptions(&opts);
+    //no inode is larger than the inline area an in core inode has room for
+    assert(l2_initfs(4096, 64, 4096, 2 * MAX_INODE_SIZE, &opts, &fs) != 0);
+    assert(l2_initfs(4096, 64, 0, MAX_INODE_SIZE, &opts, &fs) == 0);
+    assert(fs.inlineSize == INODE_INLINE_LEN && fs.inlineSize >= 3 * sizeof(DirEntry));
+    LONG nFree = fs.superblock.nFreeDBlks;
 
-    for(UINT i = 0; i < FREE_INODE_CACHE_SIZE; i++) {
-        assert(sb_unblockified.freeINodeCache[i] == sb.freeINodeCache[i]);
+    //a fresh directory and a small file take no data block
+    assert(l2_mkdir(&fs, "/d", 0, 0) >= 0);
+    assert(l2_mknod(&fs, "/d/f", 0, 0) >= 0);
+    for(UINT i = 0; i < sizeof(buf); i++) {
+        buf[i] = (BYTE) (i * 7);
     }
+    assert(l2_open(&fs, "/d/f", OP_WRITE) == 0);
+    assert(l2_write(&fs, "/d/f", 0, buf, 100) == 100);
+    l2_close(&fs, "/d/f", OP_WRITE);
+    assert(fs.superblock.nFreeDBlks == nFree);
+    l2_unmount(&fs);
+
+    //and reading them back after a remount goes through no data block
+    assert(l2_mount(&fs, &opts) == 0);
+    LONG hits = fs.dCache._dCache_hits, misses = fs.dCache._dCache_misses;
+    assert(l2_open(&fs, "/d/f", OP_READ) == 0);
+    assert(l2_read(&fs, "/d/f", 0, back, sizeof(back)) == 100 && memcmp(back, buf, 100) == 0);
+    l2_close(&fs, "/d/f", OP_READ);
+    printf("inline read of a 100 byte file: %ld data block cache lookups\n",
+           fs.dCache._dCache_hits + fs.dCache._dCache_misses - hits - misses);
+    assert(fs.dCache._dCache_hits == hits && fs.dCache._dCache_misses == misses);
+
+    //a write past the inode moves the file out to data blocks
+    assert(l2_open(&fs, "/d/f", OP_WRITE) == 0);
+    assert(l2_write(&fs, "/d/f", 100, buf + 100, 2000) == 2000);
+    l2_close(&fs, "/d/f", OP_WRITE);
+    assert(fs.superblock.nFreeDBlks == nFree - 2);
+    assert(l2_open(&fs, "/d/f", OP_READ) == 0);
+    assert(l2_read(&fs, "/d/f", 0, back, sizeof(back)) == 2100 && memcmp(back, buf, 2100) == 0);
+    l2_close(&fs, "/d/f", OP_READ);
+
+    //a write past the end of an inline file leaves zeroes in the gap
+    assert(l2_mknod(&fs, "/d/g", 0, 0) >= 0);
+    assert(l2_open(&fs, "/d/g", OP_WRITE) == 0);
+    assert(l2_write(&fs, "/d/g", 300, buf + 300, 10) == 10);
+    l2_close(&fs, "/d/g", OP_WRITE);
+    memset(buf, 0, 300);
+    assert(l2_open(&fs, "/d/g", OP_READ) == 0);
+    assert(l2_read(&fs, "/d/g", 0, back, sizeof(back)) == 310 && memcmp(back, buf, 310) == 0);
+    l2_close(&fs, "/d/g", OP_READ);
+
+    //the directory outgrew its inode with its fourth entry
+    assert(fs.superblock.nFreeDBlks == nFree - 3);
+    assert(l2_namei(&fs, "/d/f") >= 0 && l2_namei(&fs, "/d/g") >= 0);
+
+    //removing an entry of an inline directory survives a remount
+    assert(l2_mkdir(&fs, "/e", 0, 0) >= 0);
+    assert(l2_mknod(&fs, "/e/x", 0, 0) >= 0);
+    assert(l2_unlink(&fs, "/e/x") == 0);
+    l2_unmount(&fs);
+    assert(l2_mount(&fs, &opts) == 0);
+    assert(l2_namei(&fs, "/e/x") < 0 && l2_namei(&fs, "/d/g") >= 0);
+    l2_unmount(&fs);
+
+    //with noinline a small file takes a data block from its first byte,
+    //and the inline files already there still read back
+    assert(parseMountOptions(&opts, "noinline", NULL, 0) == 0 && !opts.inlineData);
+    assert(l2_mount(&fs, &opts) == 0);
+    nFree = fs.superblock.nFreeDBlks;
+    assert(l2_mknod(&fs, "/h", 0, 0) >= 0);
+    assert(l2_open(&fs, "/h", OP_WRITE) == 0);
+    assert(l2_write(&fs, "/h", 0, buf, 100) == 100);
+    l2_close(&fs, "/h", OP_WRITE);
+    INode inode;
+    assert(readINode(&fs, l2_namei(&fs, "/h"), &inode) == 0 && !(inode._in_flags & INODE_INLINE));
+    assert(fs.superblock.nFreeDBlks == nFree - 1);
+    assert(l2_open(&fs, "/d/g", OP_READ) == 0);
+    assert(l2_read(&fs, "/d/g", 0, back, sizeof(back)) == 310 && memcmp(back, buf, 310) == 0);
+    l2_close(&fs, "/d/g", OP_READ);
+    l2_unmount(&fs);
+
+    //an inode too small for . and .. starts a directory in a data block
+    initMountOptions(&opts);
+    assert(l2_initfs(4096, 64, 0, 512, &opts, &fs) == 0);
+    assert(fs.inlineSize < 2 * sizeof(DirEntry));
+    assert(l2_mkdir(&fs, "/d", 0, 0) >= 0 && l2_mknod(&fs, "/d/f", 0, 0) >= 0);
+    assert(readINode(&fs, l2_namei(&fs, "/d"), &inode) == 0 && !(inode._in_flags & INODE_INLINE));
+    assert(readINode(&fs, l2_namei(&fs, "/d/f"), &inode) == 0 && (inode._in_flags & INODE_INLINE));
+    l2_unmount(&fs);
+    #endif
+}
+
+//a sequential reader finds the blocks ahead of it already cached, with
+//readahead_blks=0 it finds none; a seek drops the window
+void testReadAhead() {
+    #ifdef DEBUG
+    FileSystem fs;
+    MountOptions opts;
+    INode inode;
+    BYTE blk[DEFAULT_BLK_SIZE];
+    initMountOptions(&opts);
+    opts.warmUp = false;
+    assert(l2_initfs(4096, 64, 0, 0, &opts, &fs) == 0);
+    assert(l2_mknod(&fs, "/big", 0, 0) >= 0);
+    assert(l2_open(&fs, "/big", OP_WRITE) == 0);
+    //past the direct blocks and the single indirect block
+    LONG nBlks = INODE_NUM_DIRECT_BLKS + fs.nPtrsPerBlk + 200;
+    for(LONG i = 0; i < nBlks; i++) {
+        memset(blk, (BYTE) i, sizeof(blk));
+        assert(l2_write(&fs, "/big", i * sizeof(blk), blk, sizeof(blk)) == sizeof(blk));
+    }
+    l2_close(&fs, "/big", OP_WRITE);
+    l2_unmount(&fs);
+
+    for(UINT pass = 0; pass < 2; pass++) {
+        opts.readAheadBlks = pass == 0 ? 0 : DEFAULT_READAHEAD_BLKS;
+        assert(l2_mount(&fs, &opts) == 0);
+        assert(readINode(&fs, l2_namei(&fs, "/big"), &inode) == 0);
+        assert(l2_open(&fs, "/big", OP_READ) == 0);
+        ReadAhead* ra = &getOpenFileEntry(&fs.openFileTable, "/big")->readAhead;
+        for(LONG i = 0; i < nBlks; i++) {
+            LONG id = bmap(&fs, &inode, i);
+            assert(i == 0 || hasDBlkCacheEntry(&fs.dCache, id) == (pass == 1));
+            assert(l2_read(&fs, "/big", i * sizeof(blk), blk, sizeof(blk)) == sizeof(blk));
+            assert(blk[0] == (BYTE) i && blk[sizeof(blk) - 1] == (BYTE) i);
+        }
+        assert(ra->_ra_window == opts.readAheadBlks);
+
+        //seeks shrink the window back to nothing
+        for(LONG i = 0; i < 8; i++) {
+            LONG fileBlk = (i * 7919) % nBlks;
+            assert(l2_read(&fs, "/big", fileBlk * sizeof(blk), blk, sizeof(blk)) == sizeof(blk));
+            assert(blk[0] == (BYTE) fileBlk);
+        }
+        assert(ra->_ra_window == 0);
+        l2_close(&fs, "/big", OP_READ);
+        l2_unmount(&fs);
+    }
+    #endif
+}
+
+//the inodes and blocks looked up before an unmount are read back in by the
+//warm-up of the next mount, ahead of any lookup; a mount that made no
+//call keeps the warm set it found
+void testWarmUp() {
+    #ifdef DEBUG
+    FileSystem fs;
+    MountOptions opts;
+    INode inode;
+    struct stat st;
+    char path[32];
+    UINT ids[40];
+    BYTE buf[DEFAULT_BLK_SIZE];
+    initMountOptions(&opts);
+    assert(l2_initfs(4096, 256, 0, 0, &opts, &fs) == 0);
+    assert(l2_mkdir(&fs, "/d", 0, 0) >= 0);
+    for(UINT i = 0; i < 40; i++) {
+        sprintf(path, "/d/f%u", i);
+        assert(l2_mknod(&fs, path, 0, 0) >= 0);
+        ids[i] = l2_namei(&fs, path);
+    }
+    assert(l2_mknod(&fs, "/other", 0, 0) >= 0);
+    assert(l2_open(&fs, "/other", OP_WRITE) == 0);
+    memset(buf, 5, sizeof(buf));
+    for(LONG b = 0; b < INODE_NUM_DIRECT_BLKS + 16; b++) {
+        assert(l2_write(&fs, "/other", b * sizeof(buf), buf, sizeof(buf)) == sizeof(buf));
+    }
+    l2_close(&fs, "/other", OP_WRITE);
+    assert(readINode(&fs, l2_namei(&fs, "/d"), &inode) == 0);
+    LONG dirBlk = bmap(&fs, &inode, 0);
+    assert(readINode(&fs, l2_namei(&fs, "/other"), &inode) == 0);
+    LONG ptrBlk = inode._in_sIndirectBlocks[0];
+    for(UINT i = 0; i < 40; i++) {
+        sprintf(path, "/d/f%u", i);
+        assert(l2_getattr(&fs, path, &st) == 0);
+    }
+    l2_unmount(&fs);
+    assert(l2_mount(&fs, &opts) == 0);
+    l2_unmount(&fs);
+
+    assert(l2_mount(&fs, &opts) == 0);
+    assert(fs.warmPending && !hasINodeEntry(&fs.inodeTable, ids[0]) && !hasDBlkCacheEntry(&fs.dCache, dirBlk));
+    startWarmUp(&fs);
+    waitWarmUp(&fs);
+    assert(hasDBlkCacheEntry(&fs.dCache, dirBlk) && hasDBlkCacheEntry(&fs.dCache, ptrBlk));
+    for(UINT i = 0; i < 40; i++) {
+        assert(hasINodeEntry(&fs.inodeTable, ids[i]));
+    }
+    l2_unmount(&fs);
+
+    //with nowarmup the mount starts cold
+    opts.warmUp = false;
+    assert(l2_mount(&fs, &opts) == 0);
+    assert(!fs.warmPending);
+    assert(l2_getattr(&fs, "/d/f0", &st) == 0);
+    assert(!hasDBlkCacheEntry(&fs.dCache, ptrBlk) && !hasINodeEntry(&fs.inodeTable, ids[39]));
+    l2_unmount(&fs);
     #endif
 }
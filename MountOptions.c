@@ -0,0 +1,196 @@
+/*
+ * Implementation for mount options
+ */
+
+#include "MountOptions.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void initMountOptions(MountOptions* opts) {
+    opts->diskFlags = 0;
+    opts->ioEngine = AIO_ENGINE_AUTO;
+    opts->ioDepth = AIO_DEFAULT_DEPTH;
+    opts->schedDepth = IOSCHED_DEFAULT_DEPTH;
+    opts->dCacheBlks = DBLK_CACHE_DEFAULT_BLKS;
+    opts->dCacheWays = DBLK_CACHE_DEFAULT_WAYS;
+    opts->dCachePolicy = DBLK_CACHE_LRU;
+    opts->dCacheMetaBlks = 0;
+    opts->inodeCacheSize = INODE_CACHE_LENGTH;
+    opts->writeBack = false;
+    opts->dirtyBgBytes = 0;
+    opts->dirtyBytes = 0;
+    opts->flushIntervalMs = DEFAULT_FLUSH_INTERVAL_MS;
+    opts->dirtyExpireMs = DEFAULT_DIRTY_EXPIRE_MS;
+    opts->readAheadBlks = DEFAULT_READAHEAD_BLKS;
+    opts->atime = ATIME_RELATIME;
+    opts->lazyTime = false;
+    opts->warmUp = true;
+    opts->discard = false;
+    opts->extents = false;
+    opts->inlineData = true;
+    opts->trimInterval = 0;
+    opts->diskModel = DSK_MODEL_NONE;
+    opts->stripeWidth = 0;
+    opts->stripeUnit = 0;
+}
+
+typedef enum {
+    OPT_BOOL,   //"name" sets it, "noname" clears it
+    OPT_UINT,   //"name=value"
+    OPT_LONG,
+} OPT_KIND;
+
+//the tunables taking a plain value
+typedef struct MountOptionSpec {
+    const char* name;
+    OPT_KIND kind;
+    size_t offset;
+} MountOptionSpec;
+
+static const MountOptionSpec optionSpecs[] = {
+    { "io_depth",          OPT_UINT, offsetof(MountOptions, ioDepth) },
+    { "sched_depth",       OPT_UINT, offsetof(MountOptions, schedDepth) },
+    { "dcache_blks",       OPT_UINT, offsetof(MountOptions, dCacheBlks) },
+    { "dcache_ways",       OPT_UINT, offsetof(MountOptions, dCacheWays) },
+    { "dcache_meta_blks",  OPT_UINT, offsetof(MountOptions, dCacheMetaBlks) },
+    { "inode_cache",       OPT_UINT, offsetof(MountOptions, inodeCacheSize) },
+    { "writeback",         OPT_BOOL, offsetof(MountOptions, writeBack) },
+    { "dirty_bg_bytes",    OPT_LONG, offsetof(MountOptions, dirtyBgBytes) },
+    { "dirty_bytes",       OPT_LONG, offsetof(MountOptions, dirtyBytes) },
+    { "flush_interval_ms", OPT_UINT, offsetof(MountOptions, flushIntervalMs) },
+    { "dirty_expire_ms",   OPT_UINT, offsetof(MountOptions, dirtyExpireMs) },
+    { "readahead_blks",    OPT_UINT, offsetof(MountOptions, readAheadBlks) },
+    { "lazytime",          OPT_BOOL, offsetof(MountOptions, lazyTime) },
+    { "warmup",            OPT_BOOL, offsetof(MountOptions, warmUp) },
+    { "discard",           OPT_BOOL, offsetof(MountOptions, discard) },
+    { "extents",           OPT_BOOL, offsetof(MountOptions, extents) },
+    { "inline",            OPT_BOOL, offsetof(MountOptions, inlineData) },
+    { "trim_interval",     OPT_UINT, offsetof(MountOptions, trimInterval) },
+};
+
+//the options picking one of a few named values, by index into names
+static INT parseChoice(const char* value, const char* const* names, UINT nNames) {
+    for(UINT i = 0; i < nNames; i++) {
+        if(strcmp(value, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//sets one option, returns 1 if the name is unknown, -1 on a bad value
+static INT parseOption(MountOptions* opts, char* opt) {
+    static const char* const policies[] = { "lru", "clock", "2q" };
+    static const char* const engines[] = { "auto", "uring", "threads", "sync" };
+    static const char* const models[] = { "none", "hdd", "ssd" };
+
+    char* value = strchr(opt, '=');
+    if(value != NULL) {
+        *value++ = '\0';
+    }
+
+    if(value == NULL && strcmp(opt, "strictatime") == 0) {
+        opts->atime = ATIME_STRICT;
+        return 0;
+    }
+    if(value == NULL && strcmp(opt, "relatime") == 0) {
+        opts->atime = ATIME_RELATIME;
+        return 0;
+    }
+    if(value == NULL && strcmp(opt, "noatime") == 0) {
+        opts->atime = ATIME_NOATIME;
+        return 0;
+    }
+    if(value == NULL && (strcmp(opt, "mmap") == 0 || strcmp(opt, "direct") == 0)) {
+        opts->diskFlags |= strcmp(opt, "mmap") == 0 ? DSK_MMAP : DSK_DIRECT;
+        return 0;
+    }
+    if(value != NULL && strcmp(opt, "dcache_policy") == 0) {
+        INT i = parseChoice(value, policies, 3);
+        if(i < 0) {
+            return -1;
+        }
+        opts->dCachePolicy = (DBLK_CACHE_POLICY) i;
+        return 0;
+    }
+    if(value != NULL && strcmp(opt, "io_engine") == 0) {
+        INT i = parseChoice(value, engines, 4);
+        if(i < 0) {
+            return -1;
+        }
+        opts->ioEngine = (AIO_ENGINE) i;
+        return 0;
+    }
+    if(value != NULL && strcmp(opt, "disk_model") == 0) {
+        INT i = parseChoice(value, models, 3);
+        if(i < 0) {
+            return -1;
+        }
+        opts->diskModel = (DSK_MODEL) i;
+        return 0;
+    }
+
+    for(UINT i = 0; i < sizeof(optionSpecs) / sizeof(optionSpecs[0]); i++) {
+        const MountOptionSpec* spec = &optionSpecs[i];
+        BYTE* field = (BYTE*) opts + spec->offset;
+        if(spec->kind == OPT_BOOL && value == NULL) {
+            if(strcmp(opt, spec->name) == 0 || (strncmp(opt, "no", 2) == 0 && strcmp(opt + 2, spec->name) == 0)) {
+                *(BOOL*) field = strcmp(opt, spec->name) == 0;
+                return 0;
+            }
+        }
+        else if(spec->kind != OPT_BOOL && value != NULL && strcmp(opt, spec->name) == 0) {
+            char* end;
+            LONG n = strtol(value, &end, 0);
+            if(*value == '\0' || *end != '\0' || n < 0 || (spec->kind == OPT_UINT && n > UINT32_MAX)) {
+                return -1;
+            }
+            if(spec->kind == OPT_UINT) {
+                *(UINT*) field = (UINT) n;
+            }
+            else {
+                *(LONG*) field = n;
+            }
+            return 0;
+        }
+    }
+
+    //put back what was split off for the caller
+    if(value != NULL) {
+        value[-1] = '=';
+    }
+    return 1;
+}
+
+INT parseMountOptions(MountOptions* opts, const char* str, char* unknown, UINT unknownLen) {
+    char buf[strlen(str) + 1];
+    strcpy(buf, str);
+    if(unknown != NULL && unknownLen > 0) {
+        unknown[0] = '\0';
+    }
+
+    char* save;
+    for(char* opt = strtok_r(buf, ",", &save); opt != NULL; opt = strtok_r(NULL, ",", &save)) {
+        INT ret = parseOption(opts, opt);
+        if(ret < 0) {
+            fprintf(stderr, "Error: bad value in mount option %s\n", opt);
+            return -1;
+        }
+        if(ret == 0) {
+            continue;
+        }
+        size_t len = unknown != NULL ? strlen(unknown) : 0;
+        if(unknown == NULL || len + (len > 0) + strlen(opt) + 1 > unknownLen) {
+            fprintf(stderr, "Error: unknown mount option %s\n", opt);
+            return -1;
+        }
+        if(len > 0) {
+            strcat(unknown, ",");
+        }
+        strcat(unknown, opt);
+    }
+    return 0;
+}
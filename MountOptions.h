@@ -0,0 +1,105 @@
+/*
+ * Options a filesystem is made or mounted with
+ */
+
+#pragma once
+#include "IOSched.h"
+#include "DBlkCache.h"
+
+//write-back flusher wake interval and dirty block age limit, in ms
+#define DEFAULT_FLUSH_INTERVAL_MS (1000)
+#define DEFAULT_DIRTY_EXPIRE_MS (5000)
+
+//largest readahead window, in blocks
+#define DEFAULT_READAHEAD_BLKS (64)
+
+//age past which relatime moves an atime anyway, in seconds
+#define RELATIME_SECS (24 * 60 * 60)
+
+//when a read updates the access time of a file
+typedef enum {
+    ATIME_RELATIME, //when the atime is not newer than the mtime or ctime, or a day old
+    ATIME_STRICT,   //on every read
+    ATIME_NOATIME,  //never
+} ATIME_MODE;
+
+typedef struct MountOptions {
+
+    //disk backend flags passed to the disk emulator (DSK_*)
+    UINT diskFlags;
+
+    //engine and queue depth of batched block transfers
+    AIO_ENGINE ioEngine;
+    UINT ioDepth;
+
+    //# of block writes the scheduler holds back during a call, 0 writes through
+    UINT schedDepth;
+
+    //data block cache capacity in blocks, ways per set and replacement policy
+    UINT dCacheBlks;
+    UINT dCacheWays;
+    DBLK_CACHE_POLICY dCachePolicy;
+    //# of closed or unopened inodes kept in core, on top of the open ones
+    UINT inodeCacheSize;
+    //# of cache blocks indirect, directory and free list blocks are
+    //protected up to, 0 for a quarter of the cache
+    UINT dCacheMetaBlks;
+
+    //hold data block writes dirty in the cache and write them back later
+    BOOL writeBack;
+    //dirty bytes past which the flusher is woken and past which a writer
+    //flushes down to the first limit itself, 0 for a quarter and half of
+    //the cache
+    LONG dirtyBgBytes;
+    LONG dirtyBytes;
+    //how often the flusher wakes and how long a block may stay dirty, in ms
+    UINT flushIntervalMs;
+    UINT dirtyExpireMs;
+
+    //largest window sequential reads prefetch, in blocks, 0 disables
+    //readahead
+    UINT readAheadBlks;
+
+    //when reads update the atime, and whether timestamp only changes stay
+    //in core until the inode is written back for another reason
+    ATIME_MODE atime;
+    BOOL lazyTime;
+
+    //note the hottest blocks and inodes at unmount and prefetch them in
+    //the background after the next mount
+    BOOL warmUp;
+
+    //discard freed data blocks, punching holes in the image
+    BOOL discard;
+
+    //files created under the mount map their blocks by extents instead of
+    //direct and indirect block pointers
+    BOOL extents;
+
+    //files created under the mount keep their data in the inode until it
+    //outgrows the inode, noinline maps even small files by blocks
+    BOOL inlineData;
+
+    //seconds between the trim passes run at the end of l2 calls, 0 never
+    UINT trimInterval;
+
+    //device performance model charged by the disk emulator
+    DSK_MODEL diskModel;
+
+    //# of images the disk is striped over and the stripe unit in blocks,
+    //0 takes the defaults at makefs and the recorded layout at mount
+    UINT stripeWidth;
+    UINT stripeUnit;
+
+} MountOptions;
+
+// fills in the default options
+void initMountOptions(MountOptions*);
+
+// parses a comma separated option string such as
+// "noatime,lazytime,dcache_blks=4096" into the options; the options it
+// does not know are copied, comma separated, to unknown when it is not
+// NULL and are an error otherwise
+// args: options, option string, buffer for unknown options, its size
+// returns 0, or -1 on a malformed value or an unknown option
+INT parseMountOptions(MountOptions*, const char*, char*, UINT);
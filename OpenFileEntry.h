@@ -5,6 +5,7 @@
 
 #pragma once
 #include "INodeEntry.h"
+#include "ReadAhead.h"
 
 enum FILE_OP {
         OP_READ = 0,
@@ -24,6 +25,9 @@ struct OpenFileEntry {
     // the inode cached for the file
     INodeEntry* inodeEntry;
 
+    // sequential readahead state of the reads through this entry
+    ReadAhead readAhead;
+
     // list pointer to next entry
     OpenFileEntry* next;
 
@@ -21,6 +21,8 @@ OpenFileEntry* addOpenFileEntry(OpenFileTable* table, char* path, INodeEntry* in
     for(UINT i = 0; i < 3; i++) {
         newEntry->fileOp[i] = 0;
     }
+    //a read from the start of the file counts as a sequential stream
+    memset(&newEntry->readAhead, 0, sizeof(ReadAhead));
     
     //stack insert at linked list head
     newEntry->next = table->head;
@@ -0,0 +1,27 @@
+/*
+ * Access pattern state readahead keeps for an open file
+ */
+
+#pragma once
+#include "Globals.h"
+
+//window a sequential stream starts with, in blocks, the window doubles
+//each time it is refilled up to the readAheadBlks mount option
+#define READAHEAD_MIN_BLKS (4)
+
+typedef struct ReadAhead {
+
+    //file block a sequential read continues at
+    LONG _ra_next;
+
+    //file blocks below this were already prefetched for the stream
+    LONG _ra_end;
+
+    //current window in blocks, 0 while the reads look random
+    UINT _ra_window;
+
+    //# of windows issued and of blocks they read from disk
+    LONG _ra_nIssued;
+    LONG _ra_nBlks;
+
+} ReadAhead;
@@ -19,11 +19,16 @@ INT blockify(SuperBlock* superblock, BYTE* buf) {
 
     dsb->nINodes = superblock->nINodes;
     dsb->nFreeINodes = superblock->nFreeINodes;
-    memcpy(dsb->freeINodeCache, superblock->freeINodeCache, FREE_INODE_CACHE_SIZE * sizeof(UINT));
-    dsb->pNextFreeINode = superblock->pNextFreeINode;
+    dsb->nextFreeINodeGroup = superblock->nextFreeINodeGroup;
     
     dsb->rootINodeID = superblock->rootINodeID;
 
+    dsb->blkSize = superblock->blkSize;
+    dsb->inodeSize = superblock->inodeSize;
+
+    dsb->stripeWidth = superblock->stripeWidth;
+    dsb->stripeUnit = superblock->stripeUnit;
+
     return 0;
 }
 
@@ -38,37 +43,45 @@ INT unblockify(BYTE* buf, SuperBlock* superblock) {
 
     superblock->nINodes = dsb->nINodes;
     superblock->nFreeINodes = dsb->nFreeINodes;
-    memcpy(superblock->freeINodeCache, dsb->freeINodeCache, FREE_INODE_CACHE_SIZE * sizeof(UINT));
-    superblock->pNextFreeINode = dsb->pNextFreeINode;
+    superblock->nextFreeINodeGroup = dsb->nextFreeINodeGroup;
     
     superblock->rootINodeID = dsb->rootINodeID;
 
+    superblock->blkSize = dsb->blkSize;
+    superblock->inodeSize = dsb->inodeSize;
+
+    superblock->stripeWidth = dsb->stripeWidth;
+    superblock->stripeUnit = dsb->stripeUnit;
+
     superblock->modified = false;
 
     return 0;
 }
 
-#ifdef DEBUG
-void printSuperBlock(SuperBlock* sb) {
-    printf("[Superblock: nDBLks = %d, nFreeDBlks = %d, pFreeDBlksHead = %d, pNextFreeDBlk = %d, nINodes = %d, nFreeINodes = %d, pNextFreeINode = %d, rootINodeID = %d, modified = %d]\n", 
-        sb->nDBlks, sb->nFreeDBlks, sb->pFreeDBlksHead, sb->pNextFreeDBlk, sb->nINodes, sb->nFreeINodes, sb->pNextFreeINode, sb->rootINodeID, sb->modified);
+//the warm set starts past the disk fields, aligned for its ids
+static UINT warmSetOffset() {
+    return (sizeof(DSuperBlock) + sizeof(LONG) - 1) / sizeof(LONG) * sizeof(LONG);
+}
+
+DWarmSet* warmSetOf(BYTE* buf) {
+    return (DWarmSet*) (buf + warmSetOffset());
+}
+
+UINT warmSetCapacity(UINT blkSize) {
+    return (blkSize - warmSetOffset() - sizeof(DWarmSet)) / sizeof(LONG);
 }
-#endif
 
 #ifdef DEBUG
-// prints out the free inode cache for debugging
-void printFreeINodeCache(SuperBlock* sb) {
-    for(int i = 0; i < FREE_INODE_CACHE_SIZE; i++) {
-        printf("%d ", sb->freeINodeCache[i]);
-    }
-    printf("\n");
+void printSuperBlock(SuperBlock* sb) {
+    printf("[Superblock: nDBLks = %d, nFreeDBlks = %d, pFreeDBlksHead = %d, pNextFreeDBlk = %d, nINodes = %d, nFreeINodes = %d, nextFreeINodeGroup = %d, rootINodeID = %d, blkSize = %d, inodeSize = %d, stripeWidth = %d, stripeUnit = %d, modified = %d]\n", 
+        sb->nDBlks, sb->nFreeDBlks, sb->pFreeDBlksHead, sb->pNextFreeDBlk, sb->nINodes, sb->nFreeINodes, sb->nextFreeINodeGroup, sb->rootINodeID, sb->blkSize, sb->inodeSize, sb->stripeWidth, sb->stripeUnit, sb->modified);
 }
 #endif
 
 #ifdef DEBUG
 // prints out the free data block cache for debugging
 void printFreeDBlkCache(SuperBlock* sb) {
-    for(int i = 0; i < FREE_DBLK_CACHE_SIZE; i++) {
+    for(int i = 0; i < sb->blkSize / sizeof(LONG); i++) {
         printf("%d ", sb->freeDBlkCache[i]);
     }
     printf("\n");
@@ -27,19 +27,26 @@ typedef struct SuperBlock
   //# of free inodes in this file system
   UINT nFreeINodes;
 
-  //free inode list cache
-  INT freeINodeCache[FREE_INODE_CACHE_SIZE];  
-
-  //index of the next free inode in the free inode list
-  INT pNextFreeINode;
+  //group of the free inode bitmap the next inode allocation starts at
+  UINT nextFreeINodeGroup;
 
   //INode ID for root dir
   UINT rootINodeID;
 
+  //block size in bytes
+  UINT blkSize;
+
+  //inode size in bytes
+  UINT inodeSize;
+
+  //# of member images the disk is striped over and the stripe unit in blocks
+  UINT stripeWidth;
+  UINT stripeUnit;
+
   /* in-memory fields */
 
-  //SuperBlock cache of free data block list
-  LONG freeDBlkCache[FREE_DBLK_CACHE_SIZE];
+  //SuperBlock cache of free data block list, one block worth of ids is used
+  LONG freeDBlkCache[MAX_FREE_DBLK_CACHE_SIZE];
 
   //Modified bit
   BOOL modified;
@@ -58,31 +65,55 @@ typedef struct DSuperBlock
 
   UINT nINodes;
   UINT nFreeINodes;
-  INT freeINodeCache[FREE_INODE_CACHE_SIZE];
-  UINT pNextFreeINode;
+  UINT nextFreeINodeGroup;
   
   UINT rootINodeID;
 
+  UINT blkSize;
+  UINT inodeSize;
+
+  UINT stripeWidth;
+  UINT stripeUnit;
+
 } DSuperBlock;
 
+// warm set, the hottest data blocks and inodes noted at unmount for the
+// next mount to prefetch; kept in the superblock block past the disk
+// fields, a block without the magic has none
+#define WARM_SET_MAGIC (0x5741524d)
+
+typedef struct DWarmSet
+{
+  UINT magic;
+
+  //# of metadata block ids, then of data block ids, then of inode ids,
+  //stored one after the other in ids, hottest first
+  UINT nMetaBlks;
+  UINT nDataBlks;
+  UINT nINodes;
+  LONG ids[];
+
+} DWarmSet;
+
 // writes disk fields of superblock into a block-sized buffer
-// note: exactly BLK_SIZE bytes of memory must be allocated for buf
+// note: a whole block (blkSize bytes) must be allocated for buf
 INT blockify(SuperBlock*, BYTE* buf);
 
 // reads disk fields of superblock from a block-sized disk buffer to core
 // note: this will not initialize the free data block cache, that must be loaded manually
 INT unblockify(BYTE* buf, SuperBlock*);
 
+// the warm set area of a superblock block buffer
+DWarmSet* warmSetOf(BYTE* buf);
+
+// # of ids the warm set of a block of the given size holds
+UINT warmSetCapacity(UINT blkSize);
+
 #ifdef DEBUG
 // prints out a superblock for debugging
 void printSuperBlock(SuperBlock*);
 #endif
 
-#ifdef DEBUG
-// prints out the free inode cache for debugging
-void printFreeINodeCache(SuperBlock*);
-#endif
-
 #ifdef DEBUG
 // prints out the free data block cache for debugging
 void printFreeDBlkCache(SuperBlock*);
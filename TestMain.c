@@ -27,7 +27,7 @@ int main(int args, char* argv[])
     
     FileSystem fs;
     printf("Initializing file system with initfs...\n");
-    UINT succ = l2_initfs(nDBlks, nINodes, &fs);
+    UINT succ = l2_initfs(nDBlks, nINodes, 0, 0, NULL, &fs);
     if(succ == 0) {
         printf("initfs succeeded with filesystem size: %d\n", fs.nBytes);
     }
@@ -133,8 +133,8 @@ int main(int args, char* argv[])
             #ifdef DEBUG
             printf("\nSuperblock:\n");
             printSuperBlock(&fs.superblock);
-            printf("\nFree inode cache:\n");
-            printFreeINodeCache(&fs.superblock);
+            printf("\nFree inode bitmap:\n");
+            printINodeBitmap(&fs.iBitmap);
             printf("\nFree dblk cache:\n");
             printFreeDBlkCache(&fs.superblock);
             printf("\nDBlkCache:\n");
@@ -143,8 +143,6 @@ int main(int args, char* argv[])
             printOpenFileTable(&fs.openFileTable);
             printf("\nINode table:\n");
             printINodeTable(&fs.inodeTable);
-            printf("\nINode cache:\n");
-            printINodeCache(&fs.inodeCache);
             #else
             printf("Stats only available in DEBUG mode!\n");
             #endif
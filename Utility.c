@@ -28,6 +28,10 @@ void THROW(const char *fname, int lineno, const char *fxname)
     printf("Disk write out of boundry!\n");
     break;
   }
+  case _dsk_ioFail: {
+    printf("Disk read/write failed!\n");
+    break;
+  }
   case _fs_DBlkOutOfNumber: {
     printf("No more free data block on disk!\n");
     break;
@@ -8,6 +8,7 @@ typedef enum{
   _dsk_full,
   _dsk_readOutOfBoundry,
   _dsk_writeOutOfBoundry,
+  _dsk_ioFail,
   _fs_DBlkOutOfNumber,
   _fs_NonDirInPath,
   _fs_EndOfDirEntry,
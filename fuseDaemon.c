@@ -12,9 +12,12 @@
 
 #include <fuse.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
 #include "Directories.h"
 
 static FileSystem fs;
@@ -222,6 +225,11 @@ static int l3_utimens(const char *path, const struct timespec tv[2])
 	return l2_utimens(&fs, path, tv);
 }
 
+static int l3_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	return l2_sync(&fs);
+}
+
 static int l3_statfs(const char *path, struct statvfs *stat)
 {
 	;
@@ -229,11 +237,51 @@ static int l3_statfs(const char *path, struct statvfs *stat)
 
 void * l3_mount(struct fuse_conn_info *conn)
 {
-	UINT succ = l2_mount(&fs);
+	UINT succ = l2_mount(&fs, NULL);
+}
+
+// SIGUSR1, blocked in main before any thread exists so that only the
+// statistics thread takes it
+static sigset_t statsSig;
+
+// prints the disk statistics on every SIGUSR1 and starts them over,
+// so the I/O of a workload can be measured from outside the daemon;
+// they go to stderr, which the daemon keeps only in the foreground (-f)
+static void *statsMain(void *arg)
+{
+	sigset_t *set = arg;
+	int sig;
+	while(sigwait(set, &sig) == 0) {
+		DiskStats stats;
+		getDiskStats(fs.disk, &stats);
+		resetDiskStats(fs.disk);
+		fprintDiskStats(stderr, &stats);
+		fflush(stderr);
+	}
+	return NULL;
+}
+
+// runs once the daemon has forked, the warm-up and statistics threads
+// started in main would not have survived the fork
+void * l3_init(struct fuse_conn_info *conn)
+{
+	pthread_t statsThread;
+	pthread_mutex_lock(&fs.lock);
+	startWarmUp(&fs);
+	pthread_mutex_unlock(&fs.lock);
+	if(pthread_create(&statsThread, NULL, statsMain, &statsSig) == 0) {
+		pthread_detach(statsThread);
+	} else {
+		fprintf(stderr, "l3_init: cannot start the statistics thread\n");
+	}
+	return NULL;
 }
 
 void * l3_unmount(void *conn)
 {
+	DiskStats stats;
+	getDiskStats(fs.disk, &stats);
+	fprintDiskStats(stderr, &stats);
 	UINT succ = l2_unmount(&fs);
 }
 
@@ -253,21 +301,68 @@ static struct fuse_operations l3_oper = {
 	.read		= l3_read,
 	.write		= l3_write,
 	.utimens	= l3_utimens,
+	.fsync		= l3_fsync,
 	.statfs		= l3_statfs,
-//	.init		= l3_mount,
+	.init		= l3_init,
 	.destroy	= l3_unmount
 };
 
+//takes the filesystem's own options out of the -o arguments, the rest
+//stay for FUSE; an -o left empty is dropped
+//returns the new argc, -1 on a bad option
+static int takeMountOptions(int argc, char *argv[], MountOptions *opts)
+{
+	int n = 1;
+	for(int i = 1; i < argc; i++) {
+		char *optString = NULL;
+		if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			optString = argv[++i];
+		else if(strncmp(argv[i], "-o", 2) == 0 && argv[i][2] != '\0')
+			optString = argv[i] + 2;
+		if(optString == NULL) {
+			argv[n++] = argv[i];
+			continue;
+		}
+		size_t len = strlen(optString) + 1;
+		char *rest = malloc(len + 2);
+		strcpy(rest, "-o");
+		if(parseMountOptions(opts, optString, rest + 2, len) != 0) {
+			free(rest);
+			return -1;
+		}
+		if(rest[2] != '\0')
+			argv[n++] = rest;
+		else
+			free(rest);
+	}
+	argv[n] = NULL;
+	return n;
+}
+
 int main(int argc, char *argv[])
 {
 	/*printf("Initializing file system with initfs...\n");
-    	UINT succ = l2_initfs(128, 16, &fs);
+    	UINT succ = l2_initfs(128, 16, 0, 0, NULL, &fs);
     	if(succ == 0) {
         	printf("initfs succeeded with filesystem size: %d\n", fs.nBytes);
     	}
     	else {
         	printf("Error: initfs failed with error code: %d\n", succ);
     	}*/
-	UINT succ = l2_mount(&fs);
+	MountOptions opts;
+	initMountOptions(&opts);
+	argc = takeMountOptions(argc, argv, &opts);
+	if(argc < 0) {
+		fprintf(stderr, "usage: %s mountpoint [-o noatime|relatime|strictatime,lazytime,dcache_blks=N,...]\n", argv[0]);
+		return 1;
+	}
+	UINT succ = l2_mount(&fs, &opts);
+
+	//block SIGUSR1 everywhere but in the statistics thread l3_init starts,
+	//the mask is inherited across the fork and by the FUSE threads
+	sigemptyset(&statsSig);
+	sigaddset(&statsSig, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &statsSig, NULL);
+
 	return fuse_main(argc, argv, &l3_oper, NULL);	
 }